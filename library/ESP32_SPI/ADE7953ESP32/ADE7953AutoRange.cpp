@@ -0,0 +1,31 @@
+/*
+ ADE7953AutoRange.cpp - PGA gain ranging decision for the ADE7953 measurement channels
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#include "ADE7953AutoRange.h"
+
+static const uint8_t pgaGainValue[ADE7953_PGA_CODES] = {1, 2, 4, 8, 16, 22};  //PGA_x register setting -> gain
+
+uint8_t ADE7953AutoRange::gain(uint8_t gainCode){
+  return (gainCode < ADE7953_PGA_CODES) ? pgaGainValue[gainCode] : 1;
+  }
+
+uint8_t ADE7953AutoRange::step(uint8_t gainCode, uint8_t maxCode, uint32_t peakCounts, uint8_t &holdCount){  //peakCounts: RSTxPEAK reading of the interval, at the present gain
+  //Step down at once when the peak approaches clipping, step up only after ADE7953_RANGE_HOLD quiet intervals and only if the higher gain would still leave the peak below the low mark.  The gap between the two marks is the hysteresis.
+  if (peakCounts > (uint32_t)(ADE7953_WAVEFORM_FULLSCALE*ADE7953_RANGE_HIGH)) {
+    holdCount = 0;
+    return (gainCode > 0) ? gainCode - 1 : 0;
+    }
+  if (gainCode < maxCode && (float)peakCounts*pgaGainValue[gainCode + 1]/pgaGainValue[gainCode] < ADE7953_WAVEFORM_FULLSCALE*ADE7953_RANGE_LOW) {
+    holdCount++;
+    if (holdCount >= ADE7953_RANGE_HOLD) {
+      holdCount = 0;
+      return gainCode + 1;
+      }
+    return gainCode;
+    }
+  holdCount = 0;
+  return gainCode;
+  }
@@ -0,0 +1,32 @@
+/*
+ ADE7953AutoRange.h - PGA gain ranging decision for the ADE7953 measurement channels
+  Picks the next PGA gain code from the peak of the last reporting interval: down at once near clipping, up only after
+  a run of quiet intervals.  No hardware dependency, ADE7953::serviceAutoRange() applies the result and the load sweep
+  bench in extras/ade7953range runs the same step.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#ifndef ADE7953AutoRange_h
+#define ADE7953AutoRange_h
+
+#ifdef ARDUINO
+#include "Arduino.h"
+#else
+#include <stdint.h>
+#include <stddef.h>
+#endif
+
+#define ADE7953_WAVEFORM_FULLSCALE 6500000UL //Waveform/peak register reading for a full scale (+/-500 mV) input; the ADC clips here
+#define ADE7953_RANGE_HIGH 0.9   //Step the gain down when the interval peak passes this fraction of full scale
+#define ADE7953_RANGE_LOW 0.6    //Step the gain up only if the peak would stay below this fraction at the next gain
+#define ADE7953_RANGE_HOLD 3     //Consecutive quiet intervals required before stepping up
+#define ADE7953_PGA_CODES 6      //PGA_x settings 0-5, gain 22 (code 5) is Current Channel A only
+
+class ADE7953AutoRange {
+  public:
+	static uint8_t step(uint8_t gainCode, uint8_t maxCode, uint32_t peakCounts, uint8_t &holdCount);
+	static uint8_t gain(uint8_t gainCode);
+};
+
+#endif
@@ -0,0 +1,264 @@
+/*
+ ADE7953Calibration.cpp - Least squares gain/offset solver for the ADE7953 internal calibration registers
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#include "ADE7953Calibration.h"
+#include <math.h>
+
+//The ADE7953 corrects its own readings, so solving straight into the register values costs no CPU time once written:
+//  RMS:    reading = sqrt((gain/0x400000)^2 * x^2 + 128 * RMSOS)   -> fitted as a line in the squared domain
+//  Power:  reading = (gain/0x400000) * x + WATTOS                   -> fitted as a straight line
+//Points are (raw reading with the present registers, reading that should have been returned).  The present register
+//values are folded back in by solve() so a unit can be calibrated again on top of an earlier calibration.
+
+ADE7953Calibration::ADE7953Calibration(){
+  _rejected = 0;
+  clear();
+  }
+
+void ADE7953Calibration::clear(){
+  for (uint8_t q = 0; q < ADE7953_CAL_QUANTITIES; q++) {
+    _count[q] = 0;
+    }
+  }
+
+void ADE7953Calibration::clear(uint8_t quantity){
+  if (quantity < ADE7953_CAL_QUANTITIES) {
+    _count[quantity] = 0;
+    }
+  }
+
+bool ADE7953Calibration::addPoint(uint8_t quantity, double raw, double target){
+  if (quantity >= ADE7953_CAL_QUANTITIES || _count[quantity] >= ADE7953_CAL_MAX_POINTS) {
+    return false;
+    }
+  _points[quantity][_count[quantity]].raw = raw;
+  _points[quantity][_count[quantity]].target = target;
+  _count[quantity]++;
+  return true;
+  }
+
+uint8_t ADE7953Calibration::getPointCount(uint8_t quantity){
+  return (quantity < ADE7953_CAL_QUANTITIES) ? _count[quantity] : 0;
+  }
+
+bool ADE7953Calibration::isRms(uint8_t quantity){
+  return quantity <= ADE7953_CAL_IRMSB;
+  }
+
+bool ADE7953Calibration::solve(uint8_t quantity, ADE7953CalFit &fit){
+  if (quantity >= ADE7953_CAL_QUANTITIES) {
+    fit.valid = false;
+    return false;
+    }
+  if (isRms(quantity)) {
+    return fitRms(_points[quantity], _count[quantity], fit);
+    }
+  return fitLinear(_points[quantity], _count[quantity], fit);
+  }
+
+bool ADE7953Calibration::solve(uint8_t quantity, const ADE7953CalRegisters &present, ADE7953CalRegisters &updated, ADE7953CalFit &fit){  //False if nothing could be fitted or the gain is out of range, updated is then left at present
+  if (!solve(quantity, fit)) {
+    updated = present;
+    return false;
+    }
+  _rejected &= ~(1 << quantity);
+  if (!checkGain((double)present.gain*fit.gain, updated.gain)) {  //Reference in the wrong units or wiring error, the register cannot hold it
+    _rejected |= (1 << quantity);
+    updated = present;
+    return false;
+    }
+  if (isRms(quantity)) {
+    updated.offset = clampOffset(fit.offset + fit.gain*fit.gain*(double)present.offset);  //The present offset is scaled by the new gain in the squared domain
+    }
+  else {
+    updated.offset = clampOffset(fit.offset + fit.gain*(double)present.offset);
+    }
+  return true;
+  }
+
+uint8_t ADE7953Calibration::solveAll(const ADE7953CalRegisters *present, ADE7953CalRegisters *updated, ADE7953CalFit *fits){  //Arrays of ADE7953_CAL_QUANTITIES, returns a bit mask of the quantities solved
+  uint8_t solved = 0;
+  _rejected = 0;
+  for (uint8_t q = 0; q < ADE7953_CAL_QUANTITIES; q++) {
+    fits[q].valid = false;
+    if (_count[q] == 0 || !solve(q, present[q], updated[q], fits[q])) {
+      updated[q] = present[q];
+      continue;
+      }
+    solved |= (1 << q);
+    }
+  //AWGAIN/BWGAIN act on V x I, so the power points (taken with the old voltage/current gains) already include the correction the new AVGAIN/AIGAIN/BIGAIN make
+  for (uint8_t q = ADE7953_CAL_WATTA; q <= ADE7953_CAL_WATTB; q++) {
+    if (!(solved & (1 << q))) {continue;}
+    uint8_t current = (q == ADE7953_CAL_WATTA) ? ADE7953_CAL_IRMSA : ADE7953_CAL_IRMSB;
+    double vi = (fits[ADE7953_CAL_VRMS].valid ? fits[ADE7953_CAL_VRMS].gain : 1.0)*(fits[current].valid ? fits[current].gain : 1.0);
+    if (!checkGain((double)present[q].gain*fits[q].gain/vi, updated[q].gain)) {
+      _rejected |= (1 << q);
+      solved &= ~(1 << q);
+      updated[q] = present[q];
+      }
+    }
+  return solved;
+  }
+
+uint8_t ADE7953Calibration::getRejected(){  //Bit mask (1 << ADE7953_CAL_xxx) of the quantities the last solve fitted but could not write
+  return _rejected;
+  }
+
+bool ADE7953Calibration::fitLinear(const ADE7953CalPoint *points, uint8_t count, ADE7953CalFit &fit){  //target = gain*raw + offset
+  double sx = 0, sy = 0, sxx = 0, sxy = 0, syy = 0;
+  double n = count;
+
+  fit.valid = false;
+  fit.points = count;
+  if (count == 0) {
+    return false;
+    }
+  for (uint8_t i = 0; i < count; i++) {
+    sx += points[i].raw;
+    sy += points[i].target;
+    sxx += points[i].raw*points[i].raw;
+    sxy += points[i].raw*points[i].target;
+    syy += points[i].target*points[i].target;
+    }
+  double den = n*sxx - sx*sx;
+  if (count == 1 || fabs(den) < 1e-9*(n*sxx + 1.0)) {  //A single point (or all at one load) only fixes the gain
+    if (sxx == 0) {
+      return false;
+      }
+    fit.gain = sxy/sxx;
+    fit.offset = 0;
+    }
+  else {
+    fit.gain = (n*sxy - sx*sy)/den;
+    fit.offset = (sy - fit.gain*sx)/n;
+    }
+
+  double ssRes = 0, ssTot = syy - sy*sy/n;
+  fit.maxResidual = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    double r = fit.gain*points[i].raw + fit.offset - points[i].target;
+    ssRes += r*r;
+    if (fabs(r) > fit.maxResidual) {fit.maxResidual = fabs(r);}
+    }
+  fit.r2 = (ssTot > 0) ? 1.0 - ssRes/ssTot : 1.0;
+  fit.valid = (fit.gain > 0);
+  return fit.valid;
+  }
+
+bool ADE7953Calibration::fitRms(const ADE7953CalPoint *points, uint8_t count, ADE7953CalFit &fit){  //target^2 = gain^2*raw^2 + 128*offset
+  ADE7953CalPoint squared[ADE7953_CAL_MAX_POINTS];
+  ADE7953CalFit line;
+
+  fit.valid = false;
+  fit.points = count;
+  if (count == 0 || count > ADE7953_CAL_MAX_POINTS) {
+    return false;
+    }
+  for (uint8_t i = 0; i < count; i++) {
+    squared[i].raw = points[i].raw*points[i].raw;
+    squared[i].target = points[i].target*points[i].target;
+    }
+  if (!fitLinear(squared, count, line)) {
+    return false;
+    }
+  fit.gain = sqrt(line.gain);
+  fit.offset = line.offset/128.0;
+
+  //Report the quality in plain register counts rather than squared counts
+  double sy = 0, syy = 0, ssRes = 0;
+  fit.maxResidual = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    double model = line.gain*squared[i].raw + line.offset;
+    double r = sqrt(model > 0 ? model : 0) - points[i].target;
+    ssRes += r*r;
+    sy += points[i].target;
+    syy += points[i].target*points[i].target;
+    if (fabs(r) > fit.maxResidual) {fit.maxResidual = fabs(r);}
+    }
+  double ssTot = syy - sy*sy/count;
+  fit.r2 = (ssTot > 0) ? 1.0 - ssRes/ssTot : 1.0;
+  fit.valid = true;
+  return true;
+  }
+
+//Phase calibration: PHCALA/PHCALB delay one input by a whole number of 1.117 us steps.  A CT phase error shows up as a
+//difference between the angle atan2(reactive, active) measured over a line cycle window and the angle of the reference load.
+
+double ADE7953Calibration::referenceAngleDegrees(double referencePF, bool lagging){
+  double reference = acos(referencePF < 0 ? -referencePF : (referencePF > 1 ? 1 : referencePF))*180.0/M_PI;
+  return lagging ? reference : -reference;  //Capacitive (leading) loads have negative reactive energy
+  }
+
+double ADE7953Calibration::phaseErrorDegrees(double activeEnergy, double reactiveEnergy, double referencePF, bool lagging){
+  return atan2(reactiveEnergy, activeEnergy)*180.0/M_PI - referenceAngleDegrees(referencePF, lagging);
+  }
+
+double ADE7953Calibration::phcalDegreesPerLsb(double frequency){
+  return 360.0*frequency*ADE7953_PHCAL_LSB_SECONDS;
+  }
+
+uint16_t ADE7953Calibration::phcalEncode(int16_t value){  //Signed LSB count -> sign-magnitude register value
+  uint16_t magnitude = (value < 0) ? -value : value;
+  if (magnitude > ADE7953_PHCAL_MAX) {magnitude = ADE7953_PHCAL_MAX;}
+  return (value < 0) ? (magnitude | ADE7953_PHCAL_SIGN) : magnitude;
+  }
+
+int16_t ADE7953Calibration::phcalDecode(uint16_t reg){
+  int16_t magnitude = reg & (ADE7953_PHCAL_SIGN - 1);
+  return (reg & ADE7953_PHCAL_SIGN) ? -magnitude : magnitude;
+  }
+
+bool ADE7953Calibration::calibratePhase(ADE7953PhaseWindow measure, void *context, int16_t phcal, double lsbDeg, double referenceDeg, uint8_t maxIterations, double toleranceDeg, ADE7953PhaseCalResult &result){
+  //Each step converts the remaining angle error into PHCAL LSBs (lsbDeg at the measured line frequency); the direction in which PHCAL moves the angle is learned from the first step, so the routine does not depend on the CT polarity.
+  double angle, error, lastError;
+  int16_t step;
+  int8_t direction = 1;
+  
+  result.converged = false;
+  result.verified = false;
+  result.iterations = 0;
+  if (!measure(context, phcal, angle)) {return false;}
+  error = angle - referenceDeg;
+  result.initialError = error;
+  lastError = error;
+  
+  while (result.iterations < maxIterations && fabs(error) > toleranceDeg/2) {  //Aim inside half the tolerance so window noise does not fail the verification
+    step = (int16_t)lround(error/lsbDeg)*direction;
+    if (step == 0) {break;}  //Remaining error is below one LSB
+    phcal = phcalDecode(phcalEncode(phcal + step));  //Clamped to the register range
+    result.iterations++;
+    if (!measure(context, phcal, angle)) {return false;}
+    error = angle - referenceDeg;
+    if (result.iterations == 1 && fabs(error) > fabs(lastError)) {
+      direction = -direction;  //PHCAL moves the angle the other way on this board, undo and go back the right way
+      phcal = phcalDecode(phcalEncode(phcal - 2*step));
+      if (!measure(context, phcal, angle)) {return false;}
+      error = angle - referenceDeg;
+      }
+    lastError = error;
+    }
+  result.converged = (fabs(error) <= toleranceDeg);
+  result.phcal = phcal;
+  
+  //Verify on a fresh window with the final value in place
+  if (!measure(context, phcal, angle)) {return false;}
+  result.finalError = angle - referenceDeg;
+  result.verified = (fabs(result.finalError) <= toleranceDeg);
+  return result.verified;
+  }
+
+bool ADE7953Calibration::checkGain(double value, uint32_t &gain){  //The gain registers only take 0.5..1.5, anything outside is refused rather than clamped
+  if (!(value >= ADE7953_CAL_GAIN_MIN && value <= ADE7953_CAL_GAIN_MAX)) {return false;}
+  gain = (uint32_t)(value + 0.5);
+  return true;
+  }
+
+int32_t ADE7953Calibration::clampOffset(double value){  //Offset registers are signed 24-bit
+  if (value < -8388608.0) {return -8388608L;}
+  if (value > 8388607.0) {return 8388607L;}
+  return (int32_t)(value < 0 ? value - 0.5 : value + 0.5);
+  }
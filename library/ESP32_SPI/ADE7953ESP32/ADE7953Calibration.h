@@ -0,0 +1,99 @@
+/*
+ ADE7953Calibration.h - Least squares gain/offset solver for the ADE7953 internal calibration registers
+  Replaces the manual LinearCalibrationCalculator.xls workflow.  Has no hardware dependency so the same solver
+  builds into the ESP32 library and into the host tool in extras/ade7953cal.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#ifndef ADE7953Calibration_h
+#define ADE7953Calibration_h
+
+#ifdef ARDUINO
+#include "Arduino.h"
+#else
+#include <stdint.h>
+#include <stddef.h>
+#endif
+
+//Calibrated quantities, each one maps to a gain register and an offset register in the ADE7953
+#define ADE7953_CAL_VRMS 0   //AVGAIN, VRMSOS
+#define ADE7953_CAL_IRMSA 1  //AIGAIN, AIRMSOS
+#define ADE7953_CAL_IRMSB 2  //BIGAIN, BIRMSOS
+#define ADE7953_CAL_WATTA 3  //AWGAIN, AWATTOS
+#define ADE7953_CAL_WATTB 4  //BWGAIN, BWATTOS
+#define ADE7953_CAL_QUANTITIES 5
+
+#ifndef ADE7953_CAL_MAX_POINTS
+#define ADE7953_CAL_MAX_POINTS 16 //Reference points kept per quantity
+#endif
+
+#define ADE7953_CAL_GAIN_UNITY 0x400000UL //Gain register value for a gain of 1.0
+#define ADE7953_CAL_GAIN_MIN 0x200000UL   //Smallest value AVGAIN/AIGAIN/BIGAIN/AWGAIN/BWGAIN accept (0.5)
+#define ADE7953_CAL_GAIN_MAX 0x600000UL   //Largest value they accept (1.5)
+
+#define ADE7953_PHCAL_LSB_SECONDS 1.117e-6 //Delay per PHCALA/PHCALB LSB (about 0.02 degrees at 50 Hz)
+#define ADE7953_PHCAL_MAX 383               //Largest PHCAL magnitude accepted by the ADE7953
+#define ADE7953_PHCAL_SIGN 0x200            //Sign bit of the sign-magnitude PHCAL format
+
+struct ADE7953PhaseCalResult {
+  bool converged;       //Error fell inside the tolerance
+  bool verified;        //A fresh measurement with the final value written was still inside the tolerance
+  uint8_t iterations;
+  int16_t phcal;        //Final correction in LSBs (written to PHCALx in sign-magnitude form)
+  float initialError;   //Degrees, measured angle minus reference angle before any correction
+  float finalError;     //Degrees, from the verification measurement
+};
+
+typedef bool (*ADE7953PhaseWindow)(void *context, int16_t phcal, double &angleDeg);  //Puts phcal in place and measures one window, false if no angle could be measured
+
+struct ADE7953CalPoint {
+  double raw;     //Register reading taken with the gain/offset registers that are in place at the time
+  double target;  //Register reading that should have been returned (reference value x library scale factor)
+};
+
+struct ADE7953CalFit {
+  bool valid;
+  uint8_t points;
+  double gain;         //Multiplier to apply on top of the present gain register
+  double offset;       //Offset in the register's own domain (squared counts / 128 for RMS, counts for power)
+  double maxResidual;  //Largest |fit - target| over the points, in register counts
+  double r2;           //Coefficient of determination of the fit
+};
+
+struct ADE7953CalRegisters {  //Register values for one quantity, both before and after a solve
+  uint32_t gain;   //Unsigned 24-bit, 0x400000 = 1.0
+  int32_t offset;  //Signed 24-bit
+};
+
+class ADE7953Calibration {
+  public:
+    ADE7953Calibration();
+	void clear();
+	void clear(uint8_t quantity);
+	bool addPoint(uint8_t quantity, double raw, double target);
+	uint8_t getPointCount(uint8_t quantity);
+	bool solve(uint8_t quantity, ADE7953CalFit &fit);
+	bool solve(uint8_t quantity, const ADE7953CalRegisters &present, ADE7953CalRegisters &updated, ADE7953CalFit &fit);
+	uint8_t solveAll(const ADE7953CalRegisters *present, ADE7953CalRegisters *updated, ADE7953CalFit *fits);
+	uint8_t getRejected();
+
+	static bool fitLinear(const ADE7953CalPoint *points, uint8_t count, ADE7953CalFit &fit);
+	static bool fitRms(const ADE7953CalPoint *points, uint8_t count, ADE7953CalFit &fit);
+	static bool isRms(uint8_t quantity);
+	static double referenceAngleDegrees(double referencePF, bool lagging);
+	static double phaseErrorDegrees(double activeEnergy, double reactiveEnergy, double referencePF, bool lagging);
+	static double phcalDegreesPerLsb(double frequency);
+	static uint16_t phcalEncode(int16_t value);
+	static int16_t phcalDecode(uint16_t reg);
+	static bool calibratePhase(ADE7953PhaseWindow measure, void *context, int16_t phcal, double lsbDeg, double referenceDeg, uint8_t maxIterations, double toleranceDeg, ADE7953PhaseCalResult &result);
+	static bool checkGain(double value, uint32_t &gain);
+	static int32_t clampOffset(double value);
+
+  private:
+	ADE7953CalPoint _points[ADE7953_CAL_QUANTITIES][ADE7953_CAL_MAX_POINTS];
+	uint8_t _count[ADE7953_CAL_QUANTITIES];
+	uint8_t _rejected;  //Quantities whose fitted gain fell outside ADE7953_CAL_GAIN_MIN..MAX on the last solve
+};
+
+#endif
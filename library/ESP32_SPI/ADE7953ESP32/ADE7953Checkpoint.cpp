@@ -0,0 +1,162 @@
+/*
+ ADE7953Checkpoint.cpp - Crash-consistent, wear-levelled checkpoints in flash (used for the 64-bit energy totals)
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#include "ADE7953Checkpoint.h"
+#include <string.h>
+#include <stddef.h>
+
+//Records are appended slot after slot through the sector ring, so each sector is erased once per trip round the ring.  The
+//sector about to be erased is always the oldest one: the newest valid record sits in another sector (double buffering).
+//A record is written in one go with its CRC last; a cut during that write leaves a slot that fails the CRC, and a cut during
+//an erase leaves a sector whose records all fail it.  Either way restore() falls back to the newest record that checks out.
+//Restoring reads every slot of the ring (a 4 kB sector holds 32 records), since a write that failed part way leaves a damaged
+//slot that save() steps over, so the newest record may sit after one, even in slot 0.
+
+static_assert(sizeof(ADE7953CheckpointRecord) == ADE7953_CHECKPOINT_RECORD_SIZE, "ADE7953CheckpointRecord must match the flash record size");
+
+ADE7953Checkpoint::ADE7953Checkpoint(){
+  _storage = NULL;
+  _base = 0;
+  _sectors = 0;
+  _perSector = 0;
+  _sector = 0;
+  _slot = 0;
+  _sequence = 0;
+  _found = false;
+  _newestSector = 0;
+  _newestSlot = 0;
+  _minMs = ADE7953_CHECKPOINT_MIN_MS;
+  _maxMs = ADE7953_CHECKPOINT_MAX_MS;
+  _delta = ADE7953_CHECKPOINT_DELTA;
+  _lastSave = 0;
+  _saved = false;
+  _writeErrors = 0;
+  }
+
+uint32_t ADE7953Checkpoint::slotAddress(uint16_t sector, uint16_t slot){
+  return _base + (uint32_t)sector*_storage->sectorSize() + (uint32_t)slot*ADE7953_CHECKPOINT_RECORD_SIZE;
+  }
+
+bool ADE7953Checkpoint::readValid(uint16_t sector, uint16_t slot, ADE7953CheckpointRecord &record){
+  return _storage->read(slotAddress(sector, slot), &record, sizeof(record)) && record.sequence != 0xFFFFFFFFUL &&
+    record.length <= ADE7953_CHECKPOINT_MAX_PAYLOAD && record.crc == ADE7953Storage::crc32(&record, offsetof(ADE7953CheckpointRecord, crc));
+  }
+
+bool ADE7953Checkpoint::begin(ADE7953Storage &storage, uint32_t firstSector, uint16_t sectors){  //At least 2 sectors, e.g. after the logger's sectors
+  ADE7953CheckpointRecord record;
+  
+  _storage = &storage;
+  _base = firstSector*storage.sectorSize();
+  _sectors = sectors;
+  _perSector = storage.sectorSize()/ADE7953_CHECKPOINT_RECORD_SIZE;
+  _found = false;
+  _sequence = 0;
+  if (sectors < 2 || _perSector == 0 || _base + (uint32_t)sectors*storage.sectorSize() > storage.size()) {
+    _storage = NULL;
+    return false;
+    }
+  
+  for (uint16_t s = 0; s < _sectors; s++) {  //Every slot: a failed write can leave slot 0 damaged under newer records
+    for (uint16_t slot = 0; slot < _perSector; slot++) {
+      if (readValid(s, slot, record) && (!_found || record.sequence > _sequence)) {
+        _found = true;
+        _sequence = record.sequence;
+        _newestSector = s;
+        _newestSlot = slot;
+        }
+      }
+    }
+  _sector = _found ? _newestSector : 0;
+  _slot = _found ? _newestSlot + 1 : 0;  //save() skips any dirty slots after it
+  return true;
+  }
+
+bool ADE7953Checkpoint::restore(void *payload, size_t length){  //Copies the newest valid payload (zero padded), false if there is none
+  ADE7953CheckpointRecord record;
+  
+  if (!_storage || !_found || !readValid(_newestSector, _newestSlot, record)) {
+    return false;
+    }
+  memset(payload, 0, length);
+  memcpy(payload, record.payload, (length < record.length) ? length : record.length);
+  return true;
+  }
+
+bool ADE7953Checkpoint::save(const void *payload, size_t length){
+  ADE7953CheckpointRecord record, existing;
+  
+  if (!_storage || length > ADE7953_CHECKPOINT_MAX_PAYLOAD) {
+    return false;
+    }
+  memset(&record, 0xFF, sizeof(record));
+  record.sequence = _sequence + 1;
+  record.length = length;
+  memcpy(record.payload, payload, length);
+  record.crc = ADE7953Storage::crc32(&record, offsetof(ADE7953CheckpointRecord, crc));
+  
+  for (uint16_t tries = 0; tries <= _perSector; tries++) {  //Skip slots left dirty by an interrupted write
+    if (_slot >= _perSector) {
+      _sector = (_sector + 1) % _sectors;
+      _slot = 0;
+      if (!_storage->erase(slotAddress(_sector, 0))) {  //The oldest sector, the newest record is elsewhere
+        _writeErrors++;
+        return false;
+        }
+      }
+    bool erased = _storage->read(slotAddress(_sector, _slot), &existing, sizeof(existing));
+    for (size_t i = 0; erased && i < sizeof(existing); i++) {
+      erased = ((uint8_t *)&existing)[i] == 0xFF;
+      }
+    if (erased) {break;}
+    _slot++;
+    }
+  
+  if (!_storage->write(slotAddress(_sector, _slot), &record, sizeof(record))) {
+    _slot++;
+    _writeErrors++;
+    return false;
+    }
+  _newestSector = _sector;
+  _newestSlot = _slot;
+  _slot++;
+  _sequence = record.sequence;
+  _found = true;
+  return true;
+  }
+
+void ADE7953Checkpoint::setPolicy(unsigned long minIntervalMs, unsigned long maxIntervalMs, uint64_t delta){
+  _minMs = minIntervalMs;
+  _maxMs = maxIntervalMs;
+  _delta = delta;
+  }
+
+bool ADE7953Checkpoint::due(unsigned long now, uint64_t delta){  //delta: how far the value has moved since the last save, in the caller's units
+  if (!_saved) {
+    return delta > 0;
+    }
+  unsigned long elapsed = now - _lastSave;
+  if (elapsed < _minMs || delta == 0) {
+    return false;  //Bounds the write rate (and the wear) whatever the load
+    }
+  return delta >= _delta || elapsed >= _maxMs;  //Bounds the loss on a reset both in energy and in time
+  }
+
+bool ADE7953Checkpoint::update(unsigned long now, uint64_t delta, const void *payload, size_t length){  //Saves if due(), returns true when it wrote
+  if (!due(now, delta)) {
+    return false;
+    }
+  _lastSave = now;
+  _saved = true;
+  return save(payload, length);
+  }
+
+uint32_t ADE7953Checkpoint::getSequence(){
+  return _sequence;
+  }
+
+unsigned long ADE7953Checkpoint::getWriteErrors(){
+  return _writeErrors;
+  }
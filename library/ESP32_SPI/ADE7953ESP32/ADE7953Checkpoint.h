@@ -0,0 +1,69 @@
+/*
+ ADE7953Checkpoint.h - Crash-consistent, wear-levelled checkpoints in flash (used for the 64-bit energy totals)
+  Appends CRC-protected, sequence-numbered records across a ring of at least two sectors.  The newest complete record
+  always survives a reset or power cut, whether it hits a record write or a sector erase.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#ifndef ADE7953Checkpoint_h
+#define ADE7953Checkpoint_h
+
+#include "ADE7953Storage.h"
+
+#define ADE7953_CHECKPOINT_RECORD_SIZE 128
+#define ADE7953_CHECKPOINT_MAX_PAYLOAD 116  //Record size less the sequence/length header and the CRC
+
+#ifndef ADE7953_CHECKPOINT_MIN_MS
+#define ADE7953_CHECKPOINT_MIN_MS 60000UL      //Default write policy: never more often than once a minute,
+#endif
+#ifndef ADE7953_CHECKPOINT_MAX_MS
+#define ADE7953_CHECKPOINT_MAX_MS 3600000UL    //at least hourly while the value changes,
+#endif
+#ifndef ADE7953_CHECKPOINT_DELTA
+#define ADE7953_CHECKPOINT_DELTA 10000000ULL   //and as soon as 10 Wh (in uWh) have been counted
+#endif
+
+struct ADE7953CheckpointRecord {  //ADE7953_CHECKPOINT_RECORD_SIZE bytes as stored in flash
+  uint32_t sequence;  //0xFFFFFFFF in an erased slot
+  uint16_t length;
+  uint16_t reserved;
+  uint8_t payload[ADE7953_CHECKPOINT_MAX_PAYLOAD];
+  uint32_t crc;       //CRC-32 of everything before it, written last
+};
+
+class ADE7953Checkpoint {
+  public:
+    ADE7953Checkpoint();
+	bool begin(ADE7953Storage &storage, uint32_t firstSector, uint16_t sectors);
+	bool restore(void *payload, size_t length);
+	bool save(const void *payload, size_t length);
+	void setPolicy(unsigned long minIntervalMs, unsigned long maxIntervalMs, uint64_t delta);
+	bool due(unsigned long now, uint64_t delta);
+	bool update(unsigned long now, uint64_t delta, const void *payload, size_t length);
+	uint32_t getSequence();
+	unsigned long getWriteErrors();
+
+  private:
+	uint32_t slotAddress(uint16_t sector, uint16_t slot);
+	bool readValid(uint16_t sector, uint16_t slot, ADE7953CheckpointRecord &record);
+	
+	ADE7953Storage *_storage;
+	uint32_t _base;
+	uint16_t _sectors;
+	uint16_t _perSector;
+	uint16_t _sector;       //Position of the next write
+	uint16_t _slot;
+	uint32_t _sequence;     //Sequence of the newest valid record, 0 before the first
+	bool _found;
+	uint16_t _newestSector; //Location of the newest valid record
+	uint16_t _newestSlot;
+	unsigned long _minMs;
+	unsigned long _maxMs;
+	uint64_t _delta;
+	unsigned long _lastSave;
+	bool _saved;
+	unsigned long _writeErrors;
+};
+
+#endif
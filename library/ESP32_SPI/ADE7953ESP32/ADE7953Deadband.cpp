@@ -0,0 +1,103 @@
+/*
+ ADE7953Deadband.cpp - Report-by-exception change detection for ADE7953 measurement snapshots
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#include "ADE7953Deadband.h"
+#include <math.h>
+
+//A field is flagged when |value - last reported| is larger than both its absolute deadband and its relative deadband times
+//the last reported value.  Give quantities that sit near zero (export power, reactive power, channel B with no load) an
+//absolute deadband, a relative one alone flags them on every bit of noise.  Flags collect in the dirty mask until the
+//publisher serializes those fields and calls clearDirty(); the heartbeat flags every tracked field so the receiver also
+//gets a full record at least every maxSilenceMs.
+
+ADE7953Deadband::ADE7953Deadband(){
+  for (uint8_t f = 0; f < ADE7953_FIELDS; f++) {
+    _absolute[f] = 0;
+    _relative[f] = ADE7953_DEADBAND_RELATIVE;
+    }
+  _fieldMask = ADE7953_FIELDS_ALL;
+  _heartbeatMs = ADE7953_DEADBAND_HEARTBEAT_MS;
+  reset();
+  }
+
+void ADE7953Deadband::reset(){  //The next update() flags every tracked field
+  for (uint8_t f = 0; f < ADE7953_FIELDS; f++) {
+    _reported[f] = 0;
+    }
+  _dirty = 0;
+  _primed = false;
+  _lastFull = 0;
+  _evaluated = 0;
+  _reportedCount = 0;
+  }
+
+void ADE7953Deadband::setDeadband(uint8_t field, float absolute, float relative){  //Both 0 flags any change at all
+  if (field < ADE7953_FIELDS) {
+    _absolute[field] = absolute;
+    _relative[field] = relative;
+    }
+  }
+
+void ADE7953Deadband::setHeartbeat(unsigned long maxSilenceMs){  //0 turns the heartbeat off
+  _heartbeatMs = maxSilenceMs;
+  }
+
+void ADE7953Deadband::setFieldMask(uint32_t mask){  //Fields outside the mask are never flagged
+  _fieldMask = mask & ADE7953_FIELDS_ALL;
+  _dirty &= _fieldMask;
+  }
+
+bool ADE7953Deadband::exceeds(float value, float reference, float absolute, float relative){
+  float delta = fabsf(value - reference);
+  if (delta != delta) {
+    return value == value;  //NaN: flag once when a real value returns, never while the reading stays invalid
+    }
+  return delta > absolute && delta > relative*fabsf(reference);
+  }
+
+uint32_t ADE7953Deadband::update(const float *values, unsigned long now){  //values[ADE7953_FIELDS], returns the fields newly flagged by this update
+  uint32_t flagged = 0;
+  
+  if (!_primed || (_heartbeatMs > 0 && (now - _lastFull) >= _heartbeatMs)) {
+    flagged = _fieldMask;
+    _lastFull = now;
+    _primed = true;
+    }
+  else {
+    for (uint8_t f = 0; f < ADE7953_FIELDS; f++) {
+      if (!(_fieldMask & (1UL << f))) {continue;}
+      _evaluated++;
+      if (exceeds(values[f], _reported[f], _absolute[f], _relative[f])) {
+        flagged |= (1UL << f);
+        }
+      }
+    }
+  for (uint8_t f = 0; f < ADE7953_FIELDS; f++) {
+    if (flagged & (1UL << f)) {
+      _reported[f] = values[f];
+      _reportedCount++;
+      }
+    }
+  _dirty |= flagged;
+  return flagged;
+  }
+
+uint32_t ADE7953Deadband::getDirtyMask(){
+  return _dirty;
+  }
+
+void ADE7953Deadband::clearDirty(uint32_t mask){  //Call with the fields that were actually published
+  _dirty &= ~mask;
+  }
+
+float ADE7953Deadband::getReported(uint8_t field){
+  return (field < ADE7953_FIELDS) ? _reported[field] : 0;
+  }
+
+void ADE7953Deadband::getStats(uint32_t &evaluated, uint32_t &reported){  //Field comparisons made outside heartbeats and fields flagged in total
+  evaluated = _evaluated;
+  reported = _reportedCount;
+  }
@@ -0,0 +1,73 @@
+/*
+ ADE7953Deadband.h - Report-by-exception change detection for ADE7953 measurement snapshots
+  Keeps the last reported value of every snapshot field and flags a field only when it has moved by more than its
+  deadband, or when the heartbeat says a full record is due.  No hardware dependency, no heap use.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#ifndef ADE7953Deadband_h
+#define ADE7953Deadband_h
+
+#ifdef ARDUINO
+#include "Arduino.h"
+#else
+#include <stdint.h>
+#include <stddef.h>
+#endif
+
+//Snapshot fields, also the bit positions of the dirty masks (see ADE7953::snapshotValues())
+#define ADE7953_FIELD_VRMS 0
+#define ADE7953_FIELD_IRMSA 1
+#define ADE7953_FIELD_IRMSB 2
+#define ADE7953_FIELD_ACTIVEA 3
+#define ADE7953_FIELD_ACTIVEB 4
+#define ADE7953_FIELD_REACTIVEA 5
+#define ADE7953_FIELD_REACTIVEB 6
+#define ADE7953_FIELD_APPARENTA 7
+#define ADE7953_FIELD_APPARENTB 8
+#define ADE7953_FIELD_PFA 9
+#define ADE7953_FIELD_PFB 10
+#define ADE7953_FIELD_PERIOD 11
+#define ADE7953_FIELD_FREQUENCY 12
+#define ADE7953_FIELD_ANGLEA 13
+#define ADE7953_FIELD_ANGLEB 14
+#define ADE7953_FIELDS 15
+#define ADE7953_FIELDS_ALL ((1UL << ADE7953_FIELDS) - 1)
+
+#ifndef ADE7953_DEADBAND_RELATIVE
+#define ADE7953_DEADBAND_RELATIVE 0.01 //Default deadband, fraction of the last reported value
+#endif
+#ifndef ADE7953_DEADBAND_HEARTBEAT_MS
+#define ADE7953_DEADBAND_HEARTBEAT_MS 300000UL //Default longest time without a full record
+#endif
+
+class ADE7953Deadband {
+  public:
+    ADE7953Deadband();
+	void setDeadband(uint8_t field, float absolute, float relative);
+	void setHeartbeat(unsigned long maxSilenceMs);
+	void setFieldMask(uint32_t mask);
+	uint32_t update(const float *values, unsigned long now);
+	uint32_t getDirtyMask();
+	void clearDirty(uint32_t mask);
+	float getReported(uint8_t field);
+	void reset();
+	void getStats(uint32_t &evaluated, uint32_t &reported);
+	
+	static bool exceeds(float value, float reference, float absolute, float relative);
+
+  private:
+	float _absolute[ADE7953_FIELDS];
+	float _relative[ADE7953_FIELDS];
+	float _reported[ADE7953_FIELDS];  //Value at the last time each field was flagged
+	uint32_t _fieldMask;
+	uint32_t _dirty;
+	bool _primed;
+	unsigned long _heartbeatMs;
+	unsigned long _lastFull;
+	uint32_t _evaluated;
+	uint32_t _reportedCount;
+};
+
+#endif
@@ -0,0 +1,175 @@
+/*
+ ADE7953Demand.cpp - Block and sliding window demand with a persistent billing peak
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#include "ADE7953Demand.h"
+#include <string.h>
+
+//Time is in seconds on any clock that does not wrap during the billing period; with epoch time the windows line up with
+//the quarter hours a utility meter uses.  Energy arriving in one update is spread over the time since the previous update,
+//so a window boundary that falls between two updates gets the energy on each side of it.  Windows that started before
+//begin() (or after a clock step or a gap longer than the window) are incomplete and never become the peak.
+
+ADE7953Demand::ADE7953Demand(){
+  memset(&_peak, 0, sizeof(_peak));
+  _peakCheckpointed = 0;
+  _peakReset = false;
+  _demand = 0;
+  _demandTime = 0;
+  begin(ADE7953_DEMAND_WINDOW, ADE7953_DEMAND_BUCKETS, true);
+  _configured = false;  //The defaults above do not count as the caller's begin(), see restorePeak()
+  }
+
+bool ADE7953Demand::begin(uint32_t windowSec, uint8_t buckets, bool sliding){  //windowSec must divide into whole-second buckets
+  if (buckets == 0 || buckets > ADE7953_DEMAND_MAX_BUCKETS || windowSec == 0 || windowSec % buckets) {
+    return false;
+    }
+  _window = windowSec;
+  _buckets = buckets;
+  _bucketSec = windowSec/buckets;
+  _sliding = sliding;  //Sliding: a new window result at every bucket end.  Block: only at multiples of the window
+  _head = 0;
+  _filled = 0;
+  _sum = 0;
+  _current = 0;
+  _started = false;
+  _partial = false;
+  memset(_ring, 0, sizeof(_ring));
+  if (_peak.window != _window) {
+    memset(&_peak, 0, sizeof(_peak));
+    _peak.window = _window;
+    }
+  _configured = true;
+  return true;
+  }
+
+void ADE7953Demand::closeBucket(uint32_t end){
+  _sum += _current - _ring[_head];
+  _ring[_head] = _current;
+  _head = (_head + 1) % _buckets;
+  if (_partial) {
+    _partial = false;  //The bucket open at a restart did not see all of its energy
+    }
+  else if (_filled < _buckets) {
+    _filled++;
+    }
+  _current = 0;
+  _currentStart = end;
+  
+  if (_filled < _buckets || (!_sliding && end % _window)) {
+    return;
+    }
+  _demand = _sum;
+  _demandTime = end;
+  if (_sum > _peak.energy || _peak.time == 0) {
+    _peak.energy = _sum;
+    _peak.time = end;
+    }
+  }
+
+bool ADE7953Demand::update(uint64_t energy, uint32_t time){  //Returns true when a window result (getDemand()) was produced
+  if (!_started || energy < _lastEnergy || time < _lastTime) {  //First call, totals restored/cleared or clock stepped back: restart the window
+    _head = 0;
+    _filled = 0;
+    _sum = 0;
+    _current = 0;
+    memset(_ring, 0, sizeof(_ring));
+    _currentStart = time - time % _bucketSec;
+    _partial = (time != _currentStart);
+    _lastEnergy = energy;
+    _lastTime = time;
+    _started = true;
+    return false;
+    }
+  
+  uint32_t before = _demandTime;
+  uint64_t delta = energy - _lastEnergy;
+  uint32_t span = time - _lastTime;
+  _lastEnergy = energy;
+  
+  if (time - _currentStart >= (_buckets + 1)*_bucketSec) {  //Gap longer than a window: no window can be measured across it, start over in the present bucket
+    _head = 0;
+    _filled = 0;
+    _sum = 0;
+    memset(_ring, 0, sizeof(_ring));
+    _currentStart = time - time % _bucketSec;
+    _current = delta*(time - _currentStart)/span;
+    _partial = true;
+    _lastTime = time;
+    return false;
+    }
+  while (time >= _currentStart + _bucketSec) {
+    uint32_t end = _currentStart + _bucketSec;
+    uint64_t part = delta*(end - _lastTime)/span;
+    _current += part;
+    delta -= part;
+    span -= end - _lastTime;
+    _lastTime = end;
+    closeBucket(end);
+    }
+  _current += delta;
+  _lastTime = time;
+  return _demandTime != before;
+  }
+
+float ADE7953Demand::toWatts(uint64_t windowEnergy){  //uWh over the window -> W
+  return (float)((double)windowEnergy*0.0036/(double)_window);
+  }
+
+float ADE7953Demand::getDemand(){  //Demand of the last complete window, W (0 before the first one)
+  return toWatts(_demand);
+  }
+
+uint32_t ADE7953Demand::getDemandTime(){  //End of that window
+  return _demandTime;
+  }
+
+float ADE7953Demand::getPeakDemand(){
+  return toWatts(_peak.energy);
+  }
+
+uint32_t ADE7953Demand::getPeakTime(){  //0 while there has been no complete window in the period
+  return _peak.time;
+  }
+
+uint32_t ADE7953Demand::getPeriodStart(){
+  return _peak.periodStart;
+  }
+
+void ADE7953Demand::resetPeak(uint32_t time){  //Start a new billing period
+  _peak.energy = 0;
+  _peak.time = 0;
+  _peak.periodStart = time;
+  _peak.window = _window;
+  _peakReset = true;
+  }
+
+bool ADE7953Demand::restorePeak(ADE7953Checkpoint &checkpoint){  //After begin(); false when nothing was stored or it was measured with another window length
+  //begin() clears a peak measured with another window length, so a peak restored before it could be wiped (or refused
+  //against the default window) without the caller noticing; restoring before begin() is refused instead.
+  ADE7953DemandPeak peak;
+  if (!_configured || !checkpoint.restore(&peak, sizeof(peak)) || peak.window != _window) {
+    return false;
+    }
+  _peak = peak;
+  _peakCheckpointed = peak.energy;
+  return true;
+  }
+
+bool ADE7953Demand::checkpointPeak(ADE7953Checkpoint &checkpoint, unsigned long now){  //Call with millis(); writes when the peak has moved by the checkpoint delta, and at once after resetPeak()
+  if (_peakReset) {
+    if (!checkpoint.save(&_peak, sizeof(_peak))) {
+      return false;
+      }
+    _peakReset = false;
+    _peakCheckpointed = _peak.energy;
+    return true;
+    }
+  if (!checkpoint.update(now, _peak.energy - _peakCheckpointed, &_peak, sizeof(_peak))) {
+    return false;
+    }
+  _peakCheckpointed = _peak.energy;
+  return true;
+  }
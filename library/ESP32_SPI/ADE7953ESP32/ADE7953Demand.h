@@ -0,0 +1,74 @@
+/*
+ ADE7953Demand.h - Block and sliding window demand with a persistent billing peak
+  Driven by an accumulated energy total (e.g. ADE7953EnergyTotals::activeImport) through a ring of sub-interval buckets,
+  so an update costs the same whether it runs once a second or every line cycle.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#ifndef ADE7953Demand_h
+#define ADE7953Demand_h
+
+#ifdef ARDUINO
+#include "Arduino.h"
+#else
+#include <stdint.h>
+#include <stddef.h>
+#endif
+#include "ADE7953Checkpoint.h"
+
+#ifndef ADE7953_DEMAND_MAX_BUCKETS
+#define ADE7953_DEMAND_MAX_BUCKETS 60 //Sub-intervals per window, e.g. 15 one minute buckets for a 15 minute sliding window
+#endif
+#define ADE7953_DEMAND_WINDOW 900   //Default window, seconds
+#define ADE7953_DEMAND_BUCKETS 15
+
+struct ADE7953DemandPeak {  //Highest complete window of the billing period, the part kept in flash
+  uint64_t energy;       //Window energy in the input's units (uWh from the energy totals)
+  uint32_t time;         //End of that window
+  uint32_t periodStart;  //Time passed to resetPeak()
+  uint32_t window;       //Window length (s) the peak was measured with
+  uint32_t reserved;
+};
+
+class ADE7953Demand {
+  public:
+    ADE7953Demand();
+	bool begin(uint32_t windowSec, uint8_t buckets, bool sliding);
+	bool update(uint64_t energy, uint32_t time);
+	float getDemand();
+	uint32_t getDemandTime();
+	float getPeakDemand();
+	uint32_t getPeakTime();
+	uint32_t getPeriodStart();
+	void resetPeak(uint32_t time);
+	bool restorePeak(ADE7953Checkpoint &checkpoint);  //Call after begin(), which clears a peak of another window length
+	bool checkpointPeak(ADE7953Checkpoint &checkpoint, unsigned long now);
+	float toWatts(uint64_t windowEnergy);
+
+  private:
+	void closeBucket(uint32_t end);
+	
+	uint32_t _window;
+	uint32_t _bucketSec;
+	uint8_t _buckets;
+	bool _sliding;
+	uint64_t _ring[ADE7953_DEMAND_MAX_BUCKETS];  //Closed buckets, oldest at _head
+	uint8_t _head;
+	uint8_t _filled;        //Complete buckets closed since the ring was last cleared, up to _buckets
+	bool _partial;          //The open bucket started before the ring was cleared
+	uint64_t _sum;          //Sum of the ring
+	uint64_t _current;      //Energy of the open bucket
+	uint32_t _currentStart;
+	uint64_t _lastEnergy;
+	uint32_t _lastTime;
+	bool _started;
+	uint64_t _demand;       //Energy of the last complete window
+	uint32_t _demandTime;
+	ADE7953DemandPeak _peak;
+	uint64_t _peakCheckpointed;
+	bool _peakReset;
+	bool _configured;       //begin() has been called by the caller
+};
+
+#endif
@@ -0,0 +1,38 @@
+/*
+ ADE7953Derived.cpp - Apparent power, power factor and power angle of the ADE7953 derived from other registers
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#include "ADE7953Derived.h"
+#include <math.h>
+
+//The chip computes AVA as the product of its VRMS and IRMS, so the two differ only by a fixed scale and the rounding of
+//each register.  sqrt(P^2 + Q^2) equals S only for sinusoids: harmonic (distortion) power is in S but in neither P nor Q.
+
+float ADE7953Derived::learnScale(int32_t apparent, uint32_t vrms, uint32_t irms){  //AVA/BVA counts per VRMS x IRMS count, 0 if the channel is not loaded enough to tell
+  float s = (apparent < 0) ? -(float)apparent : (float)apparent;
+  if (s < ADE7953_DERIVED_MIN_VA || vrms == 0 || irms == 0) {
+    return 0;
+    }
+  return s/((float)vrms*(float)irms);
+  }
+
+float ADE7953Derived::apparentVI(float scale, uint32_t vrms, uint32_t irms){  //AVA/BVA counts
+  return scale*(float)vrms*(float)irms;
+  }
+
+float ADE7953Derived::apparentPQ(int32_t active, int32_t reactive){  //AVA/BVA counts for a sinusoidal load
+  return sqrt((float)active*(float)active + (float)reactive*(float)reactive);
+  }
+
+int16_t ADE7953Derived::powerFactor(int32_t active, float apparent){  //P/S in the PFx register format, 0x7FFF = 1.0
+  float ratio = (apparent > 0) ? 32768.0*(float)active/apparent : 0;
+  if (ratio > 32767.0) {return 32767;}
+  if (ratio < -32768.0) {return -32768;}
+  return (int16_t)ratio;
+  }
+
+float ADE7953Derived::powerAngle(int32_t active, int32_t reactive){  //atan2(Q, P) in degrees, positive for an inductive load, 0 with no power
+  return (active != 0 || reactive != 0) ? atan2((float)reactive, (float)active)*180.0/M_PI : 0;
+  }
@@ -0,0 +1,32 @@
+/*
+ ADE7953Derived.h - Apparent power, power factor and power angle of the ADE7953 derived from other registers
+  The arithmetic behind ADE7953::readDerived() and verifyDerived(): apparent power from VRMS x IRMS on a scale learned
+  from AVA/BVA, or from the active and reactive powers, and the power factor in the PFx register format.  No hardware
+  dependency, so the register model bench in extras/ade7953derived runs the same code.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#ifndef ADE7953Derived_h
+#define ADE7953Derived_h
+
+#ifdef ARDUINO
+#include "Arduino.h"
+#else
+#include <stdint.h>
+#include <stddef.h>
+#endif
+
+#define ADE7953_DERIVED_MIN_VA 10000      //AVA/BVA counts below which a channel counts as unloaded and is left out of verifyDerived()
+#define ADE7953_DERIVED_SCALE_ALPHA 0.25  //Weight of each verifyDerived() reading in the learned VRMS x IRMS -> AVA scale
+
+class ADE7953Derived {
+  public:
+	static float learnScale(int32_t apparent, uint32_t vrms, uint32_t irms);
+	static float apparentVI(float scale, uint32_t vrms, uint32_t irms);
+	static float apparentPQ(int32_t active, int32_t reactive);
+	static int16_t powerFactor(int32_t active, float apparent);
+	static float powerAngle(int32_t active, int32_t reactive);
+};
+
+#endif
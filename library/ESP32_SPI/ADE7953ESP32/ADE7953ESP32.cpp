@@ -9,9 +9,12 @@
 #include "Arduino.h"
 #include "ADE7953ESP32.h"
 #include "esp32-hal-spi.h"
+#include "driver/pcnt.h"
 //#define ADE7953_VERBOSE_DEBUG //This line turns on verbose debug via serial monitor (Normally off or //'ed).  Use sparingly and in a test program!  Turning this on can take a lot of memory!  This is non-specific and for all functions, beware, it's a lot of output!  Reported bytes are in HEX
 
 spi_t * spy; //for ESP32
+static ADE7953BusLock busLock;  //One per bus: every ADE7953 on VSPI shares spy and the session started in beginBatch()
+static uint16_t busBatchDepth = 0;  //Nesting of beginBatch() across every ADE7953 on the bus, only touched with busLock held
 
 
 //******************Calibration Factors*************************
@@ -53,6 +56,13 @@ spi_t * spy; //for ESP32
 #define getInstActivePowerA_m 1.0 
 #define getInstActivePowerA_b 0.0
 
+#define getActiveEnergyA_m 1.0 //Energy register counts per Wh (per varh / VAh for the reactive and apparent registers), used by the energy totals
+#define getActiveEnergyB_m 1.0
+#define getReactiveEnergyA_m 1.0
+#define getReactiveEnergyB_m 1.0
+#define getApparentEnergyA_m 1.0
+#define getApparentEnergyB_m 1.0
+
 
 
 
@@ -94,7 +104,7 @@ spi_t * spy; //for ESP32
 #define PFB_16 0x10B //PFB, (R) Default:0x0000, Signed,Power factor (Current Channel B) 
 #define ANGLE_A_16 0x10C //ANGLE_A, (R) Default:0x0000, Signed,Angle between the voltage input and the Current Channel A input 
 #define ANGLE_B_16 0x10D //ANGLE_B, (R) Default:0x0000, Signed,Angle between the voltage input and the Current Channel B input 
-#define Period_16 0x11E //Period, (R) Default:0x0000, Unsigned, Period register 
+#define Period_16 0x10E //Period, (R) Default:0x0000, Unsigned, Period register 
 #define ALT_OUTPUT_16 0x110 //ALT_OUTPUT, (R/W) Default:0x0000, Unsigned,Alternative output functions**/
 #define LAST_ADD_16 0x1FE //LAST_ADD, (R) Default:0x0000, Unsigned, Contains the address of the last successful communication 
 #define LAST_RWDATA_16 0x1FF //LAST_RWDATA_16, (R) Default:0x0000, Unsigned,Contains the data from the last successful 16-bit register communication 
@@ -113,8 +123,8 @@ spi_t * spy; //for ESP32
 #define ACCMODE_32 0x301 //ACCMODE, (R/W) Default: 0x000000, Unsigned, Accumulation mode(32 bit)
 #define AP_NOLOAD_24 0x203 //AP_NOLOAD, (R/W) Default: 0x00E419, Unsigned,Active power no-load level(24 bit)
 #define AP_NOLOAD_32 0x303 //AP_NOLOAD, (R/W) Default: 0x00E419, Unsigned,Active power no-load level(32 bit)
-#define VAR_NOLOAD_24 0x204 //VAR_NOLOAD, (R/W) Default: 0x000000, Unsigned,Reactive power no-load level(24 bit)
-#define VAR_NOLOAD_32 0x304 //VAR_NOLOAD, (R/W) Default: 0x000000, Unsigned,Reactive power no-load level(32 bit)
+#define VAR_NOLOAD_24 0x204 //VAR_NOLOAD, (R/W) Default: 0x00E419, Unsigned,Reactive power no-load level(24 bit)
+#define VAR_NOLOAD_32 0x304 //VAR_NOLOAD, (R/W) Default: 0x00E419, Unsigned,Reactive power no-load level(32 bit)
 #define VA_NOLOAD_24 0x205 //VA_NOLOAD, (R/W) Default: 0x000000, Unsigned,Apparent power no-load level(24 bit)
 #define VA_NOLOAD_32 0x305 //VA_NOLOAD, (R/W) Default: 0x000000, Unsigned,Apparent power no-load level(32 bit)
 #define AVA_24 0x210 //AVA, (R) Default: 0x000000, Signed,Instantaneous apparent power (Current Channel A)(24 bit)
@@ -563,7 +573,7 @@ return value;
 float ADE7953::getVrms(){  
 	unsigned long value=0;  
 	value=spiAlgorithm32_read((functionBitVal(VRMS_32,1)),(functionBitVal(VRMS_32,0)));
-	float decimal = decimalize(value, getVrms_m, getVrms_b);
+	float decimal = decimalize(value, getVrms_m*_gainScale[ADE7953_CHANNEL_V], getVrms_b);
 return decimal;
   }  
   
@@ -582,14 +592,14 @@ return value;
 float ADE7953::getIrmsA(){  
 	unsigned long value=0;  
 	value=spiAlgorithm32_read((functionBitVal(IRMSA_32,1)),(functionBitVal(IRMSA_32,0))); 
-	float decimal = decimalize(value, getIrmsA_m, getIrmsA_b);
+	float decimal = decimalize(value, getIrmsA_m*_gainScale[ADE7953_CHANNEL_A], getIrmsA_b);
 return decimal;
   }
   
 float ADE7953::getIrmsB(){
 	unsigned long value=0;
 	value=spiAlgorithm32_read((functionBitVal(IRMSB_32,1)), (functionBitVal(IRMSB_32, 0)));
-	float decimal = decimalize(value, getIrmsB_m, getIrmsB_b);
+	float decimal = decimalize(value, getIrmsB_m*_gainScale[ADE7953_CHANNEL_B], getIrmsB_b);
 return decimal;
 	}
   
@@ -650,42 +660,82 @@ return value;
 float ADE7953::getInstApparentPowerA(){  
 	long value=0;  
 	value=spiAlgorithm32_read((functionBitVal(AVA_32,1)),(functionBitVal(AVA_32,0))); 
-	float decimal = decimalize(value, getInstApparentPowerA_m, getInstApparentPowerA_b);
+	float decimal = decimalize(value, getInstApparentPowerA_m*_gainScale[ADE7953_CHANNEL_V]*_gainScale[ADE7953_CHANNEL_A], getInstApparentPowerA_b);
 return abs(decimal);
   }
   
 float ADE7953::getInstApparentPowerB(){  
 	long value=0;  
 	value=spiAlgorithm32_read((functionBitVal(BVA_32,1)),(functionBitVal(BVA_32,0))); 
-	float decimal = decimalize(value, getInstApparentPowerB_m, getInstApparentPowerB_b);
+	float decimal = decimalize(value, getInstApparentPowerB_m*_gainScale[ADE7953_CHANNEL_V]*_gainScale[ADE7953_CHANNEL_B], getInstApparentPowerB_b);
 return abs(decimal);
   }
   
 float ADE7953::getInstActivePowerA(){  
 	long value=0;  
 	value=spiAlgorithm32_read((functionBitVal(AWATT_32,1)),(functionBitVal(AWATT_32,0))); 
-	float decimal = decimalize(value, getInstActivePowerA_m, getInstActivePowerA_b);
+	float decimal = decimalize(value, getInstActivePowerA_m*_gainScale[ADE7953_CHANNEL_V]*_gainScale[ADE7953_CHANNEL_A], getInstActivePowerA_b);
 return abs(decimal);
   }
   
 float ADE7953::getInstActivePowerB(){  
 	long value=0;  
 	value=spiAlgorithm32_read((functionBitVal(BWATT_32,1)),(functionBitVal(BWATT_32,0))); 
-	float decimal = decimalize(value, getInstActivePowerB_m, getInstActivePowerB_b);
+	float decimal = decimalize(value, getInstActivePowerB_m*_gainScale[ADE7953_CHANNEL_V]*_gainScale[ADE7953_CHANNEL_B], getInstActivePowerB_b);
 return abs(decimal);
   }
   
+float ADE7953::getSignedActivePowerA(){  //Same as getInstActivePowerA() but keeps the direction: negative when power flows back to the line (export)
+	long value=0;  
+	value=(int32_t)spiAlgorithm32_read((functionBitVal(AWATT_32,1)),(functionBitVal(AWATT_32,0))); 
+	float decimal = decimalize(value, getInstActivePowerA_m*_gainScale[ADE7953_CHANNEL_V]*_gainScale[ADE7953_CHANNEL_A], getInstActivePowerA_b);
+return decimal;
+  }
+  
+float ADE7953::getSignedActivePowerB(){  
+	long value=0;  
+	value=(int32_t)spiAlgorithm32_read((functionBitVal(BWATT_32,1)),(functionBitVal(BWATT_32,0))); 
+	float decimal = decimalize(value, getInstActivePowerB_m*_gainScale[ADE7953_CHANNEL_V]*_gainScale[ADE7953_CHANNEL_B], getInstActivePowerB_b);
+return decimal;
+  }
+
+float ADE7953::getFrequency(){  //Line frequency in Hz from the Period register
+	uint16_t value=0;  
+	value=spiAlgorithm16_read((functionBitVal(Period_16,1)),(functionBitVal(Period_16,0))); 
+return periodToHz(value);
+  }
+
+float ADE7953::getPhaseAngleA(){  //Degrees, ANGLE_A converted with the Period read in the same bus session
+	int16_t angle=0;  
+	uint16_t period=0;  
+	beginBatch();
+	angle=spiAlgorithm16_read((functionBitVal(ANGLE_A_16,1)),(functionBitVal(ANGLE_A_16,0))); 
+	period=spiAlgorithm16_read((functionBitVal(Period_16,1)),(functionBitVal(Period_16,0))); 
+	endBatch();
+return angleToDegrees(angle, period);
+  }
+
+float ADE7953::getPhaseAngleB(){  
+	int16_t angle=0;  
+	uint16_t period=0;  
+	beginBatch();
+	angle=spiAlgorithm16_read((functionBitVal(ANGLE_B_16,1)),(functionBitVal(ANGLE_B_16,0))); 
+	period=spiAlgorithm16_read((functionBitVal(Period_16,1)),(functionBitVal(Period_16,0))); 
+	endBatch();
+return angleToDegrees(angle, period);
+  }
+  
 float ADE7953::getInstReactivePowerA(){  
 	long value=0;  
 	value=spiAlgorithm32_read((functionBitVal(AVAR_32,1)),(functionBitVal(AVAR_32,0))); 
-	float decimal = decimalize(value, getInstReactivePowerA_m, getInstReactivePowerA_b);
+	float decimal = decimalize(value, getInstReactivePowerA_m*_gainScale[ADE7953_CHANNEL_V]*_gainScale[ADE7953_CHANNEL_A], getInstReactivePowerA_b);
 return decimal;
   }
   
 float ADE7953::getInstReactivePowerB(){  
 	long value=0;  
 	value=spiAlgorithm32_read((functionBitVal(BVAR_32,1)),(functionBitVal(BVAR_32,0))); 
-	float decimal = decimalize(value, getInstReactivePowerB_m, getInstReactivePowerB_b);
+	float decimal = decimalize(value, getInstReactivePowerB_m*_gainScale[ADE7953_CHANNEL_V]*_gainScale[ADE7953_CHANNEL_B], getInstReactivePowerB_b);
 return decimal;
   }
   
@@ -694,239 +744,2349 @@ return decimal;
 //*******************************************************
 
 
-//****************ADE 7953 Library Control Functions**************************************
+//****************Power Quality Functions*****************
+//The ADE7953 compares every voltage/current sample against SAGLVL, OVLVL and OILVL and times the zero crossings against ZXTOUT on its own, so detection latency is set by the chip and only logging depends on how often servicePowerQuality() runs.
+//Levels are given in calibrated peak units, the units of getVrms()/getIrmsA() times 1.414 for a sine wave.  They are converted to waveform codes with ADE7953_PEAK_SCALE (see peakCounts()).
 
-//****************Object Definition*****************
-ADE7953::ADE7953(int SS, int SPI_freq)  //set SPI frequency and SS pin designation
-{
-  _SS=SS;
-  _SPI_freq=SPI_freq;
+void ADE7953::configurePowerQuality(float sagLevel, uint8_t sagHalfCycles, float ovLevel, float oiLevel, unsigned int zxTimeoutMs){
+  uint32_t irqena, irqenb;
+  unsigned long zxCounts;
+  
+  _pqLevel[0] = sagLevel;
+  _pqLevel[1] = ovLevel;
+  _pqLevel[2] = oiLevel;
+  _pqConfigured = true;
+  _zxTimeoutMs = zxTimeoutMs;
+  zxCounts = ((unsigned long)zxTimeoutMs*14000UL)/1000UL;  //ZXTOUT counts at 14 kHz (0.07 ms per LSB, 4.58 s at most)
+  if (zxCounts > 0xFFFF) {zxCounts = 0xFFFF;}
+  
+  writePQLevels();
+  spiAlgorithm8_write((functionBitVal(SAGCYC_8,1)),(functionBitVal(SAGCYC_8,0)),sagHalfCycles);
+  spiAlgorithm16_write((functionBitVal(ZXTOUT_16,1)),(functionBitVal(ZXTOUT_16,0)),functionBitVal(zxCounts,1),functionBitVal(zxCounts,0));
+  
+  //Arm the interrupts without disturbing any other enables
+  irqena = spiAlgorithm32_read((functionBitVal(IRQENA_32,1)),(functionBitVal(IRQENA_32,0)));
+  irqena |= ADE7953_IRQ_SAG | ADE7953_IRQ_OV | ADE7953_IRQ_OI | ADE7953_IRQ_ZXTO;
+  spiAlgorithm32_write((functionBitVal(IRQENA_32,1)),(functionBitVal(IRQENA_32,0)),functionBitVal(irqena,3),functionBitVal(irqena,2),functionBitVal(irqena,1),functionBitVal(irqena,0));
+  irqenb = spiAlgorithm32_read((functionBitVal(IRQENB_32,1)),(functionBitVal(IRQENB_32,0)));
+  irqenb |= ADE7953_IRQ_OI;
+  spiAlgorithm32_write((functionBitVal(IRQENB_32,1)),(functionBitVal(IRQENB_32,0)),functionBitVal(irqenb,3),functionBitVal(irqenb,2),functionBitVal(irqenb,1),functionBitVal(irqenb,0));
+  
+  busLock.lock();
+  readIrqStatus(irqena, irqenb);  //Clear anything that latched before the levels were in place
+  _irqLatchA = 0;
+  _irqLatchB = 0;
+  busLock.unlock();
+  _pqOpenMask = 0;
   }
-//**************************************************
 
-//****************Initialization********************
-void ADE7953::initialize(){
-    
-  #ifdef ADE7953_VERBOSE_DEBUG
-   Serial.print("ADE7953:initialize function started "); 
-  #endif
+void ADE7953::writePQLevels(){  //Converts the levels to register counts at the present PGA gains
+  _sagLevel = peakCounts(_pqLevel[0], ADE7953_CHANNEL_V);
+  _ovLevel = peakCounts(_pqLevel[1], ADE7953_CHANNEL_V);
+  _oiLevel = peakCounts(_pqLevel[2], ADE7953_CHANNEL_A);  //OILVL is shared by both current channels and follows the Channel A gain
+  spiAlgorithm32_write((functionBitVal(SAGLVL_32,1)),(functionBitVal(SAGLVL_32,0)),functionBitVal(_sagLevel,3),functionBitVal(_sagLevel,2),functionBitVal(_sagLevel,1),functionBitVal(_sagLevel,0));
+  spiAlgorithm32_write((functionBitVal(OVLVL_32,1)),(functionBitVal(OVLVL_32,0)),functionBitVal(_ovLevel,3),functionBitVal(_ovLevel,2),functionBitVal(_ovLevel,1),functionBitVal(_ovLevel,0));
+  spiAlgorithm32_write((functionBitVal(OILVL_32,1)),(functionBitVal(OILVL_32,0)),functionBitVal(_oiLevel,3),functionBitVal(_oiLevel,2),functionBitVal(_oiLevel,1),functionBitVal(_oiLevel,0));
+  }
 
-  spy = spiStartBus(VSPI, SPI_CLOCK_DIV16, SPI_MODE3, SPI_MSBFIRST);
-  spiAttachSCK(spy, -1);
-  spiAttachMOSI(spy, -1);
-  spiAttachMISO(spy, -1);
-  pinMode(_SS, OUTPUT);
-  digitalWrite(_SS, HIGH);
-  delay(50);
-  digitalWrite(_SS, LOW); //Enable data transfer by bringing SS line LOW
-  spiTransferByte(spy, 0x00);
-  spiTransferByte(spy, 0xFE);
-  spiTransferByte(spy, WRITE);
-  spiTransferByte(spy, 0x00);
-  spiTransferByte(spy, 0xAD);       
-  spiTransferByte(spy, 0x01);
-  spiTransferByte(spy, 0x20);
-  spiTransferByte(spy, WRITE);
-  spiTransferByte(spy, 0x00);
-  spiTransferByte(spy, 0x30);  
-  digitalWrite(_SS, HIGH); //Disable data transfer by bringing SS line HIGH
-  spiStopBus(spy);
+float ADE7953::peakUnits(uint32_t counts, uint8_t channel){  //Waveform/peak register codes -> calibrated peak units at the present PGA gain
+  float m = (channel == ADE7953_CHANNEL_V) ? getVrms_m : ((channel == ADE7953_CHANNEL_A) ? getIrmsA_m : getIrmsB_m);
+  return (float)counts*ADE7953_PEAK_SCALE/(m*_gainScale[channel]);
+  }
 
-  delay(100);
-  #ifdef ADE7953_VERBOSE_DEBUG
-   Serial.print(" ADE7953:initialize function completed "); 
-  #endif
-  
-  //Initial Start-up Init. Commands
-  //spiAlgorithm16_write((functionBitVal(PHCALA_16,1)),(functionBitVal(PHCALA_16,0)),0x00,0x00);
-  //delay(100);
-  spiAlgorithm32_write((functionBitVal(AP_NOLOAD_32,1)),(functionBitVal(AP_NOLOAD_32,0)),0x00,0x00,0x00,0x01); //Check for ensuring read and write operations are okay
-  delay(100);
-  spiAlgorithm8_write((functionBitVal(LCYCMODE_8,1)),(functionBitVal(LCYCMODE_8,0)),0b01111111); //Enable line cycle accumulation mode for all energies and channels
-  delay(100);
-  spiAlgorithm16_write((functionBitVal(LINECYC_16,1)),(functionBitVal(LINECYC_16,0)),0x00,0x78); //Sets number of half line cycle accumulations to 120
-  delay(100);
+uint32_t ADE7953::peakCounts(float level, uint8_t channel){  //Inverse of peakUnits(), clamped to the 24-bit level registers
+  float m = (channel == ADE7953_CHANNEL_V) ? getVrms_m : ((channel == ADE7953_CHANNEL_A) ? getIrmsA_m : getIrmsB_m);
+  float counts = level*m*_gainScale[channel]/ADE7953_PEAK_SCALE;
+  if (counts <= 0) {return 0;}
+  return (counts >= 0xFFFFFF) ? 0xFFFFFF : (uint32_t)counts;
+  }
 
-}
-//**************************************************
+void ADE7953::attachIRQ(int irqPin){  //Optional: with the IRQ line wired, servicePowerQuality() only touches the bus after the chip has asserted it
+  _irqPin = irqPin;
+  pinMode(_irqPin, INPUT_PULLUP);
+  attachInterruptArg(digitalPinToInterrupt(_irqPin), irqHandler, this, FALLING);  //IRQ is active low and stays low until the status is read with reset
+  }
 
-byte ADE7953::functionBitVal(int addr, uint8_t byteVal)
-{
-//Returns as integer an address of a specified byte - basically a byte controlled shift register with "byteVal" controlling the byte that is read and returned
-  int x = ((addr >> (8*byteVal)) & 0xff);
-  #ifdef ADE7953_VERBOSE_DEBUG
-   Serial.print("ADE7953::functionBitVal function details: ");
-   Serial.print("Address input (dec): ");  
-   Serial.print(addr, DEC);
-   Serial.print(" Byte requested (dec): ");  
-   Serial.print(byteVal, DEC);
-   Serial.print(" Returned Value (dec): ");
-   Serial.print(x, DEC);  
-   Serial.print(" Returned Value (HEX): ");
-   Serial.print(x, HEX); 
-   Serial.print(" ADE7953::functionBitVal function completed "); 
-  #endif
-  
-  return x;
-}
+void IRAM_ATTR ADE7953::irqHandler(void *arg){
+  ADE7953 *device = (ADE7953 *)arg;
+  if (!device->_irqPending) {
+    device->_irqTimestamp = millis();
+    device->_irqPending = true;
+    }
+  if (!device->_capIrqPending) {
+    device->_capIrqTime = micros();
+    device->_capIrqPending = true;
+    }
+  device->_schedIrqPending = true;
+  }
 
-uint8_t ADE7953::spiAlgorithm8_read(byte MSB, byte LSB) { //This is the algorithm that reads from a register in the ADE7953. The arguments are the MSB and LSB of the address of the register respectively. The values of the arguments are obtained from the list of functions above.
-  #ifdef ADE7953_VERBOSE_DEBUG
-   Serial.print("ADE7953::spiAlgorithm8_read function started "); 
-  #endif
-  uint8_t readval_unsigned = 0;  //This variable is the unsigned integer value to compile read bytes into (if needed)
-  byte one;
-  byte two; //This may be a dummy read, it looks like the ADE7953 is outputting an extra byte as a 16 bit response even for a 1 byte return
-  
-  spy = spiStartBus(VSPI, SPI_CLOCK_DIV16, SPI_MODE3, SPI_MSBFIRST);
-  spiAttachSCK(spy, -1);
-  spiAttachMOSI(spy, -1);
-  spiAttachMISO(spy, -1);
-  digitalWrite(_SS, LOW);
-  spiTransferByte(spy, MSB);
-  spiTransferByte(spy, LSB);  
-  spiTransferByte(spy, READ);    
-  one = spiTransferByte(spy, WRITE);
-  two = spiTransferByte(spy, WRITE);
-  digitalWrite(_SS, HIGH);
-  spiStopBus(spy);
-  
-  #ifdef ADE7953_VERBOSE_DEBUG
-   Serial.print("ADE7953::spiAlgorithm8_read function details: ");
-   Serial.print("Address Byte 1(MSB)[HEX]: ");  
-   Serial.print(MSB, HEX);
-   Serial.print(" Address Byte 2(LSB)[HEX]: ");  
-   Serial.print(LSB, HEX);
-   Serial.print(" Returned bytes (1(MSB) and 2 - 2nd is for 16-bit return form): ");
-   Serial.print(one, HEX);
-   Serial.print(" ");
-   Serial.print(two, HEX);
-   Serial.print(" ADE7953::spiAlgorithm8_read function completed "); 
-  #endif
+void ADE7953::readIrqStatus(uint32_t &statusA, uint32_t &statusB){  //Reads and clears both status registers, the bits are also kept for the service routines
+  beginBatch();  //The latches are shared by every service, they are only touched with the bus lock held
+  statusA = spiAlgorithm32_read((functionBitVal(RSTIRQSTATA_32,1)),(functionBitVal(RSTIRQSTATA_32,0)));
+  statusB = spiAlgorithm32_read((functionBitVal(RSTIRQSTATB_32,1)),(functionBitVal(RSTIRQSTATB_32,0)));
+  _irqLatchA |= statusA;
+  _irqLatchB |= statusB;
+  endBatch();
+  }
+
+void ADE7953::readResetPeaks(uint32_t &vPeak, uint32_t &iaPeak, uint32_t &ibPeak){  //Peaks since the previous call, the registers restart from zero on every read
+  beginBatch();
+  vPeak = spiAlgorithm32_read((functionBitVal(RSTVPEAK_32,1)),(functionBitVal(RSTVPEAK_32,0))) & 0xFFFFFF;
+  iaPeak = spiAlgorithm32_read((functionBitVal(RSTIAPEAK_32,1)),(functionBitVal(RSTIAPEAK_32,0))) & 0xFFFFFF;
+  ibPeak = spiAlgorithm32_read((functionBitVal(RSTIBPEAK_32,1)),(functionBitVal(RSTIBPEAK_32,0))) & 0xFFFFFF;
+  //Every reader shares the reset, so fold the values into the interval the peak tracker will report next (still under the bus lock)
+  if (vPeak > _intervalPeak[0]) {_intervalPeak[0] = vPeak;}
+  if (iaPeak > _intervalPeak[1]) {_intervalPeak[1] = iaPeak;}
+  if (ibPeak > _intervalPeak[2]) {_intervalPeak[2] = ibPeak;}
+  endBatch();
+  }
+
+void ADE7953::servicePowerQuality(){  //Call from loop(): collects new events from the chip and closes the ones that have ended
+  unsigned long stamp, now;
+  uint32_t statusA, statusB, vPeak, iaPeak, ibPeak, latchA, latchB;
+  float v, ia, ib;
   
-  //Post-read packing and bitshifting operation
-    readval_unsigned = one;  //Process MSB (nothing much to see here for only one 8 bit value)
+  if (_irqPin >= 0 && !_irqPending && _pqOpenMask == 0) {
+    return;  //IRQ line idle and nothing waiting to close: no bus traffic at all
+    }
+  stamp = _irqPending ? _irqTimestamp : millis();
+  _irqPending = false;  //Cleared before the status read so an edge raised during the read is not lost
+  beginBatch();
+  readIrqStatus(statusA, statusB);
+  readResetPeaks(vPeak, iaPeak, ibPeak);
+  latchA = _irqLatchA;  //Take the bits this service handles while the lock is held, the other bits stay for their owners
+  latchB = _irqLatchB;
+  _irqLatchA &= ~(ADE7953_IRQ_SAG | ADE7953_IRQ_OV | ADE7953_IRQ_OI | ADE7953_IRQ_ZXTO);
+  _irqLatchB &= ~ADE7953_IRQ_OI;
+  endBatch();
+  now = millis();
+  v = peakUnits(vPeak, ADE7953_CHANNEL_V);
+  ia = peakUnits(iaPeak, ADE7953_CHANNEL_A);
+  ib = peakUnits(ibPeak, ADE7953_CHANNEL_B);
   
-	return readval_unsigned;  //uint8_t versus long because it is only an 8 bit value, function returns uint8_t.
- }
+  //Update or close the events already in progress with the peaks seen since the last call
+  if (_pqOpenMask & (1 << ADE7953_PQ_SAG)) {
+    if (vPeak >= _sagLevel) {pqClose(ADE7953_PQ_SAG, now);}
+    else if (v < _pqOpen[ADE7953_PQ_SAG].peak) {_pqOpen[ADE7953_PQ_SAG].peak = v;}
+    }
+  if (_pqOpenMask & (1 << ADE7953_PQ_OV)) {
+    if (vPeak <= _ovLevel) {pqClose(ADE7953_PQ_OV, now);}
+    else if (v > _pqOpen[ADE7953_PQ_OV].peak) {_pqOpen[ADE7953_PQ_OV].peak = v;}
+    }
+  if (_pqOpenMask & (1 << ADE7953_PQ_OIA)) {
+    if (iaPeak <= _oiLevel) {pqClose(ADE7953_PQ_OIA, now);}
+    else if (ia > _pqOpen[ADE7953_PQ_OIA].peak) {_pqOpen[ADE7953_PQ_OIA].peak = ia;}
+    }
+  if (_pqOpenMask & (1 << ADE7953_PQ_OIB)) {
+    if (ibPeak <= _oiLevel) {pqClose(ADE7953_PQ_OIB, now);}
+    else if (ib > _pqOpen[ADE7953_PQ_OIB].peak) {_pqOpen[ADE7953_PQ_OIB].peak = ib;}
+    }
+  if (_pqOpenMask & (1 << ADE7953_PQ_ZXTO)) {
+    if (!(latchA & ADE7953_IRQ_ZXTO) && (now - _zxtoLastSeen) > 2*_zxTimeoutMs) {pqClose(ADE7953_PQ_ZXTO, now);}  //ZXTO re-asserts every timeout period while crossings are missing
+    }
   
+  //Open new events, the ADE7953 raises each of these once at the start of the condition
+  if (latchA & ADE7953_IRQ_SAG) {pqOpen(ADE7953_PQ_SAG, stamp, v);}  //The first peak may still include cycles before the sag, the next call refines it
+  if (latchA & ADE7953_IRQ_OV) {pqOpen(ADE7953_PQ_OV, stamp, v);}
+  if (latchA & ADE7953_IRQ_OI) {pqOpen(ADE7953_PQ_OIA, stamp, ia);}
+  if (latchB & ADE7953_IRQ_OI) {pqOpen(ADE7953_PQ_OIB, stamp, ib);}
+  if (latchA & ADE7953_IRQ_ZXTO) {
+    pqOpen(ADE7953_PQ_ZXTO, stamp, v);
+    _zxtoLastSeen = now;
+    }
+  }
 
-uint16_t ADE7953::spiAlgorithm16_read(byte MSB, byte LSB) { //This is the algorithm that reads from a register in the ADE7953. The arguments are the MSB and LSB of the address of the register respectively. The values of the arguments are obtained from the list of functions above.
-  #ifdef ADE7953_VERBOSE_DEBUG
-   Serial.print("ADE7953::spiAlgorithm16_read function started "); 
-  #endif
-  uint16_t readval_unsigned = 0;  //This variable is the unsigned integer value to compile read bytes into (if needed)
-  byte one;
-  byte two;
+void ADE7953::pqOpen(uint8_t type, unsigned long timestamp, float peak){
+  if (_pqOpenMask & (1 << type)) {
+    return;  //Already in progress, a repeated interrupt just extends it
+    }
+  _pqOpen[type].type = type;
+  _pqOpen[type].timestamp = timestamp;
+  _pqOpen[type].duration = 0;
+  _pqOpen[type].peak = peak;
+  _pqOpenMask |= (1 << type);
+  }
+
+void ADE7953::pqClose(uint8_t type, unsigned long now){
+  _pqOpen[type].duration = now - _pqOpen[type].timestamp;
+  _pqOpenMask &= ~(1 << type);
+  if (_pqCount == ADE7953_PQ_LOG_SIZE) {
+    _pqDropped++;  //Overwrite the oldest entry
+    }
+  else {
+    _pqCount++;
+    }
+  _pqLog[_pqHead] = _pqOpen[type];
+  _pqHead = (_pqHead + 1) % ADE7953_PQ_LOG_SIZE;
+  }
+
+uint8_t ADE7953::getPQActive(){  //Bit mask (1 << ADE7953_PQ_xxx) of the events currently in progress
+  return _pqOpenMask;
+  }
+
+uint8_t ADE7953::getPQEventCount(){
+  return _pqCount;
+  }
+
+bool ADE7953::getPQEvent(uint8_t index, ADE7953PQEvent &event){  //index 0 is the oldest completed event in the log
+  if (index >= _pqCount) {
+    return false;
+    }
+  event = _pqLog[(_pqHead + ADE7953_PQ_LOG_SIZE - _pqCount + index) % ADE7953_PQ_LOG_SIZE];
+  return true;
+  }
+
+unsigned long ADE7953::getPQEventsDropped(){
+  return _pqDropped;
+  }
+
+void ADE7953::clearPQEvents(){
+  _pqHead = 0;
+  _pqCount = 0;
+  _pqDropped = 0;
+  }
+
+//*******************************************************
+
+
+//****************Snapshot and Peak Tracking Functions*****************
+//readSnapshot() reads one reporting interval in a single bus session (no per-register spiStartBus/spiStopBus) and pushes the interval peaks from the read-with-reset peak registers into a short history.  VPEAK/IAPEAK/IBPEAK from getVpeak() etc. latch the all-time maximum instead.
+
+void ADE7953::readSnapshot(ADE7953Snapshot &snapshot){
+  uint32_t vPeak, iaPeak, ibPeak;
+  uint16_t period;
+  int16_t angleA, angleB;
   
-  spy = spiStartBus(VSPI, SPI_CLOCK_DIV16, SPI_MODE3, SPI_MSBFIRST);
-  spiAttachSCK(spy, -1);
-  spiAttachMOSI(spy, -1);
-  spiAttachMISO(spy, -1);
-  digitalWrite(_SS, LOW);
-  spiTransferByte(spy, MSB);
-  spiTransferByte(spy, LSB);  
-  spiTransferByte(spy, READ);    
-  one = spiTransferByte(spy, WRITE);
-  two = spiTransferByte(spy, WRITE);
-  digitalWrite(_SS, HIGH);
-  spiStopBus(spy);
+  beginBatch();
+  snapshot.timestamp = millis();
+  snapshot.vrms = getVrms();
+  snapshot.irmsA = getIrmsA();
+  snapshot.irmsB = getIrmsB();
+  snapshot.activePowerA = getSignedActivePowerA();
+  snapshot.activePowerB = getSignedActivePowerB();
+  snapshot.reactivePowerA = getInstReactivePowerA();
+  snapshot.reactivePowerB = getInstReactivePowerB();
+  snapshot.apparentPowerA = getInstApparentPowerA();
+  snapshot.apparentPowerB = getInstApparentPowerB();
+  snapshot.powerFactorA = getPowerFactorA();
+  snapshot.powerFactorB = getPowerFactorB();
+  period = spiAlgorithm16_read((functionBitVal(Period_16,1)),(functionBitVal(Period_16,0)));
+  angleA = spiAlgorithm16_read((functionBitVal(ANGLE_A_16,1)),(functionBitVal(ANGLE_A_16,0)));
+  angleB = spiAlgorithm16_read((functionBitVal(ANGLE_B_16,1)),(functionBitVal(ANGLE_B_16,0)));
+  readResetPeaks(vPeak, iaPeak, ibPeak);
+  endBatch();
   
-  #ifdef ADE7953_VERBOSE_DEBUG
-   Serial.print("ADE7953::spiAlgorithm16_read function details: ");
-   Serial.print("Address Byte 1(MSB)[HEX]: ");  
-   Serial.print(MSB, HEX);
-   Serial.print(" Address Byte 2(LSB)[HEX]: ");  
-   Serial.print(LSB, HEX);
-   Serial.print(" Returned bytes (1(MSB) and 2) [HEX]: ");
-   Serial.print(one, HEX);
-   Serial.print(" ");
-   Serial.print(two, HEX);
-   Serial.print(" ADE7953::spiAlgorithm16_read function completed "); 
-  #endif
-   
-   //Post-read packing and bitshifting operation
-   //readval_unsigned = (((uint32_t) one << 8) + ((uint32_t) two));  //(Alternate bitshift algorithm)
-   
-   readval_unsigned = (one << 8);  //Process MSB  (Alternate bitshift algorithm)
-   readval_unsigned = readval_unsigned + two;  //Process LSB
-			   
-			return readval_unsigned;	
-    }
+  busLock.lock();  //The frequency window and the interval peaks are shared with the scheduler
+  snapshot.period = decimalize(period, getPeriod_m, getPeriod_b);
+  snapshot.frequency = periodToHz(period);
+  snapshot.phaseAngleA = angleToDegrees(angleA, period);
+  snapshot.phaseAngleB = angleToDegrees(angleB, period);
+  addFrequencySample(period, snapshot.timestamp);
   
+  snapshot.peaks.vpeak = peakUnits(_intervalPeak[0], ADE7953_CHANNEL_V);  //Waveform codes rescaled to the RMS register scale, so peak/RMS is the crest factor
+  snapshot.peaks.ipeakA = peakUnits(_intervalPeak[1], ADE7953_CHANNEL_A);
+  snapshot.peaks.ipeakB = peakUnits(_intervalPeak[2], ADE7953_CHANNEL_B);
+  snapshot.flags = 0;
+  if ((long)(snapshot.timestamp - _rangeSettleUntil) < 0) {
+    snapshot.flags |= ADE7953_SNAPSHOT_RANGING;  //A PGA gain changed recently, the filtered RMS/power registers are still settling
+    }
+  _peakHistory[_peakHistoryHead] = snapshot.peaks;  //Kept in calibrated units so a later gain change does not rescale old intervals
+  _peakHistoryHead = (_peakHistoryHead + 1) % ADE7953_PEAK_HISTORY;
+  if (_peakHistoryCount < ADE7953_PEAK_HISTORY) {_peakHistoryCount++;}
+  _lastIntervalPeak[0] = _intervalPeak[0];
+  _lastIntervalPeak[1] = _intervalPeak[1];
+  _lastIntervalPeak[2] = _intervalPeak[2];
+  _intervalPeak[0] = 0;
+  _intervalPeak[1] = 0;
+  _intervalPeak[2] = 0;
+  busLock.unlock();
+  }
 
+uint8_t ADE7953::getPeakHistoryCount(){
+  return _peakHistoryCount;
+  }
 
-uint32_t ADE7953::spiAlgorithm24_read(byte MSB, byte LSB) { //This is the algorithm that reads from a register in the ADE7953. The arguments are the MSB and LSB of the address of the register respectively. The values of the arguments are obtained from the list of functions above.
-  #ifdef ADE7953_VERBOSE_DEBUG
-   Serial.print("ADE7953::spiAlgorithm24_read function started "); 
-  #endif 
-  //long readval_signed=0;
-  uint32_t readval_unsigned = 0;  //This variable is the unsigned integer value to compile read bytes into (if needed)
-  byte one;
-  byte two;
-  byte three;
-  
-  spy = spiStartBus(VSPI, SPI_CLOCK_DIV16, SPI_MODE3, SPI_MSBFIRST);
-  spiAttachSCK(spy, -1);
-  spiAttachMOSI(spy, -1);
-  spiAttachMISO(spy, -1);
-  digitalWrite(_SS, LOW);
-  spiTransferByte(spy, MSB);
-  spiTransferByte(spy, LSB);  
-  spiTransferByte(spy, READ);    
-  one = spiTransferByte(spy, WRITE);
-  two = spiTransferByte(spy, WRITE);
-  three = spiTransferByte(spy, WRITE);
-  digitalWrite(_SS, HIGH);
-  spiStopBus(spy);
+bool ADE7953::getPeakHistory(uint8_t index, ADE7953Peaks &peaks){  //index 0 is the most recent snapshot interval
+  if (index >= _peakHistoryCount) {
+    return false;
+    }
+  peaks = _peakHistory[(_peakHistoryHead + ADE7953_PEAK_HISTORY - 1 - index) % ADE7953_PEAK_HISTORY];
+  return true;
+  }
 
-   
- #ifdef ADE7953_VERBOSE_DEBUG
-   Serial.print("ADE7953::spiAlgorithm24_read function details: ");
-   Serial.print("Address Byte 1(MSB)[HEX]: ");  
-   Serial.print(MSB, HEX);
-   Serial.print(" Address Byte 2(LSB)[HEX]: ");  
-   Serial.print(LSB, HEX);
-   Serial.print(" Returned bytes (1(MSB) to 3)[HEX]: ");
-   Serial.print(one, HEX);
-   Serial.print(" ");
-   Serial.print(two, HEX);
-   Serial.print(" ");
-   Serial.print(three, HEX);
-   Serial.print(" ADE7953::spiAlgorithm24_read function completed "); 
-  #endif
+void ADE7953::getRollingPeaks(ADE7953Peaks &peaks){  //Highest peaks over all intervals in the history
+  peaks.vpeak = 0;
+  peaks.ipeakA = 0;
+  peaks.ipeakB = 0;
+  for (uint8_t i = 0; i < _peakHistoryCount; i++) {
+    if (_peakHistory[i].vpeak > peaks.vpeak) {peaks.vpeak = _peakHistory[i].vpeak;}
+    if (_peakHistory[i].ipeakA > peaks.ipeakA) {peaks.ipeakA = _peakHistory[i].ipeakA;}
+    if (_peakHistory[i].ipeakB > peaks.ipeakB) {peaks.ipeakB = _peakHistory[i].ipeakB;}
+    }
+  }
 
-  //Post-read packing and bitshifting operation
-  readval_unsigned = (((uint32_t) one << 16)+ ((uint32_t) two << 8) + ((uint32_t) three)); //(Alternative shift algorithm)
-   
-			return readval_unsigned;
+float ADE7953::snapshotField(const ADE7953Snapshot &snapshot, uint8_t field){  //field: ADE7953_FIELD_xxx (see ADE7953Deadband.h)
+  switch (field) {
+    case ADE7953_FIELD_VRMS: return snapshot.vrms;
+    case ADE7953_FIELD_IRMSA: return snapshot.irmsA;
+    case ADE7953_FIELD_IRMSB: return snapshot.irmsB;
+    case ADE7953_FIELD_ACTIVEA: return snapshot.activePowerA;
+    case ADE7953_FIELD_ACTIVEB: return snapshot.activePowerB;
+    case ADE7953_FIELD_REACTIVEA: return snapshot.reactivePowerA;
+    case ADE7953_FIELD_REACTIVEB: return snapshot.reactivePowerB;
+    case ADE7953_FIELD_APPARENTA: return snapshot.apparentPowerA;
+    case ADE7953_FIELD_APPARENTB: return snapshot.apparentPowerB;
+    case ADE7953_FIELD_PFA: return snapshot.powerFactorA;
+    case ADE7953_FIELD_PFB: return snapshot.powerFactorB;
+    case ADE7953_FIELD_PERIOD: return snapshot.period;
+    case ADE7953_FIELD_FREQUENCY: return snapshot.frequency;
+    case ADE7953_FIELD_ANGLEA: return snapshot.phaseAngleA;
+    case ADE7953_FIELD_ANGLEB: return snapshot.phaseAngleB;
+    }
+  return 0;
   }
-  
 
-uint32_t ADE7953::spiAlgorithm32_read(byte MSB, byte LSB) { //This is the algorithm that reads from a 32 bit register in the ADE7953. The arguments are the MSB and LSB of the address of the register respectively. The values of the arguments are obtained from the list of functions above.  Caution, some register elements contain information that is only 24 bit with padding on the MSB
-  #ifdef ADE7953_VERBOSE_DEBUG
-   Serial.print("ADE7953::spiAlgorithm32_read function started "); 
-  #endif 
-  uint32_t readval_unsigned = 0;  //This variable is the unsigned integer value to compile read bytes into (if needed)
-  byte one;
-  byte two;
-  byte three;
-  byte four;
+void ADE7953::snapshotValues(const ADE7953Snapshot &snapshot, float *values){  //values[ADE7953_FIELDS], the layout ADE7953Deadband::update() takes
+  for (uint8_t f = 0; f < ADE7953_FIELDS; f++) {
+    values[f] = snapshotField(snapshot, f);
+    }
+  }
 
-  spy = spiStartBus(VSPI, SPI_CLOCK_DIV16, SPI_MODE3, SPI_MSBFIRST);
-  spiAttachSCK(spy, -1);
-  spiAttachMOSI(spy, -1);
-  spiAttachMISO(spy, -1);
-  digitalWrite(_SS, LOW);
-  spiTransferByte(spy, MSB);
-  spiTransferByte(spy, LSB);  
-  spiTransferByte(spy, READ);    
-  one = spiTransferByte(spy, WRITE);
-  two = spiTransferByte(spy, WRITE);
-  three = spiTransferByte(spy, WRITE);
+float ADE7953::telemetryResolution(uint8_t field){  //Counts per unit that keep one register LSB per telemetry count at PGA gain 1, give the same to the encoder and decoder
+  switch (field) {
+    case ADE7953_FIELD_VRMS: return getVrms_m;
+    case ADE7953_FIELD_IRMSA: return getIrmsA_m;
+    case ADE7953_FIELD_IRMSB: return getIrmsB_m;
+    case ADE7953_FIELD_ACTIVEA: return getInstActivePowerA_m;
+    case ADE7953_FIELD_ACTIVEB: return getInstActivePowerB_m;
+    case ADE7953_FIELD_REACTIVEA: return getInstReactivePowerA_m;
+    case ADE7953_FIELD_REACTIVEB: return getInstReactivePowerB_m;
+    case ADE7953_FIELD_APPARENTA: return getInstApparentPowerA_m;
+    case ADE7953_FIELD_APPARENTB: return getInstApparentPowerB_m;
+    }
+  return ADE7953TelemetryEncoder::defaultResolution(field);
+  }
+
+//*******************************************************
+
+
+//****************PGA Gain Ranging Functions*****************
+//Raising the analog gain lifts small loads off the noise floor.  The calibration gains above are for PGA gain 1, every reported value is divided by the active gain so readings stay continuous across a range change.
+
+void ADE7953::setPGAGain(uint8_t channel, uint8_t gainCode){  //channel: ADE7953_CHANNEL_V, ADE7953_CHANNEL_A or ADE7953_CHANNEL_B
+  uint8_t maxCode = (channel == ADE7953_CHANNEL_A) ? 5 : 4;
+  int addr = (channel == ADE7953_CHANNEL_V) ? PGA_V_8 : ((channel == ADE7953_CHANNEL_A) ? PGA_IA_8 : PGA_IB_8);
+  if (channel > ADE7953_CHANNEL_B) {
+    return;
+    }
+  if (gainCode > maxCode) {gainCode = maxCode;}
+  float ratio = (float)ADE7953AutoRange::gain(gainCode)/_gainScale[channel];
+  if (ratio != 1.0) {
+    accumulateEnergy();  //The energy registers hold energy at the old gain, take it into the totals before it is scaled by the new one
+    rescaleCF(channel, ratio);
+    }
+  spiAlgorithm8_write((functionBitVal(addr,1)),(functionBitVal(addr,0)),gainCode);
+  _pgaCode[channel] = gainCode;
+  _gainScale[channel] = ADE7953AutoRange::gain(gainCode);
+  _rangeSettleUntil = millis() + ADE7953_RANGE_SETTLE_MS;
+  if (_pqConfigured) {
+    writePQLevels();  //Keep the sag/overvoltage/overcurrent levels at the same engineering value
+    }
+  writeCaptureLevel(channel);
+  }
+
+uint8_t ADE7953::getPGAGain(uint8_t channel){
+  return (channel <= ADE7953_CHANNEL_B) ? _pgaCode[channel] : 0;
+  }
+
+void ADE7953::enableAutoRange(uint8_t channelMask){  //Bit mask of (1 << ADE7953_CHANNEL_x) to be ranged by serviceAutoRange()
+  _autoRangeMask = channelMask;
+  _rangeHold[0] = 0;
+  _rangeHold[1] = 0;
+  _rangeHold[2] = 0;
+  }
+
+bool ADE7953::serviceAutoRange(){  //Call after readSnapshot(), uses that interval's peaks.  Returns true when a gain was changed
+  bool changed = false;
+  for (uint8_t ch = 0; ch <= ADE7953_CHANNEL_B; ch++) {
+    if (!(_autoRangeMask & (1 << ch))) {continue;}
+    uint8_t maxCode = (ch == ADE7953_CHANNEL_A) ? 5 : 4;
+    uint8_t code = autoRangeStep(_pgaCode[ch], maxCode, _lastIntervalPeak[ch], _rangeHold[ch]);
+    if (code != _pgaCode[ch]) {
+      setPGAGain(ch, code);
+      changed = true;
+      }
+    }
+  return changed;
+  }
+
+uint8_t ADE7953::autoRangeStep(uint8_t gainCode, uint8_t maxCode, uint32_t peakCounts, uint8_t &holdCount){  //Pure decision step, kept static so the ranging can be exercised without hardware
+  return ADE7953AutoRange::step(gainCode, maxCode, peakCounts, holdCount);
+  }
+
+//*******************************************************
+
+
+//****************Register Calibration Functions*****************
+//Reference points are taken against a known source/load, solved by least squares (ADE7953Calibration) and written into the chip's own gain and offset registers, so the correction costs nothing at run time.  The #define gains above stay in place as the unit conversion: the solved registers make the raw reading equal reference x gain.
+
+static const int calRawReg[ADE7953_CAL_QUANTITIES] = {VRMS_32, IRMSA_32, IRMSB_32, AWATT_32, BWATT_32};
+static const int calGainReg[ADE7953_CAL_QUANTITIES] = {AVGAIN_32, AIGAIN_32, BIGAIN_32, AWGAIN_32, BWGAIN_32};
+static const int calOffsetReg[ADE7953_CAL_QUANTITIES] = {VRMSOS_32, AIRMSOS_32, BIRMSOS_32, AWATTOS_32, BWATTOS_32};
+
+bool ADE7953::addCalibrationPoint(ADE7953Calibration &calibration, uint8_t quantity, float reference, uint8_t samples){  //Averages "samples" readings of the quantity while the reference is applied
+  double sum = 0, scale;
+  if (quantity >= ADE7953_CAL_QUANTITIES || samples == 0) {
+    return false;
+    }
+  for (uint8_t i = 0; i < samples; i++) {
+    long value = spiAlgorithm32_read((functionBitVal(calRawReg[quantity],1)),(functionBitVal(calRawReg[quantity],0)));
+    sum += (quantity >= ADE7953_CAL_WATTA) ? (double)value : (double)(uint32_t)value;  //Power registers are signed, RMS registers unsigned
+    delay(50);  //Spread the samples over several line cycles of the RMS/power filters
+    }
+  switch (quantity) {
+    case ADE7953_CAL_VRMS: scale = getVrms_m*_gainScale[ADE7953_CHANNEL_V]; break;
+    case ADE7953_CAL_IRMSA: scale = getIrmsA_m*_gainScale[ADE7953_CHANNEL_A]; break;
+    case ADE7953_CAL_IRMSB: scale = getIrmsB_m*_gainScale[ADE7953_CHANNEL_B]; break;
+    case ADE7953_CAL_WATTA: scale = getInstActivePowerA_m*_gainScale[ADE7953_CHANNEL_V]*_gainScale[ADE7953_CHANNEL_A]; break;
+    default: scale = getInstActivePowerB_m*_gainScale[ADE7953_CHANNEL_V]*_gainScale[ADE7953_CHANNEL_B]; break;
+    }
+  return calibration.addPoint(quantity, sum/samples, (double)reference*scale);
+  }
+
+uint8_t ADE7953::applyCalibration(ADE7953Calibration &calibration){  //Solves every quantity that has points and writes its registers, returns a bit mask (1 << ADE7953_CAL_xxx) of those written
+  //A gain outside 0x200000..0x600000 leaves both registers of that quantity as they were, calibration.getRejected() has its bit
+  ADE7953CalRegisters present[ADE7953_CAL_QUANTITIES], updated[ADE7953_CAL_QUANTITIES];
+  ADE7953CalFit fits[ADE7953_CAL_QUANTITIES];
+  uint8_t solved;
+  
+  for (uint8_t q = 0; q < ADE7953_CAL_QUANTITIES; q++) {
+    readCalibrationRegisters(q, present[q]);
+    }
+  solved = calibration.solveAll(present, updated, fits);
+  for (uint8_t q = 0; q < ADE7953_CAL_QUANTITIES; q++) {
+    if (solved & (1 << q)) {
+      writeCalibrationRegisters(q, updated[q]);
+      }
+    }
+  #ifdef ADE7953_VERBOSE_DEBUG
+  if (calibration.getRejected()) {
+   Serial.print("ADE7953::applyCalibration gain out of range, not written (mask): ");
+   Serial.println(calibration.getRejected(), HEX);
+   }
+  #endif
+  return solved;
+  }
+
+void ADE7953::readCalibrationRegisters(uint8_t quantity, ADE7953CalRegisters &registers){
+  uint32_t offset;
+  if (quantity >= ADE7953_CAL_QUANTITIES) {
+    return;
+    }
+  registers.gain = spiAlgorithm32_read((functionBitVal(calGainReg[quantity],1)),(functionBitVal(calGainReg[quantity],0))) & 0xFFFFFF;
+  offset = spiAlgorithm32_read((functionBitVal(calOffsetReg[quantity],1)),(functionBitVal(calOffsetReg[quantity],0))) & 0xFFFFFF;
+  registers.offset = (offset & 0x800000) ? (int32_t)(offset | 0xFF000000) : (int32_t)offset;  //Sign extend the 24-bit value
+  }
+
+void ADE7953::writeCalibrationRegisters(uint8_t quantity, const ADE7953CalRegisters &registers){
+  uint32_t gain = registers.gain;
+  uint32_t offset = (uint32_t)registers.offset;
+  if (quantity >= ADE7953_CAL_QUANTITIES) {
+    return;
+    }
+  spiAlgorithm32_write((functionBitVal(calGainReg[quantity],1)),(functionBitVal(calGainReg[quantity],0)),functionBitVal(gain,3),functionBitVal(gain,2),functionBitVal(gain,1),functionBitVal(gain,0));
+  spiAlgorithm32_write((functionBitVal(calOffsetReg[quantity],1)),(functionBitVal(calOffsetReg[quantity],0)),functionBitVal(offset,3),functionBitVal(offset,2),functionBitVal(offset,1),functionBitVal(offset,0));
+  _derivedScale[0] = 0;  //VRMS/IRMS and AVA have separate gains, learn the apparent power scale again
+  _derivedScale[1] = 0;
+  }
+
+bool ADE7953::waitForIrq(uint32_t bitsA, unsigned long timeoutMs){  //Polls the status (through the shared latch, so other services keep their bits) until one of bitsA is seen
+  uint32_t statusA, statusB;
+  unsigned long start = millis();
+  do {
+    busLock.lock();
+    readIrqStatus(statusA, statusB);
+    bool seen = (_irqLatchA & bitsA) != 0;
+    _irqLatchA &= ~bitsA;
+    busLock.unlock();
+    if (seen) {
+      return true;
+      }
+    delay(5);
+    } while (millis() - start < timeoutMs);
+  return false;
+  }
+
+bool ADE7953::measureLineCycleAngle(uint8_t channel, float &angleDeg){  //Angle of the energy accumulated over one LINECYC window (set up by initialize())
+  uint8_t ch = (channel == ADE7953_CHANNEL_B) ? 1 : 0;
+  long active[2], reactive[2];
+  
+  //The energy registers reset on read, so both windows go through accumulateEnergy() and stay in the totals.
+  //The first window may have started before a PHCAL change, its angle is thrown away.
+  if (!waitForIrq(ADE7953_IRQ_CYCEND, 3000)) {return false;}
+  accumulateEnergy(active, reactive);
+  if (!waitForIrq(ADE7953_IRQ_CYCEND, 3000)) {return false;}
+  accumulateEnergy(active, reactive);
+  if (active[ch] == 0 && reactive[ch] == 0) {return false;}  //No load on the channel
+  angleDeg = atan2((double)reactive[ch], (double)active[ch])*180.0/M_PI;
+  return true;
+  }
+
+struct PhaseCalContext {
+  ADE7953 *device;
+  uint8_t channel;
+  int addr;        //PHCALA_16 or PHCALB_16
+  int16_t written; //Value in the register now
+};
+
+bool ADE7953::phaseCalWindow(void *context, int16_t phcal, double &angleDeg){  //ADE7953PhaseWindow for ADE7953Calibration::calibratePhase()
+  PhaseCalContext *cal = (PhaseCalContext *)context;
+  ADE7953 *d = cal->device;
+  float angle;
+  if (phcal != cal->written) {
+    uint16_t reg = ADE7953Calibration::phcalEncode(phcal);
+    d->spiAlgorithm16_write((d->functionBitVal(cal->addr,1)),(d->functionBitVal(cal->addr,0)),d->functionBitVal(reg,1),d->functionBitVal(reg,0));
+    cal->written = phcal;
+    }
+  if (!d->measureLineCycleAngle(cal->channel, angle)) {return false;}
+  angleDeg = angle;
+  return true;
+  }
+
+bool ADE7953::calibratePhase(uint8_t channel, float referencePF, bool lagging, uint8_t maxIterations, float toleranceDeg, ADE7953PhaseCalResult &result){
+  //Run with a reference load of known power factor (a low PF such as 0.5 lagging makes the error easiest to see).
+  //The iteration itself is ADE7953Calibration::calibratePhase(), which extras/ade7953phcal runs against a simulated chip.
+  PhaseCalContext cal;
+  cal.device = this;
+  cal.channel = channel;
+  cal.addr = (channel == ADE7953_CHANNEL_B) ? PHCALB_16 : PHCALA_16;
+  cal.written = ADE7953Calibration::phcalDecode(spiAlgorithm16_read((functionBitVal(cal.addr,1)),(functionBitVal(cal.addr,0))));
+  double lsbDeg = ADE7953Calibration::phcalDegreesPerLsb(periodToHz(spiAlgorithm16_read((functionBitVal(Period_16,1)),(functionBitVal(Period_16,0)))));
+  return ADE7953Calibration::calibratePhase(phaseCalWindow, &cal, cal.written, lsbDeg, ADE7953Calibration::referenceAngleDegrees(referencePF, lagging), maxIterations, toleranceDeg, result);
+  }
+
+//*******************************************************
+
+
+//****************Bidirectional Energy Functions*****************
+//accumulateEnergy() empties the read-with-reset energy registers of both channels together with ACCMODE in one bus session and adds them into 64-bit import/export and four-quadrant totals.  Call it at least once per energy register half-full period (AEHF interrupt) so nothing overflows between calls.
+//Quadrants follow the usual metering convention: Q1 import/lagging, Q2 export/lagging, Q3 export/leading, Q4 import/leading.
+
+#define ACCMODE_APSIGN_A (1UL << 10)
+#define ACCMODE_APSIGN_B (1UL << 11)
+#define ACCMODE_VARSIGN_A (1UL << 12)
+#define ACCMODE_VARSIGN_B (1UL << 13)
+
+static uint64_t energyMicroUnits(long counts, float countsPerUnit){  //Magnitude of an energy register delta in micro Wh/varh/VAh
+  double units = (counts < 0 ? -(double)counts : (double)counts)*1e6/countsPerUnit;
+  return (uint64_t)(units + 0.5);
+  }
+
+void ADE7953::accumulateEnergy(){
+  long active[2], reactive[2];
+  accumulateEnergy(active, reactive);
+  }
+
+void ADE7953::accumulateEnergy(long *active, long *reactive){  //Every read of the energy registers goes through here, the deltas are also returned for measureLineCycleAngle()
+  long apparent[2];
+  uint32_t accmode;
+  
+  beginBatch();  //Held until the totals are updated, so two tasks accumulating cannot lose each other's deltas
+  active[0] = (int32_t)spiAlgorithm32_read((functionBitVal(AENERGYA_32,1)),(functionBitVal(AENERGYA_32,0)));
+  reactive[0] = (int32_t)spiAlgorithm32_read((functionBitVal(RENERGYA_32,1)),(functionBitVal(RENERGYA_32,0)));
+  apparent[0] = (int32_t)spiAlgorithm32_read((functionBitVal(APENERGYA_32,1)),(functionBitVal(APENERGYA_32,0)));
+  active[1] = (int32_t)spiAlgorithm32_read((functionBitVal(AENERGYB_32,1)),(functionBitVal(AENERGYB_32,0)));
+  reactive[1] = (int32_t)spiAlgorithm32_read((functionBitVal(RENERGYB_32,1)),(functionBitVal(RENERGYB_32,0)));
+  apparent[1] = (int32_t)spiAlgorithm32_read((functionBitVal(APENERGYB_32,1)),(functionBitVal(APENERGYB_32,0)));
+  accmode = spiAlgorithm32_read((functionBitVal(ACCMODE_32,1)),(functionBitVal(ACCMODE_32,0)));
+  
+  uint64_t units[2][3];  //Active, reactive, apparent magnitudes per channel, also used by the CF cross-check
+  for (uint8_t ch = 0; ch < 2; ch++) {
+    ADE7953EnergyTotals &totals = _energyTotals[ch];
+    float vi = _gainScale[ADE7953_CHANNEL_V]*_gainScale[ch == 0 ? ADE7953_CHANNEL_A : ADE7953_CHANNEL_B];
+    //The energy deltas carry their own sign, the ACCMODE sign bits only decide the direction of an interval with no active energy
+    bool exporting = (active[ch] != 0) ? (active[ch] < 0) : ((accmode & (ch == 0 ? ACCMODE_APSIGN_A : ACCMODE_APSIGN_B)) != 0);
+    bool leading = (reactive[ch] != 0) ? (reactive[ch] < 0) : ((accmode & (ch == 0 ? ACCMODE_VARSIGN_A : ACCMODE_VARSIGN_B)) != 0);
+    units[ch][0] = energyMicroUnits(active[ch], (ch == 0 ? getActiveEnergyA_m : getActiveEnergyB_m)*vi);
+    units[ch][1] = energyMicroUnits(reactive[ch], (ch == 0 ? getReactiveEnergyA_m : getReactiveEnergyB_m)*vi);
+    units[ch][2] = energyMicroUnits(apparent[ch], (ch == 0 ? getApparentEnergyA_m : getApparentEnergyB_m)*vi);
+    
+    if (exporting) {totals.activeExport += units[ch][0];}
+    else {totals.activeImport += units[ch][0];}
+    totals.reactive[exporting ? (leading ? 2 : 1) : (leading ? 3 : 0)] += units[ch][1];
+    totals.apparent += units[ch][2];
+    }
+  _energySigns = (uint8_t)((accmode >> 10) & 0x0F);
+  
+  for (uint8_t o = 0; o < 2; o++) {  //Compare the pulses counted over the same interval with the register energy of the CF source
+    if (_cfUnit[o] < 0) {continue;}
+    uint64_t pulses = getCFPulses(o + 1);
+    uint8_t source = _cfSource[o];
+    if (_cfCheckPrimed[o] && source != ADE7953_CF_IRMS_A && source != ADE7953_CF_IRMS_B && source != ADE7953_CF_IRMS_AB) {
+      _cfCheckCf[o] += (double)(pulses - _cfCheckPulses[o])*1e6/_cfPulsesPerUnit[o];
+      _cfCheckReg[o] += (source == ADE7953_CF_ACTIVE_AB) ? (double)(units[0][0] + units[1][0]) : (double)units[source >> 2][source & 0x03];
+      }
+    _cfCheckPulses[o] = pulses;
+    _cfCheckPrimed[o] = true;  //The first interval started before the counter did
+    }
+  endBatch();
+  }
+
+void ADE7953::getEnergyTotals(uint8_t channel, ADE7953EnergyTotals &totals){  //channel: ADE7953_CHANNEL_A or ADE7953_CHANNEL_B
+  busLock.lock();  //A copy taken half way through accumulateEnergy() would mix two intervals
+  totals = _energyTotals[channel == ADE7953_CHANNEL_B ? 1 : 0];
+  busLock.unlock();
+  }
+
+void ADE7953::setEnergyTotals(uint8_t channel, const ADE7953EnergyTotals &totals){  //Restore totals kept in non-volatile storage after a reset
+  busLock.lock();
+  _energyTotals[channel == ADE7953_CHANNEL_B ? 1 : 0] = totals;
+  busLock.unlock();
+  }
+
+uint8_t ADE7953::getEnergySigns(){  //ACCMODE bits 13:10 (VARSIGN_B, VARSIGN_A, APSIGN_B, APSIGN_A) from the last accumulateEnergy(), 1 = negative
+  return _energySigns;
+  }
+
+//Checkpointing: the chip's energy registers restart from zero on every read and on reset, so the totals only survive a
+//watchdog reboot through flash.  Call restoreEnergy() once after initialize() and checkpointEnergy() after each
+//accumulateEnergy(); the checkpoint's policy decides when a write is actually due.
+
+uint64_t ADE7953::energyMoved(){  //Caller holds the bus lock
+  return _energyTotals[0].activeImport + _energyTotals[0].activeExport + _energyTotals[1].activeImport + _energyTotals[1].activeExport;
+  }
+
+bool ADE7953::restoreEnergy(ADE7953Checkpoint &checkpoint){  //false when no checkpoint was found, the totals are left as they are
+  ADE7953EnergyTotals totals[2];
+  if (!checkpoint.restore(totals, sizeof(totals))) {
+    return false;
+    }
+  busLock.lock();
+  memcpy(_energyTotals, totals, sizeof(_energyTotals));
+  _energyCheckpointed = energyMoved();
+  busLock.unlock();
+  return true;
+  }
+
+bool ADE7953::checkpointEnergy(ADE7953Checkpoint &checkpoint){  //Returns true when a record was written
+  ADE7953EnergyTotals totals[2];
+  busLock.lock();  //Copied under the lock, the flash write itself does not hold up the bus
+  memcpy(totals, _energyTotals, sizeof(totals));
+  uint64_t moved = energyMoved();
+  uint64_t since = moved - _energyCheckpointed;
+  busLock.unlock();
+  if (!checkpoint.update(millis(), since, totals, sizeof(totals))) {
+    return false;
+    }
+  busLock.lock();
+  _energyCheckpointed = moved;
+  busLock.unlock();
+  return true;
+  }
+
+//*******************************************************
+
+
+//****************Line Frequency Functions*****************
+//The Period register is refreshed every line cycle and counts at 223.75 kHz, about 11 mHz per LSB at 50 Hz.  serviceFrequency() (or readSnapshot(), which
+//reads Period in its own batch) feeds each reading into an averaging window; the window mean is cycles/time, i.e. samples divided by the summed periods,
+//which resolves below one LSB once several cycles are averaged.  Call it every 20-100 ms for a 10 Hz output with the default 100 ms window.
+
+float ADE7953::periodToHz(uint16_t period){
+  return (float)ADE7953_PERIOD_CLOCK/((float)period + 1.0);
+  }
+
+float ADE7953::angleToDegrees(int16_t angle, uint16_t period){  //ANGLE_x is a time delay in the same 223.75 kHz counts as one line period (Period + 1)
+  return (float)angle*360.0/((float)period + 1.0);
+  }
+
+void ADE7953::setFrequencyWindow(unsigned int windowMs){  //0 reports every reading on its own
+  _freqWindowMs = windowMs;
+  _freqStarted = false;
+  _freqCycles = 0;
+  _freqSamples = 0;
+  _freqValid = false;
+  }
+
+bool ADE7953::serviceFrequency(){  //Returns true when an averaging window completed with this reading
+  uint16_t period;
+  
+  busLock.lock();  //The window is shared with readSnapshot() and the scheduler
+  period = spiAlgorithm16_read((functionBitVal(Period_16,1)),(functionBitVal(Period_16,0)));
+  bool completed = addFrequencySample(period, millis());
+  busLock.unlock();
+  return completed;
+  }
+
+bool ADE7953::getFrequencyAverage(ADE7953Frequency &average){  //false until the first window has completed
+  if (!_freqValid) {
+    return false;
+    }
+  average = _freqAverage;
+  return true;
+  }
+
+bool ADE7953::addFrequencySample(uint16_t period, unsigned long now){  //Each reading stands for the time since the one before it, so the mean does not depend on the polling rate
+  uint32_t milliHz = (uint32_t)(((uint64_t)ADE7953_PERIOD_CLOCK*1000 + ((uint32_t)period + 1)/2)/((uint32_t)period + 1));
+  if (!_freqStarted) {
+    _freqWindowStart = now;
+    _freqLast = now;
+    _freqStarted = true;
+    }
+  _freqCycles += (uint64_t)milliHz*(now - _freqLast);  //A burst of reads inside one line cycle repeats the same Period but adds no time
+  _freqLast = now;
+  if (_freqSamples < 0xFFFF) {
+    _freqSamples++;
+    }
+  if ((now - _freqWindowStart) < _freqWindowMs) {
+    return false;
+    }
+  
+  if (now != _freqWindowStart) {
+    milliHz = (uint32_t)((_freqCycles + (now - _freqWindowStart)/2)/(now - _freqWindowStart));
+    }
+  if (_freqValid && now != _freqAverage.timestamp) {
+    _freqAverage.rocof = (int32_t)(((int64_t)milliHz - (int64_t)_freqAverage.milliHz)*1000/(long)(now - _freqAverage.timestamp));
+    }
+  else {
+    _freqAverage.rocof = 0;
+    }
+  _freqAverage.milliHz = milliHz;
+  _freqAverage.samples = _freqSamples;
+  _freqAverage.timestamp = now;
+  _freqValid = true;
+  _freqWindowStart = now;  //The next window starts where this one ended so the output rate follows the window, not the polling phase
+  _freqCycles = 0;
+  _freqSamples = 0;
+  return true;
+  }
+
+//*******************************************************
+
+
+//****************Zero Crossing Functions*****************
+//With ZX_ALT = 0000 the ZX pin (Pin 1) follows the polarity of the voltage channel, so every edge is a zero crossing.  The pin interrupt only stores micros()
+//and the pin level into a power-of-two ring and then publishes the new write count; serviceZeroCross() runs the ring through an alpha-beta tracking filter
+//outside interrupt context.  Each polarity keeps its own phase so an unequal duty cycle (DC offset) does not pull the period, both share one period estimate.
+//The timestamps include the fixed delay of the ZX low-pass filter (CONFIG ZXLPF) and the interrupt latency, measure it once if the absolute time matters.
+
+void ADE7953::attachZeroCross(int zxPin){
+  uint16_t altOutput;
+  
+  altOutput = spiAlgorithm16_read((functionBitVal(ALT_OUTPUT_16,1)),(functionBitVal(ALT_OUTPUT_16,0)));
+  altOutput &= ~0x000F;  //ZX_ALT = 0000, zero crossing detection on Pin 1
+  spiAlgorithm16_write((functionBitVal(ALT_OUTPUT_16,1)),(functionBitVal(ALT_OUTPUT_16,0)),functionBitVal(altOutput,1),functionBitVal(altOutput,0));
+  zxReset();
+  _zxPin = zxPin;
+  pinMode(_zxPin, INPUT);
+  attachInterruptArg(digitalPinToInterrupt(_zxPin), zxHandler, this, CHANGE);
+  }
+
+void IRAM_ATTR ADE7953::zxHandler(void *arg){
+  ADE7953 *device = (ADE7953 *)arg;
+  uint32_t index = device->_zxWrite;
+  device->_zxTime[index & (ADE7953_ZX_RING_SIZE - 1)] = micros();
+  device->_zxRising[index & (ADE7953_ZX_RING_SIZE - 1)] = digitalRead(device->_zxPin);  //High after a rising crossing
+  device->_zxWrite = index + 1;
+  }
+
+void ADE7953::zxReset(){
+  _zxPhaseValid[0] = false;
+  _zxPhaseValid[1] = false;
+  _zxPeriodValid = false;
+  _zxGood = 0;
+  }
+
+uint8_t ADE7953::serviceZeroCross(){  //Call at least every ADE7953_ZX_RING_SIZE half cycles, returns the number of crossings processed
+  uint32_t write = _zxWrite;
+  uint8_t processed = 0;
+  
+  if (write - _zxRead > ADE7953_ZX_RING_SIZE) {
+    _zxDropped += write - _zxRead - ADE7953_ZX_RING_SIZE;  //Overwritten before being read, the filter bridges the gap in whole periods
+    _zxRead = write - ADE7953_ZX_RING_SIZE;
+    }
+  while (_zxRead != write) {
+    uint32_t index = _zxRead & (ADE7953_ZX_RING_SIZE - 1);
+    zxTrack(_zxTime[index], _zxRising[index] != 0);
+    _zxRead++;
+    processed++;
+    }
+  return processed;
+  }
+
+void ADE7953::zxTrack(uint32_t timestamp, bool rising){
+  uint8_t p = rising ? 1 : 0;
+  
+  if (!_zxPhaseValid[p]) {
+    _zxPhase[p] = timestamp;
+    _zxPhaseValid[p] = true;
+    return;
+    }
+  uint32_t elapsed = timestamp - _zxPhase[p];
+  if (!_zxPeriodValid) {  //Acquisition: the first same-polarity interval in range seeds the period
+    if (elapsed >= ADE7953_ZX_MIN_PERIOD_US && elapsed <= ADE7953_ZX_MAX_PERIOD_US) {
+      _zxPeriod = elapsed;
+      _zxPeriodValid = true;
+      }
+    _zxPhase[p] = timestamp;
+    return;
+    }
+  
+  float cycles = floorf((float)elapsed/_zxPeriod + 0.5);
+  if (cycles < 1) {
+    return;  //Edge well inside the current half cycle, a glitch on the pin
+    }
+  float residual = (float)elapsed - cycles*_zxPeriod;
+  if (fabsf(residual) > _zxPeriod/8) {  //Outside the gate: phase jump or a new supply, start over from this crossing
+    zxReset();
+    _zxPhase[p] = timestamp;
+    _zxPhaseValid[p] = true;
+    return;
+    }
+  _zxPhase[p] += (uint32_t)(int32_t)lroundf(cycles*_zxPeriod + ADE7953_ZX_ALPHA*residual);
+  _zxPeriod += ADE7953_ZX_BETA*residual/cycles;
+  if (_zxGood < ADE7953_ZX_LOCK) {_zxGood++;}
+  }
+
+bool ADE7953::isZeroCrossLocked(){
+  return _zxPeriodValid && _zxGood >= ADE7953_ZX_LOCK;
+  }
+
+float ADE7953::getZeroCrossPeriod(){  //Filtered line period in us, 0 until locked
+  return isZeroCrossLocked() ? _zxPeriod : 0;
+  }
+
+float ADE7953::getZeroCrossFrequency(){
+  return isZeroCrossLocked() ? 1e6/_zxPeriod : 0;
+  }
+
+bool ADE7953::predictZeroCross(bool rising, uint32_t now, uint32_t &timestamp){  //First crossing of the given polarity after now (micros()), from the filtered phase and period
+  uint8_t p = rising ? 1 : 0;
+  
+  if (!isZeroCrossLocked() || !_zxPhaseValid[p]) {
+    return false;
+    }
+  int32_t elapsed = (int32_t)(now - _zxPhase[p]);
+  float cycles = (elapsed < 0) ? 0 : floorf((float)elapsed/_zxPeriod) + 1;
+  timestamp = _zxPhase[p] + (uint32_t)lroundf(cycles*_zxPeriod);
+  return true;
+  }
+
+uint8_t ADE7953::getZeroCrossings(ADE7953ZeroCross *crossings, uint8_t count){  //Last count raw crossings, newest first; returns how many are valid
+  uint32_t write = _zxWrite;
+  
+  if (count > ADE7953_ZX_RING_SIZE) {count = ADE7953_ZX_RING_SIZE;}
+  if (count > write) {count = write;}
+  for (uint8_t i = 0; i < count; i++) {
+    uint32_t index = (write - 1 - i) & (ADE7953_ZX_RING_SIZE - 1);
+    crossings[i].timestamp = _zxTime[index];
+    crossings[i].rising = _zxRising[index] != 0;
+    }
+  uint32_t overwritten = _zxWrite - write + count;  //The oldest entries copied may have been replaced by the interrupt meanwhile
+  if (overwritten > ADE7953_ZX_RING_SIZE) {
+    overwritten -= ADE7953_ZX_RING_SIZE;
+    return (overwritten >= count) ? 0 : count - overwritten;
+    }
+  return count;
+  }
+
+unsigned long ADE7953::getZeroCrossDropped(){
+  return _zxDropped;
+  }
+
+//*******************************************************
+
+
+//****************CF Pulse Counting Functions*****************
+//The CF1/CF2 pins give one pulse per CFxDEN LSBs of the selected energy (or IRMS) accumulation.  Counting them with an ESP32 PCNT unit keeps an energy
+//total advancing with no SPI traffic, even while the bus is held by other work or the sketch is stalled.  The 16-bit hardware counter is extended to
+//64 bits by counting its limit events in an interrupt.  With an energy source selected, accumulateEnergy() also compares the pulse energy with the
+//register energy over the same intervals (getCFCrossCheck()), which catches a wrong pulse constant or a missing pulse input.
+
+void ADE7953::configureCF(uint8_t output, uint8_t source, uint16_t denominator){  //output 1 or 2, source ADE7953_CF_xxx, denominator >= 1
+  uint16_t cfmode;
+  uint8_t o = (output == 2) ? 1 : 0;
+  uint16_t den = (denominator == 0) ? 1 : denominator;
+  
+  beginBatch();
+  cfmode = spiAlgorithm16_read((functionBitVal(CFMODE_16,1)),(functionBitVal(CFMODE_16,0)));
+  cfmode &= ~((0x000F << (4*o)) | (0x0100 << o));  //CFxSEL and CFxDIS
+  cfmode |= (source & 0x0F) << (4*o);
+  spiAlgorithm16_write((functionBitVal(CFMODE_16,1)),(functionBitVal(CFMODE_16,0)),functionBitVal(cfmode,1),functionBitVal(cfmode,0));
+  //CF1DEN/CF2DEN only take a new value after two sequential writes
+  spiAlgorithm16_write((functionBitVal(o ? CF2DEN_16 : CF1DEN_16,1)),(functionBitVal(o ? CF2DEN_16 : CF1DEN_16,0)),functionBitVal(den,1),functionBitVal(den,0));
+  spiAlgorithm16_write((functionBitVal(o ? CF2DEN_16 : CF1DEN_16,1)),(functionBitVal(o ? CF2DEN_16 : CF1DEN_16,0)),functionBitVal(den,1),functionBitVal(den,0));
+  endBatch();
+  _cfSource[o] = source;
+  _cfDen[o] = den;
+  }
+
+bool ADE7953::attachCFCounter(uint8_t output, int pin, uint8_t pcntUnit, float pulsesPerUnit){  //pulsesPerUnit 0 derives it from the energy gains and CFxDEN
+  uint8_t o = (output == 2) ? 1 : 0;
+  uint8_t source = _cfSource[o];
+  pcnt_config_t config;
+  
+  if (pulsesPerUnit <= 0) {
+    float countsPerUnit;
+    uint8_t ch = (source == ADE7953_CF_ACTIVE_AB) ? 0 : (source >> 2);  //A + B is scaled like Channel A
+    if (source == ADE7953_CF_IRMS_A || source == ADE7953_CF_IRMS_B || (source >= ADE7953_CF_IRMS_AB && source != ADE7953_CF_ACTIVE_AB)) {
+      return false;  //IRMS sources have no energy gain, give the constant explicitly
+      }
+    switch ((source == ADE7953_CF_ACTIVE_AB) ? 0 : (source & 0x03)) {
+      case 0: countsPerUnit = ch ? getActiveEnergyB_m : getActiveEnergyA_m; break;
+      case 1: countsPerUnit = ch ? getReactiveEnergyB_m : getReactiveEnergyA_m; break;
+      default: countsPerUnit = ch ? getApparentEnergyB_m : getApparentEnergyA_m; break;
+      }
+    pulsesPerUnit = countsPerUnit*_gainScale[ADE7953_CHANNEL_V]*_gainScale[ch ? ADE7953_CHANNEL_B : ADE7953_CHANNEL_A]/_cfDen[o];  //Taken at the present PGA gains
+    }
+  
+  memset(&config, 0, sizeof(config));
+  config.pulse_gpio_num = pin;
+  config.ctrl_gpio_num = PCNT_PIN_NOT_USED;
+  config.channel = PCNT_CHANNEL_0;
+  config.unit = (pcnt_unit_t)pcntUnit;
+  config.pos_mode = PCNT_COUNT_INC;  //CF pulses are active low, count the rising edge at the end of each pulse
+  config.neg_mode = PCNT_COUNT_DIS;
+  config.lctrl_mode = PCNT_MODE_KEEP;
+  config.hctrl_mode = PCNT_MODE_KEEP;
+  config.counter_h_lim = ADE7953_CF_PCNT_LIMIT;
+  config.counter_l_lim = 0;
+  if (pcnt_unit_config(&config) != ESP_OK) {
+    return false;
+    }
+  pcnt_set_filter_value(config.unit, ADE7953_CF_PCNT_FILTER);
+  pcnt_filter_enable(config.unit);
+  pcnt_event_enable(config.unit, PCNT_EVT_H_LIM);
+  pcnt_counter_pause(config.unit);
+  pcnt_counter_clear(config.unit);
+  pcnt_isr_service_install(0);  //Already installed by another unit is fine
+  if (pcnt_isr_handler_add(config.unit, cfLimitHandler, (void *)&_cfWraps[o]) != ESP_OK) {
+    return false;
+    }
+  _cfWraps[o] = 0;
+  _cfUnit[o] = pcntUnit;
+  _cfPulsesPerUnit[o] = pulsesPerUnit;
+  _cfEnergyBase[o] = 0;
+  _cfBasePulses[o] = 0;
+  clearCFCrossCheck(output);
+  pcnt_counter_resume(config.unit);
+  return true;
+  }
+
+void IRAM_ATTR ADE7953::cfLimitHandler(void *arg){  //The counter has reached ADE7953_CF_PCNT_LIMIT and restarted from zero
+  volatile uint32_t *wraps = (volatile uint32_t *)arg;
+  (*wraps)++;
+  }
+
+uint64_t ADE7953::getCFPulses(uint8_t output){  //Pulses counted since attachCFCounter()
+  uint8_t o = (output == 2) ? 1 : 0;
+  uint32_t wraps;
+  int16_t count;
+  
+  if (_cfUnit[o] < 0) {
+    return 0;
+    }
+  do {  //Read again if a limit interrupt landed between the two reads
+    wraps = _cfWraps[o];
+    pcnt_get_counter_value((pcnt_unit_t)_cfUnit[o], &count);
+    } while (wraps != _cfWraps[o]);
+  return (uint64_t)wraps*ADE7953_CF_PCNT_LIMIT + (uint16_t)count;
+  }
+
+double ADE7953::getCFEnergy(uint8_t output){  //Wh, varh or VAh depending on the CF source
+  uint8_t o = (output == 2) ? 1 : 0;
+  return _cfEnergyBase[o] + (double)(getCFPulses(output) - _cfBasePulses[o])/_cfPulsesPerUnit[o];
+  }
+
+void ADE7953::rescaleCF(uint8_t channel, float ratio){  //A PGA gain change scales the CF pulse rate: close the pulses so far at the old constant
+  for (uint8_t o = 0; o < 2; o++) {
+    uint8_t source = _cfSource[o];
+    bool irms = (source == ADE7953_CF_IRMS_A || source == ADE7953_CF_IRMS_B || source == ADE7953_CF_IRMS_AB);
+    uint8_t ch = (source >= ADE7953_CF_IRMS_AB) ? ADE7953_CHANNEL_A : ((source >> 2) ? ADE7953_CHANNEL_B : ADE7953_CHANNEL_A);  //A + B is scaled like Channel A
+    if (_cfUnit[o] < 0 || (channel == ADE7953_CHANNEL_V ? irms : channel != ch)) {continue;}
+    uint64_t pulses = getCFPulses(o + 1);
+    _cfEnergyBase[o] += (double)(pulses - _cfBasePulses[o])/_cfPulsesPerUnit[o];
+    _cfBasePulses[o] = pulses;
+    _cfPulsesPerUnit[o] *= ratio;
+    }
+  }
+
+bool ADE7953::getCFCrossCheck(uint8_t output, float &ratio){  //Pulse energy / register energy since clearCFCrossCheck(), false until energy has been seen
+  uint8_t o = (output == 2) ? 1 : 0;
+  if (_cfCheckReg[o] <= 0) {
+    return false;
+    }
+  ratio = _cfCheckCf[o]/_cfCheckReg[o];
+  return true;
+  }
+
+void ADE7953::clearCFCrossCheck(uint8_t output){
+  uint8_t o = (output == 2) ? 1 : 0;
+  _cfCheckPrimed[o] = false;
+  _cfCheckCf[o] = 0;
+  _cfCheckReg[o] = 0;
+  }
+
+//*******************************************************
+
+
+//****************Waveform Capture Functions*****************
+//sampleWaveform() reads V, IA and IB (32-bit waveform registers, updated at 6.99 kHz) in one bus session into a circular pre-trigger buffer and checks
+//the armed triggers.  Once a trigger fires the post-trigger samples are taken and the whole window is copied into the capture slot, where it stays
+//until releaseCapture() while the ring keeps running.  At 1 MHz SPI one sample takes about 200 us, so serviceCapture() reaches roughly 5 kS/s per
+//channel (one sample in every one or two ADE7953 updates); give it its own task for gap-free pre-trigger data, and note that the rest of the library
+//cannot use the bus while it runs.  The overcurrent trigger uses the IRQ pin from attachIRQ() when it is wired and otherwise polls the status with
+//every sample.  Status bits it reads are left in the shared latch, so servicePowerQuality() still logs the overcurrent event.
+
+bool ADE7953::configureCapture(uint16_t preSamples, uint16_t postSamples){  //pre + post <= ADE7953_CAPTURE_SAMPLES, post >= 1
+  if (postSamples == 0 || (uint32_t)preSamples + postSamples > ADE7953_CAPTURE_SAMPLES) {
+    return false;
+    }
+  _capPre = preSamples;
+  _capPost = postSamples;
+  return true;
+  }
+
+void ADE7953::setCaptureLevel(uint8_t channel, float level){  //channel ADE7953_CHANNEL_x, level in calibrated peak units (as configurePowerQuality()), 0 = off
+  if (channel > ADE7953_CHANNEL_B) {
+    return;
+    }
+  _capLevelUnits[channel] = level;
+  writeCaptureLevel(channel);
+  }
+
+void ADE7953::writeCaptureLevel(uint8_t channel){  //Samples are waveform codes, on the same scale as the peak registers
+  float level = _capLevelUnits[channel];
+  uint32_t counts = peakCounts(level, channel);
+  _capLevel[channel] = (level > 0) ? (int32_t)(counts ? counts : 1) : 0;
+  }
+
+void ADE7953::setCaptureZeroCross(bool rising, uint32_t offsetUs){  //ZX trigger time: offsetUs after the next crossing of that polarity
+  _capZxRising = rising;
+  _capZxOffset = offsetUs;
+  _capZxTargetValid = false;
+  }
+
+void ADE7953::armCapture(uint8_t triggers){  //ADE7953_CAPTURE_xxx mask, one shot: fires once, then call again to re-arm
+  _capRemaining = 0;
+  _capManual = false;
+  _capIrqPending = false;
+  _capZxTargetValid = false;
+  _capArmed = triggers;
+  }
+
+void ADE7953::triggerCapture(){  //Fires an armed ADE7953_CAPTURE_MANUAL trigger on the next sample, safe to call from an interrupt
+  _capManual = true;
+  }
+
+bool ADE7953::isCaptureArmed(){  //Armed or still taking post-trigger samples
+  return _capArmed != 0 || _capRemaining != 0;
+  }
+
+bool ADE7953::captureTrigger(uint8_t source, uint32_t eventTime, uint16_t remaining){  //false if the trigger had to be dropped
+  if (_capReady) {
+    _capMissed++;  //Previous capture not released yet, keep it and stay armed
+    return false;
+    }
+  _capPending.trigger = source;
+  _capPending.triggerTime = eventTime;
+  _capPending.latency = micros() - eventTime;
+  _capArmed = 0;
+  _capRemaining = remaining;
+  if (remaining == 0) {
+    captureFreeze();
+    }
+  return true;
+  }
+
+void ADE7953::captureFreeze(){  //Copies the newest pre + post samples from the ring into the slot, oldest first
+  uint16_t post = _capPost;
+  uint16_t count = _capPre + post;
+  if (count > _capFill) {count = _capFill;}
+  _capPending.pre = count - post;
+  _capPending.samples = count;
+  for (uint16_t i = 0; i < count; i++) {
+    _capSlot[i] = _capRing[(_capHead + ADE7953_CAPTURE_SAMPLES - count + i) % ADE7953_CAPTURE_SAMPLES];
+    }
+  _capInfo = _capPending;
+  _capReady = true;
+  }
+
+bool ADE7953::sampleWaveform(){  //Takes one sample, returns true when it completed a capture
+  uint32_t start = micros();
+  uint32_t statusA, statusB;
+  ADE7953WaveformSample &sample = _capRing[_capHead];
+  
+  beginBatch();
+  if (_capArmed & ADE7953_CAPTURE_OI) {  //Event triggers are checked first so the next sample is the first post-trigger one
+    if (_irqPin < 0 || _capIrqPending) {
+      uint32_t edge = (_irqPin < 0) ? start : _capIrqTime;
+      _capIrqPending = false;
+      readIrqStatus(statusA, statusB);
+      if ((statusA | statusB) & ADE7953_IRQ_OI) {
+        captureTrigger(ADE7953_CAPTURE_OI, edge, _capPost);
+        }
+      }
+    }
+  if ((_capArmed & ADE7953_CAPTURE_MANUAL) && _capManual) {
+    _capManual = false;
+    captureTrigger(ADE7953_CAPTURE_MANUAL, start, _capPost);
+    }
+  if (_capArmed & ADE7953_CAPTURE_ZX) {
+    if (!_capZxTargetValid) {
+      serviceZeroCross();
+      _capZxTargetValid = predictZeroCross(_capZxRising, start, _capZxTarget);
+      _capZxTarget += _capZxOffset;
+      }
+    if (_capZxTargetValid && (int32_t)(start - _capZxTarget) >= 0) {
+      captureTrigger(ADE7953_CAPTURE_ZX, _capZxTarget, _capPost);
+      _capZxTargetValid = false;
+      }
+    }
+  start = micros();
+  sample.time = start;
+  sample.v = (int32_t)spiAlgorithm32_read((functionBitVal(V_32,1)),(functionBitVal(V_32,0)));
+  sample.ia = (int32_t)spiAlgorithm32_read((functionBitVal(IA_32,1)),(functionBitVal(IA_32,0)));
+  sample.ib = (int32_t)spiAlgorithm32_read((functionBitVal(IB_32,1)),(functionBitVal(IB_32,0)));
+  endBatch();
+  _capHead = (_capHead + 1) % ADE7953_CAPTURE_SAMPLES;
+  if (_capFill < ADE7953_CAPTURE_SAMPLES) {_capFill++;}
+  if (_subCycle) {
+    _subCycle->add(sample.time, sample.v, sample.ia, sample.ib);
+    }
+  
+  if (_capRemaining) {
+    if (--_capRemaining == 0) {
+      captureFreeze();
+      return true;
+      }
+    return false;
+    }
+  if (_capArmed & ADE7953_CAPTURE_LEVEL) {  //The sample over the level is samples[pre]
+    if ((_capLevel[0] && abs(sample.v) > _capLevel[0]) || (_capLevel[1] && abs(sample.ia) > _capLevel[1]) || (_capLevel[2] && abs(sample.ib) > _capLevel[2])) {
+      return captureTrigger(ADE7953_CAPTURE_LEVEL, start, _capPost - 1) && _capRemaining == 0;
+      }
+    }
+  return false;
+  }
+
+bool ADE7953::serviceCapture(unsigned long budgetUs){  //Samples back to back for budgetUs, returns true if a capture completed (it returns early)
+  uint32_t start = micros();
+  do {
+    if (sampleWaveform()) {
+      return true;
+      }
+    } while ((uint32_t)(micros() - start) < budgetUs);
+  return false;
+  }
+
+bool ADE7953::getCapture(ADE7953CaptureInfo &info){  //false while the slot is empty
+  if (!_capReady) {
+    return false;
+    }
+  info = _capInfo;
+  return true;
+  }
+
+const ADE7953WaveformSample *ADE7953::getCaptureSamples(){  //info.samples entries, valid until releaseCapture()
+  return _capSlot;
+  }
+
+void ADE7953::releaseCapture(){  //Frees the slot for the next trigger
+  _capReady = false;
+  }
+
+unsigned long ADE7953::getCaptureMissed(){  //Triggers that fired while the slot was still full
+  return _capMissed;
+  }
+
+//The VRMS/IRMSx registers settle over many line cycles.  An attached ADE7953SubCycleRms gets every sample taken by sampleWaveform()/serviceCapture()
+//and reports once per half cycle, so a sag or an inrush shows up within a cycle instead of a few hundred ms.  The RMS registers are not on the waveform
+//scale: a full scale sine is +/-6,500,000 waveform codes, 4,596,194 codes RMS, but reads 9,032,007 in VRMS/IRMS.  The results are multiplied by that
+//ratio (ADE7953_PEAK_SCALE, 1.965) before the getVrms()/getIrmsA()/getIrmsB() gains so both read the same on a sine.
+
+void ADE7953::attachSubCycleRms(ADE7953SubCycleRms *rms){  //NULL detaches
+  _subCycle = rms;
+  }
+
+bool ADE7953::getSubCycleRms(ADE7953CycleRms &rms){  //Latest half cycle in calibrated RMS units, false before the first full cycle
+  float m[3] = {(float)(getVrms_m*_gainScale[ADE7953_CHANNEL_V]), (float)(getIrmsA_m*_gainScale[ADE7953_CHANNEL_A]), (float)(getIrmsB_m*_gainScale[ADE7953_CHANNEL_B])};
+  float b[3] = {getVrms_b, getIrmsA_b, getIrmsB_b};
+  
+  if (!_subCycle || !_subCycle->getLatest(rms)) {
+    return false;
+    }
+  for (uint8_t c = 0; c < 3; c++) {
+    rms.half[c] = rms.half[c]*ADE7953_PEAK_SCALE/m[c] + b[c];  //Waveform RMS -> RMS register counts, then as decimalize() without truncating to whole counts
+    rms.full[c] = rms.full[c]*ADE7953_PEAK_SCALE/m[c] + b[c];
+    }
+  return true;
+  }
+
+//*******************************************************
+
+
+//****************Read Scheduler Functions*****************
+//Register groups change at very different rates: instantaneous power with every waveform sample, RMS over a few cycles, energy over seconds and the
+//configuration only on a reset.  Each group gets a period and/or a status trigger; serviceSchedule() finds the due groups, pulls in the ones that will be
+//due soon anyway, and reads them all in one bus session into a cached snapshot, so polling fast quantities does not drag the slow ones along.  Due times
+//advance in whole periods from the schedule, so a late call does not shift the phase; every period skipped entirely counts as a miss.
+//WSMP groups are timed from the 143 us sample interval rather than the status bit, which is set on nearly every poll.  CYCEND reads RSTIRQSTATA after an
+//IRQ edge when attachIRQ() is used, otherwise every ADE7953_SCHED_POLL_MS; the bits other services use stay in the shared latch.
+
+void ADE7953::setSchedule(uint8_t group, unsigned long periodMs){  //0 takes the group off the timer, at most ADE7953_SCHED_MAX_MS (24 days)
+  if (group >= ADE7953_GROUPS) {
+    return;
+    }
+  if (periodMs > ADE7953_SCHED_MAX_MS) {periodMs = ADE7953_SCHED_MAX_MS;}  //Due times are compared as signed differences of millis()
+  _schedPeriod[group] = periodMs;
+  _schedDue[group] = millis();
+  }
+
+void ADE7953::setScheduleTrigger(uint8_t group, uint8_t triggers){  //ADE7953_SCHED_WSMP and/or ADE7953_SCHED_CYCEND, 0 = none
+  uint32_t irqena;
+  
+  if (group >= ADE7953_GROUPS) {
+    return;
+    }
+  _schedTrigger[group] = triggers;
+  if (triggers & ADE7953_SCHED_CYCEND) {  //Lets the IRQ pin wake the scheduler; WSMP stays off the pin (6.99 kHz), its status bit is set either way
+    irqena = spiAlgorithm32_read((functionBitVal(IRQENA_32,1)),(functionBitVal(IRQENA_32,0)));
+    if (!(irqena & ADE7953_IRQ_CYCEND)) {
+      irqena |= ADE7953_IRQ_CYCEND;
+      spiAlgorithm32_write((functionBitVal(IRQENA_32,1)),(functionBitVal(IRQENA_32,0)),functionBitVal(irqena,3),functionBitVal(irqena,2),functionBitVal(irqena,1),functionBitVal(irqena,0));
+      }
+    }
+  }
+
+void ADE7953::readGroup(uint8_t group, uint32_t now){
+  uint32_t vPeak, iaPeak, ibPeak;
+  int16_t angleA, angleB;
+  uint16_t period;
+  bool cached;
+  
+  switch (group) {
+    case ADE7953_GROUP_POWER:
+      _schedSnapshot.activePowerA = getSignedActivePowerA();
+      _schedSnapshot.activePowerB = getSignedActivePowerB();
+      _schedSnapshot.reactivePowerA = getInstReactivePowerA();
+      _schedSnapshot.reactivePowerB = getInstReactivePowerB();
+      _schedSnapshot.apparentPowerA = getInstApparentPowerA();
+      _schedSnapshot.apparentPowerB = getInstApparentPowerB();
+      break;
+    case ADE7953_GROUP_RMS:
+      _schedSnapshot.vrms = getVrms();
+      _schedSnapshot.irmsA = getIrmsA();
+      _schedSnapshot.irmsB = getIrmsB();
+      break;
+    case ADE7953_GROUP_PF:
+      _schedSnapshot.powerFactorA = getPowerFactorA();
+      _schedSnapshot.powerFactorB = getPowerFactorB();
+      angleA = spiAlgorithm16_read((functionBitVal(ANGLE_A_16,1)),(functionBitVal(ANGLE_A_16,0)));
+      angleB = spiAlgorithm16_read((functionBitVal(ANGLE_B_16,1)),(functionBitVal(ANGLE_B_16,0)));
+      if (_schedPeriodRaw) {
+        _schedSnapshot.phaseAngleA = angleToDegrees(angleA, _schedPeriodRaw);
+        _schedSnapshot.phaseAngleB = angleToDegrees(angleB, _schedPeriodRaw);
+        }
+      break;
+    case ADE7953_GROUP_PERIOD:
+      period = spiAlgorithm16_read((functionBitVal(Period_16,1)),(functionBitVal(Period_16,0)));
+      _schedPeriodRaw = period;
+      _schedSnapshot.period = decimalize(period, getPeriod_m, getPeriod_b);
+      _schedSnapshot.frequency = periodToHz(period);
+      addFrequencySample(period, millis());
+      break;
+    case ADE7953_GROUP_ENERGY:
+      accumulateEnergy();
+      break;
+    case ADE7953_GROUP_PEAKS:
+      readResetPeaks(vPeak, iaPeak, ibPeak);  //Folded into the interval readSnapshot() reports, so both views keep every peak
+      _schedSnapshot.peaks.vpeak = peakUnits(_intervalPeak[0], ADE7953_CHANNEL_V);  //As readSnapshot(): waveform codes on the RMS register scale
+      _schedSnapshot.peaks.ipeakA = peakUnits(_intervalPeak[1], ADE7953_CHANNEL_A);
+      _schedSnapshot.peaks.ipeakB = peakUnits(_intervalPeak[2], ADE7953_CHANNEL_B);
+      break;
+    case ADE7953_GROUP_CONFIG:
+      cached = _cacheEnabled;
+      _cacheEnabled = false;  //Straight from the chip, a cached copy would hide the reset
+      //The PGA codes alone miss a reset while the gains are at 1, their reset value; LCYCMODE is always set to 0x7F by initialize()
+      if (spiAlgorithm8_read((functionBitVal(LCYCMODE_8,1)),(functionBitVal(LCYCMODE_8,0))) == ADE7953_LCYCMODE_RESET ||
+          spiAlgorithm8_read((functionBitVal(PGA_V_8,1)),(functionBitVal(PGA_V_8,0))) != _pgaCode[ADE7953_CHANNEL_V] ||
+          spiAlgorithm8_read((functionBitVal(PGA_IA_8,1)),(functionBitVal(PGA_IA_8,0))) != _pgaCode[ADE7953_CHANNEL_A] ||
+          spiAlgorithm8_read((functionBitVal(PGA_IB_8,1)),(functionBitVal(PGA_IB_8,0))) != _pgaCode[ADE7953_CHANNEL_B]) {
+        _configMismatches++;  //The chip lost its settings (brown-out or reset), the sketch should initialize() and configure it again
+        }
+      _cacheEnabled = cached;
+      break;
+    }
+  _schedStats[group].reads++;
+  _schedStats[group].lastRead = now;
+  }
+
+uint8_t ADE7953::serviceSchedule(){  //Call from loop() as often as the fastest group needs, returns the mask (1 << group) of groups read
+  uint32_t now = micros();
+  uint32_t nowMs = millis();  //Timer groups run on millis(), so a period can be longer than the 71 minute micros() wrap
+  uint32_t statusA, statusB, start;
+  uint8_t due = 0, triggered = 0;
+  bool cycend = false, poll;
+  
+  for (uint8_t g = 0; g < ADE7953_GROUPS; g++) {
+    if (_schedPeriod[g] && (int32_t)(nowMs - _schedDue[g]) >= 0) {due |= (1 << g);}
+    if ((_schedTrigger[g] & ADE7953_SCHED_WSMP) && (uint32_t)(now - _schedStats[g].lastRead) >= ADE7953_SCHED_WSMP_US) {triggered |= (1 << g);}  //Timed, a status read per sample would cost more than the group
+    if (_schedTrigger[g] & ADE7953_SCHED_CYCEND) {cycend = true;}
+    }
+  poll = cycend && ((_irqPin >= 0) ? _schedIrqPending : (uint32_t)(now - _schedLastPoll) >= ADE7953_SCHED_POLL_MS*1000UL);
+  if (!due && !triggered && !poll) {
+    return 0;  //Nothing due and no status to look at: no bus traffic
+    }
+  
+  start = micros();
+  beginBatch();
+  if (poll) {
+    _schedIrqPending = false;
+    _schedLastPoll = now;
+    readIrqStatus(statusA, statusB);
+    if (_irqLatchA & ADE7953_IRQ_CYCEND) {
+      for (uint8_t g = 0; g < ADE7953_GROUPS; g++) {
+        if (_schedTrigger[g] & ADE7953_SCHED_CYCEND) {triggered |= (1 << g);}
+        }
+      _irqLatchA &= ~ADE7953_IRQ_CYCEND;
+      }
+    }
+  if (due || triggered) {
+    for (uint8_t g = 0; g < ADE7953_GROUPS; g++) {  //Timer groups nearly due ride along instead of opening their own burst later
+      if (_schedPeriod[g] && !(due & (1 << g)) && (int32_t)(_schedDue[g] - nowMs) < (int32_t)(_schedPeriod[g]*ADE7953_SCHED_LOOKAHEAD)) {
+        due |= (1 << g);
+        }
+      }
+    }
+  for (uint8_t g = 0; g < ADE7953_GROUPS; g++) {
+    if (!((due | triggered) & (1 << g))) {continue;}
+    readGroup(g, now);
+    if (due & (1 << g)) {
+      int32_t late = (int32_t)(nowMs - _schedDue[g]);
+      uint32_t skipped = 0;
+      if (late > 0) {
+        if ((uint32_t)late > _schedStats[g].maxLate) {_schedStats[g].maxLate = late;}
+        skipped = (uint32_t)late/_schedPeriod[g];
+        _schedStats[g].misses += skipped;
+        }
+      _schedDue[g] += _schedPeriod[g]*(skipped + 1);
+      }
+    }
+  endBatch();
+  _schedBursts++;
+  _schedBusUs += micros() - start;
+  _schedSnapshot.timestamp = millis();
+  return due | triggered;
+  }
+
+void ADE7953::getScheduled(ADE7953Snapshot &snapshot){  //Latest value of every scheduled group, fields of groups never read stay 0 (see getScheduleStats() for their age)
+  snapshot = _schedSnapshot;
+  snapshot.flags = ((long)(millis() - _rangeSettleUntil) < 0) ? ADE7953_SNAPSHOT_RANGING : 0;
+  }
+
+bool ADE7953::getScheduleStats(uint8_t group, ADE7953ScheduleStats &stats){
+  if (group >= ADE7953_GROUPS) {
+    return false;
+    }
+  stats = _schedStats[group];
+  return true;
+  }
+
+void ADE7953::getScheduleBusStats(unsigned long &bursts, uint32_t &busUs){  //Bus sessions opened by serviceSchedule() and the time spent in them
+  bursts = _schedBursts;
+  busUs = _schedBusUs;
+  }
+
+unsigned long ADE7953::getConfigMismatches(){  //ADE7953_GROUP_CONFIG reads that found the PGA gains changed behind the library
+  return _configMismatches;
+  }
+
+void ADE7953::clearScheduleStats(){
+  memset(_schedStats, 0, sizeof(_schedStats));
+  _schedBursts = 0;
+  _schedBusUs = 0;
+  }
+
+//*******************************************************
+
+
+//****************Register Read Cache Functions*****************
+//Firmware with several consumers (display, logging, control) tends to call the same getters many times per loop.  With the cache enabled a
+//register read within the freshness window of its class is answered from RAM instead of a bus transaction.  The default windows follow the
+//ADE7953's own update rates: a waveform register read again within 143 us would return the same sample anyway, and the filtered power/RMS
+//readings and the per-cycle PF/ANGLE/Period move far less than their resolution in 10 ms.  Read-with-reset and status registers are never
+//cached, since reading them changes them, and any register write empties the cache because a write may change other readings (gains, PGA, reset).
+
+void ADE7953::enableReadCache(bool enable){  //Off by default, disabling also empties the cache
+  _cacheEnabled = enable;
+  invalidateReadCache();
+  }
+
+void ADE7953::setCacheTTL(uint8_t cacheClass, uint32_t ttlUs){  //Freshness window of one ADE7953_CACHE_xxx class in us, 0 stops caching that class
+  if (cacheClass < ADE7953_CACHE_CLASSES) {
+    _cacheTTL[cacheClass] = ttlUs;
+    }
+  }
+
+void ADE7953::invalidateReadCache(){
+  for (uint8_t i = 0; i < ADE7953_CACHE_SIZE; i++) {
+    _cacheAddr[i] = 0xFFFF;
+    }
+  }
+
+void ADE7953::getReadCacheStats(unsigned long &hits, unsigned long &misses){  //Counts cacheable reads only while the cache is enabled
+  hits = _cacheHits;
+  misses = _cacheMisses;
+  }
+
+void ADE7953::clearReadCacheStats(){
+  _cacheHits = 0;
+  _cacheMisses = 0;
+  }
+
+uint8_t ADE7953::cacheClass(uint16_t addr){  //The 24-bit (0x2xx) and 32-bit (0x3xx) addresses of a register share a class
+  uint16_t reg = ((addr & 0xF00) == 0x300) ? (addr - 0x100) : addr;
+  if ((addr & 0xFF) == 0xFF || addr == LAST_OP_8 || addr == LAST_ADD_16) {
+    return ADE7953_CACHE_NONE;
+    }
+  if ((reg >= AENERGYA_24 && reg <= APENERGYB_24) || reg == RSTVPEAK_24 || reg == RSTIAPEAK_24 || reg == RSTIBPEAK_24 || reg == IRQSTATA_24 || reg == RSTIRQSTATA_24 || reg == IRQSTATB_24 || reg == RSTIRQSTATB_24) {
+    return ADE7953_CACHE_NONE;  //Read-with-reset energies and peaks, interrupt status
+    }
+  if (reg >= IA_24 && reg <= V_24) {
+    return ADE7953_CACHE_WAVEFORM;
+    }
+  if ((reg >= AVA_24 && reg <= BVAR_24) || (reg >= IRMSA_24 && reg <= VRMS_24) || reg == VPEAK_24 || reg == IAPEAK_24 || reg == IBPEAK_24 || reg == ACCMODE_24) {
+    return ADE7953_CACHE_POWER;
+    }
+  if ((reg >= PFA_16 && reg <= ANGLE_B_16) || reg == Period_16) {
+    return ADE7953_CACHE_CYCLE;
+    }
+  return ADE7953_CACHE_CONFIG;
+  }
+
+bool ADE7953::cacheLookup(byte MSB, byte LSB, uint32_t &value){
+  if (!_cacheEnabled) {
+    return false;
+    }
+  uint16_t addr = ((uint16_t)MSB << 8) | LSB;
+  uint8_t cls = cacheClass(addr);
+  if (cls == ADE7953_CACHE_NONE || _cacheTTL[cls] == 0) {
+    return false;
+    }
+  uint32_t now = micros();
+  for (uint8_t i = 0; i < ADE7953_CACHE_SIZE; i++) {
+    if (_cacheAddr[i] == addr) {
+      if ((uint32_t)(now - _cacheTime[i]) < _cacheTTL[cls]) {
+        value = _cacheValue[i];
+        _cacheHits++;
+        return true;
+        }
+      break;
+      }
+    }
+  _cacheMisses++;
+  return false;
+  }
+
+void ADE7953::cacheStore(byte MSB, byte LSB, uint32_t value){  //Called after every bus read, refreshes the entry or replaces the oldest one
+  if (!_cacheEnabled) {
+    return;
+    }
+  uint16_t addr = ((uint16_t)MSB << 8) | LSB;
+  uint8_t cls = cacheClass(addr);
+  if (cls == ADE7953_CACHE_NONE || _cacheTTL[cls] == 0) {
+    return;
+    }
+  uint32_t now = micros();
+  uint8_t slot = 0;
+  uint32_t oldest = 0;
+  for (uint8_t i = 0; i < ADE7953_CACHE_SIZE; i++) {
+    if (_cacheAddr[i] == addr || _cacheAddr[i] == 0xFFFF) {
+      slot = i;
+      break;
+      }
+    if ((uint32_t)(now - _cacheTime[i]) >= oldest) {
+      oldest = now - _cacheTime[i];
+      slot = i;
+      }
+    }
+  _cacheAddr[slot] = addr;
+  _cacheValue[slot] = value;
+  _cacheTime[slot] = now;
+  }
+
+//*******************************************************
+
+
+//****************Derived Quantity Functions*****************
+//The power registers are not independent: the ADE7953 computes apparent power as VRMS x IRMS, the power factor as AWATT/AVA and the ANGLE registers
+//follow the phase between active and reactive power.  readDerived() reads only the registers the requested fields cannot be computed from and derives
+//the rest, so a full snapshot of both channels needs V, IA, IB, AWATT, BWATT, AVAR, BVAR and Period (8 reads) rather than 14.  A field is read
+//directly whenever deriving it would cost as many reads as the register itself.  VRMS x IRMS is scaled to AVA counts by a factor learned from the
+//chip (the first readDerived() that needs it reads AVA/BVA as well); verifyDerived() reads both sets and reports how far apart they are.  The arithmetic
+//is in ADE7953Derived.
+//The phase angle is always the power angle atan2(Q, P), never ANGLE_x: the ANGLE registers time the zero crossings, and with harmonics those move
+//away from the power angle by up to several degrees (their sign also follows the CT orientation).  readSnapshot() and the scheduler report ANGLE_x.
+
+#define DERIVED_V 0x0001
+#define DERIVED_I(c) (0x0002 << (c))
+#define DERIVED_P(c) (0x0008 << (c))
+#define DERIVED_Q(c) (0x0020 << (c))
+#define DERIVED_S(c) (0x0080 << (c))      //AVA/BVA read directly
+#define DERIVED_PF(c) (0x0200 << (c))     //PFA/PFB read directly
+#define DERIVED_PERIOD 0x2000
+#define DERIVED_SVI(c) (0x4000 << (c))    //Apparent power from VRMS x IRMS
+#define DERIVED_REGISTERS 0x3FFF
+
+static const int derivedIrmsReg[2] = {IRMSA_32, IRMSB_32};
+static const int derivedWattReg[2] = {AWATT_32, BWATT_32};
+static const int derivedVarReg[2] = {AVAR_32, BVAR_32};
+static const int derivedVaReg[2] = {AVA_32, BVA_32};
+static const int derivedPfReg[2] = {PFA_16, PFB_16};
+static const int derivedAngleReg[2] = {ANGLE_A_16, ANGLE_B_16};
+
+void ADE7953::setDerivedQuantities(uint32_t fieldMask){  //Bits (1 << ADE7953_FIELD_xxx) of the snapshot fields readDerived() should fill
+  _derivedMask = fieldMask & ADE7953_FIELDS_ALL;
+  }
+
+uint8_t ADE7953::getDerivedReadCount(){  //Register reads one readDerived() takes with the present field mask
+  uint16_t plan = derivedPlan(_derivedMask);
+  uint8_t reads = 0;
+  for (uint8_t c = 0; c < 2; c++) {
+    if ((plan & DERIVED_SVI(c)) && _derivedScale[c] == 0) {
+      plan |= DERIVED_S(c);  //Scale not learned yet
+      }
+    }
+  plan &= DERIVED_REGISTERS;
+  while (plan) {
+    reads += plan & 1;
+    plan >>= 1;
+    }
+  return reads;
+  }
+
+uint16_t ADE7953::derivedPlan(uint32_t fieldMask){
+  uint16_t plan = 0;
+  if (fieldMask & (1UL << ADE7953_FIELD_VRMS)) {plan |= DERIVED_V;}
+  if (fieldMask & ((1UL << ADE7953_FIELD_PERIOD) | (1UL << ADE7953_FIELD_FREQUENCY))) {plan |= DERIVED_PERIOD;}
+  for (uint8_t c = 0; c < 2; c++) {
+    if (fieldMask & (1UL << (ADE7953_FIELD_IRMSA + c))) {plan |= DERIVED_I(c);}
+    if (fieldMask & (1UL << (ADE7953_FIELD_ACTIVEA + c))) {plan |= DERIVED_P(c);}
+    if (fieldMask & (1UL << (ADE7953_FIELD_REACTIVEA + c))) {plan |= DERIVED_Q(c);}
+    }
+  for (uint8_t c = 0; c < 2; c++) {
+    if (fieldMask & (1UL << (ADE7953_FIELD_ANGLEA + c))) {  //atan2(Q, P), the same angle whichever other fields are asked for
+      plan |= DERIVED_P(c) | DERIVED_Q(c);
+      }
+    //S is VRMS x IRMS when both are read anyway and AVA/BVA otherwise, never sqrt(P^2 + Q^2): distortion power is in neither P nor Q
+    bool vi = (plan & DERIVED_V) && (plan & DERIVED_I(c));
+    bool apparent = fieldMask & (1UL << (ADE7953_FIELD_APPARENTA + c));
+    if (apparent) {
+      plan |= vi ? DERIVED_SVI(c) : DERIVED_S(c);
+      }
+    if (fieldMask & (1UL << (ADE7953_FIELD_PFA + c))) {  //P/S when P is read and S is known anyway, PFx otherwise
+      if ((plan & DERIVED_P(c)) && (apparent || vi)) {
+        if (vi) {plan |= DERIVED_SVI(c);}
+        }
+      else {
+        plan |= DERIVED_PF(c);
+        }
+      }
+    }
+  return plan;
+  }
+
+uint8_t ADE7953::readDerived(ADE7953Snapshot &snapshot){  //Returns the number of register reads
+  uint16_t plan = derivedPlan(_derivedMask);
+  uint32_t v = 0, irms[2] = {0, 0};
+  int32_t p[2] = {0, 0}, q[2] = {0, 0}, s[2] = {0, 0};
+  int16_t pf[2] = {0, 0};
+  uint16_t period = 0;
+  uint8_t reads = 0;
+  
+  for (uint8_t c = 0; c < 2; c++) {
+    if ((plan & DERIVED_SVI(c)) && _derivedScale[c] == 0) {
+      plan |= DERIVED_S(c);  //Read AVA/BVA this once and learn the VRMS x IRMS scale from it
+      }
+    }
+  beginBatch();
+  snapshot.timestamp = millis();
+  if (plan & DERIVED_V) {v = spiAlgorithm32_read((functionBitVal(VRMS_32,1)),(functionBitVal(VRMS_32,0))); reads++;}
+  if (plan & DERIVED_PERIOD) {period = spiAlgorithm16_read((functionBitVal(Period_16,1)),(functionBitVal(Period_16,0))); reads++;}
+  for (uint8_t c = 0; c < 2; c++) {
+    if (plan & DERIVED_I(c)) {irms[c] = spiAlgorithm32_read((functionBitVal(derivedIrmsReg[c],1)),(functionBitVal(derivedIrmsReg[c],0))); reads++;}
+    if (plan & DERIVED_P(c)) {p[c] = (int32_t)spiAlgorithm32_read((functionBitVal(derivedWattReg[c],1)),(functionBitVal(derivedWattReg[c],0))); reads++;}
+    if (plan & DERIVED_Q(c)) {q[c] = (int32_t)spiAlgorithm32_read((functionBitVal(derivedVarReg[c],1)),(functionBitVal(derivedVarReg[c],0))); reads++;}
+    if (plan & DERIVED_S(c)) {s[c] = (int32_t)spiAlgorithm32_read((functionBitVal(derivedVaReg[c],1)),(functionBitVal(derivedVaReg[c],0))); reads++;}
+    if (plan & DERIVED_PF(c)) {pf[c] = spiAlgorithm16_read((functionBitVal(derivedPfReg[c],1)),(functionBitVal(derivedPfReg[c],0))); reads++;}
+    }
+  endBatch();
+  
+  float vi[2] = {_gainScale[ADE7953_CHANNEL_V]*_gainScale[ADE7953_CHANNEL_A], _gainScale[ADE7953_CHANNEL_V]*_gainScale[ADE7953_CHANNEL_B]};
+  snapshot.vrms = decimalize(v, getVrms_m*_gainScale[ADE7953_CHANNEL_V], getVrms_b);
+  snapshot.irmsA = decimalize(irms[0], getIrmsA_m*_gainScale[ADE7953_CHANNEL_A], getIrmsA_b);
+  snapshot.irmsB = decimalize(irms[1], getIrmsB_m*_gainScale[ADE7953_CHANNEL_B], getIrmsB_b);
+  float deg[2];
+  for (uint8_t c = 0; c < 2; c++) {
+    float sRaw = 0;  //Stays 0 when neither S nor P/S is asked for
+    if (plan & DERIVED_S(c)) {
+      sRaw = (s[c] < 0) ? -(float)s[c] : (float)s[c];
+      if (plan & DERIVED_SVI(c)) {
+        float scale = ADE7953Derived::learnScale(s[c], v, irms[c]);
+        if (scale > 0) {_derivedScale[c] = scale;}
+        }
+      }
+    else if (plan & DERIVED_SVI(c)) {
+      sRaw = ADE7953Derived::apparentVI(_derivedScale[c], v, irms[c]);
+      }
+    if (!(plan & DERIVED_PF(c))) {
+      pf[c] = ADE7953Derived::powerFactor(p[c], sRaw);
+      }
+    deg[c] = ADE7953Derived::powerAngle(p[c], q[c]);
+    s[c] = (int32_t)(sRaw + 0.5);
+    }
+  snapshot.phaseAngleA = deg[0];
+  snapshot.phaseAngleB = deg[1];
+  snapshot.activePowerA = decimalize(p[0], getInstActivePowerA_m*vi[0], getInstActivePowerA_b);
+  snapshot.activePowerB = decimalize(p[1], getInstActivePowerB_m*vi[1], getInstActivePowerB_b);
+  snapshot.reactivePowerA = decimalize(q[0], getInstReactivePowerA_m*vi[0], getInstReactivePowerA_b);
+  snapshot.reactivePowerB = decimalize(q[1], getInstReactivePowerB_m*vi[1], getInstReactivePowerB_b);
+  snapshot.apparentPowerA = abs(decimalize(s[0], getInstApparentPowerA_m*vi[0], getInstApparentPowerA_b));
+  snapshot.apparentPowerB = abs(decimalize(s[1], getInstApparentPowerB_m*vi[1], getInstApparentPowerB_b));
+  snapshot.powerFactorA = abs(decimalize(pf[0], getPowerFactorA_m, getPowerFactorA_b));
+  snapshot.powerFactorB = abs(decimalize(pf[1], getPowerFactorB_m, getPowerFactorB_b));
+  snapshot.period = decimalize(period, getPeriod_m, getPeriod_b);
+  snapshot.frequency = (plan & DERIVED_PERIOD) ? periodToHz(period) : 0;
+  snapshot.peaks.vpeak = 0;
+  snapshot.peaks.ipeakA = 0;
+  snapshot.peaks.ipeakB = 0;
+  snapshot.flags = 0;
+  if ((long)(snapshot.timestamp - _rangeSettleUntil) < 0) {
+    snapshot.flags |= ADE7953_SNAPSHOT_RANGING;
+    }
+  return reads;
+  }
+
+bool ADE7953::verifyDerived(ADE7953DerivedCheck &check){  //Reads the derived-from and the chip's own registers of both channels in one session and compares them
+  uint32_t v, irms[2];
+  int32_t p[2], q[2], s[2];
+  int16_t pf[2], angle[2];
+  uint16_t period;
+  
+  beginBatch();
+  v = spiAlgorithm32_read((functionBitVal(VRMS_32,1)),(functionBitVal(VRMS_32,0)));
+  period = spiAlgorithm16_read((functionBitVal(Period_16,1)),(functionBitVal(Period_16,0)));
+  for (uint8_t c = 0; c < 2; c++) {
+    irms[c] = spiAlgorithm32_read((functionBitVal(derivedIrmsReg[c],1)),(functionBitVal(derivedIrmsReg[c],0)));
+    p[c] = (int32_t)spiAlgorithm32_read((functionBitVal(derivedWattReg[c],1)),(functionBitVal(derivedWattReg[c],0)));
+    q[c] = (int32_t)spiAlgorithm32_read((functionBitVal(derivedVarReg[c],1)),(functionBitVal(derivedVarReg[c],0)));
+    s[c] = (int32_t)spiAlgorithm32_read((functionBitVal(derivedVaReg[c],1)),(functionBitVal(derivedVaReg[c],0)));
+    pf[c] = spiAlgorithm16_read((functionBitVal(derivedPfReg[c],1)),(functionBitVal(derivedPfReg[c],0)));
+    angle[c] = spiAlgorithm16_read((functionBitVal(derivedAngleReg[c],1)),(functionBitVal(derivedAngleReg[c],0)));
+    }
+  endBatch();
+  
+  check.channels = 0;
+  check.apparentError = 0;
+  check.apparentErrorPQ = 0;
+  check.pfError = 0;
+  check.angleError = 0;
+  for (uint8_t c = 0; c < 2; c++) {
+    float chipS = (s[c] < 0) ? -(float)s[c] : (float)s[c];
+    float scale = ADE7953Derived::learnScale(s[c], v, irms[c]);
+    if (scale == 0) {
+      continue;  //No load on the channel, nothing meaningful to compare
+      }
+    if (_derivedScale[c] == 0) {
+      _derivedScale[c] = scale;
+      }
+    float sVI = ADE7953Derived::apparentVI(_derivedScale[c], v, irms[c]);
+    float sPQ = ADE7953Derived::apparentPQ(p[c], q[c]);
+    float errVI = fabs(sVI - chipS)/chipS;
+    float errPQ = fabs(sPQ - chipS)/chipS;
+    float errPF = fabs((float)ADE7953Derived::powerFactor(p[c], sVI) - (float)pf[c])/32768.0;
+    //ANGLE_x is a zero crossing delay whose sign depends on the CT orientation, so the magnitudes are compared
+    float errAngle = fabs(fabs(ADE7953Derived::powerAngle(p[c], q[c])) - fabs(angleToDegrees(angle[c], period)));
+    if (errVI > check.apparentError) {check.apparentError = errVI;}
+    if (errPQ > check.apparentErrorPQ) {check.apparentErrorPQ = errPQ;}
+    if (errPF > check.pfError) {check.pfError = errPF;}
+    if (errAngle > check.angleError) {check.angleError = errAngle;}
+    _derivedScale[c] += ADE7953_DERIVED_SCALE_ALPHA*(scale - _derivedScale[c]);  //Follows slow drift without letting one reading take over
+    check.channels |= (1 << c);
+    }
+  return check.channels != 0;
+  }
+
+//*******************************************************
+
+
+//****************Register Dump Functions*****************
+//A full register sweep for fault reports.  Every register of the table in ADE7953RegisterMap is read in one bus session straight from the chip
+//(the read cache is bypassed), except the read-with-reset ones, which would lose accumulated energy, peaks or interrupt flags, and the
+//LAST_xxx communication registers, which would only describe the sweep itself.  70 reads, about 440 bytes on the bus: 1-2 ms.
+
+uint8_t ADE7953::dumpRegisters(ADE7953RegisterImage &image){  //Returns the number of registers read
+  bool cache = _cacheEnabled;
+  uint8_t reads = 0;
+  
+  ADE7953RegisterMap::clear(image);
+  _cacheEnabled = false;
+  beginBatch();
+  image.timestamp = millis();
+  for (uint8_t i = 0; i < ADE7953RegisterMap::count(); i++) {
+    const ADE7953RegisterInfo &reg = ADE7953RegisterMap::info(i);
+    uint32_t value;
+    if (reg.flags & ADE7953_REG_NO_DUMP) {continue;}
+    if (reg.width == 1) {value = spiAlgorithm8_read((functionBitVal(reg.addr,1)),(functionBitVal(reg.addr,0)));}
+    else if (reg.width == 2) {value = spiAlgorithm16_read((functionBitVal(reg.addr,1)),(functionBitVal(reg.addr,0)));}
+    else {value = spiAlgorithm32_read((functionBitVal(reg.addr,1)),(functionBitVal(reg.addr,0)));}
+    ADE7953RegisterMap::setValue(image, i, value);
+    reads++;
+    }
+  endBatch();
+  _cacheEnabled = cache;
+  return reads;
+  }
+
+uint8_t ADE7953::diffRegisters(const ADE7953RegisterImage &reference, ADE7953RegisterDiff *diffs, uint8_t maxDiffs){  //Dumps the chip and compares the configuration against reference
+  ADE7953RegisterImage image;
+  dumpRegisters(image);
+  return ADE7953RegisterMap::diff(reference, image, ADE7953_REG_MEASURED, diffs, maxDiffs);
+  }
+
+//*******************************************************
+
+
+//****************Bus Fault Handling Functions*****************
+//A failed SPI transfer looks like any other register value (a missing chip reads all ones, a stuck MISO all zeros), so the getters cannot tell.
+//The ADE7953 keeps the address and the data of its last successful transfer in LAST_ADD and LAST_RWDATA, and reading those does not replace them.
+//With setReadVerify(n) every nth register read is followed by LAST_ADD and the LAST_RWDATA of the same width in the same bus session; a mismatch
+//is retried with a doubling delay.  A read-with-reset register cannot be read again without losing its contents, so for those the retry takes
+//the value from LAST_RWDATA once two readings of it agree.  Results go to a sticky status (getCommStatus()) and to the per-device counters.
+
+static bool readResets(uint16_t addr){  //Registers that clear on read: energies, RSTxPEAK, RSTIRQSTATx (24 and 32-bit addresses)
+  if ((addr & 0xF00) != 0x200 && (addr & 0xF00) != 0x300) {
+    return false;
+    }
+  uint8_t reg = addr & 0xFF;
+  return (reg >= 0x1E && reg <= 0x23) || reg == 0x27 || reg == 0x29 || reg == 0x2B || reg == 0x2E || reg == 0x31;
+  }
+
+uint32_t ADE7953::spiRawRead(uint16_t addr, uint8_t bits){  //One transfer without the cache, the checks or the counters
+  uint8_t bytes = (bits == 8) ? 2 : bits/8;  //8-bit registers answer with a padding byte, as in spiAlgorithm8_read()
+  uint32_t value = 0;
+  spiBusOpen();
+  digitalWrite(_SS, LOW);
+  spiTransferByte(spy, functionBitVal(addr,1));
+  spiTransferByte(spy, functionBitVal(addr,0));
+  spiTransferByte(spy, READ);
+  for (uint8_t i = 0; i < bytes; i++) {
+    value = (value << 8) | spiTransferByte(spy, WRITE);
+    }
+  digitalWrite(_SS, HIGH);
+  spiBusClose();
+  return (bits == 8) ? (value >> 8) : value;
+  }
+
+uint32_t ADE7953::commCheck(byte MSB, byte LSB, uint8_t bits, uint32_t value, uint32_t started){  //Called by the spiAlgorithmNN_read() functions after each bus read
+  uint16_t addr = ((uint16_t)MSB << 8) | LSB;
+  uint16_t lastData = (bits == 8) ? LAST_RWDATA_8 : ((bits == 16) ? LAST_RWDATA_16 : ((bits == 24) ? LAST_RWDATA_24 : LAST_RWDATA_32));
+  
+  _comm.reads++;
+  if (_verifyEvery && (addr & 0xFF) != 0xFF && addr != LAST_ADD_16 && addr != LAST_OP_8 && ++_verifyCount >= _verifyEvery) {
+    uint32_t backoff = ADE7953_RETRY_BACKOFF_US;
+    _verifyCount = 0;
+    _comm.verified++;
+    beginBatch();
+    for (uint8_t attempt = 0; ; attempt++) {
+      uint16_t lastAdd = spiRawRead(LAST_ADD_16, 16);
+      uint32_t data = spiRawRead(lastData, bits);
+      if (lastAdd == addr && data == value) {
+        break;
+        }
+      if (attempt >= _retryMax) {
+        if (lastAdd == 0x0000 || lastAdd == 0xFFFF) {  //Nothing answering, the check reads back a floating or stuck MISO line
+          _comm.noResponse++;
+          if (_commStatus < ADE7953_COMM_NO_RESPONSE) {_commStatus = ADE7953_COMM_NO_RESPONSE;}
+          }
+        else {
+          _comm.errors++;
+          if (_commStatus < ADE7953_COMM_MISMATCH) {_commStatus = ADE7953_COMM_MISMATCH;}
+          }
+        break;
+        }
+      _comm.retries++;
+      delayMicroseconds(backoff);
+      backoff *= 2;
+      if (!readResets(addr)) {
+        value = spiRawRead(addr, bits);
+        }
+      else if (lastAdd == addr) {
+        value = data;  //Accepted if the next LAST_RWDATA reading agrees with it
+        }
+      }
+    endBatch();
+    }
+  
+  uint32_t latency = micros() - started;
+  uint8_t bin = 0;
+  for (uint32_t t = latency >> 4; t && bin < ADE7953_LATENCY_BINS - 1; t >>= 1) {
+    bin++;
+    }
+  _comm.latency[bin]++;
+  if (latency > _comm.maxLatency) {_comm.maxLatency = latency;}
+  return value;
+  }
+
+void ADE7953::setReadVerify(uint16_t everyN, uint8_t retries){  //Check one read in everyN (1 = all, 0 = none), retry a failed one up to retries times
+  _verifyEvery = everyN;
+  _verifyCount = 0;
+  _retryMax = retries;
+  }
+
+uint8_t ADE7953::getCommStatus(){  //Worst ADE7953_COMM_xxx since clearCommStatus(), so a whole loop of getter calls can be checked at once
+  return _commStatus;
+  }
+
+void ADE7953::clearCommStatus(){
+  _commStatus = ADE7953_COMM_OK;
+  }
+
+void ADE7953::getCommStats(ADE7953CommStats &stats){
+  stats = _comm;
+  }
+
+void ADE7953::clearCommStats(){
+  memset(&_comm, 0, sizeof(_comm));
+  }
+
+uint8_t ADE7953::readRegister(uint16_t addr, uint32_t &value){  //Any register of the map with its own status, width from ADE7953RegisterMap
+  int index = ADE7953RegisterMap::find(addr);
+  uint8_t sticky = _commStatus;
+  if (index < 0) {
+    return ADE7953_COMM_BAD_ADDRESS;
+    }
+  uint8_t width = ADE7953RegisterMap::info(index).width;
+  busLock.lock();  //The status below belongs to this read, not to another task's
+  _commStatus = ADE7953_COMM_OK;
+  if (width == 1) {value = spiAlgorithm8_read((functionBitVal(addr,1)),(functionBitVal(addr,0)));}
+  else if (width == 2) {value = spiAlgorithm16_read((functionBitVal(addr,1)),(functionBitVal(addr,0)));}
+  else if ((addr & 0xF00) == 0x200) {value = spiAlgorithm24_read((functionBitVal(addr,1)),(functionBitVal(addr,0)));}
+  else {value = spiAlgorithm32_read((functionBitVal(addr,1)),(functionBitVal(addr,0)));}
+  uint8_t status = _commStatus;
+  _commStatus = (sticky > status) ? sticky : status;
+  busLock.unlock();
+  return status;
+  }
+
+uint8_t ADE7953::readField(uint8_t field, float &value){  //Status-returning form of the getters, field: ADE7953_FIELD_xxx, same units as the snapshot
+  busLock.lock();
+  uint8_t sticky = _commStatus;
+  _commStatus = ADE7953_COMM_OK;
+  switch (field) {
+    case ADE7953_FIELD_VRMS: value = getVrms(); break;
+    case ADE7953_FIELD_IRMSA: value = getIrmsA(); break;
+    case ADE7953_FIELD_IRMSB: value = getIrmsB(); break;
+    case ADE7953_FIELD_ACTIVEA: value = getSignedActivePowerA(); break;
+    case ADE7953_FIELD_ACTIVEB: value = getSignedActivePowerB(); break;
+    case ADE7953_FIELD_REACTIVEA: value = getInstReactivePowerA(); break;
+    case ADE7953_FIELD_REACTIVEB: value = getInstReactivePowerB(); break;
+    case ADE7953_FIELD_APPARENTA: value = getInstApparentPowerA(); break;
+    case ADE7953_FIELD_APPARENTB: value = getInstApparentPowerB(); break;
+    case ADE7953_FIELD_PFA: value = getPowerFactorA(); break;
+    case ADE7953_FIELD_PFB: value = getPowerFactorB(); break;
+    case ADE7953_FIELD_PERIOD: value = getPeriod(); break;
+    case ADE7953_FIELD_FREQUENCY: value = getFrequency(); break;
+    case ADE7953_FIELD_ANGLEA: value = getPhaseAngleA(); break;
+    case ADE7953_FIELD_ANGLEB: value = getPhaseAngleB(); break;
+    default:
+      _commStatus = sticky;
+      busLock.unlock();
+      return ADE7953_COMM_BAD_ADDRESS;
+    }
+  uint8_t status = _commStatus;
+  _commStatus = (sticky > status) ? sticky : status;
+  busLock.unlock();
+  return status;
+  }
+
+//*******************************************************
+
+
+//****************Shared Access Functions*****************
+//Every bus transfer, batch and register read (with its cache, check and status bookkeeping) runs under one lock per SPI
+//bus, so tasks can call the getters concurrently.  Interrupt handlers must not wait for it: they queue reads with
+//requestRead() and the task that calls serviceRequests() carries them out.
+
+bool IRAM_ATTR ADE7953::requestRead(uint16_t addr, ADE7953RequestDone done, void *arg){  //Interrupt handler or task, false if the queue was full
+  ADE7953Request request;
+  request.addr = addr;
+  request.done = done;
+  request.arg = arg;
+  if (!_requests.push(request)) {
+    return false;
+    }
+#ifdef ESP32
+  if (_requestTask != NULL) {
+    if (xPortInIsrContext()) {
+      BaseType_t woken = pdFALSE;
+      vTaskNotifyGiveFromISR(_requestTask, &woken);
+      if (woken == pdTRUE) {portYIELD_FROM_ISR();}
+      }
+    else {
+      xTaskNotifyGive(_requestTask);
+      }
+    }
+#endif
+  return true;
+  }
+
+uint8_t ADE7953::serviceRequests(){  //Task context: reads the queued registers and runs their callbacks, returns how many
+  ADE7953Request request;
+  uint8_t serviced = 0;
+  while (serviced < ADE7953_REQUEST_QUEUE && _requests.pop(request)) {  //Bounded, requests queued meanwhile wait for the next call
+    uint32_t value = 0;
+    uint8_t status = readRegister(request.addr, value);
+    if (request.done != NULL) {
+      request.done(request.arg, request.addr, value, status);  //Bus lock already released, the callback may take its time
+      }
+    serviced++;
+    }
+  return serviced;
+  }
+
+unsigned long ADE7953::getDroppedRequests(){
+  return _requests.getDropped();
+  }
+
+#ifdef ESP32
+void ADE7953::setRequestTask(TaskHandle_t task){  //Task notified on every requestRead(), e.g. one blocked in ulTaskNotifyTake() before serviceRequests()
+  _requestTask = task;
+  }
+#endif
+
+void ADE7953::getLockStats(ADE7953LockStats &stats){  //Shared by every ADE7953 on the bus
+  busLock.getStats(stats);
+  }
+
+void ADE7953::clearLockStats(){
+  busLock.lock();
+  busLock.clearStats();
+  busLock.unlock();
+  }
+
+//*******************************************************
+
+
+//****************ADE 7953 Library Control Functions**************************************
+
+//****************Object Definition*****************
+ADE7953::ADE7953(int SS, int SPI_freq)  //set SPI frequency and SS pin designation
+{
+  _SS=SS;
+  _SPI_freq=SPI_freq;
+  _irqPin=-1;
+  _irqPending=false;
+  _irqTimestamp=0;
+  _irqLatchA=0;
+  _irqLatchB=0;
+  _sagLevel=0;
+  _ovLevel=0xFFFFFF;
+  _oiLevel=0xFFFFFF;
+  _zxTimeoutMs=0;
+  _zxtoLastSeen=0;
+  _pqOpenMask=0;
+  _pqHead=0;
+  _pqCount=0;
+  _pqDropped=0;
+  _intervalPeak[0]=0;
+  _intervalPeak[1]=0;
+  _intervalPeak[2]=0;
+  _peakHistoryHead=0;
+  _peakHistoryCount=0;
+  _pqConfigured=false;
+  for (uint8_t ch = 0; ch <= ADE7953_CHANNEL_B; ch++) {
+    _pgaCode[ch]=0;
+    _gainScale[ch]=1.0;
+    _rangeHold[ch]=0;
+    _lastIntervalPeak[ch]=0;
+    }
+  _autoRangeMask=0;
+  _rangeSettleUntil=0;
+  memset(_energyTotals, 0, sizeof(_energyTotals));
+  _energySigns=0;
+  _energyCheckpointed=0;
+  _freqWindowMs=ADE7953_FREQ_WINDOW_MS;
+  _freqWindowStart=0;
+  _freqStarted=false;
+  _freqLast=0;
+  _freqCycles=0;
+  _freqSamples=0;
+  memset(&_freqAverage, 0, sizeof(_freqAverage));
+  _freqValid=false;
+  _zxPin=-1;
+  _zxWrite=0;
+  _zxRead=0;
+  _zxDropped=0;
+  _zxPeriod=0;
+  zxReset();
+  for (uint8_t o = 0; o < 2; o++) {
+    _cfSource[o]=ADE7953_CF_ACTIVE_A;
+    _cfDen[o]=0x3F;
+    _cfUnit[o]=-1;
+    _cfPulsesPerUnit[o]=1.0;
+    _cfEnergyBase[o]=0;
+    _cfBasePulses[o]=0;
+    _cfWraps[o]=0;
+    _cfCheckPrimed[o]=false;
+    _cfCheckPulses[o]=0;
+    _cfCheckCf[o]=0;
+    _cfCheckReg[o]=0;
+    }
+  _capHead=0;
+  _capFill=0;
+  _capPre=ADE7953_CAPTURE_SAMPLES/4;
+  _capPost=ADE7953_CAPTURE_SAMPLES - ADE7953_CAPTURE_SAMPLES/4;
+  _capArmed=0;
+  _capRemaining=0;
+  memset(&_capPending, 0, sizeof(_capPending));
+  memset(&_capInfo, 0, sizeof(_capInfo));
+  _capLevel[0]=0;
+  _capLevel[1]=0;
+  _capLevel[2]=0;
+  _capLevelUnits[0]=0;
+  _capLevelUnits[1]=0;
+  _capLevelUnits[2]=0;
+  _capZxRising=true;
+  _capZxOffset=0;
+  _capZxTargetValid=false;
+  _capZxTarget=0;
+  _capManual=false;
+  _capIrqPending=false;
+  _capIrqTime=0;
+  _capReady=false;
+  _capMissed=0;
+  _subCycle=NULL;
+  for (uint8_t g = 0; g < ADE7953_GROUPS; g++) {
+    _schedPeriod[g]=0;
+    _schedDue[g]=0;
+    _schedTrigger[g]=0;
+    }
+  memset(&_schedSnapshot, 0, sizeof(_schedSnapshot));
+  _schedPeriodRaw=0;
+  _schedIrqPending=false;
+  _schedLastPoll=0;
+  _configMismatches=0;
+  clearScheduleStats();
+  _cacheEnabled=false;
+  _cacheTTL[ADE7953_CACHE_WAVEFORM]=ADE7953_CACHE_WAVEFORM_US;
+  _cacheTTL[ADE7953_CACHE_POWER]=ADE7953_CACHE_POWER_US;
+  _cacheTTL[ADE7953_CACHE_CYCLE]=ADE7953_CACHE_CYCLE_US;
+  _cacheTTL[ADE7953_CACHE_CONFIG]=ADE7953_CACHE_CONFIG_US;
+  invalidateReadCache();
+  clearReadCacheStats();
+  _derivedMask=ADE7953_FIELDS_ALL;
+  _derivedScale[0]=0;
+  _derivedScale[1]=0;
+  _verifyEvery=ADE7953_VERIFY_EVERY;
+  _verifyCount=0;
+  _retryMax=ADE7953_RETRY_MAX;
+#ifdef ESP32
+  _requestTask=NULL;
+#endif
+  _commStatus=ADE7953_COMM_OK;
+  clearCommStats();
+  }
+//**************************************************
+
+//****************Initialization********************
+void ADE7953::initialize(){
+    
+  #ifdef ADE7953_VERBOSE_DEBUG
+   Serial.print("ADE7953:initialize function started "); 
+  #endif
+
+  busLock.lock();
+  spiBusOpen();  //Leaves the session of a batch another ADE7953 on the bus has open alone
+  pinMode(_SS, OUTPUT);
+  digitalWrite(_SS, HIGH);
+  delay(50);
+  digitalWrite(_SS, LOW); //Enable data transfer by bringing SS line LOW
+  spiTransferByte(spy, 0x00);
+  spiTransferByte(spy, 0xFE);
+  spiTransferByte(spy, WRITE);
+  spiTransferByte(spy, 0x00);
+  spiTransferByte(spy, 0xAD);       
+  spiTransferByte(spy, 0x01);
+  spiTransferByte(spy, 0x20);
+  spiTransferByte(spy, WRITE);
+  spiTransferByte(spy, 0x00);
+  spiTransferByte(spy, 0x30);  
+  digitalWrite(_SS, HIGH); //Disable data transfer by bringing SS line HIGH
+  spiBusClose();
+  busLock.unlock();
+
+  delay(100);
+  #ifdef ADE7953_VERBOSE_DEBUG
+   Serial.print(" ADE7953:initialize function completed "); 
+  #endif
+  
+  //Initial Start-up Init. Commands
+  //spiAlgorithm16_write((functionBitVal(PHCALA_16,1)),(functionBitVal(PHCALA_16,0)),0x00,0x00);
+  //delay(100);
+  spiAlgorithm32_write((functionBitVal(AP_NOLOAD_32,1)),(functionBitVal(AP_NOLOAD_32,0)),0x00,0x00,0x00,0x01); //Check for ensuring read and write operations are okay
+  delay(100);
+  spiAlgorithm8_write((functionBitVal(LCYCMODE_8,1)),(functionBitVal(LCYCMODE_8,0)),0b01111111); //Enable line cycle accumulation mode for all energies and channels
+  delay(100);
+  spiAlgorithm16_write((functionBitVal(LINECYC_16,1)),(functionBitVal(LINECYC_16,0)),0x00,0x78); //Sets number of half line cycle accumulations to 120
+  delay(100);
+
+}
+//**************************************************
+
+void ADE7953::beginBatch(){  //Keeps the SPI bus session open until the matching endBatch(), calls may be nested (also across devices on the bus).  Other tasks wait until then.
+  busLock.lock();
+  if (busBatchDepth == 0) {
+    spy = spiStartBus(VSPI, SPI_CLOCK_DIV16, SPI_MODE3, SPI_MSBFIRST);
+    spiAttachSCK(spy, -1);
+    spiAttachMOSI(spy, -1);
+    spiAttachMISO(spy, -1);
+    }
+  busBatchDepth++;
+  }
+
+void ADE7953::endBatch(){
+  busLock.lock();  //The depth is the bus's, look at it with the lock held
+  if (busBatchDepth == 0) {
+    busLock.unlock();
+    return;
+    }
+  busBatchDepth--;
+  if (busBatchDepth == 0) {
+    spiStopBus(spy);
+    }
+  busLock.unlock();
+  busLock.unlock();  //The hold taken by beginBatch()
+  }
+
+void ADE7953::spiBusOpen(){  //Single register transfers start their own bus session unless a batch is already open, caller holds the bus lock
+  if (busBatchDepth == 0) {
+    spy = spiStartBus(VSPI, SPI_CLOCK_DIV16, SPI_MODE3, SPI_MSBFIRST);
+    spiAttachSCK(spy, -1);
+    spiAttachMOSI(spy, -1);
+    spiAttachMISO(spy, -1);
+    }
+  }
+
+void ADE7953::spiBusClose(){
+  if (busBatchDepth == 0) {
+    spiStopBus(spy);
+    }
+  }
+
+byte ADE7953::functionBitVal(int addr, uint8_t byteVal)
+{
+//Returns as integer an address of a specified byte - basically a byte controlled shift register with "byteVal" controlling the byte that is read and returned
+  int x = ((addr >> (8*byteVal)) & 0xff);
+  #ifdef ADE7953_VERBOSE_DEBUG
+   Serial.print("ADE7953::functionBitVal function details: ");
+   Serial.print("Address input (dec): ");  
+   Serial.print(addr, DEC);
+   Serial.print(" Byte requested (dec): ");  
+   Serial.print(byteVal, DEC);
+   Serial.print(" Returned Value (dec): ");
+   Serial.print(x, DEC);  
+   Serial.print(" Returned Value (HEX): ");
+   Serial.print(x, HEX); 
+   Serial.print(" ADE7953::functionBitVal function completed "); 
+  #endif
+  
+  return x;
+}
+
+uint8_t ADE7953::spiAlgorithm8_read(byte MSB, byte LSB) { //This is the algorithm that reads from a register in the ADE7953. The arguments are the MSB and LSB of the address of the register respectively. The values of the arguments are obtained from the list of functions above.
+  #ifdef ADE7953_VERBOSE_DEBUG
+   Serial.print("ADE7953::spiAlgorithm8_read function started "); 
+  #endif
+  uint8_t readval_unsigned = 0;  //This variable is the unsigned integer value to compile read bytes into (if needed)
+  byte one;
+  byte two; //This may be a dummy read, it looks like the ADE7953 is outputting an extra byte as a 16 bit response even for a 1 byte return
+  
+  uint32_t cached;
+  busLock.lock();  //Held across the cache, the transfer and the checks so other tasks see whole reads
+  if (cacheLookup(MSB, LSB, cached)) {
+    busLock.unlock();
+    return cached;
+    }
+  uint32_t started = micros();
+  spiBusOpen();
+  digitalWrite(_SS, LOW);
+  spiTransferByte(spy, MSB);
+  spiTransferByte(spy, LSB);  
+  spiTransferByte(spy, READ);    
+  one = spiTransferByte(spy, WRITE);
+  two = spiTransferByte(spy, WRITE);
+  digitalWrite(_SS, HIGH);
+  spiBusClose();
+  
+  #ifdef ADE7953_VERBOSE_DEBUG
+   Serial.print("ADE7953::spiAlgorithm8_read function details: ");
+   Serial.print("Address Byte 1(MSB)[HEX]: ");  
+   Serial.print(MSB, HEX);
+   Serial.print(" Address Byte 2(LSB)[HEX]: ");  
+   Serial.print(LSB, HEX);
+   Serial.print(" Returned bytes (1(MSB) and 2 - 2nd is for 16-bit return form): ");
+   Serial.print(one, HEX);
+   Serial.print(" ");
+   Serial.print(two, HEX);
+   Serial.print(" ADE7953::spiAlgorithm8_read function completed "); 
+  #endif
+  
+  //Post-read packing and bitshifting operation
+    readval_unsigned = one;  //Process MSB (nothing much to see here for only one 8 bit value)
+  
+	readval_unsigned = commCheck(MSB, LSB, 8, readval_unsigned, started);  //Optional LAST_ADD/LAST_RWDATA check, counters
+	cacheStore(MSB, LSB, readval_unsigned);
+	busLock.unlock();
+	return readval_unsigned;  //uint8_t versus long because it is only an 8 bit value, function returns uint8_t.
+ }
+  
+
+uint16_t ADE7953::spiAlgorithm16_read(byte MSB, byte LSB) { //This is the algorithm that reads from a register in the ADE7953. The arguments are the MSB and LSB of the address of the register respectively. The values of the arguments are obtained from the list of functions above.
+  #ifdef ADE7953_VERBOSE_DEBUG
+   Serial.print("ADE7953::spiAlgorithm16_read function started "); 
+  #endif
+  uint16_t readval_unsigned = 0;  //This variable is the unsigned integer value to compile read bytes into (if needed)
+  byte one;
+  byte two;
+  
+  uint32_t cached;
+  busLock.lock();  //Held across the cache, the transfer and the checks so other tasks see whole reads
+  if (cacheLookup(MSB, LSB, cached)) {
+    busLock.unlock();
+    return cached;
+    }
+  uint32_t started = micros();
+  spiBusOpen();
+  digitalWrite(_SS, LOW);
+  spiTransferByte(spy, MSB);
+  spiTransferByte(spy, LSB);  
+  spiTransferByte(spy, READ);    
+  one = spiTransferByte(spy, WRITE);
+  two = spiTransferByte(spy, WRITE);
+  digitalWrite(_SS, HIGH);
+  spiBusClose();
+  
+  #ifdef ADE7953_VERBOSE_DEBUG
+   Serial.print("ADE7953::spiAlgorithm16_read function details: ");
+   Serial.print("Address Byte 1(MSB)[HEX]: ");  
+   Serial.print(MSB, HEX);
+   Serial.print(" Address Byte 2(LSB)[HEX]: ");  
+   Serial.print(LSB, HEX);
+   Serial.print(" Returned bytes (1(MSB) and 2) [HEX]: ");
+   Serial.print(one, HEX);
+   Serial.print(" ");
+   Serial.print(two, HEX);
+   Serial.print(" ADE7953::spiAlgorithm16_read function completed "); 
+  #endif
+   
+   //Post-read packing and bitshifting operation
+   //readval_unsigned = (((uint32_t) one << 8) + ((uint32_t) two));  //(Alternate bitshift algorithm)
+   
+   readval_unsigned = (one << 8);  //Process MSB  (Alternate bitshift algorithm)
+   readval_unsigned = readval_unsigned + two;  //Process LSB
+			   
+			readval_unsigned = commCheck(MSB, LSB, 16, readval_unsigned, started);  //Optional LAST_ADD/LAST_RWDATA check, counters
+			cacheStore(MSB, LSB, readval_unsigned);
+			busLock.unlock();
+			return readval_unsigned;	
+    }
+  
+
+
+uint32_t ADE7953::spiAlgorithm24_read(byte MSB, byte LSB) { //This is the algorithm that reads from a register in the ADE7953. The arguments are the MSB and LSB of the address of the register respectively. The values of the arguments are obtained from the list of functions above.
+  #ifdef ADE7953_VERBOSE_DEBUG
+   Serial.print("ADE7953::spiAlgorithm24_read function started "); 
+  #endif 
+  //long readval_signed=0;
+  uint32_t readval_unsigned = 0;  //This variable is the unsigned integer value to compile read bytes into (if needed)
+  byte one;
+  byte two;
+  byte three;
+  
+  uint32_t cached;
+  busLock.lock();  //Held across the cache, the transfer and the checks so other tasks see whole reads
+  if (cacheLookup(MSB, LSB, cached)) {
+    busLock.unlock();
+    return cached;
+    }
+  uint32_t started = micros();
+  spiBusOpen();
+  digitalWrite(_SS, LOW);
+  spiTransferByte(spy, MSB);
+  spiTransferByte(spy, LSB);  
+  spiTransferByte(spy, READ);    
+  one = spiTransferByte(spy, WRITE);
+  two = spiTransferByte(spy, WRITE);
+  three = spiTransferByte(spy, WRITE);
+  digitalWrite(_SS, HIGH);
+  spiBusClose();
+
+   
+ #ifdef ADE7953_VERBOSE_DEBUG
+   Serial.print("ADE7953::spiAlgorithm24_read function details: ");
+   Serial.print("Address Byte 1(MSB)[HEX]: ");  
+   Serial.print(MSB, HEX);
+   Serial.print(" Address Byte 2(LSB)[HEX]: ");  
+   Serial.print(LSB, HEX);
+   Serial.print(" Returned bytes (1(MSB) to 3)[HEX]: ");
+   Serial.print(one, HEX);
+   Serial.print(" ");
+   Serial.print(two, HEX);
+   Serial.print(" ");
+   Serial.print(three, HEX);
+   Serial.print(" ADE7953::spiAlgorithm24_read function completed "); 
+  #endif
+
+  //Post-read packing and bitshifting operation
+  readval_unsigned = (((uint32_t) one << 16)+ ((uint32_t) two << 8) + ((uint32_t) three)); //(Alternative shift algorithm)
+   
+			readval_unsigned = commCheck(MSB, LSB, 24, readval_unsigned, started);  //Optional LAST_ADD/LAST_RWDATA check, counters
+			cacheStore(MSB, LSB, readval_unsigned);
+			busLock.unlock();
+			return readval_unsigned;
+  }
+  
+
+uint32_t ADE7953::spiAlgorithm32_read(byte MSB, byte LSB) { //This is the algorithm that reads from a 32 bit register in the ADE7953. The arguments are the MSB and LSB of the address of the register respectively. The values of the arguments are obtained from the list of functions above.  Caution, some register elements contain information that is only 24 bit with padding on the MSB
+  #ifdef ADE7953_VERBOSE_DEBUG
+   Serial.print("ADE7953::spiAlgorithm32_read function started "); 
+  #endif 
+  uint32_t readval_unsigned = 0;  //This variable is the unsigned integer value to compile read bytes into (if needed)
+  byte one;
+  byte two;
+  byte three;
+  byte four;
+
+  uint32_t cached;
+  busLock.lock();  //Held across the cache, the transfer and the checks so other tasks see whole reads
+  if (cacheLookup(MSB, LSB, cached)) {
+    busLock.unlock();
+    return cached;
+    }
+  uint32_t started = micros();
+  spiBusOpen();
+  digitalWrite(_SS, LOW);
+  spiTransferByte(spy, MSB);
+  spiTransferByte(spy, LSB);  
+  spiTransferByte(spy, READ);    
+  one = spiTransferByte(spy, WRITE);
+  two = spiTransferByte(spy, WRITE);
+  three = spiTransferByte(spy, WRITE);
   four = spiTransferByte(spy, WRITE);	
   digitalWrite(_SS, HIGH);
-  spiStopBus(spy);
+  spiBusClose();
   
   #ifdef ADE7953_VERBOSE_DEBUG
    Serial.print("ADE7953::spiAlgorithm32_read function details: ");
@@ -957,6 +3117,9 @@ uint32_t ADE7953::spiAlgorithm32_read(byte MSB, byte LSB) { //This is the algori
   readval_unsigned = (readval_unsigned + (four));  //Process LSB
   Serial.println(readval_unsigned, BIN);  */
 
+  readval_unsigned = commCheck(MSB, LSB, 32, readval_unsigned, started);  //Optional LAST_ADD/LAST_RWDATA check, counters
+  cacheStore(MSB, LSB, readval_unsigned);
+  busLock.unlock();
   return readval_unsigned;
 }
 
@@ -966,10 +3129,11 @@ void ADE7953::spiAlgorithm32_write(byte MSB, byte LSB, byte onemsb, byte two, by
    Serial.print(" spiAlgorithm32_write function started "); 
   #endif 
 
-  spy = spiStartBus(VSPI, SPI_CLOCK_DIV16, SPI_MODE3, SPI_MSBFIRST);
-  spiAttachSCK(spy, -1);
-  spiAttachMOSI(spy, -1);
-  spiAttachMISO(spy, -1);
+  busLock.lock();
+  if (_cacheEnabled) {
+    invalidateReadCache();  //A write can change other registers' readings too
+    }
+  spiBusOpen();
   digitalWrite(_SS, LOW);
   spiTransferByte(spy, MSB);
   spiTransferByte(spy, LSB);
@@ -979,7 +3143,8 @@ void ADE7953::spiAlgorithm32_write(byte MSB, byte LSB, byte onemsb, byte two, by
   spiTransferByte(spy, three);
   spiTransferByte(spy, fourlsb); 	
   digitalWrite(_SS, HIGH);
-  spiStopBus(spy);
+  spiBusClose();
+  busLock.unlock();
 
   
   #ifdef ADE7953_VERBOSE_DEBUG
@@ -1005,10 +3170,11 @@ void ADE7953::spiAlgorithm32_write(byte MSB, byte LSB, byte onemsb, byte two, by
    Serial.print(" spiAlgorithm24_write function started "); 
   #endif
 
-  spy = spiStartBus(VSPI, SPI_CLOCK_DIV16, SPI_MODE3, SPI_MSBFIRST);
-  spiAttachSCK(spy, -1);
-  spiAttachMOSI(spy, -1);
-  spiAttachMISO(spy, -1);
+  busLock.lock();
+  if (_cacheEnabled) {
+    invalidateReadCache();  //A write can change other registers' readings too
+    }
+  spiBusOpen();
   digitalWrite(_SS, LOW);
   spiTransferByte(spy, MSB);
   spiTransferByte(spy, LSB);
@@ -1017,7 +3183,8 @@ void ADE7953::spiAlgorithm32_write(byte MSB, byte LSB, byte onemsb, byte two, by
   spiTransferByte(spy, two);
   spiTransferByte(spy, threelsb);
   digitalWrite(_SS, HIGH);
-  spiStopBus(spy);
+  spiBusClose();
+  busLock.unlock();
 
   #ifdef ADE7953_VERBOSE_DEBUG
    Serial.print("ADE7953::spiAlgorithm24_read function details: ");
@@ -1040,10 +3207,11 @@ void ADE7953::spiAlgorithm16_write(byte MSB, byte LSB, byte onemsb, byte twolsb)
    Serial.print(" spiAlgorithm16_write function started "); 
   #endif
 
-  spy = spiStartBus(VSPI, SPI_CLOCK_DIV16, SPI_MODE3, SPI_MSBFIRST);
-  spiAttachSCK(spy, -1);
-  spiAttachMOSI(spy, -1);
-  spiAttachMISO(spy, -1);
+  busLock.lock();
+  if (_cacheEnabled) {
+    invalidateReadCache();  //A write can change other registers' readings too
+    }
+  spiBusOpen();
   digitalWrite(_SS, LOW);
   spiTransferByte(spy, MSB);
   spiTransferByte(spy, LSB);
@@ -1051,7 +3219,8 @@ void ADE7953::spiAlgorithm16_write(byte MSB, byte LSB, byte onemsb, byte twolsb)
   spiTransferByte(spy, onemsb);
   spiTransferByte(spy, twolsb);
   digitalWrite(_SS, HIGH);
-  spiStopBus(spy);
+  spiBusClose();
+  busLock.unlock();
 
   #ifdef ADE7953_VERBOSE_DEBUG
    Serial.print("ADE7953::spiAlgorithm16_read function details: ");
@@ -1072,17 +3241,19 @@ void ADE7953::spiAlgorithm8_write(byte MSB, byte LSB, byte onemsb) { //This is t
    Serial.print(" spiAlgorithm8_write function started "); 
   #endif
 
-  spy = spiStartBus(VSPI, SPI_CLOCK_DIV16, SPI_MODE3, SPI_MSBFIRST);
-  spiAttachSCK(spy, -1);
-  spiAttachMOSI(spy, -1);
-  spiAttachMISO(spy, -1);  
+  busLock.lock();
+  if (_cacheEnabled) {
+    invalidateReadCache();  //A write can change other registers' readings too
+    }
+  spiBusOpen();
   digitalWrite(_SS, LOW);
   spiTransferByte(spy, MSB);
   spiTransferByte(spy, LSB);
   spiTransferByte(spy, WRITE);
   spiTransferByte(spy, onemsb);
   digitalWrite(_SS, HIGH);
-  spiStopBus(spy);
+  spiBusClose();
+  busLock.unlock();
 
 
   #ifdef ADE7953_VERBOSE_DEBUG
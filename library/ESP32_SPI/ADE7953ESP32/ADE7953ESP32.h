@@ -11,11 +11,252 @@
 
 #include "Arduino.h" //this includes the arduino library header. It makes all the Arduino functions available in this tab.
 #include "esp32-hal-spi.h"
+#include "ADE7953Calibration.h"
+#include "ADE7953Deadband.h"
+#include "ADE7953AutoRange.h"
+#include "ADE7953Derived.h"
+#include "ADE7953Telemetry.h"  //Also defines ADE7953EnergyTotals
+#include "ADE7953Checkpoint.h"
+#include "ADE7953SubCycleRms.h"
+#include "ADE7953RegisterMap.h"
+#include "ADE7953Lock.h"
 
 const unsigned int READ = 0b10000000;  //This value tells the ADE7953 that data is to be read from the requested register.
 const unsigned int WRITE = 0b00000000; //This value tells the ADE7953 that data is to be written to the requested register.
 const int SPI_freq = 1000000;//Communicate with the ADE7953 at 1 MHz frequency, this is the default value
 
+//Interrupt bits, identical positions in IRQENA/IRQSTATA/RSTIRQSTATA (Channel A and voltage) and IRQENB/IRQSTATB/RSTIRQSTATB (Channel B, bits 0-13 only).  See the register notes in the .cpp file.
+#define ADE7953_IRQ_AEHF (1UL << 0)
+#define ADE7953_IRQ_VAREHF (1UL << 1)
+#define ADE7953_IRQ_VAEHF (1UL << 2)
+#define ADE7953_IRQ_AEOF (1UL << 3)
+#define ADE7953_IRQ_VAREOF (1UL << 4)
+#define ADE7953_IRQ_VAEOF (1UL << 5)
+#define ADE7953_IRQ_AP_NOLOAD (1UL << 6)
+#define ADE7953_IRQ_VAR_NOLOAD (1UL << 7)
+#define ADE7953_IRQ_VA_NOLOAD (1UL << 8)
+#define ADE7953_IRQ_APSIGN (1UL << 9)
+#define ADE7953_IRQ_VARSIGN (1UL << 10)
+#define ADE7953_IRQ_ZXTO_I (1UL << 11)
+#define ADE7953_IRQ_ZXI (1UL << 12)
+#define ADE7953_IRQ_OI (1UL << 13)
+#define ADE7953_IRQ_ZXTO (1UL << 14) //Channel A register only from here on
+#define ADE7953_IRQ_ZXV (1UL << 15)
+#define ADE7953_IRQ_OV (1UL << 16)
+#define ADE7953_IRQ_WSMP (1UL << 17)
+#define ADE7953_IRQ_CYCEND (1UL << 18)
+#define ADE7953_IRQ_SAG (1UL << 19)
+#define ADE7953_IRQ_RESET (1UL << 20)
+#define ADE7953_IRQ_CRC (1UL << 21)
+
+//Power quality event types reported by the event log (see configurePowerQuality())
+#define ADE7953_PQ_SAG 0   //Voltage stayed below SAGLVL for SAGCYC half line cycles
+#define ADE7953_PQ_OV 1    //Voltage peak exceeded OVLVL
+#define ADE7953_PQ_OIA 2   //Current Channel A peak exceeded OILVL
+#define ADE7953_PQ_OIB 3   //Current Channel B peak exceeded OILVL
+#define ADE7953_PQ_ZXTO 4  //No voltage zero crossing for the ZXTOUT period
+#define ADE7953_PQ_TYPES 5
+
+//The waveform and peak registers (SAGLVL, OVLVL, OILVL, xPEAK) swing +/-6,500,000 codes at full scale while VRMS/IRMS read
+//9,032,007 for a full scale sine, so peak codes x ADE7953_PEAK_SCALE are on the scale the Vrms/Irms gains were found for
+#define ADE7953_RMS_FULLSCALE 9032007UL
+#define ADE7953_PEAK_SCALE (1.41421356f*ADE7953_RMS_FULLSCALE/ADE7953_WAVEFORM_FULLSCALE)  //1.965
+
+#ifndef ADE7953_PQ_LOG_SIZE
+#define ADE7953_PQ_LOG_SIZE 16 //Number of completed power quality events kept, the oldest is overwritten when full
+#endif
+
+struct ADE7953PQEvent {
+  uint8_t type;             //ADE7953_PQ_xxx
+  unsigned long timestamp;  //millis() at the moment the ADE7953 raised its IRQ line (or the poll that found it)
+  unsigned long duration;   //ms from timestamp until the condition was seen to clear
+  float peak;               //Lowest voltage peak for a sag, highest voltage/current peak otherwise (calibrated peak units)
+};
+
+
+//Measurement channels, also the index order of the peak arrays
+#define ADE7953_CHANNEL_V 0
+#define ADE7953_CHANNEL_A 1
+#define ADE7953_CHANNEL_B 2
+
+//PGA auto-ranging (see serviceAutoRange(), full scale and thresholds in ADE7953AutoRange.h)
+#define ADE7953_RANGE_SETTLE_MS 500  //Snapshots taken this long after a gain change are flagged ADE7953_SNAPSHOT_RANGING
+
+//Snapshot flags
+#define ADE7953_SNAPSHOT_RANGING 0x01  //A PGA gain changed during or shortly before this interval
+
+#ifndef ADE7953_PEAK_HISTORY
+#define ADE7953_PEAK_HISTORY 16 //Number of reporting intervals kept by the peak tracker
+#endif
+
+//Line frequency and phase angle (see serviceFrequency())
+#define ADE7953_PERIOD_CLOCK 223750UL //Period and ANGLE_A/ANGLE_B count at 223.75 kHz, f = 223750/(Period + 1)
+#ifndef ADE7953_FREQ_WINDOW_MS
+#define ADE7953_FREQ_WINDOW_MS 100 //Default averaging window, gives a 10 Hz update rate
+#endif
+
+struct ADE7953Frequency {  //One completed frequency averaging window
+  unsigned long timestamp;  //millis() when the window closed
+  uint32_t milliHz;         //Mean line frequency over the window (cycles counted / time covered)
+  int32_t rocof;            //df/dt against the previous window in mHz per second
+  uint16_t samples;         //Period readings taken in the window, each weighted by the time it covers
+};
+
+//Zero crossing timestamps from the ZX pin (see attachZeroCross())
+#ifndef ADE7953_ZX_RING_SIZE
+#define ADE7953_ZX_RING_SIZE 32 //Crossings kept by the pin interrupt, must be a power of two
+#endif
+#define ADE7953_ZX_ALPHA 0.2   //Tracking filter gain on the crossing time
+#define ADE7953_ZX_BETA 0.02   //Tracking filter gain on the period
+#define ADE7953_ZX_LOCK 4      //Consecutive crossings inside the gate before predictions are offered
+#define ADE7953_ZX_MIN_PERIOD_US 14000UL  //Accepted line period range, about 40-70 Hz
+#define ADE7953_ZX_MAX_PERIOD_US 25000UL
+
+struct ADE7953ZeroCross {
+  uint32_t timestamp;  //micros() taken in the pin interrupt
+  bool rising;         //true for a negative to positive going voltage crossing
+};
+
+//CF1/CF2 output sources, the CF1SEL/CF2SEL codes of CFMODE (see configureCF())
+#define ADE7953_CF_ACTIVE_A 0
+#define ADE7953_CF_REACTIVE_A 1
+#define ADE7953_CF_APPARENT_A 2
+#define ADE7953_CF_IRMS_A 3
+#define ADE7953_CF_ACTIVE_B 4
+#define ADE7953_CF_REACTIVE_B 5
+#define ADE7953_CF_APPARENT_B 6
+#define ADE7953_CF_IRMS_B 7
+#define ADE7953_CF_IRMS_AB 8
+#define ADE7953_CF_ACTIVE_AB 9
+#define ADE7953_CF_PCNT_LIMIT 30000  //PCNT counts up to this value, each wrap is added by the limit interrupt
+#define ADE7953_CF_PCNT_FILTER 1023  //PCNT glitch filter in APB clock cycles (about 12.8 us)
+
+//Triggered waveform capture (see armCapture())
+#ifndef ADE7953_CAPTURE_SAMPLES
+#define ADE7953_CAPTURE_SAMPLES 256 //Pre-trigger ring and capture slot length, 16 bytes per sample each
+#endif
+#define ADE7953_CAPTURE_OI 0x01      //Overcurrent IRQ (OIA or OIB, level from configurePowerQuality())
+#define ADE7953_CAPTURE_LEVEL 0x02   //A sample beyond the software level set with setCaptureLevel()
+#define ADE7953_CAPTURE_ZX 0x04      //A fixed time after a predicted voltage zero crossing (needs attachZeroCross())
+#define ADE7953_CAPTURE_MANUAL 0x08  //triggerCapture()
+
+struct ADE7953WaveformSample {
+  uint32_t time;  //micros() when the read started
+  int32_t v;      //V, IA, IB waveform registers, same raw scale as getInstVoltage()/getInstCurrentA()/getInstCurrentB()
+  int32_t ia;
+  int32_t ib;
+};
+
+struct ADE7953CaptureInfo {
+  uint8_t trigger;       //ADE7953_CAPTURE_xxx that fired
+  uint32_t triggerTime;  //micros() of the trigger event: IRQ edge, triggering sample or scheduled ZX-relative time
+  uint32_t latency;      //us from triggerTime until the trigger was acted on
+  uint16_t pre;          //Samples before the trigger (fewer than configured if the ring had not filled yet)
+  uint16_t samples;      //Total samples in the slot, samples[pre] is the first at or after the trigger
+};
+
+//Multi-rate read scheduler register groups (see setSchedule())
+#define ADE7953_GROUP_POWER 0   //AWATT, BWATT, AVAR, BVAR, AVA, BVA
+#define ADE7953_GROUP_RMS 1     //VRMS, IRMSA, IRMSB
+#define ADE7953_GROUP_PF 2      //PFA, PFB, ANGLE_A, ANGLE_B
+#define ADE7953_GROUP_PERIOD 3  //Period (also feeds the frequency averaging window)
+#define ADE7953_GROUP_ENERGY 4  //accumulateEnergy()
+#define ADE7953_GROUP_PEAKS 5   //Read-with-reset peaks, folded into the snapshot interval peaks
+#define ADE7953_GROUP_CONFIG 6  //LCYCMODE and PGA_V/PGA_IA/PGA_IB compared with the library's settings (detects a chip reset)
+#define ADE7953_GROUPS 7
+#define ADE7953_SCHED_WSMP 0x01    //Read the group once per new waveform sample (6.99 kHz, every 143 us)
+#define ADE7953_SCHED_CYCEND 0x02  //Read the group at the end of each LINECYC accumulation (CYCEND)
+#define ADE7953_SCHED_WSMP_US 143  //Waveform and instantaneous power update interval
+#define ADE7953_SCHED_MAX_MS 0x7FFFFFFFUL  //Longest timer period, longer ones are clamped
+#define ADE7953_LCYCMODE_RESET 0x40  //LCYCMODE after a chip reset, initialize() sets 0x7F
+#ifndef ADE7953_SCHED_POLL_MS
+#define ADE7953_SCHED_POLL_MS 10   //Status polling interval for CYCEND triggers when no IRQ pin is attached
+#endif
+#ifndef ADE7953_SCHED_LOOKAHEAD
+#define ADE7953_SCHED_LOOKAHEAD 0.25 //Groups due within this fraction of their period join a burst that is going out anyway
+#endif
+
+struct ADE7953ScheduleStats {
+  unsigned long reads;    //Times the group was read
+  unsigned long misses;   //Whole periods skipped because serviceSchedule() came too late
+  uint32_t maxLate;       //Worst lateness against the due time, ms
+  uint32_t lastRead;      //micros() of the last read
+};
+
+//Register read cache (see enableReadCache()), freshness classes by how often the ADE7953 updates the register
+#define ADE7953_CACHE_WAVEFORM 0  //IA, IB, V: new sample every 143 us
+#define ADE7953_CACHE_POWER 1     //Powers, RMS, non-resetting peaks, ACCMODE sign bits: low pass filtered, settle over hundreds of ms
+#define ADE7953_CACHE_CYCLE 2     //PF, ANGLE, Period: updated once per line cycle
+#define ADE7953_CACHE_CONFIG 3    //Everything else: changes only when written (or by a chip reset)
+#define ADE7953_CACHE_CLASSES 4
+#define ADE7953_CACHE_NONE 0xFF   //Never cached: read-with-reset energies/peaks/status, LAST_OP/LAST_ADD/LAST_RWDATA
+#ifndef ADE7953_CACHE_SIZE
+#define ADE7953_CACHE_SIZE 24     //Registers held at once, the oldest entry is replaced when full
+#endif
+#define ADE7953_CACHE_WAVEFORM_US 143UL   //Default freshness windows
+#define ADE7953_CACHE_POWER_US 10000UL
+#define ADE7953_CACHE_CYCLE_US 10000UL
+#define ADE7953_CACHE_CONFIG_US 1000000UL
+
+//Communication checks (see setReadVerify())
+#define ADE7953_COMM_OK 0
+#define ADE7953_COMM_MISMATCH 1     //LAST_ADD/LAST_RWDATA still disagreed with the read after the last retry
+#define ADE7953_COMM_NO_RESPONSE 2  //The check read back 0x0000/0xFFFF: no chip answering, or MISO stuck
+#define ADE7953_COMM_BAD_ADDRESS 3  //readRegister()/readField() asked for something that does not exist
+#ifndef ADE7953_VERIFY_EVERY
+#define ADE7953_VERIFY_EVERY 0      //Default check rate, 0 = off
+#endif
+#ifndef ADE7953_RETRY_MAX
+#define ADE7953_RETRY_MAX 3
+#endif
+#define ADE7953_RETRY_BACKOFF_US 50 //First retry delay, doubled for each further retry
+#define ADE7953_LATENCY_BINS 8      //Bin n counts reads faster than 16 << n us, the last bin everything slower
+
+struct ADE7953CommStats {
+  unsigned long reads;       //Register reads that went to the bus (cache hits not counted)
+  unsigned long verified;    //Reads checked against LAST_ADD/LAST_RWDATA
+  unsigned long retries;
+  unsigned long errors;      //Checked reads still wrong after the last retry
+  unsigned long noResponse;  //Checked reads that found nothing answering
+  uint32_t maxLatency;       //us, read including its check and retries
+  unsigned long latency[ADE7953_LATENCY_BINS];
+};
+
+struct ADE7953Peaks {
+  float vpeak;   //Calibrated peak units (register x ADE7953_PEAK_SCALE / Vrms or Irms gain), for a sine wave peak = RMS x 1.414
+  float ipeakA;
+  float ipeakB;
+};
+
+struct ADE7953Snapshot {  //One reporting interval, filled by readSnapshot() in a single bus session
+  unsigned long timestamp;  //millis() when the batch was read
+  float vrms;
+  float irmsA;
+  float irmsB;
+  float activePowerA;  //Signed: negative while exporting
+  float activePowerB;
+  float reactivePowerA;
+  float reactivePowerB;
+  float apparentPowerA;
+  float apparentPowerB;
+  float powerFactorA;
+  float powerFactorB;
+  float period;
+  float frequency;     //Hz, from the same Period reading
+  float phaseAngleA;   //Degrees between the voltage and the Current Channel A zero crossings (ANGLE_A); readDerived() gives atan2(Q, P) instead
+  float phaseAngleB;
+  ADE7953Peaks peaks;  //Highest peaks since the previous snapshot (read-with-reset registers)
+  uint8_t flags;       //ADE7953_SNAPSHOT_xxx
+};
+
+//Derived quantities (see readDerived() and ADE7953Derived.h)
+struct ADE7953DerivedCheck {  //Derived against chip values, worst of the loaded channels
+  uint8_t channels;       //Bit 0 Channel A, bit 1 Channel B compared (loaded)
+  float apparentError;    //Relative error of the VRMS x IRMS apparent power
+  float apparentErrorPQ;  //Relative error of sqrt(P^2 + Q^2), grows with harmonic content
+  float pfError;          //Power factor error in PF units (1.0 = full scale)
+  float angleError;       //Degrees between |atan2(Q, P)| and |ANGLE register|: two different angles, equal only for sinusoids
+};
 
 class ADE7953 {
   public:
@@ -55,6 +296,11 @@ class ADE7953 {
 	float getInstActivePowerB();
 	float getInstReactivePowerA();
 	float getInstReactivePowerB();
+	float getSignedActivePowerA();
+	float getSignedActivePowerB();
+	float getFrequency();
+	float getPhaseAngleA();
+	float getPhaseAngleB();
 	
 
 	byte functionBitVal(int addr, uint8_t byteVal);
@@ -65,10 +311,301 @@ class ADE7953 {
 	
 	
 	float decimalize(long input, float factor, float offset);
+	
+	//Power quality (sag, overvoltage, overcurrent, missing zero crossing) detected by the ADE7953 itself
+	void configurePowerQuality(float sagLevel, uint8_t sagHalfCycles, float ovLevel, float oiLevel, unsigned int zxTimeoutMs);
+	void attachIRQ(int irqPin);
+	void servicePowerQuality();
+	uint8_t getPQActive();
+	uint8_t getPQEventCount();
+	bool getPQEvent(uint8_t index, ADE7953PQEvent &event);
+	unsigned long getPQEventsDropped();
+	void clearPQEvents();
+	void readIrqStatus(uint32_t &statusA, uint32_t &statusB);
+	
+	//Batched reads: everything between beginBatch() and endBatch() shares one SPI bus session
+	void beginBatch();
+	void endBatch();
+	void readSnapshot(ADE7953Snapshot &snapshot);
+	uint8_t getPeakHistoryCount();
+	bool getPeakHistory(uint8_t index, ADE7953Peaks &peaks);
+	void getRollingPeaks(ADE7953Peaks &peaks);
+	static float snapshotField(const ADE7953Snapshot &snapshot, uint8_t field);
+	static void snapshotValues(const ADE7953Snapshot &snapshot, float *values);
+	static float telemetryResolution(uint8_t field);
+	
+	//PGA gain and auto-ranging
+	void setPGAGain(uint8_t channel, uint8_t gainCode);
+	uint8_t getPGAGain(uint8_t channel);
+	void enableAutoRange(uint8_t channelMask);
+	bool serviceAutoRange();
+	static uint8_t autoRangeStep(uint8_t gainCode, uint8_t maxCode, uint32_t peakCounts, uint8_t &holdCount);
+	
+	//Calibration solved into the ADE7953 gain/offset registers (see ADE7953Calibration.h)
+	bool addCalibrationPoint(ADE7953Calibration &calibration, uint8_t quantity, float reference, uint8_t samples);
+	uint8_t applyCalibration(ADE7953Calibration &calibration);
+	void readCalibrationRegisters(uint8_t quantity, ADE7953CalRegisters &registers);
+	void writeCalibrationRegisters(uint8_t quantity, const ADE7953CalRegisters &registers);
+	bool calibratePhase(uint8_t channel, float referencePF, bool lagging, uint8_t maxIterations, float toleranceDeg, ADE7953PhaseCalResult &result);
+	bool measureLineCycleAngle(uint8_t channel, float &angleDeg);
+	
+	//Import/export and four-quadrant energy totals
+	void accumulateEnergy();
+	void getEnergyTotals(uint8_t channel, ADE7953EnergyTotals &totals);
+	void setEnergyTotals(uint8_t channel, const ADE7953EnergyTotals &totals);
+	uint8_t getEnergySigns();
+	bool restoreEnergy(ADE7953Checkpoint &checkpoint);
+	bool checkpointEnergy(ADE7953Checkpoint &checkpoint);
+	
+	//Averaged line frequency and rate of change
+	void setFrequencyWindow(unsigned int windowMs);
+	bool serviceFrequency();
+	bool getFrequencyAverage(ADE7953Frequency &average);
+	static float periodToHz(uint16_t period);
+	static float angleToDegrees(int16_t angle, uint16_t period);
+	
+	//Zero crossing timestamps and prediction from the ZX pin
+	void attachZeroCross(int zxPin);
+	uint8_t serviceZeroCross();
+	bool isZeroCrossLocked();
+	float getZeroCrossPeriod();
+	float getZeroCrossFrequency();
+	bool predictZeroCross(bool rising, uint32_t now, uint32_t &timestamp);
+	uint8_t getZeroCrossings(ADE7953ZeroCross *crossings, uint8_t count);
+	unsigned long getZeroCrossDropped();
+	
+	//Energy from the CF1/CF2 pulse outputs, counted by the ESP32 PCNT without bus traffic
+	void configureCF(uint8_t output, uint8_t source, uint16_t denominator);
+	bool attachCFCounter(uint8_t output, int pin, uint8_t pcntUnit, float pulsesPerUnit);
+	uint64_t getCFPulses(uint8_t output);
+	double getCFEnergy(uint8_t output);
+	bool getCFCrossCheck(uint8_t output, float &ratio);
+	void clearCFCrossCheck(uint8_t output);
+	
+	//Triggered waveform capture with a pre-trigger buffer
+	bool configureCapture(uint16_t preSamples, uint16_t postSamples);
+	void setCaptureLevel(uint8_t channel, float level);
+	void setCaptureZeroCross(bool rising, uint32_t offsetUs);
+	void armCapture(uint8_t triggers);
+	void triggerCapture();
+	bool sampleWaveform();
+	bool serviceCapture(unsigned long budgetUs);
+	bool isCaptureArmed();
+	bool getCapture(ADE7953CaptureInfo &info);
+	const ADE7953WaveformSample *getCaptureSamples();
+	void releaseCapture();
+	unsigned long getCaptureMissed();
+	
+	//Half/full-cycle RMS computed from the waveform samples (see ADE7953SubCycleRms.h)
+	void attachSubCycleRms(ADE7953SubCycleRms *rms);
+	bool getSubCycleRms(ADE7953CycleRms &rms);
+	
+	//Multi-rate read scheduler: each register group on its own period or status trigger, due groups read in one bus burst
+	void setSchedule(uint8_t group, unsigned long periodMs);
+	void setScheduleTrigger(uint8_t group, uint8_t triggers);
+	uint8_t serviceSchedule();
+	void getScheduled(ADE7953Snapshot &snapshot);
+	bool getScheduleStats(uint8_t group, ADE7953ScheduleStats &stats);
+	void getScheduleBusStats(unsigned long &bursts, uint32_t &busUs);
+	unsigned long getConfigMismatches();
+	void clearScheduleStats();
+	
+	//Register read cache: repeated reads inside the freshness window are answered from RAM
+	void enableReadCache(bool enable);
+	void setCacheTTL(uint8_t cacheClass, uint32_t ttlUs);
+	void invalidateReadCache();
+	void getReadCacheStats(unsigned long &hits, unsigned long &misses);
+	void clearReadCacheStats();
+	static uint8_t cacheClass(uint16_t addr);
+	
+	//Apparent power, power factor and angle computed from the registers read anyway
+	void setDerivedQuantities(uint32_t fieldMask);
+	uint8_t readDerived(ADE7953Snapshot &snapshot);
+	uint8_t getDerivedReadCount();
+	bool verifyDerived(ADE7953DerivedCheck &check);
+	
+	//Whole register map in one bus session (see ADE7953RegisterMap.h)
+	uint8_t dumpRegisters(ADE7953RegisterImage &image);
+	uint8_t diffRegisters(const ADE7953RegisterImage &reference, ADE7953RegisterDiff *diffs, uint8_t maxDiffs);
+	
+	//Read verification through LAST_ADD/LAST_RWDATA, retries and communication health counters
+	void setReadVerify(uint16_t everyN, uint8_t retries = ADE7953_RETRY_MAX);
+	uint8_t getCommStatus();
+	void clearCommStatus();
+	void getCommStats(ADE7953CommStats &stats);
+	void clearCommStats();
+	uint8_t readRegister(uint16_t addr, uint32_t &value);
+	uint8_t readField(uint8_t field, float &value);
+	
+	//Sharing the device between tasks and interrupt handlers (see ADE7953Lock.h)
+	bool IRAM_ATTR requestRead(uint16_t addr, ADE7953RequestDone done, void *arg);
+	uint8_t serviceRequests();
+	unsigned long getDroppedRequests();
+#ifdef ESP32
+	void setRequestTask(TaskHandle_t task);
+#endif
+	void getLockStats(ADE7953LockStats &stats);
+	void clearLockStats();
   
   private:
   	int _SS;
     int _SPI_freq;
+	
+	void spiBusOpen();
+	void spiBusClose();
+	
+	static void IRAM_ATTR irqHandler(void *arg);
+	void readResetPeaks(uint32_t &vPeak, uint32_t &iaPeak, uint32_t &ibPeak);
+	void pqOpen(uint8_t type, unsigned long timestamp, float peak);
+	void pqClose(uint8_t type, unsigned long now);
+	void writePQLevels();
+	float peakUnits(uint32_t counts, uint8_t channel);
+	uint32_t peakCounts(float level, uint8_t channel);
+	void writeCaptureLevel(uint8_t channel);
+	bool waitForIrq(uint32_t bitsA, unsigned long timeoutMs);
+	static bool phaseCalWindow(void *context, int16_t phcal, double &angleDeg);
+	void accumulateEnergy(long *active, long *reactive);
+	
+	int _irqPin;
+	volatile bool _irqPending;
+	volatile unsigned long _irqTimestamp;
+	uint32_t _irqLatchA;  //Status bits collected by readIrqStatus() not yet consumed by a service routine
+	uint32_t _irqLatchB;
+	
+	float _pqLevel[3];  //Sag, overvoltage and overcurrent levels as configured (calibrated peak units)
+	bool _pqConfigured;
+	uint32_t _sagLevel;  //Thresholds in raw peak register counts
+	uint32_t _ovLevel;
+	uint32_t _oiLevel;
+	unsigned long _zxTimeoutMs;
+	unsigned long _zxtoLastSeen;
+	uint8_t _pqOpenMask;
+	ADE7953PQEvent _pqOpen[ADE7953_PQ_TYPES];
+	ADE7953PQEvent _pqLog[ADE7953_PQ_LOG_SIZE];
+	uint8_t _pqHead;
+	uint8_t _pqCount;
+	unsigned long _pqDropped;
+	
+	uint32_t _intervalPeak[3];  //V, IA, IB raw peaks gathered since the last snapshot
+	uint32_t _lastIntervalPeak[3];  //Raw peaks of the last completed snapshot interval, used by the auto-ranging
+	ADE7953Peaks _peakHistory[ADE7953_PEAK_HISTORY];
+	uint8_t _peakHistoryHead;
+	uint8_t _peakHistoryCount;
+	
+	uint8_t _pgaCode[3];     //PGA_V, PGA_IA, PGA_IB settings
+	float _gainScale[3];     //Analog gain applied on each channel relative to the calibration
+	uint8_t _rangeHold[3];
+	uint8_t _autoRangeMask;
+	unsigned long _rangeSettleUntil;
+	
+	ADE7953EnergyTotals _energyTotals[2];
+	uint8_t _energySigns;
+	uint64_t _energyCheckpointed;  //Active import + export of both channels at the last checkpoint
+	uint64_t energyMoved();
+	
+	bool addFrequencySample(uint16_t period, unsigned long now);
+	unsigned int _freqWindowMs;
+	unsigned long _freqWindowStart;
+	unsigned long _freqLast;  //millis() of the previous Period reading
+	bool _freqStarted;
+	uint64_t _freqCycles;  //Sum of mHz x ms over the open window, i.e. line cycles counted
+	uint16_t _freqSamples;
+	ADE7953Frequency _freqAverage;
+	bool _freqValid;
+	
+	static void IRAM_ATTR zxHandler(void *arg);
+	void zxTrack(uint32_t timestamp, bool rising);
+	void zxReset();
+	int _zxPin;
+	volatile uint32_t _zxTime[ADE7953_ZX_RING_SIZE];  //Written only by zxHandler()
+	volatile uint8_t _zxRising[ADE7953_ZX_RING_SIZE];
+	volatile uint32_t _zxWrite;  //Free running count of captured crossings, published after the entry is complete
+	uint32_t _zxRead;            //Crossings already passed to the tracking filter
+	unsigned long _zxDropped;
+	uint32_t _zxPhase[2];        //Filtered time of the last falling [0] and rising [1] crossing
+	bool _zxPhaseValid[2];
+	float _zxPeriod;             //Filtered line period in us
+	bool _zxPeriodValid;
+	uint8_t _zxGood;
+	
+	static void IRAM_ATTR cfLimitHandler(void *arg);
+	void rescaleCF(uint8_t channel, float ratio);
+	uint8_t _cfSource[2];        //CF1, CF2
+	uint16_t _cfDen[2];
+	int8_t _cfUnit[2];           //PCNT unit, -1 when not counted
+	float _cfPulsesPerUnit[2];   //At the present PGA gains
+	double _cfEnergyBase[2];     //Energy counted before the last PGA gain change, units
+	uint64_t _cfBasePulses[2];   //Pulse count at that change
+	volatile uint32_t _cfWraps[2];
+	bool _cfCheckPrimed[2];
+	uint64_t _cfCheckPulses[2];  //Pulse count at the previous accumulateEnergy()
+	double _cfCheckCf[2];        //Micro units seen by the pulse counter and by the energy registers since clearCFCrossCheck()
+	double _cfCheckReg[2];
+	
+	bool captureTrigger(uint8_t source, uint32_t eventTime, uint16_t remaining);
+	void captureFreeze();
+	ADE7953WaveformSample _capRing[ADE7953_CAPTURE_SAMPLES];
+	uint16_t _capHead;           //Next ring entry to write
+	uint16_t _capFill;
+	uint16_t _capPre;
+	uint16_t _capPost;
+	uint8_t _capArmed;           //Trigger sources still armed, 0 once fired
+	uint16_t _capRemaining;      //Post-trigger samples still to take, 0 when not triggered
+	ADE7953CaptureInfo _capPending;
+	int32_t _capLevel[3];        //Software trigger levels in waveform codes at the present PGA gain, 0 = off
+	float _capLevelUnits[3];     //The same levels as set, in calibrated peak units
+	bool _capZxRising;
+	uint32_t _capZxOffset;
+	bool _capZxTargetValid;
+	uint32_t _capZxTarget;
+	volatile bool _capManual;
+	volatile bool _capIrqPending;  //Set by irqHandler() alongside _irqPending, consumed by the capture only
+	volatile uint32_t _capIrqTime;
+	ADE7953WaveformSample _capSlot[ADE7953_CAPTURE_SAMPLES];
+	ADE7953CaptureInfo _capInfo;
+	bool _capReady;
+	unsigned long _capMissed;
+	ADE7953SubCycleRms *_subCycle;
+	
+	void readGroup(uint8_t group, uint32_t now);
+	uint32_t _schedPeriod[ADE7953_GROUPS];  //ms, 0 = not on a timer
+	uint32_t _schedDue[ADE7953_GROUPS];     //millis()
+	uint8_t _schedTrigger[ADE7953_GROUPS];
+	ADE7953ScheduleStats _schedStats[ADE7953_GROUPS];
+	ADE7953Snapshot _schedSnapshot;
+	uint16_t _schedPeriodRaw;  //Latest Period reading, converts the angles
+	volatile bool _schedIrqPending;  //Set by irqHandler(), consumed by the scheduler only
+	uint32_t _schedLastPoll;
+	unsigned long _schedBursts;
+	uint32_t _schedBusUs;
+	unsigned long _configMismatches;
+	
+	bool cacheLookup(byte MSB, byte LSB, uint32_t &value);
+	void cacheStore(byte MSB, byte LSB, uint32_t value);
+	bool _cacheEnabled;
+	uint32_t _cacheTTL[ADE7953_CACHE_CLASSES];
+	uint16_t _cacheAddr[ADE7953_CACHE_SIZE];  //0xFFFF = empty
+	uint32_t _cacheValue[ADE7953_CACHE_SIZE];
+	uint32_t _cacheTime[ADE7953_CACHE_SIZE];  //micros() of the bus read
+	unsigned long _cacheHits;
+	unsigned long _cacheMisses;
+	
+	uint16_t derivedPlan(uint32_t fieldMask);
+	uint32_t _derivedMask;
+	float _derivedScale[2];  //AVA/BVA counts per VRMS x IRMS count, 0 = not learned yet
+	
+	uint32_t spiRawRead(uint16_t addr, uint8_t bits);
+	uint32_t commCheck(byte MSB, byte LSB, uint8_t bits, uint32_t value, uint32_t started);
+	uint16_t _verifyEvery;
+	uint16_t _verifyCount;
+	uint8_t _retryMax;
+	uint8_t _commStatus;
+	ADE7953CommStats _comm;
+	
+	ADE7953RequestQueue _requests;
+#ifdef ESP32
+	TaskHandle_t _requestTask;
+#endif
 };
 
 #endif
@@ -0,0 +1,166 @@
+/*
+ ADE7953LoadEvents.cpp - Appliance switching event detector over the active/reactive power of one current channel
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#include "ADE7953LoadEvents.h"
+#include <math.h>
+
+//Steady:    a sample leaves the steady state when P or Q is further from it than max(minStep/2, noiseFactor x noise);
+//           otherwise it moves the steady state and the noise estimate a little (slow drift is not an event).
+//Transient: ends when the last ADE7953_EVENT_SETTLE samples lie within the same level of each other.  Their mean is
+//           the new steady state; the step is queued if P or Q moved by at least minStep, so a spike that returns to
+//           where it started only re-bases.
+//Feed it the signed snapshot powers and the interval current peak (read-with-reset IPEAK), which catches an inrush
+//shorter than the snapshot interval.
+
+#define ADE7953_EVENT_IDLE 0
+#define ADE7953_EVENT_STEADY 1
+#define ADE7953_EVENT_TRANSIENT 2
+#define ADE7953_EVENT_TRACK 0.05  //Steady state and noise tracking rate per sample
+
+ADE7953LoadEvents::ADE7953LoadEvents(){
+  _minStep = ADE7953_EVENT_MIN_STEP;
+  _noiseFactor = ADE7953_EVENT_NOISE_K;
+  _settle = ADE7953_EVENT_SETTLE;
+  _maxTransient = ADE7953_EVENT_MAX_TRANSIENT;
+  _eventHead = 0;
+  _eventCount = 0;
+  _dropped = 0;
+  reset();
+  }
+
+void ADE7953LoadEvents::setThresholds(float minStep, float noiseFactor){
+  _minStep = minStep;
+  _noiseFactor = noiseFactor;
+  }
+
+void ADE7953LoadEvents::setSettle(uint8_t samples, unsigned long maxTransientMs){  //More samples reject slow ramps better but report later
+  _settle = (samples < 1) ? 1 : ((samples > 8) ? 8 : samples);
+  _maxTransient = maxTransientMs;
+  }
+
+void ADE7953LoadEvents::reset(){  //Forget the steady state, the queue is kept
+  _state = ADE7953_EVENT_IDLE;
+  _noise = 0;
+  _windowCount = 0;
+  }
+
+float ADE7953LoadEvents::trigger(){
+  float level = _noiseFactor*_noise;
+  return (level > _minStep*0.5) ? level : _minStep*0.5;
+  }
+
+void ADE7953LoadEvents::queue(const ADE7953LoadEvent &event){
+  if (_eventCount == ADE7953_EVENT_QUEUE) {
+    _eventHead = (_eventHead + 1) % ADE7953_EVENT_QUEUE;
+    _eventCount--;
+    _dropped++;
+    }
+  _events[(_eventHead + _eventCount) % ADE7953_EVENT_QUEUE] = event;
+  _eventCount++;
+  }
+
+bool ADE7953LoadEvents::update(unsigned long time, float activePower, float reactivePower, float currentPeak){  //One call per snapshot, returns true when an event was queued
+  if (_state == ADE7953_EVENT_IDLE) {
+    _baseP = activePower;
+    _baseQ = reactivePower;
+    _state = ADE7953_EVENT_STEADY;
+    return false;
+    }
+  
+  float level = trigger();
+  if (_state == ADE7953_EVENT_STEADY) {
+    float dP = fabsf(activePower - _baseP);
+    float dQ = fabsf(reactivePower - _baseQ);
+    if (dP <= level && dQ <= level) {
+      _baseP += ADE7953_EVENT_TRACK*(activePower - _baseP);
+      _baseQ += ADE7953_EVENT_TRACK*(reactivePower - _baseQ);
+      _noise += ADE7953_EVENT_TRACK*(((dP > dQ) ? dP : dQ) - _noise);
+      return false;
+      }
+    _state = ADE7953_EVENT_TRANSIENT;
+    _open.time = time;
+    _open.before = _baseP;
+    _open.inrushP = activePower - _baseP;
+    _open.currentPeak = currentPeak;
+    _windowCount = 0;
+    }
+  else {
+    if (fabsf(activePower - _baseP) > fabsf(_open.inrushP)) {_open.inrushP = activePower - _baseP;}
+    if (currentPeak > _open.currentPeak) {_open.currentPeak = currentPeak;}
+    }
+  
+  if (_windowCount == _settle) {  //Slide the settle window
+    for (uint8_t i = 1; i < _settle; i++) {
+      _windowP[i - 1] = _windowP[i];
+      _windowQ[i - 1] = _windowQ[i];
+      _windowTime[i - 1] = _windowTime[i];
+      }
+    _windowCount--;
+    }
+  _windowP[_windowCount] = activePower;
+  _windowQ[_windowCount] = reactivePower;
+  _windowTime[_windowCount] = time;
+  _windowCount++;
+  if (_windowCount < _settle) {
+    return false;
+    }
+  
+  float minP = _windowP[0], maxP = _windowP[0], minQ = _windowQ[0], maxQ = _windowQ[0], sumP = 0, sumQ = 0;
+  for (uint8_t i = 0; i < _settle; i++) {
+    if (_windowP[i] < minP) {minP = _windowP[i];}
+    if (_windowP[i] > maxP) {maxP = _windowP[i];}
+    if (_windowQ[i] < minQ) {minQ = _windowQ[i];}
+    if (_windowQ[i] > maxQ) {maxQ = _windowQ[i];}
+    sumP += _windowP[i];
+    sumQ += _windowQ[i];
+    }
+  if (maxP - minP > level || maxQ - minQ > level) {
+    if (time - _open.time > _maxTransient) {  //Never settled (e.g. a motor under varying load): start over from here
+      _state = ADE7953_EVENT_IDLE;
+      }
+    return false;
+    }
+  
+  float newP = sumP/_settle;
+  float newQ = sumQ/_settle;
+  _open.deltaP = newP - _baseP;
+  _open.deltaQ = newQ - _baseQ;
+  _open.duration = _windowTime[0] - _open.time;
+  _baseP = newP;
+  _baseQ = newQ;
+  _state = ADE7953_EVENT_STEADY;
+  if (fabsf(_open.deltaP) < _minStep && fabsf(_open.deltaQ) < _minStep) {
+    return false;
+    }
+  queue(_open);
+  return true;
+  }
+
+uint8_t ADE7953LoadEvents::available(){
+  return _eventCount;
+  }
+
+bool ADE7953LoadEvents::read(ADE7953LoadEvent &event){  //Oldest first
+  if (_eventCount == 0) {
+    return false;
+    }
+  event = _events[_eventHead];
+  _eventHead = (_eventHead + 1) % ADE7953_EVENT_QUEUE;
+  _eventCount--;
+  return true;
+  }
+
+unsigned long ADE7953LoadEvents::getDropped(){  //Events overwritten before they were read
+  return _dropped;
+  }
+
+bool ADE7953LoadEvents::isSteady(){
+  return _state == ADE7953_EVENT_STEADY;
+  }
+
+float ADE7953LoadEvents::getNoise(){  //Present steady state noise estimate, W/var
+  return _noise;
+  }
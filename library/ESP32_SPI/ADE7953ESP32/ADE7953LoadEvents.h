@@ -0,0 +1,75 @@
+/*
+ ADE7953LoadEvents.h - Appliance switching event detector over the active/reactive power of one current channel
+  Finds step changes against a tracked steady state, waits for the power to settle and queues the step as a feature
+  record (dP, dQ, transient duration, inrush) for non-intrusive load monitoring.  Fixed memory, no hardware dependency.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#ifndef ADE7953LoadEvents_h
+#define ADE7953LoadEvents_h
+
+#ifdef ARDUINO
+#include "Arduino.h"
+#else
+#include <stdint.h>
+#include <stddef.h>
+#endif
+
+#ifndef ADE7953_EVENT_QUEUE
+#define ADE7953_EVENT_QUEUE 16        //Events held until read(), the oldest is overwritten when full
+#endif
+#define ADE7953_EVENT_MIN_STEP 25.0   //Smallest step (W or var) reported as an event
+#define ADE7953_EVENT_NOISE_K 5.0     //Trigger level in multiples of the steady state noise (mean absolute deviation)
+#define ADE7953_EVENT_SETTLE 3        //Consecutive samples within the trigger level that end a transient (at most 8)
+#define ADE7953_EVENT_MAX_TRANSIENT 60000UL //A transient that has not settled after this long (ms) is dropped
+
+struct ADE7953LoadEvent {
+  unsigned long time;      //Time of the first sample off the previous steady state
+  unsigned long duration;  //Until the first sample of the new steady state, ms
+  float deltaP;            //New minus previous steady state, W (positive = switched on)
+  float deltaQ;            //var
+  float before;            //Steady active power before the event, W
+  float inrushP;           //Largest active power excursion from the previous steady state during the transient, W
+  float currentPeak;       //Highest current peak passed to update() during the transient (0 if none)
+};
+
+class ADE7953LoadEvents {
+  public:
+    ADE7953LoadEvents();
+	void setThresholds(float minStep, float noiseFactor);
+	void setSettle(uint8_t samples, unsigned long maxTransientMs);
+	bool update(unsigned long time, float activePower, float reactivePower, float currentPeak);
+	uint8_t available();
+	bool read(ADE7953LoadEvent &event);
+	unsigned long getDropped();
+	bool isSteady();
+	float getNoise();
+	void reset();
+
+  private:
+	float trigger();
+	void queue(const ADE7953LoadEvent &event);
+	
+	float _minStep;
+	float _noiseFactor;
+	uint8_t _settle;
+	unsigned long _maxTransient;
+	
+	uint8_t _state;     //0 no baseline yet, 1 steady, 2 transient
+	float _baseP;       //Steady state, tracked slowly so drift does not trigger
+	float _baseQ;
+	float _noise;       //Mean absolute deviation of P and Q from the steady state
+	ADE7953LoadEvent _open;
+	float _windowP[8];  //Last samples of a transient, to test for settling
+	float _windowQ[8];
+	unsigned long _windowTime[8];
+	uint8_t _windowCount;
+	
+	ADE7953LoadEvent _events[ADE7953_EVENT_QUEUE];
+	uint8_t _eventHead;
+	uint8_t _eventCount;
+	unsigned long _dropped;
+};
+
+#endif
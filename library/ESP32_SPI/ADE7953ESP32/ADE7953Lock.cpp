@@ -0,0 +1,140 @@
+/*
+ ADE7953Lock.cpp - Bus lock and interrupt-safe request queue for sharing ADE7953 devices between tasks
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#include "ADE7953Lock.h"
+#include <string.h>
+
+#ifndef ARDUINO
+#include <chrono>
+#endif
+
+//The FreeRTOS mutex has priority inheritance: a low priority task holding the bus runs at the priority of the highest task
+//waiting for it until it lets go, so a display task cannot hold up a control task for longer than its own transaction.
+
+ADE7953BusLock::ADE7953BusLock(){
+#ifdef ESP32
+  _mutex = xSemaphoreCreateRecursiveMutex();
+#endif
+  _depth = 0;
+  _holdStart = 0;
+  clearStats();
+  }
+
+uint32_t ADE7953BusLock::now(){
+#ifdef ARDUINO
+  return micros();
+#else
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+void ADE7953BusLock::lock(){
+  uint32_t start = now();
+  bool waited = false;
+#ifdef ESP32
+  if (xSemaphoreTakeRecursive(_mutex, 0) != pdTRUE) {
+    waited = true;
+    xSemaphoreTakeRecursive(_mutex, portMAX_DELAY);
+    }
+#else
+  if (!_mutex.try_lock()) {
+    waited = true;
+    _mutex.lock();
+    }
+#endif
+  if (_depth++ == 0) {
+    _holdStart = now();
+    _stats.acquisitions++;
+    if (waited) {
+      uint32_t wait = _holdStart - start;
+      _stats.contended++;
+      if (wait > _stats.maxWait) {_stats.maxWait = wait;}
+      }
+    }
+  }
+
+void ADE7953BusLock::unlock(){
+  if (_depth == 0) {
+    return;  //Not held
+    }
+  if (--_depth == 0) {
+    uint32_t hold = now() - _holdStart;
+    _stats.totalHold += hold;
+    if (hold > _stats.maxHold) {_stats.maxHold = hold;}
+    }
+#ifdef ESP32
+  xSemaphoreGiveRecursive(_mutex);
+#else
+  _mutex.unlock();
+#endif
+  }
+
+void ADE7953BusLock::getStats(ADE7953LockStats &stats){
+  lock();
+  stats = _stats;  //Counts this call's own acquisition
+  unlock();
+  }
+
+void ADE7953BusLock::clearStats(){
+  memset(&_stats, 0, sizeof(_stats));
+  }
+
+ADE7953RequestQueue::ADE7953RequestQueue(){
+#ifdef ESP32
+  portMUX_INITIALIZE(&_mux);
+#endif
+  _head = 0;
+  _count = 0;
+  _dropped = 0;
+  }
+
+bool IRAM_ATTR ADE7953RequestQueue::push(const ADE7953Request &request){
+  bool queued = false;
+#ifdef ESP32
+  portENTER_CRITICAL_SAFE(&_mux);  //Spinlock, also keeps out an interrupt handler on the other core
+#else
+  std::lock_guard<std::mutex> guard(_mutex);
+#endif
+  if (_count < ADE7953_REQUEST_QUEUE) {
+    _ring[(_head + _count) % ADE7953_REQUEST_QUEUE] = request;
+    _count++;
+    queued = true;
+    }
+  else {
+    _dropped++;
+    }
+#ifdef ESP32
+  portEXIT_CRITICAL_SAFE(&_mux);
+#endif
+  return queued;
+  }
+
+bool ADE7953RequestQueue::pop(ADE7953Request &request){
+  bool popped = false;
+#ifdef ESP32
+  portENTER_CRITICAL_SAFE(&_mux);
+#else
+  std::lock_guard<std::mutex> guard(_mutex);
+#endif
+  if (_count > 0) {
+    request = _ring[_head];
+    _head = (_head + 1) % ADE7953_REQUEST_QUEUE;
+    _count--;
+    popped = true;
+    }
+#ifdef ESP32
+  portEXIT_CRITICAL_SAFE(&_mux);
+#endif
+  return popped;
+  }
+
+uint8_t ADE7953RequestQueue::count(){
+  return _count;
+  }
+
+unsigned long ADE7953RequestQueue::getDropped(){
+  return _dropped;
+  }
@@ -0,0 +1,91 @@
+/*
+ ADE7953Lock.h - Bus lock and interrupt-safe request queue for sharing ADE7953 devices between tasks
+  ADE7953BusLock is a recursive mutex (FreeRTOS on the ESP32, std::recursive_mutex on Linux) that keeps wait and hold time
+  statistics.  ADE7953RequestQueue is a short ring that an interrupt handler can push register reads into, to be carried out
+  later by a task.  The host builds are used by the stress test in extras/ade7953lock.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#ifndef ADE7953Lock_h
+#define ADE7953Lock_h
+
+#ifdef ARDUINO
+#include "Arduino.h"
+#else
+#include <stdint.h>
+#include <stddef.h>
+#endif
+
+#ifdef ESP32
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#else
+#include <mutex>
+#endif
+
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
+
+#ifndef ADE7953_REQUEST_QUEUE
+#define ADE7953_REQUEST_QUEUE 8 //Deferred requests held at once, further pushes are dropped and counted
+#endif
+
+struct ADE7953LockStats {
+  unsigned long acquisitions;  //Outermost lock() calls
+  unsigned long contended;     //... that found the lock held by another task and had to wait
+  uint32_t maxWait;            //us
+  uint32_t maxHold;            //us from the outermost lock() to its unlock()
+  uint64_t totalHold;          //us
+};
+
+typedef void (*ADE7953RequestDone)(void *arg, uint16_t addr, uint32_t value, uint8_t status);  //Runs in the task that services the queue
+
+struct ADE7953Request {
+  uint16_t addr;            //Register to read, any address ADE7953RegisterMap knows
+  ADE7953RequestDone done;
+  void *arg;
+};
+
+class ADE7953BusLock {
+  public:
+    ADE7953BusLock();
+	void lock();      //Never from an interrupt handler
+	void unlock();
+	void getStats(ADE7953LockStats &stats);
+	void clearStats();
+
+  private:
+	static uint32_t now();
+#ifdef ESP32
+	SemaphoreHandle_t _mutex;
+#else
+	std::recursive_mutex _mutex;
+#endif
+	uint16_t _depth;         //Nesting of the owner, only touched while held
+	uint32_t _holdStart;
+	ADE7953LockStats _stats;
+};
+
+class ADE7953RequestQueue {
+  public:
+    ADE7953RequestQueue();
+	bool IRAM_ATTR push(const ADE7953Request &request);  //Interrupt handler or task
+	bool pop(ADE7953Request &request);
+	uint8_t count();
+	unsigned long getDropped();
+
+  private:
+#ifdef ESP32
+	portMUX_TYPE _mux;
+#else
+	std::mutex _mutex;
+#endif
+	ADE7953Request _ring[ADE7953_REQUEST_QUEUE];
+	uint8_t _head;
+	uint8_t _count;
+	unsigned long _dropped;
+};
+
+#endif
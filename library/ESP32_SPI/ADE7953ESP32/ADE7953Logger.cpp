@@ -0,0 +1,357 @@
+/*
+ ADE7953Logger.cpp - On-flash time series of ADE7953 measurements with 1 s, 1 min and 15 min min/max/mean rollups
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#include "ADE7953Logger.h"
+#include <string.h>
+
+//Layout: the storage is split into three rings of sectors, one per resolution.  Records are appended in sequence order and a
+//sector is only erased when the writer reaches it again, so every sector wears at the same rate.  Inside a sector the record in
+//slot n has sequence firstSequence + n, which makes the RAM index of first records (one entry per sector) enough to find any
+//sequence number directly and any time with a binary search of at most log2(records per sector) reads.
+//1 s records are collected in RAM and written ADE7953_LOG_BATCH at a time; a power loss costs at most that many seconds, the
+//rollups are written as soon as they close.  An append does at most one batch write and one sector erase, a read() touches
+//at most count records, so both have a fixed worst case.
+//Sequence numbers, not times, order the log: a clock that steps backwards only affects seekTime().
+
+static_assert(sizeof(ADE7953LogRecord) == ADE7953_LOG_RECORD_SIZE, "ADE7953LogRecord must match the flash record size");
+
+static const uint32_t logInterval[ADE7953_LOG_LEVELS] = {1, 60, 900};
+static const uint8_t logDefaultFields[ADE7953_LOG_SLOTS] = {ADE7953_FIELD_VRMS, ADE7953_FIELD_IRMSA, ADE7953_FIELD_IRMSB, ADE7953_FIELD_ACTIVEA,
+  ADE7953_FIELD_ACTIVEB, ADE7953_FIELD_REACTIVEA, ADE7953_FIELD_REACTIVEB, ADE7953_FIELD_FREQUENCY};
+
+ADE7953Logger::ADE7953Logger(){
+  _storage = NULL;
+  _perSector = 0;
+  _batchCount = 0;
+  _writeErrors = 0;
+  memcpy(_fields, logDefaultFields, sizeof(_fields));
+  memset(_region, 0, sizeof(_region));
+  memset(_acc, 0, sizeof(_acc));
+  memset(_uplink, 0, sizeof(_uplink));
+  }
+
+void ADE7953Logger::setFields(const uint8_t *fields, uint8_t count){  //Snapshot fields to keep, up to ADE7953_LOG_SLOTS; takes effect with the next interval
+  for (uint8_t s = 0; s < ADE7953_LOG_SLOTS; s++) {
+    _fields[s] = (s < count && fields[s] < ADE7953_FIELDS) ? fields[s] : 0xFF;
+    }
+  memset(_acc, 0, sizeof(_acc));
+  }
+
+bool ADE7953Logger::begin(ADE7953Storage &storage, uint16_t sectors1s, uint16_t sectors1min, uint16_t sectors15min){
+  //Sector counts per resolution (at least 2 each, at most ADE7953_LOG_MAX_SECTORS), allocated from the start of the storage.
+  //Picks up after the newest record found, so calling it on every boot continues the same log.
+  uint16_t sectors[ADE7953_LOG_LEVELS] = {sectors1s, sectors1min, sectors15min};
+  uint32_t base = 0;
+  
+  _storage = &storage;
+  _perSector = storage.sectorSize()/ADE7953_LOG_RECORD_SIZE;
+  _batchCount = 0;
+  for (uint8_t level = 0; level < ADE7953_LOG_LEVELS; level++) {
+    if (sectors[level] < 2 || sectors[level] > ADE7953_LOG_MAX_SECTORS) {return false;}
+    _region[level].base = base;
+    _region[level].sectors = sectors[level];
+    base += (uint32_t)sectors[level]*storage.sectorSize();
+    }
+  if (base > storage.size() || _perSector == 0) {
+    return false;
+    }
+  for (uint8_t level = 0; level < ADE7953_LOG_LEVELS; level++) {
+    recover(level);
+    _uplink[level] = _region[level].nextSequence;  //Nothing to backfill until ackUplink() says otherwise
+    _acc[level].open = false;
+    }
+  return true;
+  }
+
+uint32_t ADE7953Logger::recordCrc(const ADE7953LogRecord &record){
+  ADE7953LogRecord copy = record;
+  copy.crc = 0;
+  return ADE7953Storage::crc32(&copy, sizeof(copy));
+  }
+
+uint32_t ADE7953Logger::slotAddress(uint8_t level, uint16_t sector, uint16_t slot){
+  return _region[level].base + (uint32_t)sector*_storage->sectorSize() + (uint32_t)slot*ADE7953_LOG_RECORD_SIZE;
+  }
+
+void ADE7953Logger::recover(uint8_t level){  //Rebuild the sparse index from the first slot of every sector and find the write position
+  Region &region = _region[level];
+  ADE7953LogRecord record;
+  int32_t head = -1;
+  
+  for (uint16_t s = 0; s < region.sectors; s++) {
+    region.firstSequence[s] = ADE7953_LOG_NONE;
+    if (_storage->read(slotAddress(level, s, 0), &record, sizeof(record)) && record.sequence != ADE7953_LOG_NONE && record.crc == recordCrc(record)) {
+      region.firstSequence[s] = record.sequence;
+      region.firstTime[s] = record.time;
+      if (head < 0 || record.sequence > region.firstSequence[head]) {head = s;}
+      }
+    }
+  if (head < 0) {  //Empty (or foreign) region: start over in sector 0
+    region.head = 0;
+    region.slot = 0;
+    region.flushed = 0;
+    region.nextSequence = 0;
+    if (!_storage->erase(slotAddress(level, 0, 0))) {_writeErrors++;}
+    return;
+    }
+  
+  uint16_t lo = 1, hi = _perSector;  //Slots fill in order, so the first erased one can be found by bisection
+  while (lo < hi) {
+    uint16_t mid = (lo + hi)/2;
+    uint32_t sequence = 0;
+    _storage->read(slotAddress(level, head, mid) + offsetof(ADE7953LogRecord, sequence), &sequence, sizeof(sequence));
+    if (sequence == ADE7953_LOG_NONE) {hi = mid;}
+    else {lo = mid + 1;}
+    }
+  region.head = head;
+  region.slot = lo;
+  region.flushed = lo;
+  region.nextSequence = region.firstSequence[head] + lo;
+  }
+
+bool ADE7953Logger::log(const float *values, uint32_t time){  //values[ADE7953_FIELDS], time in seconds (epoch or uptime, but the same clock every call)
+  float picked[ADE7953_LOG_SLOTS];
+  double sum[ADE7953_LOG_SLOTS];
+  unsigned long errors = _writeErrors;
+  
+  if (!_storage) {
+    return false;
+    }
+  for (uint8_t level = 0; level < ADE7953_LOG_LEVELS; level++) {  //Lower resolutions fold into the next one as they close, so close from the finest up
+    if (_acc[level].open && time/logInterval[level] != _acc[level].key) {
+      closeInterval(level);
+      }
+    }
+  for (uint8_t s = 0; s < ADE7953_LOG_SLOTS; s++) {
+    picked[s] = (_fields[s] < ADE7953_FIELDS) ? values[_fields[s]] : 0;
+    sum[s] = picked[s];
+    }
+  fold(ADE7953_LOG_1S, time, 1, picked, picked, sum);
+  return _writeErrors == errors;
+  }
+
+void ADE7953Logger::fold(uint8_t level, uint32_t start, uint16_t samples, const float *min, const float *max, const double *sum){
+  Accumulator &acc = _acc[level];
+  uint32_t key = start/logInterval[level];
+  
+  if (acc.open && key != acc.key) {
+    closeInterval(level);
+    }
+  if (!acc.open) {
+    acc.open = true;
+    acc.key = key;
+    acc.start = key*logInterval[level];
+    acc.samples = 0;
+    for (uint8_t s = 0; s < ADE7953_LOG_SLOTS; s++) {
+      acc.min[s] = min[s];
+      acc.max[s] = max[s];
+      acc.sum[s] = 0;
+      }
+    }
+  for (uint8_t s = 0; s < ADE7953_LOG_SLOTS; s++) {
+    if (min[s] < acc.min[s]) {acc.min[s] = min[s];}
+    if (max[s] > acc.max[s]) {acc.max[s] = max[s];}
+    acc.sum[s] += sum[s];
+    }
+  acc.samples = (acc.samples + samples > 0xFFFF) ? 0xFFFF : acc.samples + samples;
+  }
+
+void ADE7953Logger::closeInterval(uint8_t level){
+  Accumulator &acc = _acc[level];
+  ADE7953LogRecord record;
+  
+  memset(&record, 0, sizeof(record));
+  record.time = acc.start;
+  record.samples = acc.samples;
+  memcpy(record.fields, _fields, sizeof(record.fields));
+  for (uint8_t s = 0; s < ADE7953_LOG_SLOTS; s++) {
+    record.min[s] = acc.min[s];
+    record.max[s] = acc.max[s];
+    record.mean[s] = acc.samples ? (float)(acc.sum[s]/acc.samples) : 0;
+    }
+  memset(record.reserved, 0xFF, sizeof(record.reserved));
+  acc.open = false;
+  append(level, record);
+  if (level + 1 < ADE7953_LOG_LEVELS) {
+    fold(level + 1, acc.start, acc.samples, acc.min, acc.max, acc.sum);
+    }
+  }
+
+bool ADE7953Logger::append(uint8_t level, ADE7953LogRecord &record){
+  Region &region = _region[level];
+  
+  if (region.slot >= _perSector) {  //Head sector full: move on and erase the oldest sector
+    if (level == ADE7953_LOG_1S) {flushBatch();}
+    region.head = (region.head + 1) % region.sectors;
+    region.firstSequence[region.head] = ADE7953_LOG_NONE;
+    region.slot = 0;
+    region.flushed = 0;
+    if (!_storage->erase(slotAddress(level, region.head, 0))) {
+      _writeErrors++;
+      }
+    }
+  record.sequence = region.nextSequence++;
+  record.level = level;
+  record.version = ADE7953_LOG_VERSION;
+  record.crc = recordCrc(record);
+  if (region.slot == 0) {
+    region.firstSequence[region.head] = record.sequence;
+    region.firstTime[region.head] = record.time;
+    }
+  region.slot++;
+  
+  if (level == ADE7953_LOG_1S) {
+    _batch[_batchCount++] = record;
+    return (_batchCount < ADE7953_LOG_BATCH) ? true : flushBatch();
+    }
+  region.flushed = region.slot;
+  if (!_storage->write(slotAddress(level, region.head, region.slot - 1), &record, sizeof(record))) {
+    _writeErrors++;
+    return false;
+    }
+  return true;
+  }
+
+bool ADE7953Logger::flushBatch(){  //One write for all pending 1 s records, they are contiguous in the head sector
+  Region &region = _region[ADE7953_LOG_1S];
+  bool ok = true;
+  
+  if (_batchCount == 0) {
+    return true;
+    }
+  if (!_storage->write(slotAddress(ADE7953_LOG_1S, region.head, region.flushed), _batch, (size_t)_batchCount*sizeof(ADE7953LogRecord))) {
+    _writeErrors++;
+    ok = false;
+    }
+  region.flushed += _batchCount;
+  _batchCount = 0;
+  return ok;
+  }
+
+bool ADE7953Logger::flush(){  //Writes the pending 1 s records now, e.g. before deep sleep; open intervals stay open
+  return _storage ? flushBatch() : false;
+  }
+
+uint16_t ADE7953Logger::usedSlots(uint8_t level, uint16_t sector){
+  if (_region[level].firstSequence[sector] == ADE7953_LOG_NONE) {return 0;}
+  return (sector == _region[level].head) ? _region[level].slot : _perSector;
+  }
+
+bool ADE7953Logger::locate(uint8_t level, uint32_t sequence, uint16_t &sector, uint16_t &slot){
+  Region &region = _region[level];
+  for (uint16_t s = 0; s < region.sectors; s++) {
+    uint32_t first = region.firstSequence[s];
+    if (first != ADE7953_LOG_NONE && sequence >= first && sequence - first < usedSlots(level, s)) {
+      sector = s;
+      slot = sequence - first;
+      return true;
+      }
+    }
+  return false;
+  }
+
+bool ADE7953Logger::readSlot(uint8_t level, uint16_t sector, uint16_t slot, ADE7953LogRecord &record){  //false for a slot that fails its CRC
+  Region &region = _region[level];
+  if (level == ADE7953_LOG_1S && sector == region.head && slot >= region.flushed) {
+    record = _batch[slot - region.flushed];  //Still waiting in the batch
+    return true;
+    }
+  if (!_storage->read(slotAddress(level, sector, slot), &record, sizeof(record))) {
+    return false;
+    }
+  return record.sequence == region.firstSequence[sector] + slot && record.crc == recordCrc(record);
+  }
+
+uint32_t ADE7953Logger::getOldestSequence(uint8_t level){  //Oldest record still in flash, equal to getNextSequence() when empty
+  uint32_t oldest = _region[level].nextSequence;
+  for (uint16_t s = 0; s < _region[level].sectors; s++) {
+    if (_region[level].firstSequence[s] < oldest) {oldest = _region[level].firstSequence[s];}
+    }
+  return oldest;
+  }
+
+uint32_t ADE7953Logger::getNextSequence(uint8_t level){  //Sequence the next record of this resolution will get
+  return _region[level].nextSequence;
+  }
+
+bool ADE7953Logger::seekSequence(uint8_t level, uint32_t sequence, ADE7953LogCursor &cursor){  //false if the record has been overwritten (cursor moves to the oldest) or not written yet
+  if (level >= ADE7953_LOG_LEVELS) {return false;}
+  uint32_t oldest = getOldestSequence(level);
+  cursor.level = level;
+  cursor.sequence = (sequence < oldest) ? oldest : sequence;
+  return sequence >= oldest && sequence <= _region[level].nextSequence;
+  }
+
+bool ADE7953Logger::seekTime(uint8_t level, uint32_t time, ADE7953LogCursor &cursor){  //Cursor at the first record starting at or after time
+  if (level >= ADE7953_LOG_LEVELS || !_storage) {return false;}
+  Region &region = _region[level];
+  int32_t best = -1;
+  ADE7953LogRecord record;
+  
+  cursor.level = level;
+  for (uint16_t s = 0; s < region.sectors; s++) {  //Newest sector that starts at or before time, from the RAM index
+    if (region.firstSequence[s] == ADE7953_LOG_NONE || region.firstTime[s] > time) {continue;}
+    if (best < 0 || region.firstSequence[s] > region.firstSequence[best]) {best = s;}
+    }
+  if (best < 0) {
+    cursor.sequence = getOldestSequence(level);
+    return true;
+    }
+  uint16_t lo = 0, hi = usedSlots(level, best);
+  while (lo < hi) {
+    uint16_t mid = (lo + hi)/2;
+    if (readSlot(level, best, mid, record) && record.time >= time) {hi = mid;}
+    else {lo = mid + 1;}  //A damaged record sorts as earlier, at worst it is returned by read() as skipped
+    }
+  cursor.sequence = region.firstSequence[best] + lo;
+  return true;
+  }
+
+uint16_t ADE7953Logger::read(ADE7953LogCursor &cursor, ADE7953LogRecord *records, uint16_t count){
+  //Returns up to count records from the cursor on and advances it.  Looks at no more than count slots, damaged ones are
+  //skipped, so a caller that wants all of a range calls again until it gets 0 or a record past its end time.
+  uint16_t n = 0, sector, slot;
+  uint8_t level = cursor.level;
+  
+  if (level >= ADE7953_LOG_LEVELS || !_storage) {return 0;}
+  uint32_t oldest = getOldestSequence(level);
+  if (cursor.sequence < oldest) {cursor.sequence = oldest;}  //Overwritten while the caller was away
+  for (uint16_t i = 0; i < count && cursor.sequence < _region[level].nextSequence; i++) {
+    if (locate(level, cursor.sequence, sector, slot) && readSlot(level, sector, slot, records[n])) {
+      n++;
+      }
+    cursor.sequence++;
+    }
+  return n;
+  }
+
+//****************Uplink Backfill*****************
+//The publisher acknowledges each record (or the last of a batch) once the broker has it; after a reconnect readBackfill()
+//returns what was logged since.  Keep the acknowledged sequence in a checkpoint and restore it with ackUplink() after a
+//reboot, otherwise backfill starts from the records logged after begin().
+
+void ADE7953Logger::ackUplink(uint8_t level, uint32_t sequence){
+  if (level < ADE7953_LOG_LEVELS) {
+    _uplink[level] = sequence + 1;
+    }
+  }
+
+uint32_t ADE7953Logger::getUplinkSequence(uint8_t level){  //Next sequence to send
+  return (level < ADE7953_LOG_LEVELS) ? _uplink[level] : 0;
+  }
+
+uint16_t ADE7953Logger::readBackfill(uint8_t level, ADE7953LogRecord *records, uint16_t count){  //Records not yet acknowledged, oldest first; does not acknowledge them
+  ADE7953LogCursor cursor;
+  if (level >= ADE7953_LOG_LEVELS) {return 0;}
+  seekSequence(level, _uplink[level], cursor);
+  return read(cursor, records, count);
+  }
+
+unsigned long ADE7953Logger::getWriteErrors(){
+  return _writeErrors;
+  }
+
+//*******************************************************
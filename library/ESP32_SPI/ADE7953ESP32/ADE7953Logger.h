@@ -0,0 +1,113 @@
+/*
+ ADE7953Logger.h - On-flash time series of ADE7953 measurements with 1 s, 1 min and 15 min min/max/mean rollups
+  Each resolution is a ring of flash sectors holding fixed size records; a RAM index of the first record in every sector
+  finds any time or sequence number with a handful of reads.  Written for ADE7953Storage, so it runs on an ESP32 data
+  partition or on a file on a PC.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#ifndef ADE7953Logger_h
+#define ADE7953Logger_h
+
+#include "ADE7953Storage.h"
+#include "ADE7953Deadband.h"
+
+#define ADE7953_LOG_1S 0
+#define ADE7953_LOG_1MIN 1
+#define ADE7953_LOG_15MIN 2
+#define ADE7953_LOG_LEVELS 3
+#define ADE7953_LOG_SLOTS 8      //Snapshot fields kept per record
+#define ADE7953_LOG_VERSION 1
+#define ADE7953_LOG_RECORD_SIZE 128
+#define ADE7953_LOG_NONE 0xFFFFFFFFUL  //Sequence of an erased slot
+
+#ifndef ADE7953_LOG_MAX_SECTORS
+#define ADE7953_LOG_MAX_SECTORS 128 //Sectors per resolution covered by the RAM index (8 bytes of RAM each)
+#endif
+#ifndef ADE7953_LOG_BATCH
+#define ADE7953_LOG_BATCH 4 //1 s records held in RAM and written together, 4 x 128 bytes = two 256 byte flash pages
+#endif
+
+struct ADE7953LogRecord {  //ADE7953_LOG_RECORD_SIZE bytes as stored in flash
+  uint32_t time;      //Start of the interval, seconds on the clock passed to log()
+  uint32_t sequence;  //Counts up per resolution, ADE7953_LOG_NONE in an erased slot
+  uint16_t samples;   //log() calls folded into the record
+  uint8_t level;      //ADE7953_LOG_1S, ADE7953_LOG_1MIN or ADE7953_LOG_15MIN
+  uint8_t version;
+  uint8_t fields[ADE7953_LOG_SLOTS];  //ADE7953_FIELD_xxx held in each slot, 0xFF for an unused slot
+  uint32_t crc;       //CRC-32 of the record computed with this member set to 0
+  float min[ADE7953_LOG_SLOTS];
+  float max[ADE7953_LOG_SLOTS];
+  float mean[ADE7953_LOG_SLOTS];
+  uint8_t reserved[8];
+};
+
+struct ADE7953LogCursor {  //Position for read(), set by seekTime() or seekSequence()
+  uint8_t level;
+  uint32_t sequence;
+};
+
+class ADE7953Logger {
+  public:
+    ADE7953Logger();
+	void setFields(const uint8_t *fields, uint8_t count);
+	bool begin(ADE7953Storage &storage, uint16_t sectors1s, uint16_t sectors1min, uint16_t sectors15min);
+	bool log(const float *values, uint32_t time);
+	bool flush();
+	
+	bool seekTime(uint8_t level, uint32_t time, ADE7953LogCursor &cursor);
+	bool seekSequence(uint8_t level, uint32_t sequence, ADE7953LogCursor &cursor);
+	uint16_t read(ADE7953LogCursor &cursor, ADE7953LogRecord *records, uint16_t count);
+	uint32_t getOldestSequence(uint8_t level);
+	uint32_t getNextSequence(uint8_t level);
+	
+	void ackUplink(uint8_t level, uint32_t sequence);
+	uint32_t getUplinkSequence(uint8_t level);
+	uint16_t readBackfill(uint8_t level, ADE7953LogRecord *records, uint16_t count);
+	unsigned long getWriteErrors();
+
+  private:
+	struct Accumulator {  //The interval being collected at one resolution
+	  bool open;
+	  uint32_t key;  //time / interval length
+	  uint32_t start;
+	  uint16_t samples;
+	  float min[ADE7953_LOG_SLOTS];
+	  float max[ADE7953_LOG_SLOTS];
+	  double sum[ADE7953_LOG_SLOTS];
+	};
+	struct Region {  //The sector ring of one resolution
+	  uint32_t base;
+	  uint16_t sectors;
+	  uint16_t head;     //Sector being filled
+	  uint16_t slot;     //Next free slot in the head sector, including records still in the batch
+	  uint16_t flushed;  //Slots of the head sector already in flash
+	  uint32_t nextSequence;
+	  uint32_t firstSequence[ADE7953_LOG_MAX_SECTORS];  //Sparse index, ADE7953_LOG_NONE for an empty sector
+	  uint32_t firstTime[ADE7953_LOG_MAX_SECTORS];
+	};
+	
+	void recover(uint8_t level);
+	void fold(uint8_t level, uint32_t start, uint16_t samples, const float *min, const float *max, const double *sum);
+	void closeInterval(uint8_t level);
+	bool append(uint8_t level, ADE7953LogRecord &record);
+	bool flushBatch();
+	uint32_t slotAddress(uint8_t level, uint16_t sector, uint16_t slot);
+	bool readSlot(uint8_t level, uint16_t sector, uint16_t slot, ADE7953LogRecord &record);
+	bool locate(uint8_t level, uint32_t sequence, uint16_t &sector, uint16_t &slot);
+	uint16_t usedSlots(uint8_t level, uint16_t sector);
+	static uint32_t recordCrc(const ADE7953LogRecord &record);
+	
+	ADE7953Storage *_storage;
+	uint16_t _perSector;
+	uint8_t _fields[ADE7953_LOG_SLOTS];
+	Region _region[ADE7953_LOG_LEVELS];
+	Accumulator _acc[ADE7953_LOG_LEVELS];
+	ADE7953LogRecord _batch[ADE7953_LOG_BATCH];
+	uint8_t _batchCount;
+	uint32_t _uplink[ADE7953_LOG_LEVELS];
+	unsigned long _writeErrors;
+};
+
+#endif
@@ -0,0 +1,258 @@
+/*
+ ADE7953RegisterMap.cpp - ADE7953 register table, compact register images and image diffs
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#include "ADE7953RegisterMap.h"
+#include "ADE7953Storage.h"  //crc32()
+#include <stdio.h>
+#include <string.h>
+
+#define RW ADE7953_REG_WRITABLE
+#define RWS (ADE7953_REG_WRITABLE | ADE7953_REG_SIGNED)
+#define MU ADE7953_REG_MEASURED
+#define MS (ADE7953_REG_MEASURED | ADE7953_REG_SIGNED)
+
+//Reset values as listed with the register constants in ADE7953ESP32.cpp
+static const ADE7953RegisterInfo registerTable[] = {
+  {0x000, 1, RW, 0x00, "SAGCYC"},
+  {0x001, 1, RW, 0x00, "DISNOLOAD"},
+  {0x004, 1, RW, 0x40, "LCYCMODE"},
+  {0x007, 1, RW, 0x00, "PGA_V"},
+  {0x008, 1, RW, 0x00, "PGA_IA"},
+  {0x009, 1, RW, 0x00, "PGA_IB"},
+  {0x040, 1, RW, 0x00, "WRITE_PROTECT"},
+  {0x0FD, 1, ADE7953_REG_NO_DUMP, 0x00, "LAST_OP"},
+  {0x0FF, 1, ADE7953_REG_NO_DUMP, 0x00, "LAST_RWDATA_8"},
+  {0x702, 1, ADE7953_REG_NO_RESET, 0x00, "VERSION"},
+  {0x800, 1, RW, 0x00, "EX_REF"},
+  {0x100, 2, RW, 0xFFFF, "ZXTOUT"},
+  {0x101, 2, RW, 0x0000, "LINECYC"},
+  {0x102, 2, RW, 0x8004, "CONFIG"},
+  {0x103, 2, RW, 0x003F, "CF1DEN"},
+  {0x104, 2, RW, 0x003F, "CF2DEN"},
+  {0x107, 2, RW, 0x0300, "CFMODE"},
+  {0x108, 2, RW, 0x0000, "PHCALA"},
+  {0x109, 2, RW, 0x0000, "PHCALB"},
+  {0x10A, 2, MS, 0x0000, "PFA"},
+  {0x10B, 2, MS, 0x0000, "PFB"},
+  {0x10C, 2, MS, 0x0000, "ANGLE_A"},
+  {0x10D, 2, MS, 0x0000, "ANGLE_B"},
+  {0x10E, 2, MU, 0x0000, "PERIOD"},
+  {0x110, 2, RW, 0x0000, "ALT_OUTPUT"},
+  {0x120, 2, RW, 0x0000, "RESERVED_120"},  //initialize() sets 0x30 as the datasheet requires
+  {0x1FE, 2, ADE7953_REG_NO_DUMP, 0x0000, "LAST_ADD"},
+  {0x1FF, 2, ADE7953_REG_NO_DUMP, 0x0000, "LAST_RWDATA_16"},
+  {0x300, 4, RW, 0x000000, "SAGLVL"},
+  {0x301, 4, RW, 0x000000, "ACCMODE"},
+  {0x303, 4, RW, 0x00E419, "AP_NOLOAD"},
+  {0x304, 4, RW, 0x00E419, "VAR_NOLOAD"},
+  {0x305, 4, RW, 0x000000, "VA_NOLOAD"},
+  {0x310, 4, MS, 0x000000, "AVA"},
+  {0x311, 4, MS, 0x000000, "BVA"},
+  {0x312, 4, MS, 0x000000, "AWATT"},
+  {0x313, 4, MS, 0x000000, "BWATT"},
+  {0x314, 4, MS, 0x000000, "AVAR"},
+  {0x315, 4, MS, 0x000000, "BVAR"},
+  {0x316, 4, MS, 0x000000, "IA"},
+  {0x317, 4, MS, 0x000000, "IB"},
+  {0x318, 4, MS, 0x000000, "V"},
+  {0x31A, 4, MU, 0x000000, "IRMSA"},
+  {0x31B, 4, MU, 0x000000, "IRMSB"},
+  {0x31C, 4, MU, 0x000000, "VRMS"},
+  {0x31E, 4, ADE7953_REG_NO_DUMP | MS, 0x000000, "AENERGYA"},
+  {0x31F, 4, ADE7953_REG_NO_DUMP | MS, 0x000000, "AENERGYB"},
+  {0x320, 4, ADE7953_REG_NO_DUMP | MS, 0x000000, "RENERGYA"},
+  {0x321, 4, ADE7953_REG_NO_DUMP | MS, 0x000000, "RENERGYB"},
+  {0x322, 4, ADE7953_REG_NO_DUMP | MS, 0x000000, "APENERGYA"},
+  {0x323, 4, ADE7953_REG_NO_DUMP | MS, 0x000000, "APENERGYB"},
+  {0x324, 4, RW, 0xFFFFFF, "OVLVL"},
+  {0x325, 4, RW, 0xFFFFFF, "OILVL"},
+  {0x326, 4, MU, 0x000000, "VPEAK"},
+  {0x327, 4, ADE7953_REG_NO_DUMP | MU, 0x000000, "RSTVPEAK"},
+  {0x328, 4, MU, 0x000000, "IAPEAK"},
+  {0x329, 4, ADE7953_REG_NO_DUMP | MU, 0x000000, "RSTIAPEAK"},
+  {0x32A, 4, MU, 0x000000, "IBPEAK"},
+  {0x32B, 4, ADE7953_REG_NO_DUMP | MU, 0x000000, "RSTIBPEAK"},
+  {0x32C, 4, RW, 0x100000, "IRQENA"},
+  {0x32D, 4, MU, 0x000000, "IRQSTATA"},
+  {0x32E, 4, ADE7953_REG_NO_DUMP | MU, 0x000000, "RSTIRQSTATA"},
+  {0x32F, 4, RW, 0x000000, "IRQENB"},
+  {0x330, 4, MU, 0x000000, "IRQSTATB"},
+  {0x331, 4, ADE7953_REG_NO_DUMP | MU, 0x000000, "RSTIRQSTATB"},
+  {0x37F, 4, ADE7953_REG_NO_RESET, 0xFFFFFF, "CRC"},
+  {0x380, 4, RW, 0x400000, "AIGAIN"},
+  {0x381, 4, RW, 0x400000, "AVGAIN"},
+  {0x382, 4, RW, 0x400000, "AWGAIN"},
+  {0x383, 4, RW, 0x400000, "AVARGAIN"},
+  {0x384, 4, RW, 0x400000, "AVAGAIN"},
+  {0x386, 4, RWS, 0x000000, "AIRMSOS"},
+  {0x388, 4, RWS, 0x000000, "VRMSOS"},
+  {0x389, 4, RWS, 0x000000, "AWATTOS"},
+  {0x38A, 4, RWS, 0x000000, "AVAROS"},
+  {0x38B, 4, RWS, 0x000000, "AVAOS"},
+  {0x38C, 4, RW, 0x400000, "BIGAIN"},
+  {0x38D, 4, RW, 0x400000, "BVGAIN"},
+  {0x38E, 4, RW, 0x400000, "BWGAIN"},
+  {0x38F, 4, RW, 0x400000, "BVARGAIN"},
+  {0x390, 4, RW, 0x400000, "BVAGAIN"},
+  {0x392, 4, RWS, 0x000000, "BIRMSOS"},
+  {0x395, 4, RWS, 0x000000, "BWATTOS"},
+  {0x396, 4, RWS, 0x000000, "BVAROS"},
+  {0x397, 4, RWS, 0x000000, "BVAOS"},
+  {0x3FF, 4, ADE7953_REG_NO_DUMP, 0x000000, "LAST_RWDATA_32"},
+};
+
+static_assert(sizeof(registerTable)/sizeof(registerTable[0]) == ADE7953_REGMAP_SIZE, "ADE7953_REGMAP_SIZE must match the register table");
+
+//Encoded image, little endian:  magic (2)  format (1)  register count (1)  timestamp (4)  valid bitmap  values of the valid registers in
+//table order at their bus width  CRC-32 of everything before it (4)
+
+uint8_t ADE7953RegisterMap::count(){
+  return ADE7953_REGMAP_SIZE;
+  }
+
+const ADE7953RegisterInfo &ADE7953RegisterMap::info(uint8_t index){
+  return registerTable[index < ADE7953_REGMAP_SIZE ? index : 0];
+  }
+
+int ADE7953RegisterMap::find(uint16_t addr){  //Table index of a register, 24-bit addresses (0x2xx) find their 32-bit entry
+  if ((addr & 0xF00) == 0x200 && (addr & 0xFF) != 0xFF) {
+    addr += 0x100;
+    }
+  for (uint8_t i = 0; i < ADE7953_REGMAP_SIZE; i++) {
+    if (registerTable[i].addr == addr) {return i;}
+    }
+  return -1;
+  }
+
+int ADE7953RegisterMap::find(const char *name){
+  for (uint8_t i = 0; i < ADE7953_REGMAP_SIZE; i++) {
+    if (strcmp(registerTable[i].name, name) == 0) {return i;}
+    }
+  return -1;
+  }
+
+void ADE7953RegisterMap::clear(ADE7953RegisterImage &image){
+  memset(&image, 0, sizeof(image));
+  }
+
+void ADE7953RegisterMap::resetDefaults(ADE7953RegisterImage &image){  //What a dump of a freshly reset chip should hold
+  clear(image);
+  for (uint8_t i = 0; i < ADE7953_REGMAP_SIZE; i++) {
+    if (!(registerTable[i].flags & (ADE7953_REG_NO_DUMP | ADE7953_REG_NO_RESET))) {
+      setValue(image, i, registerTable[i].reset);
+      }
+    }
+  }
+
+bool ADE7953RegisterMap::isValid(const ADE7953RegisterImage &image, uint8_t index){
+  return index < ADE7953_REGMAP_SIZE && (image.valid[index >> 3] & (1 << (index & 7)));
+  }
+
+void ADE7953RegisterMap::setValue(ADE7953RegisterImage &image, uint8_t index, uint32_t value){
+  if (index >= ADE7953_REGMAP_SIZE) {
+    return;
+    }
+  image.values[index] = value;
+  image.valid[index >> 3] |= (1 << (index & 7));
+  }
+
+size_t ADE7953RegisterMap::encode(const ADE7953RegisterImage &image, uint8_t *buffer, size_t size){  //Returns the encoded length, 0 if the buffer is too small
+  size_t n = 0;
+  if (size < 8 + sizeof(image.valid) + 4) {
+    return 0;
+    }
+  buffer[n++] = ADE7953_REGMAP_MAGIC & 0xFF;
+  buffer[n++] = ADE7953_REGMAP_MAGIC >> 8;
+  buffer[n++] = ADE7953_REGMAP_FORMAT;
+  buffer[n++] = ADE7953_REGMAP_SIZE;
+  for (uint8_t b = 0; b < 4; b++) {
+    buffer[n++] = (image.timestamp >> (8*b)) & 0xFF;
+    }
+  memcpy(buffer + n, image.valid, sizeof(image.valid));
+  n += sizeof(image.valid);
+  for (uint8_t i = 0; i < ADE7953_REGMAP_SIZE; i++) {
+    if (!isValid(image, i)) {continue;}
+    if (n + registerTable[i].width + 4 > size) {
+      return 0;
+      }
+    for (uint8_t b = 0; b < registerTable[i].width; b++) {
+      buffer[n++] = (image.values[i] >> (8*b)) & 0xFF;
+      }
+    }
+  uint32_t crc = ADE7953Storage::crc32(buffer, n);
+  for (uint8_t b = 0; b < 4; b++) {
+    buffer[n++] = (crc >> (8*b)) & 0xFF;
+    }
+  return n;
+  }
+
+bool ADE7953RegisterMap::decode(const uint8_t *buffer, size_t length, ADE7953RegisterImage &image){  //Rejects other formats, other table sizes and damaged images
+  size_t n = 8 + sizeof(image.valid);
+  clear(image);
+  if (length < n + 4 || buffer[0] != (ADE7953_REGMAP_MAGIC & 0xFF) || buffer[1] != (ADE7953_REGMAP_MAGIC >> 8) ||
+    buffer[2] != ADE7953_REGMAP_FORMAT || buffer[3] != ADE7953_REGMAP_SIZE) {
+    return false;
+    }
+  uint32_t crc = 0;
+  for (uint8_t b = 0; b < 4; b++) {
+    crc |= (uint32_t)buffer[length - 4 + b] << (8*b);
+    }
+  if (crc != ADE7953Storage::crc32(buffer, length - 4)) {
+    return false;
+    }
+  for (uint8_t b = 0; b < 4; b++) {
+    image.timestamp |= (uint32_t)buffer[4 + b] << (8*b);
+    }
+  memcpy(image.valid, buffer + 8, sizeof(image.valid));
+  for (uint8_t i = 0; i < ADE7953_REGMAP_SIZE; i++) {
+    if (!isValid(image, i)) {continue;}
+    if (n + registerTable[i].width > length - 4) {
+      clear(image);
+      return false;
+      }
+    for (uint8_t b = 0; b < registerTable[i].width; b++) {
+      image.values[i] |= (uint32_t)buffer[n++] << (8*b);
+      }
+    }
+  if (n != length - 4) {
+    clear(image);
+    return false;
+    }
+  return true;
+  }
+
+uint8_t ADE7953RegisterMap::diff(const ADE7953RegisterImage &reference, const ADE7953RegisterImage &image, uint8_t ignoreFlags, ADE7953RegisterDiff *diffs, uint8_t maxDiffs){
+  //Registers present in both images whose values differ, skipping any with a flag in ignoreFlags (usually ADE7953_REG_MEASURED).
+  //Returns the number of differences, of which the first maxDiffs are stored.
+  uint8_t found = 0;
+  for (uint8_t i = 0; i < ADE7953_REGMAP_SIZE; i++) {
+    if ((registerTable[i].flags & ignoreFlags) || !isValid(reference, i) || !isValid(image, i) || reference.values[i] == image.values[i]) {
+      continue;
+      }
+    if (found < maxDiffs && diffs) {
+      diffs[found].index = i;
+      diffs[found].from = reference.values[i];
+      diffs[found].to = image.values[i];
+      }
+    found++;
+    }
+  return found;
+  }
+
+size_t ADE7953RegisterMap::formatDiff(const ADE7953RegisterDiff &diff, char *text, size_t size){  //"CONFIG  0x102  0x8004 -> 0x8000"
+  const ADE7953RegisterInfo &reg = info(diff.index);
+  int digits = reg.width*2;
+  int n = snprintf(text, size, "%-14s 0x%03X  0x%0*lX -> 0x%0*lX", reg.name, reg.addr, digits, (unsigned long)diff.from, digits, (unsigned long)diff.to);
+  return (n < 0) ? 0 : (size_t)n;
+  }
+
+int32_t ADE7953RegisterMap::toSigned(uint8_t index, uint32_t value){  //Signed registers read at their 32-bit address come back sign extended already
+  const ADE7953RegisterInfo &reg = info(index);
+  if (!(reg.flags & ADE7953_REG_SIGNED)) {return (int32_t)value;}
+  if (reg.width == 1) {return (int8_t)value;}
+  if (reg.width == 2) {return (int16_t)value;}
+  return (int32_t)value;
+  }
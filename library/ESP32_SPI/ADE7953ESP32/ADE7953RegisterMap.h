@@ -0,0 +1,72 @@
+/*
+ ADE7953RegisterMap.h - ADE7953 register table, compact register images and image diffs
+  One entry per physical register (the 24-bit registers are listed at their 32-bit addresses) with its width, reset value
+  and whether reading it has side effects.  ADE7953::dumpRegisters() fills an image in one bus session; images encode to a
+  few hundred bytes for fault reports and compare against the reset defaults or a known good unit.  No hardware
+  dependency, the same code builds into the host tool in extras/ade7953regs.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#ifndef ADE7953RegisterMap_h
+#define ADE7953RegisterMap_h
+
+#ifdef ARDUINO
+#include "Arduino.h"
+#else
+#include <stdint.h>
+#include <stddef.h>
+#endif
+
+//Register flags
+#define ADE7953_REG_WRITABLE 0x01  //R/W configuration or calibration register
+#define ADE7953_REG_SIGNED 0x02    //Two's complement (the PHCAL registers are sign-magnitude and not flagged)
+#define ADE7953_REG_MEASURED 0x04  //Measurement or status, changes on its own
+#define ADE7953_REG_NO_DUMP 0x08   //Read-with-reset or communication diagnostics, a dump would change or mislead
+#define ADE7953_REG_NO_RESET 0x10  //No fixed reset value (silicon version, configuration checksum)
+
+#define ADE7953_REGMAP_SIZE 86          //Entries in the register table
+#define ADE7953_REGMAP_MAGIC 0x7953
+#define ADE7953_REGMAP_FORMAT 1
+#define ADE7953_REGMAP_MAX_BYTES 384    //Largest encoded image
+
+struct ADE7953RegisterInfo {
+  uint16_t addr;
+  uint8_t width;   //Bytes on the bus: 1, 2 or 4
+  uint8_t flags;   //ADE7953_REG_xxx
+  uint32_t reset;  //Value after a power-on or software reset
+  const char *name;
+};
+
+struct ADE7953RegisterImage {
+  uint32_t timestamp;                                 //millis() when the sweep started
+  uint32_t values[ADE7953_REGMAP_SIZE];               //In table order
+  uint8_t valid[(ADE7953_REGMAP_SIZE + 7)/8];         //Bit set for every register that was read
+};
+
+struct ADE7953RegisterDiff {
+  uint8_t index;  //Table index
+  uint32_t from;  //Value in the reference image
+  uint32_t to;    //Value in the compared image
+};
+
+class ADE7953RegisterMap {
+  public:
+	static uint8_t count();
+	static const ADE7953RegisterInfo &info(uint8_t index);
+	static int find(uint16_t addr);
+	static int find(const char *name);
+
+	static void clear(ADE7953RegisterImage &image);
+	static void resetDefaults(ADE7953RegisterImage &image);
+	static bool isValid(const ADE7953RegisterImage &image, uint8_t index);
+	static void setValue(ADE7953RegisterImage &image, uint8_t index, uint32_t value);
+
+	static size_t encode(const ADE7953RegisterImage &image, uint8_t *buffer, size_t size);
+	static bool decode(const uint8_t *buffer, size_t length, ADE7953RegisterImage &image);
+	static uint8_t diff(const ADE7953RegisterImage &reference, const ADE7953RegisterImage &image, uint8_t ignoreFlags, ADE7953RegisterDiff *diffs, uint8_t maxDiffs);
+	static size_t formatDiff(const ADE7953RegisterDiff &diff, char *text, size_t size);
+	static int32_t toSigned(uint8_t index, uint32_t value);
+};
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ ADE7953Stats.cpp - Streaming statistics of ADE7953 snapshot fields over a reporting interval
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#include "ADE7953Stats.h"
+#include <math.h>
+
+//Floats throughout: the ESP32 FPU is single precision, doubles run in software.  Welford's update keeps the variance
+//accurate even for a small ripple on a large value (mains voltage), where summing squares in float would not.
+
+//****************P-squared Quantile*****************
+
+ADE7953Quantile::ADE7953Quantile(){
+  begin(0.5);
+  }
+
+void ADE7953Quantile::begin(float p){  //Also restarts the estimate
+  _p = p;
+  _count = 0;
+  for (uint8_t i = 0; i < 5; i++) {
+    _q[i] = 0;
+    _n[i] = i + 1;
+    }
+  _desired[0] = 1;
+  _desired[1] = 1 + 2*p;
+  _desired[2] = 1 + 4*p;
+  _desired[3] = 3 + 2*p;
+  _desired[4] = 5;
+  }
+
+uint32_t ADE7953Quantile::count(){
+  return _count;
+  }
+
+float ADE7953Quantile::parabolic(uint8_t i, float d){
+  return _q[i] + d/(_n[i + 1] - _n[i - 1])*((_n[i] - _n[i - 1] + d)*(_q[i + 1] - _q[i])/(_n[i + 1] - _n[i]) + (_n[i + 1] - _n[i] - d)*(_q[i] - _q[i - 1])/(_n[i] - _n[i - 1]));
+  }
+
+void ADE7953Quantile::add(float x){
+  if (x != x) {
+    return;  //NaN would poison every marker
+    }
+  if (_count < 5) {  //The first five samples are the markers, kept sorted
+    uint8_t i = _count++;
+    while (i > 0 && _q[i - 1] > x) {
+      _q[i] = _q[i - 1];
+      i--;
+      }
+    _q[i] = x;
+    return;
+    }
+  
+  uint8_t k;
+  if (x < _q[0]) {
+    _q[0] = x;
+    k = 0;
+    }
+  else if (x >= _q[4]) {
+    _q[4] = x;
+    k = 3;
+    }
+  else {
+    k = 0;
+    while (k < 3 && x >= _q[k + 1]) {k++;}
+    }
+  for (uint8_t i = k + 1; i < 5; i++) {_n[i]++;}
+  _desired[1] += _p/2;
+  _desired[2] += _p;
+  _desired[3] += (1 + _p)/2;
+  _desired[4] += 1;
+  
+  for (uint8_t i = 1; i < 4; i++) {  //Move the middle markers toward their desired positions by at most one
+    float d = _desired[i] - _n[i];
+    if ((d >= 1 && _n[i + 1] - _n[i] > 1) || (d <= -1 && _n[i - 1] - _n[i] < -1)) {
+      int8_t s = (d > 0) ? 1 : -1;
+      float q = parabolic(i, s);
+      if (!(_q[i - 1] < q && q < _q[i + 1])) {
+        q = _q[i] + s*(_q[i + s] - _q[i])/(_n[i + s] - _n[i]);  //Parabola overshot a neighbour, fall back to linear
+        }
+      _q[i] = q;
+      _n[i] += s;
+      }
+    }
+  _count++;
+  }
+
+float ADE7953Quantile::value(){
+  if (_count == 0) {
+    return 0;
+    }
+  if (_count < 5) {  //Interpolate in the sorted samples
+    float rank = _p*(_count - 1);
+    uint8_t i = (uint8_t)rank;
+    return (i + 1U < _count) ? _q[i] + (rank - i)*(_q[i + 1] - _q[i]) : _q[i];
+    }
+  return _q[2];
+  }
+
+//*******************************************************
+
+
+//****************Field Statistics*****************
+
+ADE7953Stats::ADE7953Stats(){
+  _fieldMask = ADE7953_FIELDS_ALL;
+  _low = ADE7953_STATS_LOW;
+  _high = ADE7953_STATS_HIGH;
+  reset();
+  }
+
+void ADE7953Stats::setFieldMask(uint32_t mask){  //Fields to track, leaving out the rest saves the update time; restarts the interval
+  _fieldMask = mask & ADE7953_FIELDS_ALL;
+  reset();
+  }
+
+void ADE7953Stats::setQuantiles(float low, float high){  //e.g. 0.05 and 0.95; restarts the interval
+  _low = low;
+  _high = high;
+  reset();
+  }
+
+void ADE7953Stats::reset(){  //Start a new interval
+  _count = 0;
+  for (uint8_t f = 0; f < ADE7953_FIELDS; f++) {
+    _mean[f] = 0;
+    _m2[f] = 0;
+    _min[f] = 0;
+    _max[f] = 0;
+    _pLow[f].begin(_low);
+    _pHigh[f].begin(_high);
+    }
+  }
+
+void ADE7953Stats::add(const float *values){  //values[ADE7953_FIELDS], e.g. from ADE7953::snapshotValues()
+  _count++;
+  for (uint8_t f = 0; f < ADE7953_FIELDS; f++) {
+    if (!(_fieldMask & (1UL << f))) {continue;}
+    float x = values[f];
+    float delta = x - _mean[f];
+    _mean[f] += delta/_count;
+    _m2[f] += delta*(x - _mean[f]);
+    if (_count == 1 || x < _min[f]) {_min[f] = x;}
+    if (_count == 1 || x > _max[f]) {_max[f] = x;}
+    _pLow[f].add(x);
+    _pHigh[f].add(x);
+    }
+  }
+
+bool ADE7953Stats::getSummary(uint8_t field, ADE7953StatSummary &summary){  //false for an untracked field or an empty interval
+  if (field >= ADE7953_FIELDS || !(_fieldMask & (1UL << field)) || _count == 0) {
+    return false;
+    }
+  summary.count = _count;
+  summary.mean = _mean[field];
+  summary.stddev = (_count > 1) ? sqrtf(_m2[field]/(_count - 1)) : 0;
+  summary.min = _min[field];
+  summary.max = _max[field];
+  summary.pLow = _pLow[field].value();
+  summary.pHigh = _pHigh[field].value();
+  return true;
+  }
+
+uint32_t ADE7953Stats::getCount(){  //Snapshots added since reset()
+  return _count;
+  }
+
+//*******************************************************
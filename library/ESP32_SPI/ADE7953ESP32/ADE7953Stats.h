@@ -0,0 +1,73 @@
+/*
+ ADE7953Stats.h - Streaming statistics of ADE7953 snapshot fields over a reporting interval
+  Mean and variance (Welford), min, max and two quantiles (P-squared estimator, 5 markers each) per field.  Every update
+  is O(1) in fixed memory, no heap, no hardware dependency.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#ifndef ADE7953Stats_h
+#define ADE7953Stats_h
+
+#ifdef ARDUINO
+#include "Arduino.h"
+#else
+#include <stdint.h>
+#include <stddef.h>
+#endif
+#include "ADE7953Deadband.h"
+
+#define ADE7953_STATS_LOW 0.05   //Default quantiles reported as pLow/pHigh
+#define ADE7953_STATS_HIGH 0.95
+
+struct ADE7953StatSummary {  //One field over one interval
+  uint32_t count;
+  float mean;
+  float stddev;  //Sample standard deviation, 0 below two samples
+  float min;
+  float max;
+  float pLow;    //Estimated quantiles (exact below five samples)
+  float pHigh;
+};
+
+class ADE7953Quantile {  //P-squared estimator (Jain & Chlamtac 1985) of one quantile
+  public:
+    ADE7953Quantile();
+	void begin(float p);
+	void add(float x);
+	float value();
+	uint32_t count();
+
+  private:
+	float parabolic(uint8_t i, float d);
+	float _p;
+	uint32_t _count;
+	float _q[5];        //Marker heights
+	int32_t _n[5];      //Marker positions
+	float _desired[5];  //Desired positions
+};
+
+class ADE7953Stats {
+  public:
+    ADE7953Stats();
+	void setFieldMask(uint32_t mask);
+	void setQuantiles(float low, float high);
+	void add(const float *values);
+	bool getSummary(uint8_t field, ADE7953StatSummary &summary);
+	uint32_t getCount();
+	void reset();
+
+  private:
+	uint32_t _fieldMask;
+	float _low;
+	float _high;
+	uint32_t _count;
+	float _mean[ADE7953_FIELDS];
+	float _m2[ADE7953_FIELDS];
+	float _min[ADE7953_FIELDS];
+	float _max[ADE7953_FIELDS];
+	ADE7953Quantile _pLow[ADE7953_FIELDS];
+	ADE7953Quantile _pHigh[ADE7953_FIELDS];
+};
+
+#endif
@@ -0,0 +1,140 @@
+/*
+ ADE7953Storage.cpp - Raw flash access for the ADE7953 logger and checkpoints
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#include "ADE7953Storage.h"
+#include <string.h>
+
+uint32_t ADE7953Storage::crc32(const void *data, size_t length, uint32_t crc){  //CRC-32 (IEEE 802.3), bitwise to keep the table out of RAM
+  const uint8_t *bytes = (const uint8_t *)data;
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= bytes[i];
+    for (uint8_t b = 0; b < 8; b++) {
+      crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+      }
+    }
+  return ~crc;
+  }
+
+
+//****************ESP32 Partition*****************
+#ifdef ESP32
+
+ADE7953PartitionStorage::ADE7953PartitionStorage(){
+  _partition = NULL;
+  }
+
+bool ADE7953PartitionStorage::begin(const char *label){
+  _partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+  return _partition != NULL;
+  }
+
+uint32_t ADE7953PartitionStorage::size(){
+  return _partition ? _partition->size : 0;
+  }
+
+uint32_t ADE7953PartitionStorage::sectorSize(){
+  return SPI_FLASH_SEC_SIZE;
+  }
+
+bool ADE7953PartitionStorage::read(uint32_t address, void *data, size_t length){
+  return _partition && esp_partition_read(_partition, address, data, length) == ESP_OK;
+  }
+
+bool ADE7953PartitionStorage::write(uint32_t address, const void *data, size_t length){
+  return _partition && esp_partition_write(_partition, address, data, length) == ESP_OK;
+  }
+
+bool ADE7953PartitionStorage::erase(uint32_t address){
+  return _partition && esp_partition_erase_range(_partition, address - (address % SPI_FLASH_SEC_SIZE), SPI_FLASH_SEC_SIZE) == ESP_OK;
+  }
+
+#endif
+//*******************************************************
+
+
+//****************Host File*****************
+#ifndef ARDUINO
+
+ADE7953FileStorage::ADE7953FileStorage(){
+  _file = NULL;
+  _size = 0;
+  _sectorSize = 4096;
+  }
+
+ADE7953FileStorage::~ADE7953FileStorage(){
+  if (_file) {fclose(_file);}
+  }
+
+bool ADE7953FileStorage::begin(const char *path, uint32_t size, uint32_t sectorSize){  //An existing file keeps its contents, a new one starts erased
+  uint8_t erased[256];
+  
+  if (_file) {fclose(_file);}
+  _size = size - (size % sectorSize);
+  _sectorSize = sectorSize;
+  _file = fopen(path, "r+b");
+  if (!_file) {
+    if (!(_file = fopen(path, "w+b"))) {return false;}
+    }
+  fseek(_file, 0, SEEK_END);
+  long existing = ftell(_file);
+  memset(erased, 0xFF, sizeof(erased));
+  for (long at = existing; at < (long)_size; at += sizeof(erased)) {
+    fwrite(erased, 1, ((long)_size - at < (long)sizeof(erased)) ? (size_t)(_size - at) : sizeof(erased), _file);
+    }
+  fflush(_file);
+  return true;
+  }
+
+uint32_t ADE7953FileStorage::size(){
+  return _size;
+  }
+
+uint32_t ADE7953FileStorage::sectorSize(){
+  return _sectorSize;
+  }
+
+bool ADE7953FileStorage::read(uint32_t address, void *data, size_t length){
+  if (!_file || address + length > _size) {return false;}
+  fseek(_file, address, SEEK_SET);
+  return fread(data, 1, length, _file) == length;
+  }
+
+bool ADE7953FileStorage::write(uint32_t address, const void *data, size_t length){  //ANDs into the existing bytes like NOR programming
+  uint8_t chunk[256];
+  const uint8_t *bytes = (const uint8_t *)data;
+  
+  if (!_file || address + length > _size) {return false;}
+  while (length > 0) {
+    size_t n = (length < sizeof(chunk)) ? length : sizeof(chunk);
+    if (!read(address, chunk, n)) {return false;}
+    for (size_t i = 0; i < n; i++) {chunk[i] &= bytes[i];}
+    fseek(_file, address, SEEK_SET);
+    if (fwrite(chunk, 1, n, _file) != n) {return false;}
+    address += n;
+    bytes += n;
+    length -= n;
+    }
+  fflush(_file);
+  return true;
+  }
+
+bool ADE7953FileStorage::erase(uint32_t address){
+  uint8_t erased[256];
+  uint32_t start = address - (address % _sectorSize);
+  
+  if (!_file || start >= _size) {return false;}
+  memset(erased, 0xFF, sizeof(erased));
+  fseek(_file, start, SEEK_SET);
+  for (uint32_t n = 0; n < _sectorSize; n += sizeof(erased)) {
+    if (fwrite(erased, 1, sizeof(erased), _file) != sizeof(erased)) {return false;}
+    }
+  fflush(_file);
+  return true;
+  }
+
+#endif
+//*******************************************************
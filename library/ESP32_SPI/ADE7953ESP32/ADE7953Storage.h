@@ -0,0 +1,71 @@
+/*
+ ADE7953Storage.h - Raw flash access for the ADE7953 logger and checkpoints
+  Presents a region with NOR flash rules (erase a sector to 0xFF, writes can only clear bits) so the same logging code runs
+  on an ESP32 data partition and, for testing and tools, on a plain file on Linux.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#ifndef ADE7953Storage_h
+#define ADE7953Storage_h
+
+#ifdef ARDUINO
+#include "Arduino.h"
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#endif
+
+#ifdef ESP32
+#include "esp_partition.h"
+#endif
+
+class ADE7953Storage {
+  public:
+    virtual ~ADE7953Storage() {}
+	virtual uint32_t size() = 0;
+	virtual uint32_t sectorSize() = 0;
+	virtual bool read(uint32_t address, void *data, size_t length) = 0;
+	virtual bool write(uint32_t address, const void *data, size_t length) = 0;  //Only clears bits, the range must have been erased
+	virtual bool erase(uint32_t address) = 0;  //Erases the sector holding address
+
+	static uint32_t crc32(const void *data, size_t length, uint32_t crc = 0);
+};
+
+#ifdef ESP32
+class ADE7953PartitionStorage : public ADE7953Storage {  //A data partition from the partition table, e.g. "adelog, data, 0x99, , 1M"
+  public:
+    ADE7953PartitionStorage();
+	bool begin(const char *label);
+	uint32_t size();
+	uint32_t sectorSize();
+	bool read(uint32_t address, void *data, size_t length);
+	bool write(uint32_t address, const void *data, size_t length);
+	bool erase(uint32_t address);
+
+  private:
+	const esp_partition_t *_partition;
+};
+#endif
+
+#ifndef ARDUINO
+class ADE7953FileStorage : public ADE7953Storage {  //A file standing in for a flash partition, NOR write/erase semantics are emulated
+  public:
+    ADE7953FileStorage();
+    ~ADE7953FileStorage();
+	bool begin(const char *path, uint32_t size, uint32_t sectorSize = 4096);
+	uint32_t size();
+	uint32_t sectorSize();
+	bool read(uint32_t address, void *data, size_t length);
+	bool write(uint32_t address, const void *data, size_t length);
+	bool erase(uint32_t address);
+
+  private:
+	FILE *_file;
+	uint32_t _size;
+	uint32_t _sectorSize;
+};
+#endif
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ ADE7953SubCycleRms.cpp - Half-cycle and full-cycle RMS of the ADE7953 waveform samples, aligned to voltage zero crossings
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#include "ADE7953SubCycleRms.h"
+#include <math.h>
+#include <string.h>
+
+//A crossing is confirmed once V has gone past the hysteresis on the other side of zero, but the half cycle is cut at the
+//sample where V actually changed sign: squares since the last sign change are held in a tail and move to the new half
+//cycle on confirmation, or back into the present one if V turns around (noise near zero).  Squares of the 24-bit
+//waveform codes fit 48 bits, so 64-bit sums cannot overflow within a half cycle.
+
+ADE7953SubCycleRms::ADE7953SubCycleRms(){
+  _hysteresis = ADE7953_SUBCYCLE_HYSTERESIS;
+  reset();
+  }
+
+void ADE7953SubCycleRms::setHysteresis(int32_t counts){  //Raise it for a noisy or low voltage input
+  _hysteresis = counts;
+  }
+
+void ADE7953SubCycleRms::reset(){
+  memset(_sum, 0, sizeof(_sum));
+  memset(_tail, 0, sizeof(_tail));
+  memset(_prevSum, 0, sizeof(_prevSum));
+  memset(&_latest, 0, sizeof(_latest));
+  _count = 0;
+  _tailCount = 0;
+  _prevCount = 0;
+  _polarity = 0;
+  _lastPositive = false;
+  _valid = false;
+  _halfCycles = 0;
+  _started = false;
+  }
+
+void ADE7953SubCycleRms::close(uint32_t time, bool timeout){
+  _latest.time = time;
+  _latest.samples = _count;
+  _latest.timeout = timeout;
+  for (uint8_t c = 0; c < 3; c++) {
+    _latest.half[c] = _count ? sqrtf((float)((double)_sum[c]/_count)) : 0;
+    _latest.full[c] = (_count + _prevCount) ? sqrtf((float)((double)(_sum[c] + _prevSum[c])/(_count + _prevCount))) : 0;
+    _prevSum[c] = _sum[c];
+    }
+  _prevCount = _count;
+  _valid = (_prevCount > 0);
+  _halfCycles++;
+  }
+
+bool ADE7953SubCycleRms::add(uint32_t time, int32_t v, int32_t ia, int32_t ib){  //One waveform sample, returns true when a half cycle closed (getLatest())
+  int64_t x[3] = {v, ia, ib};
+  bool positive = (v >= 0);
+  bool closed = false;
+  
+  if (!_started) {
+    _halfStart = time;
+    _tailStart = time;
+    _lastPositive = positive;
+    _started = true;
+    }
+  if (positive != _lastPositive) {  //Sign change: what was held back belongs to the present half cycle after all
+    for (uint8_t c = 0; c < 3; c++) {
+      _sum[c] += _tail[c];
+      _tail[c] = 0;
+      }
+    _count += _tailCount;
+    _tailCount = 0;
+    _tailStart = time;
+    _lastPositive = positive;
+    }
+  for (uint8_t c = 0; c < 3; c++) {
+    _tail[c] += (uint64_t)(x[c]*x[c]);
+    }
+  _tailCount++;
+  
+  if ((_polarity >= 0 && v < -_hysteresis) || (_polarity <= 0 && v > _hysteresis)) {  //Crossing confirmed, the new half cycle started at the sign change
+    int8_t polarity = (v > 0) ? 1 : -1;
+    if (_polarity != 0) {
+      close(_tailStart, false);
+      closed = true;
+      }
+    _polarity = polarity;
+    memcpy(_sum, _tail, sizeof(_sum));
+    _count = _tailCount;
+    memset(_tail, 0, sizeof(_tail));
+    _tailCount = 0;
+    _halfStart = _tailStart;
+    }
+  else if ((uint32_t)(time - _halfStart) > ADE7953_SUBCYCLE_TIMEOUT_US) {  //No crossing: report what there is so a lost voltage still shows within a cycle
+    for (uint8_t c = 0; c < 3; c++) {
+      _sum[c] += _tail[c];
+      _tail[c] = 0;
+      }
+    _count += _tailCount;
+    _tailCount = 0;
+    close(time, true);
+    memset(_sum, 0, sizeof(_sum));
+    _count = 0;
+    _polarity = 0;
+    _halfStart = time;
+    _tailStart = time;
+    closed = true;
+    }
+  return closed;
+  }
+
+bool ADE7953SubCycleRms::getLatest(ADE7953CycleRms &rms){  //false until a full cycle has been seen
+  if (!_valid) {
+    return false;
+    }
+  rms = _latest;
+  return true;
+  }
+
+uint32_t ADE7953SubCycleRms::getHalfCycles(){  //Half cycles closed since reset()
+  return _halfCycles;
+  }
@@ -0,0 +1,60 @@
+/*
+ ADE7953SubCycleRms.h - Half-cycle and full-cycle RMS of the ADE7953 waveform samples, aligned to voltage zero crossings
+  Integer sums of squares over each half cycle of the voltage, updated as samples arrive; every half cycle gives a
+  half-cycle RMS and the RMS of the last full cycle (two halves) for V, IA and IB, in waveform codes (ADE7953::getSubCycleRms()
+  converts them to the VRMS/IRMS register scale).  No hardware dependency.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#ifndef ADE7953SubCycleRms_h
+#define ADE7953SubCycleRms_h
+
+#ifdef ARDUINO
+#include "Arduino.h"
+#else
+#include <stdint.h>
+#include <stddef.h>
+#endif
+
+#define ADE7953_SUBCYCLE_HYSTERESIS 65000L  //Voltage waveform codes (1% of the 6,500,000 full scale) beyond zero that confirm a crossing
+#define ADE7953_SUBCYCLE_TIMEOUT_US 12500UL //A half cycle is closed after this long without a crossing (longer than a 40 Hz half cycle)
+
+struct ADE7953CycleRms {
+  uint32_t time;      //micros() of the zero crossing (or timeout) that ended the half cycle
+  uint16_t samples;   //Samples in the half cycle
+  bool timeout;       //Closed without a zero crossing: the voltage is missing or distorted
+  float half[3];      //RMS over the half cycle, indexed ADE7953_CHANNEL_V/A/B
+  float full[3];      //RMS over this and the previous half cycle
+};
+
+class ADE7953SubCycleRms {
+  public:
+    ADE7953SubCycleRms();
+	void setHysteresis(int32_t counts);
+	bool add(uint32_t time, int32_t v, int32_t ia, int32_t ib);
+	bool getLatest(ADE7953CycleRms &rms);
+	uint32_t getHalfCycles();
+	void reset();
+
+  private:
+	void close(uint32_t time, bool timeout);
+	
+	int32_t _hysteresis;
+	int8_t _polarity;       //Confirmed half cycle: 1 positive, -1 negative, 0 not yet known
+	bool _lastPositive;     //Sign of the previous sample
+	uint64_t _sum[3];       //Squares from the start of the half cycle up to the last sign change of V
+	uint16_t _count;
+	uint64_t _tail[3];      //Squares since that sign change, joined to the next half cycle if it is confirmed as a crossing
+	uint16_t _tailCount;
+	uint32_t _tailStart;
+	uint32_t _halfStart;
+	uint64_t _prevSum[3];   //Previous half cycle, for the full-cycle RMS
+	uint16_t _prevCount;
+	ADE7953CycleRms _latest;
+	bool _valid;
+	uint32_t _halfCycles;
+	bool _started;
+};
+
+#endif
@@ -0,0 +1,185 @@
+/*
+ ADE7953Tariff.cpp - Time-of-use binning of the ADE7953 energy totals
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#include "ADE7953Tariff.h"
+#include <string.h>
+
+//Times are local seconds since 1970-01-01 (epoch time plus the UTC/DST offset), so band changes fall on local clock
+//minutes.  A day without a switch at minute 0 starts in the band of the last switch before midnight, on whichever earlier
+//day it was, the way a meter's register stays selected overnight.  getBand() looks back at most 8 days, so band 0 is left
+//only by a schedule with no switch on any weekday.
+
+ADE7953Tariff::ADE7953Tariff(){
+  _switchCount = 0;
+  _holidayCount = 0;
+  _started = false;
+  clearRegisters();
+  _checkpointed = 0;
+  _cleared = false;
+  }
+
+bool ADE7953Tariff::setSchedule(const ADE7953TariffSwitch *switches, uint8_t count){  //Copied and sorted by minute, false if it does not fit or names a band past ADE7953_TARIFF_MAX_BANDS
+  if (count > ADE7953_TARIFF_MAX_SWITCHES) {
+    return false;
+    }
+  for (uint8_t i = 0; i < count; i++) {
+    if (switches[i].band >= ADE7953_TARIFF_MAX_BANDS || switches[i].minute >= 1440) {
+      return false;
+      }
+    }
+  for (uint8_t i = 0; i < count; i++) {  //Insertion sort, the table is short and set once
+    uint8_t j = i;
+    while (j > 0 && _switches[j - 1].minute > switches[i].minute) {
+      _switches[j] = _switches[j - 1];
+      j--;
+      }
+    _switches[j] = switches[i];
+    }
+  _switchCount = count;
+  return true;
+  }
+
+bool ADE7953Tariff::addHoliday(uint16_t day){  //day from dayNumber()
+  if (_holidayCount >= ADE7953_TARIFF_MAX_HOLIDAYS) {
+    return false;
+    }
+  _holidays[_holidayCount++] = day;
+  return true;
+  }
+
+void ADE7953Tariff::clearHolidays(){
+  _holidayCount = 0;
+  }
+
+uint16_t ADE7953Tariff::dayNumber(uint16_t year, uint8_t month, uint8_t day){  //Days since 1970-01-01 of a civil date
+  int32_t y = year - (month <= 2);
+  int32_t era = y/400;
+  uint32_t yoe = y - era*400;
+  uint32_t doy = (153*(month + (month > 2 ? -3 : 9)) + 2)/5 + day - 1;
+  uint32_t doe = yoe*365 + yoe/4 - yoe/100 + doy;
+  return (uint16_t)(era*146097 + (int32_t)doe - 719468);
+  }
+
+uint8_t ADE7953Tariff::dayType(uint32_t time){
+  uint16_t day = time/86400;
+  for (uint8_t i = 0; i < _holidayCount; i++) {
+    if (_holidays[i] == day) {
+      return ADE7953_TARIFF_HOLIDAY;
+      }
+    }
+  return 1 << ((day + 4) % 7);  //1970-01-01 was a Thursday
+  }
+
+uint8_t ADE7953Tariff::getBand(uint32_t time){  //Band of the last switch at or before time, looking back over earlier days if need be
+  uint16_t minute = (time % 86400)/60;
+  for (uint8_t back = 0; back <= 8 && time >= back*86400UL; back++) {  //A week and a holiday cover every day type
+    uint8_t type = dayType(time - back*86400UL);
+    for (int16_t i = _switchCount - 1; i >= 0; i--) {
+      if ((_switches[i].days & type) && (back > 0 || _switches[i].minute <= minute)) {
+        return _switches[i].band;
+        }
+      }
+    }
+  return 0;
+  }
+
+uint32_t ADE7953Tariff::nextChange(uint32_t time){  //Start of the next switch of the day, or the next midnight (where the day type may change)
+  uint8_t type = dayType(time);
+  uint32_t midnight = time - time % 86400;
+  uint16_t minute = (time % 86400)/60;
+  for (uint8_t i = 0; i < _switchCount; i++) {
+    if (_switches[i].minute > minute && (_switches[i].days & type)) {
+      return midnight + _switches[i].minute*60UL;
+      }
+    }
+  return midnight + 86400;
+  }
+
+void ADE7953Tariff::addEnergy(uint8_t band, uint64_t activeImport, uint64_t activeExport){
+  _registers[band].activeImport += activeImport;
+  _registers[band].activeExport += activeExport;
+  }
+
+void ADE7953Tariff::update(const ADE7953EnergyTotals &totals, uint32_t time){  //Call after accumulateEnergy() with the local time
+  if (!_started || totals.activeImport < _lastImport || totals.activeExport < _lastExport || time < _lastTime) {  //First call, totals replaced or clock stepped back
+    _lastImport = totals.activeImport;
+    _lastExport = totals.activeExport;
+    _lastTime = time;
+    _started = true;
+    return;
+    }
+  
+  uint64_t importDelta = totals.activeImport - _lastImport;
+  uint64_t exportDelta = totals.activeExport - _lastExport;
+  _lastImport = totals.activeImport;
+  _lastExport = totals.activeExport;
+  
+  if (time - _lastTime > ADE7953_TARIFF_MAX_GAP) {
+    _lastTime = time;
+    addEnergy(getBand(time), importDelta, exportDelta);
+    return;
+    }
+  uint32_t change = nextChange(_lastTime);
+  while (change < time) {  //Spread evenly over the time since the last update, a band at a time
+    uint32_t span = time - _lastTime;
+    uint64_t importPart = importDelta*(change - _lastTime)/span;
+    uint64_t exportPart = exportDelta*(change - _lastTime)/span;
+    addEnergy(getBand(_lastTime), importPart, exportPart);
+    importDelta -= importPart;
+    exportDelta -= exportPart;
+    _lastTime = change;
+    change = nextChange(change);
+    }
+  addEnergy(getBand(_lastTime), importDelta, exportDelta);
+  _lastTime = time;
+  }
+
+bool ADE7953Tariff::getRegister(uint8_t band, ADE7953TariffRegister &reg){
+  if (band >= ADE7953_TARIFF_MAX_BANDS) {
+    return false;
+    }
+  reg = _registers[band];
+  return true;
+  }
+
+void ADE7953Tariff::clearRegisters(){  //e.g. at the start of a billing period
+  memset(_registers, 0, sizeof(_registers));
+  _cleared = true;
+  }
+
+uint64_t ADE7953Tariff::moved(){
+  uint64_t total = 0;
+  for (uint8_t b = 0; b < ADE7953_TARIFF_MAX_BANDS; b++) {
+    total += _registers[b].activeImport + _registers[b].activeExport;
+    }
+  return total;
+  }
+
+bool ADE7953Tariff::restoreRegisters(ADE7953Checkpoint &checkpoint){  //false when no checkpoint was found, the registers are left as they are
+  ADE7953TariffRegister registers[ADE7953_TARIFF_MAX_BANDS];
+  if (!checkpoint.restore(registers, sizeof(registers))) {
+    return false;
+    }
+  memcpy(_registers, registers, sizeof(_registers));
+  _checkpointed = moved();
+  _cleared = false;
+  return true;
+  }
+
+bool ADE7953Tariff::checkpointRegisters(ADE7953Checkpoint &checkpoint, unsigned long now){  //Call with millis(), same write policy as ADE7953::checkpointEnergy(); writes at once after clearRegisters()
+  uint64_t total = moved();
+  if (_cleared) {
+    if (!checkpoint.save(_registers, sizeof(_registers))) {
+      return false;
+      }
+    }
+  else if (!checkpoint.update(now, total - _checkpointed, _registers, sizeof(_registers))) {
+    return false;
+    }
+  _cleared = false;
+  _checkpointed = total;
+  return true;
+  }
@@ -0,0 +1,91 @@
+/*
+ ADE7953Tariff.h - Time-of-use binning of the ADE7953 energy totals
+  A compact switch table (day types x start minute -> band) and a holiday list route each energy delta into per-band
+  64-bit import/export registers, split in proportion to time where a delta straddles a band change.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#ifndef ADE7953Tariff_h
+#define ADE7953Tariff_h
+
+#ifdef ARDUINO
+#include "Arduino.h"
+#else
+#include <stdint.h>
+#include <stddef.h>
+#endif
+#include "ADE7953Telemetry.h"
+#include "ADE7953Checkpoint.h"
+
+#ifndef ADE7953_TARIFF_MAX_BANDS
+#define ADE7953_TARIFF_MAX_BANDS 6        //Registers kept in flash must fit one checkpoint record
+#endif
+#ifndef ADE7953_TARIFF_MAX_SWITCHES
+#define ADE7953_TARIFF_MAX_SWITCHES 32
+#endif
+#ifndef ADE7953_TARIFF_MAX_HOLIDAYS
+#define ADE7953_TARIFF_MAX_HOLIDAYS 24
+#endif
+#ifndef ADE7953_TARIFF_MAX_GAP
+#define ADE7953_TARIFF_MAX_GAP 604800UL   //Longer gaps between updates (s), e.g. the first clock sync, go to the present band unsplit
+#endif
+
+//Day type bits of ADE7953TariffSwitch::days
+#define ADE7953_TARIFF_SUNDAY 0x01
+#define ADE7953_TARIFF_MONDAY 0x02
+#define ADE7953_TARIFF_TUESDAY 0x04
+#define ADE7953_TARIFF_WEDNESDAY 0x08
+#define ADE7953_TARIFF_THURSDAY 0x10
+#define ADE7953_TARIFF_FRIDAY 0x20
+#define ADE7953_TARIFF_SATURDAY 0x40
+#define ADE7953_TARIFF_HOLIDAY 0x80   //Used instead of the weekday bit on a holiday
+#define ADE7953_TARIFF_WEEKDAYS 0x3E
+#define ADE7953_TARIFF_WEEKEND 0x41
+
+struct ADE7953TariffSwitch {  //From minute on the matching days the band applies, until the next switch that applies, that day or later
+  uint8_t days;     //ADE7953_TARIFF_ day type bits
+  uint8_t band;
+  uint16_t minute;  //Minute of the day, 0-1439
+};
+
+struct ADE7953TariffRegister {  //Per band, in uWh like ADE7953EnergyTotals
+  uint64_t activeImport;
+  uint64_t activeExport;
+};
+
+class ADE7953Tariff {
+  public:
+    ADE7953Tariff();
+	bool setSchedule(const ADE7953TariffSwitch *switches, uint8_t count);
+	bool addHoliday(uint16_t day);
+	void clearHolidays();
+	uint8_t getBand(uint32_t time);
+	void update(const ADE7953EnergyTotals &totals, uint32_t time);
+	bool getRegister(uint8_t band, ADE7953TariffRegister &reg);
+	void clearRegisters();
+	bool restoreRegisters(ADE7953Checkpoint &checkpoint);
+	bool checkpointRegisters(ADE7953Checkpoint &checkpoint, unsigned long now);
+	
+	static uint16_t dayNumber(uint16_t year, uint8_t month, uint8_t day);
+
+  private:
+	uint8_t dayType(uint32_t time);
+	uint32_t nextChange(uint32_t time);
+	void addEnergy(uint8_t band, uint64_t activeImport, uint64_t activeExport);
+	uint64_t moved();
+	
+	ADE7953TariffSwitch _switches[ADE7953_TARIFF_MAX_SWITCHES];
+	uint8_t _switchCount;
+	uint16_t _holidays[ADE7953_TARIFF_MAX_HOLIDAYS];
+	uint8_t _holidayCount;
+	ADE7953TariffRegister _registers[ADE7953_TARIFF_MAX_BANDS];
+	uint64_t _lastImport;
+	uint64_t _lastExport;
+	uint32_t _lastTime;
+	bool _started;
+	uint64_t _checkpointed;
+	bool _cleared;
+};
+
+#endif
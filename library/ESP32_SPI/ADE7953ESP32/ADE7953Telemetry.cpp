@@ -0,0 +1,286 @@
+/*
+ ADE7953Telemetry.cpp - Compact binary encoding of ADE7953 snapshots and energy totals
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#include "ADE7953Telemetry.h"
+#include <math.h>
+#include <string.h>
+
+//Floats are sent as integers at a fixed resolution per field (the scale is part of the schema, sender and receiver must
+//agree on it).  The defaults keep one count per register LSB with the shipped calibration gains of 1.0, where VRMS and
+//IRMS read up to 9,032,007 and the powers about 4,860,000; a count per mV or mW would clip at int32.  Gains calibrated
+//to engineering units need ADE7953::telemetryResolution() on both ends instead.  Between keyframes each field is sent as
+//the change since its last transmission, so a steady reading costs one byte and a field left out by the deadband mask
+//costs nothing.  Energy totals are 64-bit micro units and only move by the energy of one interval, which keeps their
+//deltas to a few bytes.
+
+static const float telemetryResolution[ADE7953_FIELDS] = {  //Counts per unit in schema version 2
+  1,     //VRMS           register counts with the shipped gains
+  1,     //IRMSA
+  1,     //IRMSB
+  1,     //ACTIVEA
+  1,     //ACTIVEB
+  1,     //REACTIVEA
+  1,     //REACTIVEB
+  1,     //APPARENTA
+  1,     //APPARENTB
+  10000, //PFA
+  10000, //PFB
+  1,     //PERIOD         raw register counts
+  1000,  //FREQUENCY      mHz
+  100,   //ANGLEA         0.01 degree
+  100    //ANGLEB
+};
+
+static void energyWords(const ADE7953EnergyTotals &totals, uint64_t *words){
+  words[0] = totals.activeImport;
+  words[1] = totals.activeExport;
+  words[2] = totals.reactive[0];
+  words[3] = totals.reactive[1];
+  words[4] = totals.reactive[2];
+  words[5] = totals.reactive[3];
+  words[6] = totals.apparent;
+  }
+
+static void energyTotals(const uint64_t *words, ADE7953EnergyTotals &totals){
+  totals.activeImport = words[0];
+  totals.activeExport = words[1];
+  totals.reactive[0] = words[2];
+  totals.reactive[1] = words[3];
+  totals.reactive[2] = words[4];
+  totals.reactive[3] = words[5];
+  totals.apparent = words[6];
+  }
+
+//****************Encoder*****************
+
+ADE7953TelemetryEncoder::ADE7953TelemetryEncoder(){
+  for (uint8_t f = 0; f < ADE7953_FIELDS; f++) {
+    _scale[f] = telemetryResolution[f];
+    _last[f] = 0;
+    }
+  memset(_lastEnergy, 0, sizeof(_lastEnergy));
+  _lastTimestamp = 0;
+  _keyframeInterval = ADE7953_TELEMETRY_KEYFRAME_INTERVAL;
+  _sinceKeyframe = 0;
+  _energySent = 0;
+  _needKeyframe = true;
+  }
+
+float ADE7953TelemetryEncoder::defaultResolution(uint8_t field){
+  return (field < ADE7953_FIELDS) ? telemetryResolution[field] : 1;
+  }
+
+void ADE7953TelemetryEncoder::setResolution(uint8_t field, float scale){  //Counts per unit, the decoder must be given the same value
+  if (field < ADE7953_FIELDS && scale > 0) {
+    _scale[field] = scale;
+    _needKeyframe = true;
+    }
+  }
+
+void ADE7953TelemetryEncoder::setKeyframeInterval(uint16_t records){  //0: only the first record and forced ones
+  _keyframeInterval = records;
+  }
+
+void ADE7953TelemetryEncoder::forceKeyframe(){  //E.g. after a reconnect, when the receiver may have lost its state
+  _needKeyframe = true;
+  }
+
+uint64_t ADE7953TelemetryEncoder::zigzag(int64_t value){
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+  }
+
+int32_t ADE7953TelemetryEncoder::quantize(float value, float scale){  //NaN is sent as 0
+  float scaled = value*scale;
+  if (!(scaled == scaled)) {return 0;}
+  if (scaled >= 2147483647.0f) {return 2147483647L;}
+  if (scaled <= -2147483648.0f) {return -2147483647L - 1;}
+  return (int32_t)lroundf(scaled);
+  }
+
+size_t ADE7953TelemetryEncoder::putVarint(uint64_t value, uint8_t *buffer, size_t size){  //Returns the bytes written, 0 if they do not fit
+  size_t n = 0;
+  do {
+    if (n >= size) {return 0;}
+    uint8_t b = value & 0x7F;
+    value >>= 7;
+    buffer[n++] = value ? (b | 0x80) : b;
+    } while (value);
+  return n;
+  }
+
+size_t ADE7953TelemetryEncoder::encode(const float *values, uint32_t fieldMask, uint32_t timestamp, const ADE7953EnergyTotals *energy, uint8_t energyMask, uint8_t *buffer, size_t size){
+  //values[ADE7953_FIELDS], energy[2] (may be NULL with energyMask 0).  Returns the record length, 0 if the buffer is too small
+  //(ADE7953_TELEMETRY_MAX_RECORD always fits); nothing is committed to the encoder state unless the record was completed.
+  bool keyframe = _needKeyframe || (_keyframeInterval > 0 && _sinceKeyframe >= _keyframeInterval);
+  int32_t next[ADE7953_FIELDS];
+  uint64_t nextEnergy[2][ADE7953_TELEMETRY_ENERGY_WORDS];
+  size_t n = 0, w;
+  
+  if (energy == NULL) {energyMask = 0;}
+  energyMask &= 0x03;
+  fieldMask &= ADE7953_FIELDS_ALL;
+  if (energyMask & ~_energySent) {keyframe = true;}  //No absolute for this channel since the last keyframe, a delta would have no base
+  if (keyframe) {
+    fieldMask = ADE7953_FIELDS_ALL;
+    if (energy != NULL) {energyMask = 0x03;}  //A receiver that resynchronizes here gets every total
+    }
+  if (size < 1) {return 0;}
+  buffer[n++] = ADE7953_TELEMETRY_VERSION | (keyframe ? ADE7953_TELEMETRY_KEYFRAME : 0) | (energyMask ? ADE7953_TELEMETRY_ENERGY : 0);
+  if (!(w = putVarint(keyframe ? timestamp : (uint32_t)(timestamp - _lastTimestamp), buffer + n, size - n))) {return 0;}
+  n += w;
+  if (!(w = putVarint(fieldMask, buffer + n, size - n))) {return 0;}
+  n += w;
+  memcpy(next, _last, sizeof(next));
+  for (uint8_t f = 0; f < ADE7953_FIELDS; f++) {
+    if (!(fieldMask & (1UL << f))) {continue;}
+    next[f] = quantize(values[f], _scale[f]);
+    int64_t v = keyframe ? (int64_t)next[f] : (int64_t)next[f] - (int64_t)_last[f];
+    if (!(w = putVarint(zigzag(v), buffer + n, size - n))) {return 0;}
+    n += w;
+    }
+  memcpy(nextEnergy, _lastEnergy, sizeof(nextEnergy));
+  if (energyMask) {
+    if (n >= size) {return 0;}
+    buffer[n++] = energyMask;
+    for (uint8_t ch = 0; ch < 2; ch++) {
+      if (!(energyMask & (1 << ch))) {continue;}
+      energyWords(energy[ch], nextEnergy[ch]);
+      for (uint8_t i = 0; i < ADE7953_TELEMETRY_ENERGY_WORDS; i++) {
+        uint64_t v = keyframe ? nextEnergy[ch][i] : zigzag((int64_t)(nextEnergy[ch][i] - _lastEnergy[ch][i]));
+        if (!(w = putVarint(v, buffer + n, size - n))) {return 0;}
+        n += w;
+        }
+      }
+    }
+  
+  memcpy(_last, next, sizeof(_last));
+  memcpy(_lastEnergy, nextEnergy, sizeof(_lastEnergy));
+  _lastTimestamp = timestamp;
+  _sinceKeyframe = keyframe ? 1 : _sinceKeyframe + 1;
+  if (keyframe) {_energySent = energyMask;}
+  _needKeyframe = false;
+  return n;
+  }
+
+//*******************************************************
+
+
+//****************Decoder*****************
+
+ADE7953TelemetryDecoder::ADE7953TelemetryDecoder(){
+  for (uint8_t f = 0; f < ADE7953_FIELDS; f++) {
+    _scale[f] = telemetryResolution[f];
+    }
+  reset();
+  }
+
+void ADE7953TelemetryDecoder::reset(){  //Delta records are refused until the next keyframe
+  for (uint8_t f = 0; f < ADE7953_FIELDS; f++) {
+    _last[f] = 0;
+    }
+  memset(_lastEnergy, 0, sizeof(_lastEnergy));
+  _lastTimestamp = 0;
+  _energySynced = 0;
+  _synced = false;
+  }
+
+void ADE7953TelemetryDecoder::setResolution(uint8_t field, float scale){
+  if (field < ADE7953_FIELDS && scale > 0) {
+    _scale[field] = scale;
+    }
+  }
+
+int64_t ADE7953TelemetryDecoder::unzigzag(uint64_t value){
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+  }
+
+int ADE7953TelemetryDecoder::getVarint(const uint8_t *buffer, size_t length, uint64_t &value){  //Returns the bytes read or a negative result
+  value = 0;
+  for (size_t i = 0; i < length; i++) {
+    if (i == 10 || (i == 9 && buffer[i] > 1)) {
+      return ADE7953_TELEMETRY_BAD_VARINT;  //Longer than 64 bits
+      }
+    value |= (uint64_t)(buffer[i] & 0x7F) << (7*i);
+    if (!(buffer[i] & 0x80)) {
+      return (int)i + 1;
+      }
+    }
+  return ADE7953_TELEMETRY_TRUNCATED;
+  }
+
+int ADE7953TelemetryDecoder::decode(const uint8_t *buffer, size_t length, ADE7953TelemetryRecord &record){
+  //Records are self-delimiting, call again with buffer + result for the next one.  The decoder state only moves on a
+  //complete record, so a truncated or corrupt record can be dropped without losing synchronization.
+  int32_t next[ADE7953_FIELDS];
+  uint64_t nextEnergy[2][ADE7953_TELEMETRY_ENERGY_WORDS];
+  uint64_t v;
+  size_t n = 0;
+  int r;
+  
+  if (length < 1) {return ADE7953_TELEMETRY_TRUNCATED;}
+  uint8_t header = buffer[n++];
+  if ((header & 0x0F) != ADE7953_TELEMETRY_VERSION || (header & 0xC0)) {
+    return ADE7953_TELEMETRY_BAD_VERSION;
+    }
+  bool keyframe = (header & ADE7953_TELEMETRY_KEYFRAME) != 0;
+  if (!keyframe && !_synced) {
+    return ADE7953_TELEMETRY_NO_KEYFRAME;
+    }
+  if ((r = getVarint(buffer + n, length - n, v)) < 0) {return r;}
+  n += r;
+  uint32_t timestamp = keyframe ? (uint32_t)v : _lastTimestamp + (uint32_t)v;
+  if ((r = getVarint(buffer + n, length - n, v)) < 0) {return r;}
+  n += r;
+  if (v & ~(uint64_t)ADE7953_FIELDS_ALL) {return ADE7953_TELEMETRY_BAD_VERSION;}  //Fields this schema does not know
+  uint32_t fieldMask = (uint32_t)v;
+  memcpy(next, _last, sizeof(next));
+  for (uint8_t f = 0; f < ADE7953_FIELDS; f++) {
+    if (!(fieldMask & (1UL << f))) {continue;}
+    if ((r = getVarint(buffer + n, length - n, v)) < 0) {return r;}
+    n += r;
+    next[f] = keyframe ? (int32_t)unzigzag(v) : (int32_t)(_last[f] + unzigzag(v));
+    }
+  memcpy(nextEnergy, _lastEnergy, sizeof(nextEnergy));
+  uint8_t energyMask = 0;
+  if (header & ADE7953_TELEMETRY_ENERGY) {
+    if (n >= length) {return ADE7953_TELEMETRY_TRUNCATED;}
+    energyMask = buffer[n++];
+    if (energyMask & ~0x03) {return ADE7953_TELEMETRY_BAD_VERSION;}
+    for (uint8_t ch = 0; ch < 2; ch++) {
+      if (!(energyMask & (1 << ch))) {continue;}
+      for (uint8_t i = 0; i < ADE7953_TELEMETRY_ENERGY_WORDS; i++) {
+        if ((r = getVarint(buffer + n, length - n, v)) < 0) {return r;}
+        n += r;
+        nextEnergy[ch][i] = keyframe ? v : _lastEnergy[ch][i] + (uint64_t)unzigzag(v);
+        }
+      }
+    }
+  uint8_t energySynced = keyframe ? energyMask : _energySynced;
+  energyMask &= energySynced;  //A delta with no absolute to add it to is read past and dropped
+  for (uint8_t ch = 0; ch < 2; ch++) {
+    if (!(energySynced & (1 << ch))) {memset(nextEnergy[ch], 0, sizeof(nextEnergy[ch]));}
+    }
+  
+  memcpy(_last, next, sizeof(_last));
+  memcpy(_lastEnergy, nextEnergy, sizeof(_lastEnergy));
+  _lastTimestamp = timestamp;
+  _energySynced = energySynced;
+  _synced = true;
+  record.version = header & 0x0F;
+  record.keyframe = keyframe;
+  record.timestamp = timestamp;
+  record.fieldMask = fieldMask;
+  for (uint8_t f = 0; f < ADE7953_FIELDS; f++) {
+    record.values[f] = (float)next[f]/_scale[f];
+    }
+  record.energyMask = energyMask;
+  record.energyValid = energySynced;
+  energyTotals(_lastEnergy[0], record.energy[0]);
+  energyTotals(_lastEnergy[1], record.energy[1]);
+  return (int)n;
+  }
+
+//*******************************************************
@@ -0,0 +1,106 @@
+/*
+ ADE7953Telemetry.h - Compact binary encoding of ADE7953 snapshots and energy totals
+  Versioned record format built from a field bitmap, per-field deltas and zigzag varints.  No hardware dependency, so the
+  decoder in extras/ade7953telemetry runs the same code on a PC.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#ifndef ADE7953Telemetry_h
+#define ADE7953Telemetry_h
+
+#ifdef ARDUINO
+#include "Arduino.h"
+#else
+#include <stdint.h>
+#include <stddef.h>
+#endif
+#include "ADE7953Deadband.h"
+
+//Record layout, schema version 2 (all integers are LEB128 varints unless noted):
+//  header byte   bits 3:0 schema version, bit 4 keyframe, bit 5 energy totals follow
+//  timestamp     keyframe: millis(), otherwise ms since the previous record
+//  field bitmap  bit n = ADE7953_FIELD n present; a keyframe always carries every field
+//  fields        zigzag(value x resolution), minus the previous value of that field unless keyframe, in field order
+//  energy        channel mask byte (bit 0 = A, bit 1 = B), then per channel the 7 totals in ADE7953EnergyTotals order,
+//                zigzag of the change since the previous record (absolute on a keyframe); an encoder given totals puts
+//                both channels in every keyframe, and only sends a channel as a delta after a keyframe carried it
+//Version 2 changed the default resolutions to one register count (see ADE7953TelemetryEncoder::defaultResolution)
+#define ADE7953_TELEMETRY_VERSION 2
+#define ADE7953_TELEMETRY_KEYFRAME 0x10
+#define ADE7953_TELEMETRY_ENERGY 0x20
+#define ADE7953_TELEMETRY_MAX_RECORD 232  //Worst case record size, every field and both energy channels at full width
+#define ADE7953_TELEMETRY_ENERGY_WORDS 7
+
+#ifndef ADE7953_TELEMETRY_KEYFRAME_INTERVAL
+#define ADE7953_TELEMETRY_KEYFRAME_INTERVAL 60 //Records between keyframes, a receiver that lost a record resynchronizes on the next one
+#endif
+
+//Decoder results (negative), otherwise the number of bytes consumed
+#define ADE7953_TELEMETRY_TRUNCATED -1
+#define ADE7953_TELEMETRY_BAD_VERSION -2
+#define ADE7953_TELEMETRY_NO_KEYFRAME -3
+#define ADE7953_TELEMETRY_BAD_VARINT -4
+
+struct ADE7953EnergyTotals {  //Running totals for one current channel, in micro units (uWh, uvarh, uVAh) so 64 bits never wrap in service life
+  uint64_t activeImport;
+  uint64_t activeExport;
+  uint64_t reactive[4];  //Q1 (import, lagging), Q2 (export, lagging), Q3 (export, leading), Q4 (import, leading)
+  uint64_t apparent;
+};
+
+struct ADE7953TelemetryRecord {  //One decoded record; fields not in fieldMask keep their last decoded value
+  uint8_t version;
+  bool keyframe;
+  uint32_t timestamp;  //millis() of the sender
+  uint32_t fieldMask;
+  float values[ADE7953_FIELDS];
+  uint8_t energyMask;  //Channels whose totals were in this record
+  uint8_t energyValid;  //Channels whose energy[] is known, i.e. carried by the last keyframe; the others read 0
+  ADE7953EnergyTotals energy[2];
+};
+
+class ADE7953TelemetryEncoder {
+  public:
+    ADE7953TelemetryEncoder();
+	void setResolution(uint8_t field, float scale);
+	void setKeyframeInterval(uint16_t records);
+	void forceKeyframe();
+	size_t encode(const float *values, uint32_t fieldMask, uint32_t timestamp, const ADE7953EnergyTotals *energy, uint8_t energyMask, uint8_t *buffer, size_t size);
+
+	static float defaultResolution(uint8_t field);
+	static size_t putVarint(uint64_t value, uint8_t *buffer, size_t size);
+	static uint64_t zigzag(int64_t value);
+	static int32_t quantize(float value, float scale);
+
+  private:
+	float _scale[ADE7953_FIELDS];
+	int32_t _last[ADE7953_FIELDS];
+	uint64_t _lastEnergy[2][ADE7953_TELEMETRY_ENERGY_WORDS];
+	uint32_t _lastTimestamp;
+	uint16_t _keyframeInterval;
+	uint16_t _sinceKeyframe;
+	uint8_t _energySent;  //Channels sent absolute since the last keyframe, deltas are only sent for these
+	bool _needKeyframe;
+};
+
+class ADE7953TelemetryDecoder {
+  public:
+    ADE7953TelemetryDecoder();
+	void setResolution(uint8_t field, float scale);
+	int decode(const uint8_t *buffer, size_t length, ADE7953TelemetryRecord &record);
+	void reset();
+
+	static int getVarint(const uint8_t *buffer, size_t length, uint64_t &value);
+	static int64_t unzigzag(uint64_t value);
+
+  private:
+	float _scale[ADE7953_FIELDS];
+	int32_t _last[ADE7953_FIELDS];
+	uint64_t _lastEnergy[2][ADE7953_TELEMETRY_ENERGY_WORDS];
+	uint32_t _lastTimestamp;
+	uint8_t _energySynced;  //Channels whose totals came in the last keyframe, deltas for the others are skipped
+	bool _synced;
+};
+
+#endif
@@ -10,8 +10,6 @@
 #define local_SS 14  //Set the SS pin for SPI communication as pin 5  (#define, (no = or ;) helps to save memory)
 ADE7953 myADE7953(local_SS, local_SPI_freq); // Call the ADE7953 Object with hardware parameters specified, the "local" lets us use the same parameters for examples in this program as what is assigned to the ADE7953 object
 
-
-float calib = -7.665;
  
 void setup() {
   Serial.begin(115200);
@@ -19,7 +17,13 @@ void setup() {
   SPI.begin();
   delay(200);
   myADE7953.initialize();   //The ADE7953 must be initialized once in setup.
-  myADE7953.spiAlgorithm32_write((myADE7953.functionBitVal(0x388,1)),(myADE7953.functionBitVal(0x388,0)),0xC0,0xF5,0x47,0xAE); //Write -7.665 to VRMSOS_32 Register for calibration
+  //Calibration: with a known load connected, take reference points and let the ADE7953 correct itself (see ADE7953Calibration.h)
+  //The reference goes in the units the getters return: with the shipped gains of 1.0 that is raw counts, so set getVrms_m/getIrmsA_m
+  //to counts per V/A first (or convert the meter reading to counts).  A fit needing more than +/-50% gain is refused, not written.
+  //ADE7953Calibration calibration;
+  //myADE7953.addCalibrationPoint(calibration, ADE7953_CAL_VRMS, 120.0, 10);  //Reference meter reads 120.0 V, getVrms() returns V
+  //myADE7953.addCalibrationPoint(calibration, ADE7953_CAL_IRMSA, 0.718, 10); //Reference meter reads 0.718 A, getIrmsA() returns A
+  //if (myADE7953.applyCalibration(calibration) != 0x03) {Serial.println(calibration.getRejected(), HEX);}  //Writes AVGAIN/VRMSOS and AIGAIN/AIRMSOS
 }
 
 //int count;
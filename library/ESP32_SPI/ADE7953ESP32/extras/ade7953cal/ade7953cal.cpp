@@ -0,0 +1,120 @@
+/*
+ ade7953cal.cpp - Linux/host command line front end to ADE7953Calibration (replacement for LinearCalibrationCalculator.xls)
+  Solves recorded reference points into ADE7953 gain/offset register values with the same code the ESP32 library runs.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+
+  Build (from this folder):  g++ -O2 -I../.. ade7953cal.cpp ../../ADE7953Calibration.cpp -o ade7953cal
+
+  Usage:  ade7953cal [-s quantity=scale] [-r quantity=gain,offset] [points.csv]
+    points.csv   one point per line: quantity,raw,reference   (quantity: vrms, irmsa, irmsb, watta, wattb)
+                 raw is the register reading, reference the value from the reference meter; '#' starts a comment
+    -s           the library gain for that quantity (getVrms_m etc. in ADE7953ESP32.cpp), default 1
+    -r           the gain/offset registers in place while the points were recorded, default 0x400000,0
+  Reads standard input when no file is given.
+*/
+
+#include "ADE7953Calibration.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *quantityName[ADE7953_CAL_QUANTITIES] = {"vrms", "irmsa", "irmsb", "watta", "wattb"};
+static const char *gainRegName[ADE7953_CAL_QUANTITIES] = {"AVGAIN", "AIGAIN", "BIGAIN", "AWGAIN", "BWGAIN"};
+static const char *offsetRegName[ADE7953_CAL_QUANTITIES] = {"VRMSOS", "AIRMSOS", "BIRMSOS", "AWATTOS", "BWATTOS"};
+
+static int findQuantity(const char *name, size_t len){
+  for (int q = 0; q < ADE7953_CAL_QUANTITIES; q++) {
+    if (strlen(quantityName[q]) == len && strncmp(quantityName[q], name, len) == 0) {
+      return q;
+      }
+    }
+  return -1;
+  }
+
+static void usage(){
+  fprintf(stderr, "usage: ade7953cal [-s quantity=scale] [-r quantity=gain,offset] [points.csv]\n");
+  exit(2);
+  }
+
+int main(int argc, char **argv){
+  ADE7953Calibration calibration;
+  ADE7953CalRegisters present[ADE7953_CAL_QUANTITIES], updated[ADE7953_CAL_QUANTITIES];
+  ADE7953CalFit fits[ADE7953_CAL_QUANTITIES];
+  double scale[ADE7953_CAL_QUANTITIES];
+  const char *path = NULL;
+  FILE *in = stdin;
+  char line[256];
+  int lineNumber = 0;
+
+  for (int q = 0; q < ADE7953_CAL_QUANTITIES; q++) {
+    scale[q] = 1.0;
+    present[q].gain = ADE7953_CAL_GAIN_UNITY;
+    present[q].offset = 0;
+    }
+  for (int i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "-r") == 0) && i + 1 < argc) {
+      const char *arg = argv[i + 1];
+      const char *eq = strchr(arg, '=');
+      int q = eq ? findQuantity(arg, eq - arg) : -1;
+      if (q < 0) {usage();}
+      if (argv[i][1] == 's') {
+        scale[q] = strtod(eq + 1, NULL);
+        }
+      else {
+        char *end;
+        present[q].gain = strtoul(eq + 1, &end, 0);
+        present[q].offset = (*end == ',') ? strtol(end + 1, NULL, 0) : 0;
+        }
+      i++;
+      }
+    else if (argv[i][0] == '-') {
+      usage();
+      }
+    else {
+      path = argv[i];
+      }
+    }
+  if (path && (in = fopen(path, "r")) == NULL) {
+    perror(path);
+    return 1;
+    }
+
+  while (fgets(line, sizeof(line), in)) {
+    char *comma, *hash = strchr(line, '#');
+    double raw, reference;
+    int q;
+    lineNumber++;
+    if (hash) {*hash = 0;}
+    comma = strchr(line, ',');
+    if (!comma) {continue;}  //Blank or comment line
+    q = findQuantity(line, comma - line);
+    if (q < 0 || sscanf(comma + 1, "%lf,%lf", &raw, &reference) != 2) {
+      fprintf(stderr, "line %d: expected quantity,raw,reference\n", lineNumber);
+      return 1;
+      }
+    if (!calibration.addPoint(q, raw, reference*scale[q])) {
+      fprintf(stderr, "line %d: more than %d points for %s\n", lineNumber, ADE7953_CAL_MAX_POINTS, quantityName[q]);
+      return 1;
+      }
+    }
+  if (in != stdin) {fclose(in);}
+
+  uint8_t solved = calibration.solveAll(present, updated, fits);
+  for (int q = 0; q < ADE7953_CAL_QUANTITIES; q++) {
+    if (calibration.getRejected() & (1 << q)) {
+      fprintf(stderr, "%s: fitted gain %.4f is outside the %s range 0.5..1.5, check the reference units\n", quantityName[q], fits[q].gain, gainRegName[q]);
+      }
+    }
+  if (solved == 0) {
+    fprintf(stderr, "no quantity could be solved\n");
+    return 1;
+    }
+  for (int q = 0; q < ADE7953_CAL_QUANTITIES; q++) {
+    if (!(solved & (1 << q))) {continue;}
+    printf("%-6s points=%u gain=%.6f offset=%.1f r2=%.6f max_residual=%.4g (reference units)\n", quantityName[q], fits[q].points, fits[q].gain, fits[q].offset, fits[q].r2, fits[q].maxResidual/scale[q]);
+    printf("       %-8s 0x%06lX\n", gainRegName[q], (unsigned long)updated[q].gain);
+    printf("       %-8s 0x%06lX (%ld)\n", offsetRegName[q], (unsigned long)updated[q].offset & 0xFFFFFFUL, (long)updated[q].offset);
+    }
+  return 0;
+  }
@@ -0,0 +1,167 @@
+/*
+ ade7953checkpoint.cpp - Linux/host power-cut simulation for ADE7953Checkpoint
+  Runs the library's checkpoint code on a simulated NOR flash that loses power at a random point of a write or an erase,
+  reboots, and checks that restore() returns the last completed value (or the one being written) and never goes backwards.
+  Also checks that a write failing in slot 0 of a fresh sector does not hide the saves made after it.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+
+  Build (from this folder):  g++ -O2 -I../.. ade7953checkpoint.cpp ../../ADE7953Checkpoint.cpp ../../ADE7953Storage.cpp -o ade7953checkpoint
+
+  Usage:  ade7953checkpoint [cuts] [sectors]     defaults 20000 power cuts over 2 sectors of 4 kB
+  Exits with status 1 if any restore returned a wrong value.
+*/
+
+#include "ADE7953Checkpoint.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+class SimulatedFlash : public ADE7953Storage {  //NOR flash in RAM that can lose power part way through an operation
+  public:
+    SimulatedFlash(uint32_t size) : _size(size), _budget(-1), _dead(false), _failAt(0xFFFFFFFFUL), _erases(0), _reads(0) {
+      _data = (uint8_t *)malloc(size);
+      memset(_data, 0xFF, size);
+      }
+    ~SimulatedFlash() {free(_data);}
+	uint32_t size() {return _size;}
+	uint32_t sectorSize() {return 4096;}
+	bool read(uint32_t address, void *data, size_t length) {
+	  _reads++;
+	  if (address + length > _size) {return false;}
+	  memcpy(data, _data + address, length);
+	  return true;
+	  }
+	bool write(uint32_t address, const void *data, size_t length) {
+	  if (_dead || address + length > _size) {return false;}
+	  if (address == _failAt) {  //A write that fails part way without a power cut, the device carries on
+	    for (size_t i = 0; i < length/2; i++) {_data[address + i] &= ((const uint8_t *)data)[i];}
+	    _failAt = 0xFFFFFFFFUL;
+	    return false;
+	    }
+	  for (size_t i = 0; i < length; i++) {
+	    if (cut()) {  //The byte being programmed when power went ends up with some of its bits cleared
+	      _data[address + i] &= ((const uint8_t *)data)[i] | (uint8_t)rand();
+	      return false;
+	      }
+	    _data[address + i] &= ((const uint8_t *)data)[i];
+	    }
+	  return true;
+	  }
+	bool erase(uint32_t address) {
+	  uint32_t start = address - address % 4096;
+	  if (_dead) {return false;}
+	  _erases++;
+	  for (uint32_t i = 0; i < 4096; i += 64) {
+	    if (cut()) {  //Interrupted erase: the rest of the sector keeps old data or random bits
+	      for (uint32_t j = i; j < 4096; j++) {_data[start + j] = (rand() & 1) ? 0xFF : (_data[start + j] | (uint8_t)rand());}
+	      return false;
+	      }
+	    memset(_data + start + i, 0xFF, 64);
+	    }
+	  return true;
+	  }
+	void powerCutAfter(long operations) {_budget = operations; _dead = false;}
+	void failWriteAt(uint32_t address) {_failAt = address;}
+	void powerOn() {_budget = -1; _dead = false;}
+	bool dead() {return _dead;}
+	unsigned long erases() {return _erases;}
+	unsigned long reads() {return _reads;}
+	void resetReads() {_reads = 0;}
+
+  private:
+	bool cut() {
+	  if (_budget < 0) {return false;}
+	  if (_budget-- == 0) {_dead = true;}
+	  return _dead;
+	  }
+	uint8_t *_data;
+	uint32_t _size;
+	long _budget;
+	bool _dead;
+	uint32_t _failAt;
+	unsigned long _erases;
+	unsigned long _reads;
+};
+
+struct Totals {  //Stand-in payload the size of two ADE7953EnergyTotals
+  uint64_t counter[14];
+};
+
+static bool failedFirstSlot(){  //Write fails in slot 0 of a fresh sector, the next save lands in slot 1, then a reboot
+  SimulatedFlash flash(64*4096);
+  ADE7953Checkpoint checkpoint;
+  Totals totals;
+  uint64_t last = 0;
+
+  checkpoint.begin(flash, 8, 2);
+  flash.failWriteAt(9*4096);
+  for (int n = 1; n <= 4096/ADE7953_CHECKPOINT_RECORD_SIZE + 2; n++) {  //Fills sector 8, fails once, then goes on in sector 9
+    for (int i = 0; i < 14; i++) {totals.counter[i] = n + i;}
+    if (checkpoint.save(&totals, sizeof(totals))) {last = n;}
+    }
+  ADE7953Checkpoint rebooted;
+  memset(&totals, 0, sizeof(totals));
+  rebooted.begin(flash, 8, 2);
+  return rebooted.restore(&totals, sizeof(totals)) && totals.counter[0] == last;
+  }
+
+static double nowSeconds(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+  }
+
+int main(int argc, char **argv){
+  long cuts = (argc > 1) ? atol(argv[1]) : 20000;
+  uint16_t sectors = (argc > 2) ? atoi(argv[2]) : 2;
+  SimulatedFlash flash(64*4096);
+  uint64_t committed = 0;  //Last value whose save() returned true
+  uint64_t pending = 0;    //Value being written when the power went
+  unsigned long failures = 0, backwards = 0, saves = 0, maxReads = 0;
+  double restoreTime = 0;
+
+  srand(7);
+  for (long c = 0; c < cuts; c++) {
+    ADE7953Checkpoint checkpoint;
+    Totals totals;
+    flash.powerOn();
+    flash.resetReads();
+    double start = nowSeconds();
+    checkpoint.begin(flash, 8, sectors);
+    bool found = checkpoint.restore(&totals, sizeof(totals));
+    restoreTime += nowSeconds() - start;
+    if (flash.reads() > maxReads) {maxReads = flash.reads();}
+
+    uint64_t restored = found ? totals.counter[0] : 0;
+    bool consistent = !found;
+    if (found) {
+      consistent = true;
+      for (int i = 1; i < 14; i++) {consistent = consistent && totals.counter[i] == totals.counter[0] + i;}
+      }
+    if (!consistent || (restored != committed && restored != pending)) {failures++;}
+    if (restored < committed) {backwards++;}
+    committed = restored;  //What the device carries on from
+    pending = restored;
+
+    flash.powerCutAfter(rand() % 20000);  //Somewhere within the next few dozen saves
+    while (!flash.dead()) {
+      pending = committed + 1 + rand() % 1000;
+      for (int i = 0; i < 14; i++) {totals.counter[i] = pending + i;}
+      if (checkpoint.save(&totals, sizeof(totals))) {
+        committed = pending;
+        saves++;
+        }
+      }
+    }
+  printf("power cuts         %ld\n", cuts);
+  printf("saves completed    %lu\n", saves);
+  printf("sector erases      %lu (%.1f saves per erase)\n", flash.erases(), flash.erases() ? (double)saves/flash.erases() : 0.0);
+  printf("restore            %.1f us average, at most %lu flash reads (host)\n", restoreTime*1e6/cuts, maxReads);
+  printf("wrong restores     %lu\n", failures);
+  printf("went backwards     %lu\n", backwards);
+  bool failedSlot = failedFirstSlot();
+  printf("failed slot 0      %s\n", failedSlot ? "restored the save after it" : "LOST the saves after it");
+  return (failures || backwards || !failedSlot) ? 1 : 0;
+  }
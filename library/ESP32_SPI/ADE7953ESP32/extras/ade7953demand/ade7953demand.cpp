@@ -0,0 +1,195 @@
+/*
+ ade7953demand.cpp - Linux/host test bench for ADE7953Demand
+  Drives the library's demand code with the energy total of a synthetic load (random steps between standby and a few kW)
+  and checks every window result and the billing peak against the exact window energy: sliding and block windows, updates
+  every second and at irregular times that split their energy across bucket edges, a start part way through a bucket,
+  gaps longer than the window, and restoring the peak from a checkpoint before and after begin().
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+
+  Build (from this folder):  g++ -O2 -I../.. ade7953demand.cpp ../../ADE7953Demand.cpp ../../ADE7953Checkpoint.cpp ../../ADE7953Storage.cpp -o ade7953demand
+
+  Usage:  ade7953demand [hours] [seed]     defaults 12 h, seed 1
+  Exits with status 1 if any check fails.
+*/
+
+#include "ADE7953Demand.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+class RamStorage : public ADE7953Storage {  //Flash in RAM for the peak checkpoint
+  public:
+    RamStorage() {memset(_data, 0xFF, sizeof(_data));}
+	uint32_t size() {return sizeof(_data);}
+	uint32_t sectorSize() {return 4096;}
+	bool read(uint32_t address, void *data, size_t length) {
+	  if (address + length > sizeof(_data)) {return false;}
+	  memcpy(data, _data + address, length);
+	  return true;
+	  }
+	bool write(uint32_t address, const void *data, size_t length) {
+	  if (address + length > sizeof(_data)) {return false;}
+	  for (size_t i = 0; i < length; i++) {_data[address + i] &= ((const uint8_t *)data)[i];}
+	  return true;
+	  }
+	bool erase(uint32_t address) {
+	  if (address >= sizeof(_data)) {return false;}
+	  memset(_data + address - address % 4096, 0xFF, 4096);
+	  return true;
+	  }
+
+  private:
+	uint8_t _data[4*4096];
+};
+
+struct Update {  //What update() is called with
+  uint32_t time;
+  uint64_t energy;  //uWh
+};
+
+static unsigned long failures = 0;
+
+static void check(bool ok, const char *name, const char *what, double got, double expected){
+  if (!ok) {
+    if (failures < 20) {printf("FAIL  %-22s %s: %.6g, expected %.6g\n", name, what, got, expected);}
+    failures++;
+    }
+  }
+
+static double energyAt(const std::vector<Update> &u, uint32_t time){  //The energy total between updates, linear as update() assumes
+  size_t lo = 0, hi = u.size() - 1;
+  while (hi - lo > 1) {
+    size_t mid = (lo + hi)/2;
+    if (u[mid].time <= time) {lo = mid;}
+    else {hi = mid;}
+    }
+  if (time <= u[lo].time) {return (double)u[lo].energy;}
+  if (time >= u[hi].time) {return (double)u[hi].energy;}
+  return u[lo].energy + (double)(u[hi].energy - u[lo].energy)*(time - u[lo].time)/(u[hi].time - u[lo].time);
+  }
+
+static std::vector<uint64_t> profile(uint32_t seconds){  //Energy total at each second, power stepping every 30 s to 10 min
+  static const double watts[] = {40, 150, 400, 1200, 2200, 3500};
+  std::vector<uint64_t> total(seconds + 1);
+  double power = watts[0];
+  uint32_t next = 0;
+  total[0] = 5000000000ULL;
+  for (uint32_t s = 0; s < seconds; s++) {
+    if (s == next) {
+      power = watts[rand() % 6];
+      next = s + 30 + rand() % 570;
+      }
+    total[s + 1] = total[s] + (uint64_t)(power*1e6/3600 + 0.5);
+    }
+  return total;
+  }
+
+static void run(const char *name, uint32_t window, uint8_t buckets, bool sliding, const std::vector<Update> &u){
+  //Replays u and checks each result against the exact window energy.  A window counts only if it lies inside one run of
+  //updates: from the first whole bucket after the start (or after a gap of more than a window plus a bucket) to the last
+  //update before the next gap.
+  ADE7953Demand demand;
+  uint32_t bucketSec = window/buckets, step = sliding ? bucketSec : window;
+  uint32_t segmentStart = 0, results = 0, firstResult = 0;
+  double peak = -1, tolerance = 2.0*(buckets + 1);  //uWh, integer splits round down once per bucket edge
+  uint32_t peakTime = 0;
+
+  check(demand.begin(window, buckets, sliding), name, "begin", 0, 1);
+  for (size_t i = 0; i < u.size(); i++) {
+    bool restart = (i == 0) || u[i].time - (u[i - 1].time - u[i - 1].time % bucketSec) >= (uint32_t)(buckets + 1)*bucketSec;
+    if (restart) {  //First whole bucket: after a start part way through one, or the one after a gap
+      segmentStart = (i == 0) ? (u[i].time + bucketSec - 1)/bucketSec*bucketSec : u[i].time - u[i].time % bucketSec + bucketSec;
+      }
+    uint32_t time = u[i].time;
+    bool produced = demand.update(u[i].energy, time);
+    uint32_t latest = 0;
+    if (!restart) {  //Window ends passed by this update
+      for (uint32_t end = (u[i - 1].time/step + 1)*step; end <= time; end += step) {
+        if (end < segmentStart + window) {continue;}
+        double energy = energyAt(u, end) - energyAt(u, end - window);
+        if (energy > peak + tolerance) {
+          peak = energy;
+          peakTime = end;
+          }
+        latest = end;
+        results++;
+        if (!firstResult) {firstResult = end;}
+        }
+      }
+    check(produced == (latest != 0), name, "result produced", produced, latest != 0);
+    if (produced && latest) {
+      double expected = (energyAt(u, latest) - energyAt(u, latest - window))*0.0036/window;
+      check(demand.getDemandTime() == latest, name, "window end", demand.getDemandTime(), latest);
+      check(fabs(demand.getDemand() - expected) <= tolerance*0.0036/window + 1e-6*expected, name, "window demand", demand.getDemand(), expected);
+      }
+    }
+  double expectedPeak = peak*0.0036/window;
+  check(fabs(demand.getPeakDemand() - expectedPeak) <= tolerance*0.0036/window + 1e-6*expectedPeak, name, "peak", demand.getPeakDemand(), expectedPeak);
+  double atPeak = (energyAt(u, demand.getPeakTime()) - energyAt(u, demand.getPeakTime() - window))*0.0036/window;
+  check(fabs(atPeak - expectedPeak) <= 2*tolerance*0.0036/window + 1e-6*expectedPeak, name, "peak window", demand.getPeakTime(), peakTime);
+  check(results > 0, name, "results", results, 1);
+  printf("%-22s %5u results, first window ending %5u s after the start, peak %7.1f W\n", name, results, firstResult - u[0].time,
+    demand.getPeakDemand());
+  }
+
+int main(int argc, char **argv){
+  uint32_t seconds = ((argc > 1) ? atol(argv[1]) : 12)*3600;
+  srand((argc > 2) ? atoi(argv[2]) : 1);
+  const uint32_t t0 = 1800000000UL + 37;  //Epoch time part way through a minute
+  std::vector<uint64_t> total = profile(seconds);
+  std::vector<Update> everySecond, irregular, gaps;
+
+  for (uint32_t s = 0; s <= seconds; s++) {
+    Update update = {t0 + s, total[s]};
+    everySecond.push_back(update);
+    }
+  for (uint32_t s = 0; s <= seconds; s += 1 + rand() % 150) {  //Up to two and a half buckets per update, split across their edges
+    Update update = {t0 + s, total[s]};
+    irregular.push_back(update);
+    }
+  for (uint32_t s = 0; s <= seconds; ) {  //As irregular, with outages longer than a window (and one just at the limit)
+    Update update = {t0 + s, total[s]};
+    gaps.push_back(update);
+    uint32_t r = rand() % 400;
+    s += (r == 0) ? 1000 + rand() % 2000 : (r == 1) ? 960 - (t0 + s) % 60 : (r == 2) ? 959 - (t0 + s) % 60 : 1 + rand() % 150;
+    }
+
+  run("sliding, 1 s", 900, 15, true, everySecond);
+  run("block, 1 s", 900, 1, false, everySecond);
+  run("block of 3, 1 s", 900, 3, false, everySecond);
+  run("sliding, irregular", 900, 15, true, irregular);
+  run("block, irregular", 900, 1, false, irregular);
+  run("sliding, gaps", 900, 15, true, gaps);
+  run("block, gaps", 900, 1, false, gaps);
+  run("sliding 30 min, gaps", 1800, 30, true, gaps);
+
+  //Peak restore: only after begin(), and only with the window length it was measured with.
+  RamStorage flash;
+  ADE7953Checkpoint checkpoint, rebooted;
+  ADE7953Demand measured, early, same, block, other;
+  checkpoint.begin(flash, 0, 2);
+  measured.begin(900, 15, true);
+  measured.resetPeak(t0);
+  for (size_t i = 0; i < everySecond.size(); i++) {measured.update(everySecond[i].energy, everySecond[i].time);}
+  check(measured.checkpointPeak(checkpoint, 0), "restore", "checkpoint", 0, 1);
+  rebooted.begin(flash, 0, 2);
+  check(!early.restorePeak(rebooted), "restore", "before begin() refused", 1, 0);
+  same.begin(900, 15, true);
+  check(same.restorePeak(rebooted) && same.getPeakDemand() == measured.getPeakDemand() && same.getPeakTime() == measured.getPeakTime() &&
+    same.getPeriodStart() == t0, "restore", "after begin()", same.getPeakDemand(), measured.getPeakDemand());
+  block.begin(900, 1, false);  //Same window length, another bucket count: the peak still applies
+  check(block.restorePeak(rebooted) && block.getPeakDemand() == measured.getPeakDemand(), "restore", "block window", block.getPeakDemand(),
+    measured.getPeakDemand());
+  block.begin(900, 3, false);
+  check(block.getPeakDemand() == measured.getPeakDemand(), "restore", "kept by begin() with the same window", block.getPeakDemand(),
+    measured.getPeakDemand());
+  other.begin(1800, 30, true);
+  check(!other.restorePeak(rebooted) && other.getPeakTime() == 0, "restore", "other window refused", other.getPeakDemand(), 0);
+  printf("peak restore           %.1f W at %u, refused before begin() and for another window\n", same.getPeakDemand(), same.getPeakTime() - t0);
+
+  printf("%s (%lu failures)\n", failures ? "FAIL" : "PASS", failures);
+  return failures ? 1 : 0;
+  }
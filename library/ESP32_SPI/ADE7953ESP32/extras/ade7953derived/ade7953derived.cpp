@@ -0,0 +1,174 @@
+/*
+ ade7953derived.cpp - Linux register model bench for the ADE7953 derived quantities
+  Runs ADE7953Derived (the arithmetic behind ADE7953::readDerived() and verifyDerived()) on the registers of a modelled
+  chip: voltage and current with up to 10% harmonic distortion (3rd, 5th, 7th) at random levels, load angles and line
+  frequencies.  The model quantises every register the way the chip reports it: VRMS/IRMS (9,032,007 at full scale),
+  AWATT/AVAR/AVA (AVA = VRMS x IRMS, 4,862,401 at full scale), PFx truncated to 1/32768 and ANGLE_x as the delay between
+  the rising zero crossings in 223.75 kHz counts.  The VRMS x IRMS scale is learned from the first reading of each board,
+  as readDerived() does, and every later reading is compared with the chip registers.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+
+  Build (from this folder):  g++ -O2 -I../.. ade7953derived.cpp ../../ADE7953Derived.cpp -o ade7953derived
+
+  Usage:  ade7953derived [boards] [seed]    defaults 2000 boards of 50 readings, seed 1
+  Exits with status 1 if a VRMS x IRMS apparent power is further than 0.002% (or one AVA count) from AVA, or a derived
+  power factor more than 2/32768 from PFx.  The angle rows show how far atan2(Q, P) is from ANGLE_x: within the ANGLE
+  resolution for sinusoids, degrees apart with distortion, which is why the two are reported as different quantities.
+*/
+
+#include "ADE7953Derived.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define RMS_FULLSCALE 9032007.0    //VRMS/IRMS of a full scale sine
+#define POWER_FULLSCALE 4862401.0  //AWATT/AVA with full scale voltage and current in phase
+#define ANGLE_CLOCK 223750.0       //ANGLE_x and Period counts per second
+#define HARMONICS 4                //Fundamental, 3rd, 5th, 7th
+#define READINGS 50                //Readings per board, the first one learns the scale
+#define S_TOLERANCE 0.00002        //Relative, 0.002%
+#define PF_TOLERANCE 2             //PFx counts
+
+struct Wave {
+  double amplitude[HARMONICS];  //Peak, 1.0 = full scale input
+  double phase[HARMONICS];      //Radians at the harmonic's own frequency
+};
+
+static const int order[HARMONICS] = {1, 3, 5, 7};
+
+static double uniform(double low, double high){
+  return low + (high - low)*rand()/RAND_MAX;
+  }
+
+static void distort(Wave &w, double fundamental, double phase, double thd){  //Random split of the distortion over the harmonics
+  double weight[HARMONICS], sum = 0;
+  w.amplitude[0] = fundamental;
+  w.phase[0] = phase;
+  for (int h = 1; h < HARMONICS; h++) {
+    weight[h] = uniform(0, 1);
+    sum += weight[h]*weight[h];
+    }
+  for (int h = 1; h < HARMONICS; h++) {
+    w.amplitude[h] = (sum > 0) ? fundamental*thd*weight[h]/sqrt(sum) : 0;
+    w.phase[h] = uniform(-M_PI, M_PI);
+    }
+  }
+
+static double value(const Wave &w, double omegaT){
+  double x = 0;
+  for (int h = 0; h < HARMONICS; h++) {x += w.amplitude[h]*sin(order[h]*omegaT + w.phase[h]);}
+  return x;
+  }
+
+static double rms(const Wave &w){
+  double sum = 0;
+  for (int h = 0; h < HARMONICS; h++) {sum += w.amplitude[h]*w.amplitude[h]/2;}
+  return sqrt(sum);
+  }
+
+static double risingCrossing(const Wave &w){  //Rising zero crossing nearest the fundamental's, as an angle in radians
+  double nominal = -w.phase[0], best = nominal, bestDistance = 10;
+  const int steps = 256;
+  for (int i = 0; i < steps; i++) {
+    double a = nominal - M_PI + 2*M_PI*i/steps, b = a + 2*M_PI/steps;
+    if (value(w, a) < 0 && value(w, b) >= 0) {
+      for (int k = 0; k < 40; k++) {  //Bisection
+        double m = (a + b)/2;
+        if (value(w, m) < 0) {a = m;} else {b = m;}
+        }
+      if (fabs(a - nominal) < bestDistance) {
+        bestDistance = fabs(a - nominal);
+        best = a;
+        }
+      }
+    }
+  return best;
+  }
+
+struct Registers {
+  uint32_t vrms, irms;
+  int32_t awatt, avar, ava;
+  int16_t pf, angle;
+  uint16_t period;
+};
+
+static void chip(const Wave &v, const Wave &i, double frequency, Registers &r){  //What the ADE7953 would report for this load
+  double p = 0, q = 0;
+  for (int h = 0; h < HARMONICS; h++) {  //Q with every harmonic shifted by 90 degrees, as the chip's reactive power path does
+    p += v.amplitude[h]*i.amplitude[h]/2*cos(v.phase[h] - i.phase[h]);
+    q += v.amplitude[h]*i.amplitude[h]/2*sin(v.phase[h] - i.phase[h]);
+    }
+  double s = rms(v)*rms(i);
+  double k = POWER_FULLSCALE/0.5;  //Power counts per (full scale peak)^2
+  r.vrms = (uint32_t)lround(rms(v)*sqrt(2.0)*RMS_FULLSCALE);
+  r.irms = (uint32_t)lround(rms(i)*sqrt(2.0)*RMS_FULLSCALE);
+  r.awatt = (int32_t)lround(k*p);
+  r.avar = (int32_t)lround(k*q);
+  r.ava = (int32_t)lround(k*s);
+  double pf = 32768.0*p/s;
+  r.pf = (pf >= 32767) ? 32767 : (int16_t)pf;
+  r.period = (uint16_t)lround(ANGLE_CLOCK/frequency) - 1;
+  double delay = risingCrossing(i) - risingCrossing(v);  //Current after voltage: positive for a lagging load
+  while (delay > M_PI) {delay -= 2*M_PI;}
+  while (delay < -M_PI) {delay += 2*M_PI;}
+  r.angle = (int16_t)lround(delay/(2*M_PI*frequency)*ANGLE_CLOCK);
+  }
+
+int main(int argc, char **argv){
+  unsigned long boards = (argc > 1) ? strtoul(argv[1], NULL, 10) : 2000;
+  unsigned seed = (argc > 2) ? (unsigned)atoi(argv[2]) : 1;
+  unsigned long readings = 0, sFailures = 0, pfFailures = 0, pfAvaFailures = 0;
+  double worstS = 0, worstSLoaded = 0, worstPQ = 0, worstPF = 0, worstPFAva = 0, worstAngleSine = 0, worstAngleDistorted = 0;
+
+  if (boards == 0) {
+    fprintf(stderr, "usage: ade7953derived [boards] [seed]\n");
+    return 2;
+    }
+  srand(seed);
+  for (unsigned long b = 0; b < boards; b++) {
+    bool sine = (b % 4 == 0);  //One board in four without distortion
+    double frequency = ((b & 1) ? 50.0 : 60.0) + uniform(-0.5, 0.5);
+    float scale = 0;
+    for (int n = 0; n < READINGS; n++) {
+      Wave v, i;
+      double angle = uniform(-84, 84)*M_PI/180;  //PF down to 0.1, lagging and leading
+      distort(v, uniform(0.3, 0.85), 0, sine ? 0 : uniform(0, 0.1));
+      distort(i, (n == 0) ? uniform(0.3, 0.85) : 0.85*pow(0.012, uniform(0, 1)), -angle, sine ? 0 : uniform(0, 0.1));
+      Registers r;
+      chip(v, i, frequency, r);
+      if (n == 0) {  //readDerived() reads AVA once and learns the scale from it
+        scale = ADE7953Derived::learnScale(r.ava, r.vrms, r.irms);
+        continue;
+        }
+      if (r.ava < ADE7953_DERIVED_MIN_VA) {continue;}  //Unloaded, verifyDerived() leaves it out too
+      readings++;
+      double s = ADE7953Derived::apparentVI(scale, r.vrms, r.irms);
+      double errS = fabs(s - r.ava)/r.ava;
+      if (errS > worstS) {worstS = errS;}
+      if (r.ava >= 100*ADE7953_DERIVED_MIN_VA && errS > worstSLoaded) {worstSLoaded = errS;}
+      if (errS > S_TOLERANCE && fabs(s - r.ava) > 1.0) {sFailures++;}
+      double errPQ = fabs(ADE7953Derived::apparentPQ(r.awatt, r.avar) - r.ava)/r.ava;
+      if (errPQ > worstPQ) {worstPQ = errPQ;}
+      int pfCounts = abs(ADE7953Derived::powerFactor(r.awatt, (float)s) - r.pf);
+      if (pfCounts/32768.0 > worstPF) {worstPF = pfCounts/32768.0;}
+      if (pfCounts > PF_TOLERANCE) {pfFailures++;}
+      int pfAvaCounts = abs(ADE7953Derived::powerFactor(r.awatt, (float)abs(r.ava)) - r.pf);  //P/AVA, used when VRMS and IRMS are not both read
+      if (pfAvaCounts/32768.0 > worstPFAva) {worstPFAva = pfAvaCounts/32768.0;}
+      if (pfAvaCounts > PF_TOLERANCE) {pfAvaFailures++;}
+      double errAngle = fabs(ADE7953Derived::powerAngle(r.awatt, r.avar) - r.angle*360.0/(r.period + 1.0));
+      if (sine && errAngle > worstAngleSine) {worstAngleSine = errAngle;}
+      if (!sine && errAngle > worstAngleDistorted) {worstAngleDistorted = errAngle;}
+      }
+    }
+
+  printf("%lu boards, %lu loaded readings, distortion up to 10%% on three boards in four\n", boards, readings);
+  printf("S = VRMS x IRMS      worst %.5f%% (%.5f%% above %d counts) from AVA, %lu outside %.3f%% and one count\n", 100*worstS, 100*worstSLoaded, 100*ADE7953_DERIVED_MIN_VA, sFailures, 100*S_TOLERANCE);
+  printf("S = sqrt(P^2 + Q^2)  worst %.3f%% from AVA (distortion power is in neither P nor Q, readDerived() never uses it)\n", 100*worstPQ);
+  printf("PF = P/(VRMS x IRMS) worst %.6f (%.1f counts) from PFx, %lu outside %d counts\n", worstPF, worstPF*32768, pfFailures, PF_TOLERANCE);
+  printf("PF = P/AVA           worst %.6f (%.1f counts) from PFx, %lu outside %d counts\n", worstPFAva, worstPFAva*32768, pfAvaFailures, PF_TOLERANCE);
+  printf("atan2(Q, P)          worst %.3f deg from ANGLE_x for sinusoids, %.2f deg with distortion\n", worstAngleSine, worstAngleDistorted);
+  bool pass = !sFailures && !pfFailures && !pfAvaFailures && readings > 0;
+  printf("%s\n", pass ? "PASS" : "FAIL");
+  return pass ? 0 : 1;
+  }
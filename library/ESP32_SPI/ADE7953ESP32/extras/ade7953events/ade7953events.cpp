@@ -0,0 +1,175 @@
+/*
+ ade7953events.cpp - Linux/host test bench for the ADE7953LoadEvents switching event detector
+  Replays a synthetic household of appliances switching on and off (with inrush, reactive power, measurement noise
+  and slow drift) through the same detector the ESP32 library runs, matches the detected events against the known
+  switching times and reports precision, recall, dP error and CPU time per sample.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+
+  Build (from this folder):  g++ -O2 -I../.. ade7953events.cpp ../../ADE7953LoadEvents.cpp -o ade7953events
+
+  Usage:  ade7953events [hours] [sample_ms] [seed]   defaults 48 h of 1000 ms snapshots, seed 1
+          ade7953events -v ...                        also print every detected event as CSV
+  Exits with status 1 if precision or recall falls below 0.9.
+*/
+
+#include "ADE7953LoadEvents.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+struct Appliance {
+  const char *name;
+  float p;            //Steady W
+  float q;            //Steady var
+  float inrush;       //Multiple of p drawn during the first second
+  double meanOnS;     //Mean on time, s
+  double meanOffS;    //Mean off time, s
+  bool on;
+  double next;        //Time of the next switch, s
+};
+
+static Appliance appliances[] = {
+  {"fridge", 110, 75, 4.0, 1200, 2400, false, 0},
+  {"kettle", 2000, 0, 1.0, 180, 14400, false, 0},
+  {"microwave", 1150, 320, 1.3, 150, 10800, false, 0},
+  {"tv", 95, -18, 2.0, 7200, 14400, false, 0},
+  {"lights", 240, 10, 1.1, 5400, 9000, false, 0},
+  {"heater", 1500, 0, 1.0, 900, 3600, false, 0},
+  {"washer", 450, 380, 3.0, 2700, 43200, false, 0},
+};
+#define APPLIANCES (sizeof(appliances)/sizeof(appliances[0]))
+
+struct Truth {
+  double time;
+  float deltaP;
+  bool matched;
+};
+
+static double uniform(){
+  return (rand() + 1.0)/((double)RAND_MAX + 2.0);
+  }
+
+static double gaussian(){
+  return sqrt(-2.0*log(uniform()))*cos(2.0*M_PI*uniform());
+  }
+
+static double exponential(double mean){
+  return -mean*log(uniform());
+  }
+
+static double nowSeconds(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+  }
+
+int main(int argc, char **argv){
+  bool verbose = false;
+  if (argc > 1 && strcmp(argv[1], "-v") == 0) {
+    verbose = true;
+    argc--;
+    argv++;
+    }
+  double hours = (argc > 1) ? atof(argv[1]) : 48;
+  unsigned long sampleMs = (argc > 2) ? strtoul(argv[2], NULL, 10) : 1000;
+  srand((argc > 3) ? atoi(argv[3]) : 1);
+  if (hours <= 0 || sampleMs == 0) {
+    fprintf(stderr, "usage: ade7953events [-v] [hours] [sample_ms] [seed]\n");
+    return 2;
+    }
+
+  unsigned long samples = (unsigned long)(hours*3600000.0/sampleMs);
+  double dt = sampleMs/1000.0;
+  Truth *truth = (Truth *)calloc(samples/10 + 1000, sizeof(Truth));
+  size_t truths = 0, truthMax = samples/10 + 1000;
+  float *trace = (float *)malloc(samples*3*sizeof(float));
+  for (size_t a = 0; a < APPLIANCES; a++) {
+    appliances[a].next = exponential(appliances[a].meanOffS);
+    }
+
+  //Build the trace first so only the detector is timed
+  for (unsigned long i = 0; i < samples; i++) {
+    double t = i*dt;
+    double p = 3.0, q = 1.0, peak = 0;  //Standby base load
+    p += 15.0*sin(2.0*M_PI*t/86400.0);  //Slow drift, no event
+    for (size_t a = 0; a < APPLIANCES; a++) {
+      Appliance &ap = appliances[a];
+      double startedAt = -1;
+      while (t >= ap.next) {
+        ap.on = !ap.on;
+        startedAt = ap.next;
+        if (truths < truthMax) {
+          truth[truths].time = ap.next;
+          truth[truths].deltaP = ap.on ? ap.p : -ap.p;
+          truth[truths].matched = false;
+          truths++;
+          }
+        ap.next += exponential(ap.on ? ap.meanOnS : ap.meanOffS);
+        }
+      if (ap.on) {
+        double factor = (startedAt >= 0 && t - startedAt < 1.0) ? ap.inrush : 1.0;
+        p += ap.p*factor;
+        q += ap.q*(factor > 1.0 ? 1.0 + (factor - 1.0)*0.5 : 1.0);
+        }
+      }
+    peak = sqrt(2.0)*sqrt(p*p + q*q)/230.0;
+    trace[i*3] = p + gaussian()*(2.0 + 0.002*p);
+    trace[i*3 + 1] = q + gaussian()*(1.5 + 0.002*fabs(q));
+    trace[i*3 + 2] = peak;
+    }
+
+  ADE7953LoadEvents detector;
+  size_t events = 0, eventMax = samples/10 + 1000;
+  ADE7953LoadEvent *found = (ADE7953LoadEvent *)malloc(eventMax*sizeof(ADE7953LoadEvent));
+  double start = nowSeconds();
+  for (unsigned long i = 0; i < samples; i++) {
+    if (detector.update(i*sampleMs, trace[i*3], trace[i*3 + 1], trace[i*3 + 2])) {
+      while (detector.available() && events < eventMax) {detector.read(found[events++]);}
+      }
+    }
+  double elapsed = nowSeconds() - start;
+
+  //A detected event matches an unmatched true switch within two samples before its start and the transient after it,
+  //with the same sign and dP within 15% (or 20 W); simultaneous switches only match one way
+  size_t correct = 0, detectable = 0;
+  double errorSum = 0;
+  if (verbose) {printf("time_s,duration_ms,deltaP,deltaQ,before,inrushP,currentPeak,matched\n");}
+  for (size_t e = 0; e < events; e++) {
+    double t = found[e].time/1000.0;
+    int match = -1;
+    for (size_t k = 0; k < truths; k++) {
+      if (truth[k].matched || truth[k].time < t - 2.0*dt - 1.0 || truth[k].time > t + found[e].duration/1000.0) {continue;}
+      double tolerance = fabs(truth[k].deltaP)*0.15;
+      if (tolerance < 20) {tolerance = 20;}
+      if (fabs(found[e].deltaP - truth[k].deltaP) <= tolerance) {
+        match = k;
+        break;
+        }
+      }
+    if (match >= 0) {
+      truth[match].matched = true;
+      correct++;
+      errorSum += fabs(found[e].deltaP - truth[match].deltaP);
+      }
+    if (verbose) {
+      printf("%.1f,%lu,%.1f,%.1f,%.1f,%.1f,%.2f,%d\n", t, found[e].duration, found[e].deltaP, found[e].deltaQ, found[e].before,
+        found[e].inrushP, found[e].currentPeak, match >= 0);
+      }
+    }
+  for (size_t k = 0; k < truths; k++) {
+    if (truth[k].time < samples*dt - 10) {detectable++;}
+    }
+  double precision = events ? (double)correct/events : 1.0;
+  double recall = detectable ? (double)correct/detectable : 1.0;
+  fprintf(stderr, "%.1f h at %lu ms: %zu switches, %zu events, %zu matched\n", hours, sampleMs, detectable, events, correct);
+  fprintf(stderr, "precision %.3f  recall %.3f  mean |dP error| %.1f W  dropped %lu\n", precision, recall,
+    correct ? errorSum/correct : 0.0, detector.getDropped());
+  fprintf(stderr, "%.1f ns/sample on this host\n", elapsed*1e9/samples);
+  free(trace);
+  free(truth);
+  free(found);
+  return (precision < 0.9 || recall < 0.9) ? 1 : 0;
+  }
@@ -0,0 +1,492 @@
+/*
+ ade7953lock.cpp - Linux stress test for ADE7953BusLock, ADE7953RequestQueue and the driver's shared paths
+  Several std::threads share one simulated SPI bus the way sketch tasks share VSPI: readers doing single register reads,
+  a display task doing batched sweeps, and an "interrupt" thread queueing reads for a service thread.  Every byte checks
+  that its transaction still owns chip select, so any interleaving shows up as a torn transaction.  Prints lock wait and
+  hold times; -n runs without the lock to show the check catching tearing.
+  The second part builds the library itself against a simulated pair of ADE7953s on one bus (host/ stands in for the
+  Arduino core) and runs the same kind of load through the driver: readRegister(), readSnapshot(), readDerived(), a batch
+  on one device wrapping reads of the other, two tasks calling accumulateEnergy(), servicePowerQuality() and a CYCEND
+  triggered scheduler sharing the interrupt latch, and requestRead()/serviceRequests().  It checks the bus sessions, every
+  value read, the read verification, the energy totals against the energy register reads and that no CYCEND is lost.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+
+  Build (from this folder):  g++ -O2 -pthread -DARDUINO -Ihost -I../.. ade7953lock.cpp ../../ADE7953ESP32.cpp ../../ADE7953Lock.cpp
+    ../../ADE7953Calibration.cpp ../../ADE7953Deadband.cpp ../../ADE7953AutoRange.cpp ../../ADE7953Derived.cpp ../../ADE7953Telemetry.cpp
+    ../../ADE7953Checkpoint.cpp ../../ADE7953Storage.cpp ../../ADE7953SubCycleRms.cpp ../../ADE7953RegisterMap.cpp -o ade7953lock
+
+  Usage:  ade7953lock [-n] [readers] [seconds]    defaults: 4 readers, 2 seconds (each part)
+  Exits with status 1 if any transaction was torn, any queued read was lost or any driver check failed.
+*/
+
+#include "ADE7953Lock.h"
+#include "ADE7953ESP32.h"
+#include "driver/pcnt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#define BATCH_READS 20     //Register reads per display sweep, about a readSnapshot()
+#define ISR_PERIOD_US 500  //Interval between queued reads
+
+static ADE7953BusLock busLock;
+static ADE7953RequestQueue requests;
+static bool useLock = true;
+
+static std::atomic<int> chipSelect(0);  //Owner of the simulated bus, 0 = idle
+static std::atomic<unsigned long> transactions(0), torn(0);
+static std::atomic<unsigned long> queued(0), serviced(0), maxLatency(0);
+static std::atomic<bool> stop(false);
+
+static uint32_t nowUs(){
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+static uint32_t transfer(int owner, uint16_t addr){  //One 32-bit register read: 3 address/command bytes, 4 data bytes
+  bool broken = false;
+  if (chipSelect.exchange(owner) != 0) {broken = true;}
+  for (uint8_t i = 0; i < 7; i++) {
+    std::this_thread::yield();  //A byte on the wire, another thread may run here
+    if (chipSelect.load() != owner) {broken = true;}
+    }
+  int expected = owner;
+  if (!chipSelect.compare_exchange_strong(expected, 0)) {broken = true;}
+  transactions++;
+  if (broken) {torn++;}
+  return addr * 3u;  //Register contents, checked by the request callbacks
+  }
+
+static void busLockIf(){
+  if (useLock) {busLock.lock();}
+  }
+
+static void busUnlockIf(){
+  if (useLock) {busLock.unlock();}
+  }
+
+static void reader(int id){  //Control task: single reads, each one takes and releases the lock
+  uint16_t addr = 0x31A + id;
+  while (!stop) {
+    busLockIf();
+    transfer(id, addr);
+    busUnlockIf();
+    }
+  }
+
+static void display(int id){  //Display/MQTT task: batches held for a whole sweep, nested like beginBatch() around the getters
+  while (!stop) {
+    busLockIf();
+    for (uint8_t i = 0; i < BATCH_READS; i++) {
+      busLockIf();
+      transfer(id, 0x300 + i);
+      busUnlockIf();
+      }
+    busUnlockIf();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+static void requestDone(void *arg, uint16_t addr, uint32_t value, uint8_t status){
+  uint32_t latency = nowUs() - (uint32_t)(uintptr_t)arg;
+  if (value != addr * 3u || status != 0) {torn++;}
+  unsigned long seen = maxLatency;
+  while (latency > seen && !maxLatency.compare_exchange_weak(seen, latency)) {}
+  serviced++;
+  }
+
+static void interrupt(){  //Never takes the bus lock, only queues
+  while (!stop) {
+    ADE7953Request request;
+    request.addr = 0x107;
+    request.done = requestDone;
+    request.arg = (void *)(uintptr_t)nowUs();
+    if (requests.push(request)) {queued++;}
+    std::this_thread::sleep_for(std::chrono::microseconds(ISR_PERIOD_US));
+    }
+  }
+
+static void service(int id){  //The task ADE7953::serviceRequests() runs in
+  while (!stop || requests.count()) {
+    ADE7953Request request;
+    if (!requests.pop(request)) {
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+      continue;
+      }
+    busLockIf();
+    uint32_t value = transfer(id, request.addr);
+    busUnlockIf();
+    request.done(request.arg, request.addr, value, 0);
+    }
+  }
+
+//****************Driver on a simulated bus*****************
+//Two ADE7953s share the bus, chip select on SS_A and SS_B.  Register contents are a fixed function of chip and address,
+//except the energies (1000 counts per read, reads counted), RSTIRQSTATA (CYCEND on chip A once armed) and anything
+//written.  LAST_ADD/LAST_RWDATA behave as on the chip, so setReadVerify(1) checks every read.
+
+#define SS_A 5
+#define SS_B 17
+#define SIM_ENERGY 1000
+
+ADE7953HostSerial Serial;
+
+static std::mutex simMutex;  //Keeps the simulation itself consistent, the checks below catch a driver that lets transfers overlap
+static std::map<uint16_t, uint32_t> simWritten[2];
+static int simSelected = -1;      //Chip whose SS is low
+static bool simBusOpen = false;
+static uint8_t simByte = 0;       //Byte position in the transaction
+static uint16_t simAddr = 0;
+static bool simRead = false;
+static uint32_t simValue = 0, simData = 0;
+static uint16_t simLastAdd[2] = {0, 0};
+static uint32_t simLastData[2] = {0, 0};
+static std::atomic<unsigned long> simTorn(0), simOffBus(0), simDoubleStart(0), simBadStop(0), simTransactions(0);
+static std::atomic<unsigned long> simEnergyReads[2][2];  //[chip][channel] AENERGYx reads
+static std::atomic<bool> cycendArmed(true);
+static std::atomic<unsigned long> cycendRaised(0), cycendSeen(0);
+static std::atomic<unsigned long> wrongValues(0), energyBackwards(0), driverQueued(0), driverServiced(0);
+static std::atomic<bool> driverStop(false);
+static const uint16_t checkedRegs[] = {0x31C, 0x31A, 0x31B, 0x312, 0x313, 0x10A, 0x10E, 0x102, 0x107};  //VRMS, IRMSA, IRMSB, AWATT, BWATT, PFA, PERIOD, CONFIG, CFMODE
+
+static uint8_t regBytes(uint16_t addr){  //Bytes on the wire, 8-bit registers answer with a padding byte
+  uint8_t page = addr >> 8;
+  if (page == 0 || addr == 0x702 || addr == 0x800) {return 2;}
+  return (page == 1) ? 2 : ((page == 2) ? 3 : 4);
+  }
+
+static uint32_t regContents(int chip, uint16_t addr){
+  if (simWritten[chip].count(addr)) {return simWritten[chip][addr];}
+  if (addr == 0x10E) {return 4474;}  //50 Hz
+  uint32_t mask = ((addr >> 8) == 0) ? 0x7F : (((addr >> 8) == 1) ? 0x7FFF : 0x3FFFFF);  //Positive in every format
+  return (addr*40503u + chip*977u) & mask;
+  }
+
+static bool isLastReg(uint16_t addr){
+  return addr == 0x0FD || (addr & 0xFF) == 0xFF || addr == 0x1FE;
+  }
+
+static uint32_t simReadValue(int chip, uint16_t addr){  //Called once per read transaction, with simMutex held
+  uint8_t reg = addr & 0xFF;
+  if (addr == 0x1FE) {return simLastAdd[chip];}
+  if (isLastReg(addr)) {return simLastData[chip] << (addr == 0x0FF ? 8 : 0);}
+  if ((addr >> 8) == 3 && reg >= 0x1E && reg <= 0x23) {  //Energies, read with reset
+    if (reg <= 0x1F) {simEnergyReads[chip][reg - 0x1E]++;}
+    return SIM_ENERGY;
+    }
+  if (addr == 0x32E) {  //RSTIRQSTATA
+    bool expected = true;
+    if (chip == 0 && cycendArmed.compare_exchange_strong(expected, false)) {
+      cycendRaised++;
+      return ADE7953_IRQ_CYCEND;
+      }
+    return 0;
+    }
+  if (addr == 0x331) {return 0;}
+  uint32_t value = regContents(chip, addr);
+  return (regBytes(addr) == 2 && (addr >> 8) == 0) ? value << 8 : value;
+  }
+
+unsigned long millis(){
+  return nowUs()/1000;
+  }
+
+unsigned long micros(){
+  return nowUs();
+  }
+
+void delay(unsigned long ms){
+  std::this_thread::sleep_for(std::chrono::microseconds(ms*10));  //A hundred times faster than real, only the constructor and retries wait
+  }
+
+void delayMicroseconds(unsigned int us){
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+  }
+
+void pinMode(int pin, int mode) {}
+int digitalRead(int pin) {return HIGH;}
+int digitalPinToInterrupt(int pin) {return pin;}
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg, int mode) {}
+void detachInterrupt(uint8_t pin) {}
+void noInterrupts() {}
+void interrupts() {}
+
+void digitalWrite(int pin, int level){
+  std::lock_guard<std::mutex> guard(simMutex);
+  int chip = (pin == SS_B) ? 1 : 0;
+  if (level == LOW) {
+    if (simSelected >= 0) {simTorn++;}  //Another transaction still has its chip selected
+    simSelected = chip;
+    simByte = 0;
+    simTransactions++;
+    return;
+    }
+  if (simSelected < 0) {return;}  //Deselecting an idle bus, as initialize() does first
+  if (simSelected != chip) {simTorn++;}
+  if (simByte >= 3 && !isLastReg(simAddr)) {
+    if (!simRead) {
+      simWritten[chip][simAddr] = simData;
+      simLastData[chip] = simData;
+      }
+    else {
+      simLastData[chip] = simValue >> ((regBytes(simAddr) == 2 && (simAddr >> 8) == 0) ? 8 : 0);
+      }
+    simLastAdd[chip] = simAddr;
+    }
+  simSelected = -1;
+  }
+
+struct spi_struct_t {int unused;};
+static spi_struct_t simSpi;
+
+spi_t *spiStartBus(uint8_t spi_num, uint32_t clockDiv, uint8_t dataMode, uint8_t bitOrder){
+  std::lock_guard<std::mutex> guard(simMutex);
+  if (simBusOpen) {simDoubleStart++;}  //A session is already open, stopping this one would end the other as well
+  simBusOpen = true;
+  return &simSpi;
+  }
+
+void spiStopBus(spi_t *spi){
+  std::lock_guard<std::mutex> guard(simMutex);
+  if (!simBusOpen) {simBadStop++;}
+  simBusOpen = false;
+  }
+
+void spiAttachSCK(spi_t *spi, int8_t sck) {}
+void spiAttachMOSI(spi_t *spi, int8_t mosi) {}
+void spiAttachMISO(spi_t *spi, int8_t miso) {}
+
+uint8_t spiTransferByte(spi_t *spi, uint8_t data){
+  std::lock_guard<std::mutex> guard(simMutex);
+  uint8_t out = 0;
+  if (!simBusOpen) {simOffBus++;}
+  if (simSelected < 0) {return 0;}
+  if (simByte == 0) {simAddr = (uint16_t)data << 8;}
+  else if (simByte == 1) {simAddr |= data;}
+  else if (simByte == 2) {
+    simRead = (data & 0x80) != 0;
+    simData = 0;
+    if (simRead) {simValue = simReadValue(simSelected, simAddr);}
+    }
+  else {
+    uint8_t index = simByte - 3, bytes = regBytes(simAddr);
+    if (simRead) {out = (index < bytes) ? (uint8_t)(simValue >> (8*(bytes - 1 - index))) : 0;}
+    else {simData = (simData << 8) | data;}
+    }
+  simByte++;
+  return out;
+  }
+
+esp_err_t pcnt_unit_config(const pcnt_config_t *config) {return ESP_OK;}
+esp_err_t pcnt_get_counter_value(pcnt_unit_t unit, int16_t *count) {*count = 0; return ESP_OK;}
+esp_err_t pcnt_counter_pause(pcnt_unit_t unit) {return ESP_OK;}
+esp_err_t pcnt_counter_resume(pcnt_unit_t unit) {return ESP_OK;}
+esp_err_t pcnt_counter_clear(pcnt_unit_t unit) {return ESP_OK;}
+esp_err_t pcnt_event_enable(pcnt_unit_t unit, pcnt_evt_type_t event) {return ESP_OK;}
+esp_err_t pcnt_set_filter_value(pcnt_unit_t unit, uint16_t value) {return ESP_OK;}
+esp_err_t pcnt_filter_enable(pcnt_unit_t unit) {return ESP_OK;}
+esp_err_t pcnt_isr_service_install(int flags) {return ESP_OK;}
+esp_err_t pcnt_isr_handler_add(pcnt_unit_t unit, void (*handler)(void *), void *arg) {return ESP_OK;}
+esp_err_t pcnt_isr_handler_remove(pcnt_unit_t unit) {return ESP_OK;}
+
+static ADE7953 *devices[2];
+
+static void checkRead(int chip, uint16_t addr){
+  uint32_t value = 0;
+  if (devices[chip]->readRegister(addr, value) != ADE7953_COMM_OK || value != regContents(chip, addr)) {wrongValues++;}
+  }
+
+static void driverReader(int id){  //Control task: readRegister() on both devices
+  unsigned n = id;
+  while (!driverStop) {
+    checkRead(n & 1, checkedRegs[n % (sizeof(checkedRegs)/sizeof(checkedRegs[0]))]);
+    n += 3;
+    }
+  }
+
+static void driverDisplay(){  //Batched sweeps, including a batch on one device wrapping reads of the other
+  ADE7953Snapshot snapshot;
+  while (!driverStop) {
+    devices[0]->readSnapshot(snapshot);
+    if (snapshot.vrms != (float)regContents(0, 0x31C)) {wrongValues++;}
+    devices[1]->readDerived(snapshot);
+    if (snapshot.irmsB != (float)regContents(1, 0x31B)) {wrongValues++;}
+    devices[0]->beginBatch();
+    checkRead(1, 0x31C);
+    checkRead(0, 0x31A);
+    devices[1]->beginBatch();
+    checkRead(0, 0x10E);
+    devices[1]->endBatch();
+    checkRead(1, 0x312);
+    devices[0]->endBatch();
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+  }
+
+static void driverEnergy(){  //Two of these run, as a scheduler ENERGY group and a checkpoint task would
+  while (!driverStop) {
+    devices[0]->accumulateEnergy();
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+
+static void driverTotals(){  //Totals never move backwards
+  ADE7953EnergyTotals last[2], totals;
+  memset(last, 0, sizeof(last));
+  while (!driverStop) {
+    for (uint8_t c = 0; c < 2; c++) {
+      devices[0]->getEnergyTotals(c == 0 ? ADE7953_CHANNEL_A : ADE7953_CHANNEL_B, totals);
+      if (totals.activeImport < last[c].activeImport || totals.apparent < last[c].apparent) {energyBackwards++;}
+      last[c] = totals;
+      }
+    }
+  }
+
+static void driverPowerQuality(){  //No IRQ pin: reads RSTIRQSTATA on every call and takes its own bits out of the latch
+  while (!driverStop) {
+    devices[0]->servicePowerQuality();
+    }
+  }
+
+static void driverSchedule(){  //The PF group follows CYCEND, which servicePowerQuality() may have latched first
+  while (!driverStop) {
+    if (devices[0]->serviceSchedule() & (1 << ADE7953_GROUP_PF)) {
+      cycendSeen++;
+      cycendArmed = true;
+      }
+    std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+  }
+
+static void driverRequestDone(void *arg, uint16_t addr, uint32_t value, uint8_t status){
+  if (status != ADE7953_COMM_OK || value != regContents(0, addr)) {wrongValues++;}
+  driverServiced++;
+  }
+
+static void driverInterrupt(){
+  while (!driverStop) {
+    if (devices[0]->requestRead(0x31C, driverRequestDone, NULL)) {driverQueued++;}
+    std::this_thread::sleep_for(std::chrono::microseconds(ISR_PERIOD_US));
+    }
+  }
+
+static void driverService(){
+  while (!driverStop) {
+    devices[0]->serviceRequests();
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+  devices[0]->serviceRequests();
+  }
+
+static bool driverTest(int readers, int seconds){
+  ADE7953EnergyTotals totals[2];
+  ADE7953CommStats comm[2];
+  uint64_t perRead;
+  
+  ADE7953 a(SS_A, 1000000), b(SS_B, 1000000);
+  devices[0] = &a;
+  devices[1] = &b;
+  a.initialize();
+  b.initialize();
+  for (uint8_t c = 0; c < 2; c++) {
+    simEnergyReads[c][0] = 0;
+    simEnergyReads[c][1] = 0;
+    }
+  a.accumulateEnergy();
+  a.getEnergyTotals(ADE7953_CHANNEL_A, totals[0]);
+  perRead = totals[0].activeImport;  //Micro units for SIM_ENERGY counts
+  a.setReadVerify(1);
+  b.setReadVerify(1);
+  a.setScheduleTrigger(ADE7953_GROUP_PF, ADE7953_SCHED_CYCEND);
+  
+  std::vector<std::thread> threads;
+  for (int i = 0; i < readers; i++) {
+    threads.push_back(std::thread(driverReader, i));
+    }
+  threads.push_back(std::thread(driverDisplay));
+  threads.push_back(std::thread(driverEnergy));
+  threads.push_back(std::thread(driverEnergy));
+  threads.push_back(std::thread(driverTotals));
+  threads.push_back(std::thread(driverPowerQuality));
+  threads.push_back(std::thread(driverSchedule));
+  threads.push_back(std::thread(driverInterrupt));
+  threads.push_back(std::thread(driverService));
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+  driverStop = true;
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+    }
+  for (int i = 0; i < 50 && !cycendArmed; i++) {  //A CYCEND raised just before the stop is still in the latch
+    std::this_thread::sleep_for(std::chrono::milliseconds(ADE7953_SCHED_POLL_MS + 1));
+    if (a.serviceSchedule() & (1 << ADE7953_GROUP_PF)) {
+      cycendSeen++;
+      cycendArmed = true;
+      }
+    }
+  
+  a.getEnergyTotals(ADE7953_CHANNEL_A, totals[0]);
+  a.getEnergyTotals(ADE7953_CHANNEL_B, totals[1]);
+  a.getCommStats(comm[0]);
+  b.getCommStats(comm[1]);
+  bool energyOk = totals[0].activeImport == perRead*simEnergyReads[0][0] && totals[1].activeImport == perRead*simEnergyReads[0][1] && !energyBackwards;
+  unsigned long commErrors = comm[0].errors + comm[0].noResponse + comm[1].errors + comm[1].noResponse;
+  
+  printf("\ndriver, 2 devices, %d readers + display + 2 energy + totals + power quality + scheduler + service + interrupt threads, %d s\n", readers, seconds);
+  printf("transactions   %lu, %lu reads verified\n", simTransactions.load(), comm[0].verified + comm[1].verified);
+  printf("torn           %lu\n", simTorn.load());
+  printf("bus sessions   %lu transfers outside a session, %lu double starts, %lu stops without a start\n", simOffBus.load(), simDoubleStart.load(), simBadStop.load());
+  printf("values         %lu wrong, %lu verify failures, %lu retries\n", wrongValues.load(), commErrors, comm[0].retries + comm[1].retries);
+  printf("energy         %lu + %lu register reads, totals %s\n", simEnergyReads[0][0].load(), simEnergyReads[0][1].load(), energyOk ? "match" : "DO NOT MATCH");
+  printf("CYCEND         %lu raised, %lu reached the scheduler\n", cycendRaised.load(), cycendSeen.load());
+  printf("queued reads   %lu queued, %lu serviced\n", driverQueued.load(), driverServiced.load());
+  return !simTorn && !simOffBus && !simDoubleStart && !simBadStop && !wrongValues && !commErrors && energyOk &&
+         cycendRaised == cycendSeen && driverQueued == driverServiced;
+  }
+
+int main(int argc, char **argv){
+  int arg = 1;
+  if (arg < argc && strcmp(argv[arg], "-n") == 0) {
+    useLock = false;
+    arg++;
+    }
+  int readers = (arg < argc) ? atoi(argv[arg++]) : 4;
+  int seconds = (arg < argc) ? atoi(argv[arg++]) : 2;
+  if (readers < 1 || readers > 32 || seconds < 1) {
+    fprintf(stderr, "usage: ade7953lock [-n] [readers 1-32] [seconds]\n");
+    return 2;
+    }
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < readers; i++) {
+    threads.push_back(std::thread(reader, i + 1));
+    }
+  threads.push_back(std::thread(display, readers + 1));
+  threads.push_back(std::thread(service, readers + 2));
+  threads.push_back(std::thread(interrupt));
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+  stop = true;
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+    }
+
+  ADE7953LockStats stats;
+  busLock.getStats(stats);
+  unsigned long lost = queued - serviced;
+  printf("%s, %d readers + display + service + interrupt threads, %d s\n", useLock ? "locked" : "no lock", readers, seconds);
+  printf("transactions   %lu\n", transactions.load());
+  printf("torn           %lu\n", torn.load());
+  printf("queued reads   %lu serviced, %lu lost, %lu dropped (queue full), worst latency %lu us\n", serviced.load(), lost, requests.getDropped(), maxLatency.load());
+  if (useLock) {
+    printf("lock           %lu acquisitions, %lu contended (%.1f%%)\n", stats.acquisitions, stats.contended, stats.acquisitions ? 100.0*stats.contended/stats.acquisitions : 0.0);
+    printf("wait           max %lu us\n", (unsigned long)stats.maxWait);
+    printf("hold           max %lu us, mean %.2f us\n", (unsigned long)stats.maxHold, stats.acquisitions ? (double)stats.totalHold/stats.acquisitions : 0.0);
+    }
+  bool driverOk = !useLock || driverTest(readers, seconds);  //The driver always locks, -n only applies to the first part
+  return (torn || lost || !driverOk) ? 1 : 0;
+  }
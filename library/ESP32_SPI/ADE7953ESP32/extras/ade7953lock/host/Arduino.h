@@ -0,0 +1,56 @@
+/*
+ Arduino.h - Host stand-in for the parts of the Arduino core the ADE7953 library uses
+  Only for building the library into the Linux benches in extras, the functions are defined by the bench.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#ifndef ADE7953HostArduino_h
+#define ADE7953HostArduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define RISING 1
+#define FALLING 2
+#define CHANGE 3
+#define BIN 2
+#define DEC 10
+#define HEX 16
+#define IRAM_ATTR
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int level);
+int digitalRead(int pin);
+int digitalPinToInterrupt(int pin);
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg, int mode);
+void detachInterrupt(uint8_t pin);
+void noInterrupts();
+void interrupts();
+using std::abs;
+
+struct ADE7953HostSerial {  //Output is dropped, ADE7953_VERBOSE_DEBUG is not meant for the benches
+  template<class T> void print(T) {}
+  template<class T> void print(T, int) {}
+  template<class T> void println(T) {}
+  template<class T> void println(T, int) {}
+  void println() {}
+};
+extern ADE7953HostSerial Serial;
+
+#endif
@@ -0,0 +1,27 @@
+/*
+ esp32-hal-spi.h - Host stand-in for the ESP32 Arduino SPI HAL calls the ADE7953 library makes
+  The bench that builds the library defines these against its simulated bus.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+*/
+
+#ifndef ADE7953HostSpi_h
+#define ADE7953HostSpi_h
+
+#include <stdint.h>
+
+typedef struct spi_struct_t spi_t;
+
+#define VSPI 3
+#define SPI_CLOCK_DIV16 16
+#define SPI_MODE3 3
+#define SPI_MSBFIRST 1
+
+spi_t *spiStartBus(uint8_t spi_num, uint32_t clockDiv, uint8_t dataMode, uint8_t bitOrder);
+void spiStopBus(spi_t *spi);
+void spiAttachSCK(spi_t *spi, int8_t sck);
+void spiAttachMOSI(spi_t *spi, int8_t mosi);
+void spiAttachMISO(spi_t *spi, int8_t miso);
+uint8_t spiTransferByte(spi_t *spi, uint8_t data);
+
+#endif
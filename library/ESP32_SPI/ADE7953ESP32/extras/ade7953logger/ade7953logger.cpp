@@ -0,0 +1,216 @@
+/*
+ ade7953logger.cpp - Linux/host test bench for ADE7953Logger on ADE7953FileStorage
+  Logs a synthetic day of 1 s snapshots through the library's logger into a file with NOR flash rules, cutting the power
+  in the middle of 1 s batch writes and rebooting.  Checks the appended records and their 1 min / 15 min rollups, that
+  recovery by bisection keeps every record written before a cut, that seekTime() lands on the first record at or after any
+  time with a handful of reads from the sparse index, and that backfill returns exactly the unacknowledged records.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+
+  Build (from this folder):  g++ -O2 -I../.. ade7953logger.cpp ../../ADE7953Logger.cpp ../../ADE7953Storage.cpp -o ade7953logger
+
+  Usage:  ade7953logger [hours] [seed] [file]     defaults 24 h, seed 1, ade7953logger.bin (overwritten, removed at the end)
+  Exits with status 1 if any check fails.
+*/
+
+#include "ADE7953Logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SECTORS_1S 4
+#define SECTORS_1MIN 2
+#define SECTORS_15MIN 2
+
+class CuttableStorage : public ADE7953Storage {  //The file storage, with the power going part way through a chosen batch write
+  public:
+    CuttableStorage(ADE7953FileStorage &file) : _file(file), _cutAt(-1), _dead(false), _reads(0) {}
+	uint32_t size() {return _file.size();}
+	uint32_t sectorSize() {return _file.sectorSize();}
+	bool read(uint32_t address, void *data, size_t length) {
+	  _reads++;
+	  return _file.read(address, data, length);
+	  }
+	bool write(uint32_t address, const void *data, size_t length) {
+	  if (_dead) {return false;}
+	  if (_cutAt >= 0 && length == ADE7953_LOG_BATCH*ADE7953_LOG_RECORD_SIZE) {  //Only the first _cutAt bytes are programmed
+	    _file.write(address, data, _cutAt);
+	    _dead = true;
+	    return false;
+	    }
+	  return _file.write(address, data, length);
+	  }
+	bool erase(uint32_t address) {return _dead ? false : _file.erase(address);}
+	void cutNextBatch(long bytes) {_cutAt = bytes; _dead = false;}
+	void powerOn() {_cutAt = -1; _dead = false;}
+	bool dead() {return _dead;}
+	unsigned long reads() {return _reads;}
+	void resetReads() {_reads = 0;}
+
+  private:
+	ADE7953FileStorage &_file;
+	long _cutAt;
+	bool _dead;
+	unsigned long _reads;
+};
+
+static unsigned long failures = 0;
+
+static void check(bool ok, const char *what, uint32_t value){
+  if (!ok) {
+    if (failures < 20) {printf("FAIL  %s (%lu)\n", what, (unsigned long)value);}
+    failures++;
+    }
+  }
+
+static void snapshot(uint32_t time, float *values){  //Field 0 and 1 encode the time, so every record can be checked exactly
+  for (int f = 0; f < ADE7953_FIELDS; f++) {values[f] = 0;}
+  values[ADE7953_FIELD_VRMS] = time % 3600;
+  values[ADE7953_FIELD_IRMSA] = -(float)(time % 3600);
+  }
+
+static void checkRecord(const ADE7953LogRecord &record, uint8_t level){  //Rollups may be partial around a cut, never wrong
+  static const uint32_t length[ADE7953_LOG_LEVELS] = {1, 60, 900};
+  float first = record.time % 3600;
+  float last = first + length[level] - 1;
+
+  check(record.level == level && record.time % length[level] == 0, "record level or interval start", record.sequence);
+  check(record.samples >= 1 && record.samples <= length[level], "record sample count", record.sequence);
+  check(record.min[0] >= first && record.max[0] <= last && record.min[1] == -record.max[0] && record.max[1] == -record.min[0],
+    "record min/max", record.sequence);
+  check(record.mean[0] >= record.min[0] && record.mean[0] <= record.max[0], "record mean", record.sequence);
+  if (record.samples == length[level]) {
+    check(record.min[0] == first && record.max[0] == last && record.mean[0] == (first + last)/2, "full record min/max/mean", record.sequence);
+    }
+  }
+
+static uint32_t scan(ADE7953Logger &logger, uint8_t level, uint32_t *times, uint32_t *sequences){  //Whole retained range, oldest first
+  ADE7953LogCursor cursor;
+  ADE7953LogRecord records[16];
+  uint32_t n = 0, previous = 0;
+  uint16_t got;
+
+  logger.seekSequence(level, 0, cursor);
+  while (cursor.sequence < logger.getNextSequence(level)) {
+    got = logger.read(cursor, records, 16);
+    for (uint16_t i = 0; i < got; i++) {
+      checkRecord(records[i], level);
+      check(n == 0 || (records[i].sequence > sequences[n - 1] && records[i].time > previous), "records out of order", records[i].sequence);
+      times[n] = records[i].time;
+      sequences[n] = records[i].sequence;
+      previous = records[i].time;
+      n++;
+      }
+    }
+  return n;
+  }
+
+int main(int argc, char **argv){
+  long hours = (argc > 1) ? atol(argv[1]) : 24;
+  unsigned seed = (argc > 2) ? atoi(argv[2]) : 1;
+  const char *path = (argc > 3) ? argv[3] : "ade7953logger.bin";
+  ADE7953FileStorage file;
+  float values[ADE7953_FIELDS];
+  uint32_t times[SECTORS_1S*32], sequences[SECTORS_1S*32];
+  unsigned long cuts = 0, lost = 0, seeks = 0, maxRecoverReads = 0, maxSeekReads = 0, backfilled = 0;
+
+  remove(path);
+  if (!file.begin(path, (SECTORS_1S + SECTORS_1MIN + SECTORS_15MIN)*4096)) {
+    printf("cannot open %s\n", path);
+    return 1;
+    }
+  CuttableStorage flash(file);
+  srand(seed);
+
+  //Append with power cuts: a cut lands in a batch write, the logger is dropped (as on a reset) and a new one recovers.
+  uint32_t time = 1000000, end = time + hours*3600;
+  uint32_t nextCut = time + 600 + rand() % 3000;
+  ADE7953Logger *logger = new ADE7953Logger();
+  check(logger->begin(flash, SECTORS_1S, SECTORS_1MIN, SECTORS_15MIN), "begin", 0);
+  for (; time < end; time++) {
+    if (time >= nextCut) {
+      flash.cutNextBatch(rand() % (ADE7953_LOG_BATCH*ADE7953_LOG_RECORD_SIZE));
+      }
+    uint32_t before = logger->getNextSequence(ADE7953_LOG_1S);
+    snapshot(time, values);
+    logger->log(values, time);
+    if (!flash.dead()) {continue;}
+
+    uint32_t batchStart = before - (ADE7953_LOG_BATCH - 1);  //log() closed second time - 1 as record before, the last of the batch
+    ADE7953LogCursor cursor;
+    ADE7953LogRecord record;
+    delete logger;
+    flash.powerOn();
+    flash.resetReads();
+    logger = new ADE7953Logger();
+    check(logger->begin(flash, SECTORS_1S, SECTORS_1MIN, SECTORS_15MIN), "begin after a cut", cuts);
+    if (flash.reads() > maxRecoverReads) {maxRecoverReads = flash.reads();}
+    uint32_t next = logger->getNextSequence(ADE7953_LOG_1S);
+    check(next >= batchStart && next <= batchStart + ADE7953_LOG_BATCH, "recovered write position", next);
+    for (uint32_t s = batchStart - 8; s < next; s++) {  //Everything before the torn record must still be there
+      logger->seekSequence(ADE7953_LOG_1S, s, cursor);
+      bool found = logger->read(cursor, &record, 1) == 1;
+      if (s + 1 < next) {check(found && record.sequence == s && record.time == time - 1 - (before - s), "record before the cut", s);}
+      else if (!found) {lost++;}  //The torn record, its CRC fails and read() skips it
+      }
+    lost += before + 1 - next;  //Records never programmed
+    cuts++;
+    time += 5;  //Powered off for a few seconds
+    nextCut = time + 600 + rand() % 3000;
+    }
+  logger->flush();
+
+  //Every retained record at each resolution, in order and consistent with the values logged.
+  uint32_t minutes = scan(*logger, ADE7953_LOG_1MIN, times, sequences);
+  uint32_t quarters = scan(*logger, ADE7953_LOG_15MIN, times, sequences);
+  check(minutes > 32 && quarters > 32, "rollups retained", minutes);
+  uint32_t n = scan(*logger, ADE7953_LOG_1S, times, sequences);
+  check(n > (SECTORS_1S - 1)*32, "1 s records retained", n);
+
+  //Sparse index seek: the first record at or after any time in (and around) the retained range.
+  for (int i = 0; i < 2000; i++) {
+    uint32_t t = times[0] - 3 + rand() % (times[n - 1] - times[0] + 6);
+    ADE7953LogCursor cursor;
+    ADE7953LogRecord record;
+    uint32_t expected = 0;
+    while (expected < n && times[expected] < t) {expected++;}
+    flash.resetReads();
+    logger->seekTime(ADE7953_LOG_1S, t, cursor);
+    if (flash.reads() > maxSeekReads) {maxSeekReads = flash.reads();}
+    uint16_t got = 0;
+    for (int tries = 0; tries < 4 && got == 0 && cursor.sequence < logger->getNextSequence(ADE7953_LOG_1S); tries++) {
+      got = logger->read(cursor, &record, 1);  //A damaged record at the cursor is skipped
+      }
+    if (expected < n) {check(got == 1 && record.time == times[expected], "seekTime landed on the wrong record", t);}
+    else {check(got == 0, "seekTime past the end returned a record", t);}
+    seeks++;
+    }
+  ADE7953LogCursor cursor;
+  uint32_t oldest = logger->getOldestSequence(ADE7953_LOG_1S);
+  check(!logger->seekSequence(ADE7953_LOG_1S, oldest - 1, cursor) && cursor.sequence == oldest, "seekSequence to an overwritten record", oldest);
+
+  //Backfill: after an acknowledgement in the middle, exactly the later records come back, in order, and then nothing.
+  ADE7953LogRecord records[7];
+  uint32_t acked = n/2, expected = acked + 1, got;
+  logger->ackUplink(ADE7953_LOG_1S, sequences[acked]);
+  while ((got = logger->readBackfill(ADE7953_LOG_1S, records, 7)) > 0) {
+    for (uint32_t i = 0; i < got; i++, expected++) {
+      check(expected < n && records[i].sequence == sequences[expected], "backfill record", records[i].sequence);
+      }
+    logger->ackUplink(ADE7953_LOG_1S, records[got - 1].sequence);
+    backfilled += got;
+    }
+  check(expected == n, "backfill count", expected);
+  check(logger->readBackfill(ADE7953_LOG_1S, records, 7) == 0, "backfill after the last acknowledgement", 0);
+  logger->ackUplink(ADE7953_LOG_1S, oldest - 50);  //Acknowledged before an outage longer than the ring: resumes at the oldest
+  check(logger->readBackfill(ADE7953_LOG_1S, records, 7) > 0 && records[0].sequence == sequences[0], "backfill after overwrite", oldest);
+
+  printf("logged             %ld h of 1 s snapshots, %u/%u/%u records retained (1 s/1 min/15 min)\n", hours, n, minutes, quarters);
+  printf("power cuts         %lu mid-batch, %lu records lost in total, recovery at most %lu flash reads\n", cuts, lost, maxRecoverReads);
+  printf("seekTime           %lu seeks, at most %lu flash reads\n", seeks, maxSeekReads);
+  printf("backfill           %lu records after the acknowledgement\n", backfilled);
+  printf("%s (%lu failures)\n", failures ? "FAIL" : "PASS", failures);
+  delete logger;
+  remove(path);
+  return failures ? 1 : 0;
+  }
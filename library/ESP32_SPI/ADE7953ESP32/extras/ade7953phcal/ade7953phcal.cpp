@@ -0,0 +1,113 @@
+/*
+ ade7953phcal.cpp - Linux validation of the ADE7953 PHCALA/PHCALB phase calibration against a simulated chip
+  Runs ADE7953Calibration::calibratePhase() (the iteration behind ADE7953::calibratePhase()) on simulated boards: a CT
+  phase error, a PHCAL direction that depends on the CT polarity, a line frequency known only through the quantised
+  Period register, and line-cycle energy windows rounded to whole counts with a little measurement noise.  Each board is
+  then checked on the noise-free model: the final PHCAL must leave the true angle inside the tolerance.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+
+  Build (from this folder):  g++ -O2 -I../.. ade7953phcal.cpp ../../ADE7953Calibration.cpp -o ade7953phcal
+
+  Usage:  ade7953phcal [boards] [seed]    defaults 2000 boards, seed 1
+  Exits with status 1 if any board was reported verified with its true error outside the tolerance, a board beyond the
+  PHCAL range was not reported, or more than 1% of the correctable boards failed their (noisy) verification window.
+*/
+
+#include "ADE7953Calibration.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define PERIOD_CLOCK 223750.0  //Period register counts at 223.75 kHz
+#define WINDOW_VA_COUNTS 80000.0  //Apparent energy counts in one LINECYC window
+#define TOLERANCE_DEG 0.05
+#define MAX_ITERATIONS 8
+
+struct Board {
+  double error;      //CT phase error in degrees, seen as extra lag
+  int direction;     //+1 or -1: which way one PHCAL LSB moves the measured angle
+  double frequency;  //True line frequency
+  double angle;      //Reference load angle, degrees
+  double noise;      //Relative noise on each energy register reading
+  unsigned windows;  //Windows measured
+};
+
+static double gaussian(){
+  double u = (rand() + 1.0)/(RAND_MAX + 2.0), v = (rand() + 1.0)/(RAND_MAX + 2.0);
+  return sqrt(-2.0*log(u))*cos(2*M_PI*v);
+  }
+
+static double trueAngle(const Board &b, int16_t phcal){
+  return b.angle + b.error - b.direction*phcal*360.0*b.frequency*ADE7953_PHCAL_LSB_SECONDS;
+  }
+
+static bool window(void *context, int16_t phcal, double &angleDeg){  //ADE7953PhaseWindow: one simulated LINECYC window
+  Board *b = (Board *)context;
+  double theta = trueAngle(*b, phcal)*M_PI/180.0;
+  double active = round(WINDOW_VA_COUNTS*cos(theta)*(1 + b->noise*gaussian()));
+  double reactive = round(WINDOW_VA_COUNTS*sin(theta)*(1 + b->noise*gaussian()));
+  b->windows++;
+  if (active == 0 && reactive == 0) {return false;}
+  angleDeg = atan2(reactive, active)*180.0/M_PI;
+  return true;
+  }
+
+int main(int argc, char **argv){
+  unsigned long boards = (argc > 1) ? strtoul(argv[1], NULL, 10) : 2000;
+  unsigned seed = (argc > 2) ? (unsigned)atoi(argv[2]) : 1;
+  static const double pf[] = {0.5, 0.5, 0.8, 1.0};
+  static const bool lagging[] = {true, false, true, true};
+  unsigned long correctable = 0, verified = 0, wrongVerified = 0, missed = 0, outOfRange = 0, outOfRangeFlagged = 0;
+  unsigned long iterations = 0, windows = 0;
+  double worst = 0;
+
+  if (boards == 0) {
+    fprintf(stderr, "usage: ade7953phcal [boards] [seed]\n");
+    return 2;
+    }
+  srand(seed);
+  for (unsigned long i = 0; i < boards; i++) {
+    Board b;
+    uint8_t load = i % 4;
+    b.error = (i % 10 == 9) ? 9.0 + 3.0*rand()/RAND_MAX : -5.0 + 10.0*rand()/RAND_MAX;  //One board in ten beyond the PHCAL range
+    b.direction = (rand() & 1) ? 1 : -1;
+    b.frequency = ((i & 1) ? 50.0 : 60.0) + (rand()/(double)RAND_MAX - 0.5);
+    b.angle = ADE7953Calibration::referenceAngleDegrees(pf[load], lagging[load]);
+    b.noise = 0.0002;
+    b.windows = 0;
+
+    uint16_t period = (uint16_t)lround(PERIOD_CLOCK/b.frequency) - 1;  //What the chip reports, f = 223750/(Period + 1)
+    double lsbDeg = ADE7953Calibration::phcalDegreesPerLsb(PERIOD_CLOCK/(period + 1));
+    double range = ADE7953_PHCAL_MAX*360.0*b.frequency*ADE7953_PHCAL_LSB_SECONDS;
+    ADE7953PhaseCalResult result;
+    bool ok = ADE7953Calibration::calibratePhase(window, &b, 0, lsbDeg, b.angle, MAX_ITERATIONS, TOLERANCE_DEG, result);
+    double residual = fabs(trueAngle(b, result.phcal) - b.angle);
+    windows += b.windows;
+
+    if (fabs(b.error) > range - lsbDeg) {  //Needs more correction than PHCAL can give
+      outOfRange++;
+      if (!ok) {outOfRangeFlagged++;}
+      continue;
+      }
+    correctable++;
+    iterations += result.iterations;
+    if (ok) {
+      verified++;
+      if (residual > worst) {worst = residual;}
+      if (residual > TOLERANCE_DEG) {wrongVerified++;}
+      }
+    else {
+      missed++;
+      }
+    }
+
+  printf("%lu boards, tolerance %.3f deg, at most %d iterations\n", boards, TOLERANCE_DEG, MAX_ITERATIONS);
+  printf("correctable    %lu, verified %lu, not verified %lu, verified but outside tolerance %lu\n", correctable, verified, missed, wrongVerified);
+  printf("true residual  worst %.4f deg over verified boards\n", worst);
+  printf("iterations     mean %.2f, %.2f line-cycle windows per board\n", correctable ? (double)iterations/correctable : 0.0, (double)windows/boards);
+  printf("out of range   %lu, reported not verified %lu\n", outOfRange, outOfRangeFlagged);
+  bool pass = !wrongVerified && outOfRangeFlagged == outOfRange && missed*100 <= correctable;
+  printf("%s\n", pass ? "PASS" : "FAIL");
+  return pass ? 0 : 1;
+  }
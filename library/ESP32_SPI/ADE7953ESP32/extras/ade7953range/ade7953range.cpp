@@ -0,0 +1,117 @@
+/*
+ ade7953range.cpp - Linux load sweep bench for the ADE7953 PGA auto-ranging step
+  Feeds ADE7953AutoRange::step() (what ADE7953::autoRangeStep() and serviceAutoRange() run) with the interval peaks of a
+  simulated Current Channel A: a slow sweep from 0.05% to 150% of the gain 1 full scale and back, then random load
+  steps.  The simulated RSTIAPEAK is the input times the PGA gain, clipped where the datasheet says the ADC saturates
+  (+/-6,500,000 codes), independently of the library's ADE7953_WAVEFORM_FULLSCALE.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+
+  Build (from this folder):  g++ -O2 -I../.. ade7953range.cpp ../../ADE7953AutoRange.cpp -o ade7953range
+
+  Usage:  ade7953range [intervals] [seed]    defaults 4000 sweep intervals, seed 1
+  Exits with status 1 if a clipping channel was not stepped down on the next interval, a step up clipped or
+  overshot the high mark, or the gain hunted.
+*/
+
+#include "ADE7953AutoRange.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define MAX_CODE 5  //Current Channel A goes up to gain 22
+#define ADC_CLIP 6500000.0  //Waveform code of a full scale input, the peak registers cannot read higher
+
+struct Totals {
+  unsigned long intervals;
+  unsigned long clipped;      //Intervals whose peak hit the ADC limit
+  unsigned long stuck;        //Clipped at a gain above 1 and not stepped down
+  unsigned long badUp;        //A step up that put the next interval above the high mark
+  unsigned long changes;
+  unsigned long hunts;        //Up then straight back down (or down then up) at an unchanged input
+  double used;                //Sum of peak / full scale over the unclipped intervals
+  unsigned long usedCount;
+  unsigned long belowFloor;   //Intervals under 1% of full scale while a higher gain was available
+};
+
+static uint32_t peakReading(double input, uint8_t code){  //input: fraction of the gain 1 full scale
+  double counts = input*ADE7953AutoRange::gain(code)*ADC_CLIP;
+  if (counts > ADC_CLIP) {counts = ADC_CLIP;}
+  return (uint32_t)counts;
+  }
+
+static void run(const char *name, const double *inputs, unsigned long count, Totals &t){
+  uint8_t code = 0, hold = 0;
+  int lastDirection = 0;
+  double changeInput = -1;  //Input when the gain last changed
+  bool justUp = false;
+  Totals local = Totals();
+  for (unsigned long i = 0; i < count; i++) {
+    uint32_t peak = peakReading(inputs[i], code);
+    bool clipped = inputs[i]*ADE7953AutoRange::gain(code) >= 1.0;
+    local.intervals++;
+    if (justUp && inputs[i] == inputs[i - 1] && peak > ADC_CLIP*ADE7953_RANGE_HIGH) {local.badUp++;}
+    if (clipped) {local.clipped++;}
+    else {
+      local.used += peak/ADC_CLIP;
+      local.usedCount++;
+      if (peak < ADC_CLIP/100 && code < MAX_CODE) {local.belowFloor++;}
+      }
+    uint8_t next = ADE7953AutoRange::step(code, MAX_CODE, peak, hold);
+    if (clipped && code > 0 && next >= code) {local.stuck++;}
+    justUp = next > code;
+    if (next != code) {
+      int direction = (next > code) ? 1 : -1;
+      local.changes++;
+      if (lastDirection == -direction && inputs[i] == changeInput) {local.hunts++;}
+      lastDirection = direction;
+      changeInput = inputs[i];
+      }
+    code = next;
+    }
+  printf("%-8s %7lu intervals %6lu clipped %4lu stuck %4lu bad steps up %5lu gain changes %4lu hunts, mean %.0f%% of full scale, %lu under 1%%\n",
+    name, local.intervals, local.clipped, local.stuck, local.badUp, local.changes, local.hunts,
+    local.usedCount ? 100.0*local.used/local.usedCount : 0.0, local.belowFloor);
+  t.intervals += local.intervals;
+  t.clipped += local.clipped;
+  t.stuck += local.stuck;
+  t.badUp += local.badUp;
+  t.changes += local.changes;
+  t.hunts += local.hunts;
+  }
+
+int main(int argc, char **argv){
+  unsigned long intervals = (argc > 1) ? strtoul(argv[1], NULL, 10) : 4000;
+  unsigned seed = (argc > 2) ? (unsigned)atoi(argv[2]) : 1;
+  if (intervals < 10) {
+    fprintf(stderr, "usage: ade7953range [intervals >= 10] [seed]\n");
+    return 2;
+    }
+  double *inputs = new double[intervals];
+  Totals t = Totals();
+
+  for (unsigned long i = 0; i < intervals; i++) {  //Log sweep up over the first half, back down over the second
+    double x = (i < intervals/2) ? (double)i/(intervals/2) : (double)(intervals - 1 - i)/(intervals/2);
+    inputs[i] = 0.0005*pow(1.5/0.0005, x);
+    }
+  run("sweep", inputs, intervals, t);
+
+  srand(seed);
+  double level = 0.01;
+  for (unsigned long i = 0; i < intervals; i++) {  //Loads switching between 0.02% and 140%, held for 20 intervals on average
+    if (i == 0 || rand() % 20 == 0) {level = 0.0002*pow(1.4/0.0002, (double)rand()/RAND_MAX);}
+    inputs[i] = level;
+    }
+  run("steps", inputs, intervals, t);
+
+  for (unsigned long i = 0; i < intervals; i++) {  //Sitting on each step boundary, where hysteresis has to hold
+    double boundary = ADE7953_RANGE_HIGH/ADE7953AutoRange::gain((i/200) % MAX_CODE + 1);
+    inputs[i] = boundary*((i % 2) ? 1.02 : 0.98);
+    }
+  run("boundary", inputs, intervals, t);
+
+  delete [] inputs;
+  bool pass = !t.stuck && !t.badUp && !t.hunts;
+  printf("%s\n", pass ? "PASS" : "FAIL");
+  return pass ? 0 : 1;
+  }
@@ -0,0 +1,134 @@
+/*
+ ade7953regs.cpp - Linux/host viewer and diff tool for ADE7953 register images
+  Reads images written by ADE7953RegisterMap::encode() (see ADE7953::dumpRegisters()), either as the raw binary or as the
+  hex text a sketch prints to the serial port, lists them, and compares them against the reset defaults or a golden image.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+
+  Build (from this folder):  g++ -O2 -I../.. ade7953regs.cpp ../../ADE7953RegisterMap.cpp ../../ADE7953Storage.cpp -o ade7953regs
+
+  Usage:  ade7953regs show image             every register with its reset value
+          ade7953regs diff image [golden]    configuration registers that differ from golden (default: the reset values)
+          ade7953regs -a diff ...            include measurement and status registers
+          ade7953regs defaults out.bin       write the reset default image, a starting point for a golden image
+  diff exits with status 1 if any register differs, 2 on a bad image.
+*/
+
+#include "ADE7953RegisterMap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+static int hexValue(int c){
+  if (c >= '0' && c <= '9') {return c - '0';}
+  c = tolower(c);
+  if (c >= 'a' && c <= 'f') {return c - 'a' + 10;}
+  return -1;
+  }
+
+static bool loadImage(const char *path, ADE7953RegisterImage &image){  //Binary, or hex digits with any whitespace in between
+  uint8_t raw[4*ADE7953_REGMAP_MAX_BYTES], bytes[ADE7953_REGMAP_MAX_BYTES];
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    fprintf(stderr, "%s: cannot open\n", path);
+    return false;
+    }
+  size_t length = fread(raw, 1, sizeof(raw), f);
+  fclose(f);
+  if (ADE7953RegisterMap::decode(raw, length, image)) {
+    return true;
+    }
+  size_t n = 0;
+  int high = -1;
+  for (size_t i = 0; i < length; i++) {
+    int v = hexValue(raw[i]);
+    if (v < 0) {
+      if (isspace(raw[i])) {continue;}
+      n = 0;
+      break;
+      }
+    if (high < 0) {high = v; continue;}
+    if (n == sizeof(bytes)) {n = 0; break;}
+    bytes[n++] = (high << 4) | v;
+    high = -1;
+    }
+  if (n == 0 || !ADE7953RegisterMap::decode(bytes, n, image)) {
+    fprintf(stderr, "%s: not an ADE7953 register image (format %d, %d registers)\n", path, ADE7953_REGMAP_FORMAT, ADE7953_REGMAP_SIZE);
+    return false;
+    }
+  return true;
+  }
+
+static void show(const ADE7953RegisterImage &image){
+  printf("timestamp %lu ms\n", (unsigned long)image.timestamp);
+  printf("%-14s %-5s  %-10s %s\n", "register", "addr", "value", "reset");
+  for (uint8_t i = 0; i < ADE7953RegisterMap::count(); i++) {
+    const ADE7953RegisterInfo &reg = ADE7953RegisterMap::info(i);
+    char value[20], reset[20];
+    int digits = (reg.width & 7)*2;
+    if (ADE7953RegisterMap::isValid(image, i)) {snprintf(value, sizeof(value), "0x%0*lX", digits, (unsigned long)image.values[i]);}
+    else {snprintf(value, sizeof(value), "-");}
+    if (reg.flags & (ADE7953_REG_NO_RESET | ADE7953_REG_MEASURED)) {snprintf(reset, sizeof(reset), "-");}
+    else {snprintf(reset, sizeof(reset), "0x%0*lX", digits, (unsigned long)reg.reset);}
+    printf("%-14s 0x%03X  %-10s %-10s", reg.name, reg.addr, value, reset);
+    if ((reg.flags & ADE7953_REG_SIGNED) && ADE7953RegisterMap::isValid(image, i)) {printf(" %ld", (long)ADE7953RegisterMap::toSigned(i, image.values[i]));}
+    if (reg.flags & ADE7953_REG_NO_DUMP) {printf(" (not dumped)");}
+    else if (!(reg.flags & ADE7953_REG_MEASURED) && !(reg.flags & ADE7953_REG_NO_RESET) && ADE7953RegisterMap::isValid(image, i) && image.values[i] != reg.reset) {printf(" *");}
+    printf("\n");
+    }
+  }
+
+int main(int argc, char **argv){
+  uint8_t ignore = ADE7953_REG_MEASURED;
+  int arg = 1;
+  if (arg < argc && strcmp(argv[arg], "-a") == 0) {
+    ignore = 0;
+    arg++;
+    }
+  if (arg + 1 >= argc) {
+    fprintf(stderr, "usage: ade7953regs [-a] show|diff|defaults image [golden]\n");
+    return 2;
+    }
+  const char *command = argv[arg];
+  ADE7953RegisterImage image, reference;
+
+  if (strcmp(command, "defaults") == 0) {
+    uint8_t buffer[ADE7953_REGMAP_MAX_BYTES];
+    ADE7953RegisterMap::resetDefaults(reference);
+    size_t length = ADE7953RegisterMap::encode(reference, buffer, sizeof(buffer));
+    FILE *f = fopen(argv[arg + 1], "wb");
+    if (!f || fwrite(buffer, 1, length, f) != length) {
+      fprintf(stderr, "%s: cannot write\n", argv[arg + 1]);
+      return 2;
+      }
+    fclose(f);
+    return 0;
+    }
+  if (!loadImage(argv[arg + 1], image)) {
+    return 2;
+    }
+  if (strcmp(command, "show") == 0) {
+    show(image);
+    return 0;
+    }
+  if (strcmp(command, "diff") != 0) {
+    fprintf(stderr, "unknown command %s\n", command);
+    return 2;
+    }
+  if (arg + 2 < argc) {
+    if (!loadImage(argv[arg + 2], reference)) {return 2;}
+    }
+  else {
+    ADE7953RegisterMap::resetDefaults(reference);
+    }
+  ADE7953RegisterDiff diffs[ADE7953_REGMAP_SIZE];
+  uint8_t found = ADE7953RegisterMap::diff(reference, image, ignore, diffs, ADE7953_REGMAP_SIZE);
+  for (uint8_t i = 0; i < found; i++) {
+    char line[64];
+    ADE7953RegisterMap::formatDiff(diffs[i], line, sizeof(line));
+    printf("%s\n", line);
+    }
+  printf("%d register%s differ%s from %s\n", found, found == 1 ? "" : "s", found == 1 ? "s" : "", (arg + 2 < argc) ? argv[arg + 2] : "the reset values");
+  return found ? 1 : 0;
+  }
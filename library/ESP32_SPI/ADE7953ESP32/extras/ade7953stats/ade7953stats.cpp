@@ -0,0 +1,170 @@
+/*
+ ade7953stats.cpp - Linux/host check of ADE7953Stats against exact statistics
+  Feeds fixed, seeded sequences (mains voltage with a small ripple, power readings with load steps, uniform, normal,
+  exponential and a bimodal mix) through the library's Welford mean/variance and P-squared quantile estimators and
+  compares every summary with the exact value computed in double precision from the stored samples (two-pass variance,
+  quantiles from the sorted samples with the same interpolation the estimator uses below five samples).
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+
+  Build (from this folder):  g++ -O2 -I../.. ade7953stats.cpp ../../ADE7953Stats.cpp -o ade7953stats
+
+  Usage:  ade7953stats [samples] [seed]     defaults 3600 samples (an hour of 1 s snapshots), seed 1
+  Exits with status 1 if any summary is outside its tolerance.
+*/
+
+#include "ADE7953Stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include <vector>
+
+static uint32_t state = 1;
+static unsigned long failures = 0;
+
+static double uniform(){  //xorshift32, the same sequence on every platform
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return (state >> 8)*(1.0/16777216.0);
+  }
+
+static double normal(){
+  double u = uniform() + 1e-9, v = uniform();
+  return sqrt(-2*log(u))*cos(2*M_PI*v);
+  }
+
+static double exactQuantile(std::vector<double> sorted, double p){  //Linear between order statistics, rank p*(n-1)
+  std::sort(sorted.begin(), sorted.end());
+  double rank = p*(sorted.size() - 1);
+  size_t i = (size_t)rank;
+  return (i + 1 < sorted.size()) ? sorted[i] + (rank - i)*(sorted[i + 1] - sorted[i]) : sorted[i];
+  }
+
+static double rankError(const std::vector<double> &x, double estimate, double p){  //How far p is from the share of samples at or below the estimate
+  size_t below = 0, equal = 0;
+  for (size_t i = 0; i < x.size(); i++) {
+    if (x[i] < estimate) {below++;}
+    else if (x[i] == estimate) {equal++;}
+    }
+  double lo = (double)below/x.size(), hi = (double)(below + equal)/x.size();
+  return (p < lo) ? lo - p : (p > hi) ? p - hi : 0;
+  }
+
+static void check(const char *name, const char *what, double got, double exact, double tolerance){
+  bool ok = fabs(got - exact) <= tolerance;
+  if (!ok) {
+    printf("FAIL  %-12s %-7s %.6g, exact %.6g (tolerance %.3g)\n", name, what, got, exact, tolerance);
+    failures++;
+    }
+  }
+
+static void run(const char *name, const std::vector<double> &x, float low, float high, double tolerance){
+  //A quantile passes within tolerance x the spread of the samples (exact 1st to 99th percentile) or within tolerance in rank
+  //(the share of samples below the estimate against p): value alone fails a steep mode, rank alone a gap between two loads.
+  //tolerance 0 asks for the exact value, as below five samples.
+  ADE7953Stats stats;
+  ADE7953StatSummary summary;
+  float values[ADE7953_FIELDS];
+  double mean = 0, m2 = 0;
+  float fSum = 0, fSquares = 0;
+
+  stats.setFieldMask(1UL << ADE7953_FIELD_ACTIVEA);
+  stats.setQuantiles(low, high);
+  memset(values, 0, sizeof(values));
+  for (size_t i = 0; i < x.size(); i++) {
+    values[ADE7953_FIELD_ACTIVEA] = (float)x[i];
+    stats.add(values);
+    fSum += (float)x[i];
+    fSquares += (float)x[i]*(float)x[i];
+    }
+  for (size_t i = 0; i < x.size(); i++) {mean += (float)x[i];}
+  mean /= x.size();
+  for (size_t i = 0; i < x.size(); i++) {m2 += ((float)x[i] - mean)*((float)x[i] - mean);}
+  double stddev = (x.size() > 1) ? sqrt(m2/(x.size() - 1)) : 0;
+  double naive = (x.size() > 1) ? (fSquares - fSum*fSum/x.size())/(x.size() - 1) : 0;  //Float sum of squares, for comparison
+
+  std::vector<double> rounded(x.size());
+  for (size_t i = 0; i < x.size(); i++) {rounded[i] = (float)x[i];}
+  double exactLow = exactQuantile(rounded, low), exactHigh = exactQuantile(rounded, high);
+  double min = *std::min_element(rounded.begin(), rounded.end()), max = *std::max_element(rounded.begin(), rounded.end());
+
+  if (!stats.getSummary(ADE7953_FIELD_ACTIVEA, summary)) {
+    printf("FAIL  %-12s no summary\n", name);
+    failures++;
+    return;
+    }
+  double scale = FLT_EPSILON*sqrt((double)x.size())*(fabs(mean) + stddev);  //Float rounding of every update, as a random walk
+  check(name, "count", summary.count, x.size(), 0);
+  check(name, "min", summary.min, min, 0);
+  check(name, "max", summary.max, max, 0);
+  check(name, "mean", summary.mean, mean, scale);
+  check(name, "stddev", summary.stddev, stddev, 1e-3*stddev + scale);
+  double rankLow = rankError(rounded, summary.pLow, low), rankHigh = rankError(rounded, summary.pHigh, high);
+  double spread = exactQuantile(rounded, 0.99) - exactQuantile(rounded, 0.01);
+  if (tolerance > 0) {
+    check(name, "pLow", std::min(rankLow, fabs(summary.pLow - exactLow)/spread), 0, tolerance);
+    check(name, "pHigh", std::min(rankHigh, fabs(summary.pHigh - exactHigh)/spread), 0, tolerance);
+    }
+  else {
+    check(name, "pLow", summary.pLow, exactLow, 4*FLT_EPSILON*fabs(exactLow));
+    check(name, "pHigh", summary.pHigh, exactHigh, 4*FLT_EPSILON*fabs(exactHigh));
+    }
+  printf("%-12s n %5lu  mean %9.5g (err %8.2g)  stddev %9.4g (err %8.2g, float sum of squares %8.2g)  "
+    "p%g %8.4g (exact %8.4g, rank err %5.2f%%)  p%g %8.4g (exact %8.4g, rank err %5.2f%%)\n",
+    name, (unsigned long)x.size(), summary.mean, summary.mean - mean, summary.stddev, summary.stddev - stddev,
+    (naive > 0 ? sqrt(naive) : 0) - stddev, low*100, summary.pLow, exactLow, 100*rankLow, high*100, summary.pHigh, exactHigh, 100*rankHigh);
+  }
+
+int main(int argc, char **argv){
+  size_t n = (argc > 1) ? atol(argv[1]) : 3600;
+  state = (argc > 2) ? atol(argv[2]) : 1;
+  if (state == 0) {state = 1;}
+  double tolerance = 0.005 + 1/sqrt((double)n);  //P-squared settles as the samples grow
+  std::vector<double> x;
+
+  for (size_t k = 1; k <= 4; k++) {  //Below five samples the quantiles are exact
+    x.clear();
+    for (size_t i = 0; i < k; i++) {x.push_back(100 + 50*uniform());}
+    char name[16];
+    snprintf(name, sizeof(name), "%lu samples", (unsigned long)k);
+    run(name, x, 0.05, 0.95, 0);
+    }
+
+  x.clear();  //Mains voltage: a small ripple on a large value, where a float sum of squares loses the variance
+  for (size_t i = 0; i < n; i++) {x.push_back(230 + 0.2*normal());}
+  run("voltage", x, 0.05, 0.95, tolerance);
+
+  x.clear();  //Power with a fridge cycling and a kettle now and then, the profile in the README
+  double fridge = 0, kettle = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (uniform() < 1.0/600) {fridge = (fridge > 0) ? 0 : 120;}
+    if (kettle > 0) {kettle -= 1;}
+    else if (uniform() < 1.0/1800) {kettle = 180;}
+    x.push_back(60 + fridge + (kettle > 0 ? 2000 : 0) + 3*normal());
+    }
+  run("power", x, 0.05, 0.95, tolerance + 0.05);  //Load steps arrive in bursts, the markers lag behind them
+
+  x.clear();
+  for (size_t i = 0; i < n; i++) {x.push_back(1000*uniform());}
+  run("uniform", x, 0.05, 0.95, tolerance);
+  run("median", x, 0.5, 0.99, tolerance);
+
+  x.clear();
+  for (size_t i = 0; i < n; i++) {x.push_back(500 + 100*normal());}
+  run("normal", x, 0.05, 0.95, tolerance);
+
+  x.clear();
+  for (size_t i = 0; i < n; i++) {x.push_back(-100*log(uniform() + 1e-9));}
+  run("exponential", x, 0.05, 0.95, tolerance);
+
+  x.clear();  //Two loads, the quantiles fall inside the modes
+  for (size_t i = 0; i < n; i++) {x.push_back((uniform() < 0.7) ? 40 + 2*normal() : 1500 + 20*normal());}
+  run("bimodal", x, 0.05, 0.95, tolerance);
+
+  printf("%s (%lu failures)\n", failures ? "FAIL" : "PASS", failures);
+  return failures ? 1 : 0;
+  }
@@ -0,0 +1,213 @@
+/*
+ ade7953tariff.cpp - Linux/host test bench for ADE7953Tariff
+  Checks the library's time-of-use binning: one update interval split across a band boundary (and across several, and
+  across midnight), a schedule without a minute 0 switch carrying the previous evening's band through the night, weekends
+  and holidays without switches of their own, and a month of random updates under random schedules against a reference
+  that assigns every minute to the band of the last switch at or before it.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+
+  Build (from this folder):  g++ -O2 -I../.. ade7953tariff.cpp ../../ADE7953Tariff.cpp ../../ADE7953Checkpoint.cpp ../../ADE7953Storage.cpp -o ade7953tariff
+
+  Usage:  ade7953tariff [schedules] [seed]     defaults 50 random schedules, seed 1
+  Exits with status 1 if any check fails.
+*/
+
+#include "ADE7953Tariff.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static unsigned long failures = 0;
+
+static void check(bool ok, const char *what, double got, double expected){
+  if (!ok) {
+    if (failures < 20) {printf("FAIL  %s: %.0f, expected %.0f\n", what, got, expected);}
+    failures++;
+    }
+  }
+
+static uint32_t localTime(int year, int month, int day, int hour, int minute){  //Local seconds since 1970, as update() takes them
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  tm.tm_year = year - 1900;
+  tm.tm_mon = month - 1;
+  tm.tm_mday = day;
+  tm.tm_hour = hour;
+  tm.tm_min = minute;
+  return (uint32_t)timegm(&tm);
+  }
+
+static void feed(ADE7953Tariff &tariff, uint32_t from, uint32_t to, uint64_t energy){  //Two updates, energy imported in between
+  ADE7953EnergyTotals totals;
+  memset(&totals, 0, sizeof(totals));
+  totals.activeImport = 1000000000ULL;
+  tariff.update(totals, from);
+  totals.activeImport += energy;
+  totals.activeExport += energy/4;
+  tariff.update(totals, to);
+  }
+
+static void checkBands(ADE7953Tariff &tariff, const char *what, const uint64_t *expected){  //Import per band, export a quarter of it
+  char label[96];
+  for (uint8_t b = 0; b < ADE7953_TARIFF_MAX_BANDS; b++) {
+    ADE7953TariffRegister reg;
+    tariff.getRegister(b, reg);
+    snprintf(label, sizeof(label), "%s, band %u import", what, b);
+    check(reg.activeImport == expected[b], label, reg.activeImport, expected[b]);
+    snprintf(label, sizeof(label), "%s, band %u export", what, b);
+    check(reg.activeExport + 1 >= expected[b]/4 && reg.activeExport <= expected[b]/4 + 1, label, reg.activeExport, expected[b]/4);
+    }
+  }
+
+//Reference: every minute of the test span gets the band of the last switch at or before it, carried forward minute by minute.
+#define REFERENCE_START (9*1440)  //Minutes before the first Monday, further back than getBand() ever looks
+#define REFERENCE_MINUTES ((9 + 32)*1440)
+
+static void referenceBands(const ADE7953TariffSwitch *switches, int count, const uint16_t *holidays, int holidayCount, uint32_t monday,
+  uint8_t *bands){
+  uint8_t band = 0;
+  for (uint32_t m = 0; m < REFERENCE_MINUTES; m++) {
+    time_t at = monday + ((int32_t)m - REFERENCE_START)*60;
+    struct tm *tm = gmtime(&at);
+    uint8_t type = 1 << tm->tm_wday;
+    for (int i = 0; i < holidayCount; i++) {
+      if (holidays[i] == at/86400) {type = ADE7953_TARIFF_HOLIDAY;}
+      }
+    for (int i = 0; i < count; i++) {  //The last listed of several switches at one minute wins, as in the sorted table
+      if ((switches[i].days & type) && switches[i].minute == tm->tm_hour*60 + tm->tm_min) {band = switches[i].band;}
+      }
+    bands[m] = band;
+    }
+  }
+
+int main(int argc, char **argv){
+  int schedules = (argc > 1) ? atoi(argv[1]) : 50;
+  srand((argc > 2) ? atoi(argv[2]) : 1);
+  uint32_t monday = localTime(2026, 3, 2, 0, 0);
+  check(ADE7953Tariff::dayNumber(2026, 3, 2) == monday/86400, "dayNumber", ADE7953Tariff::dayNumber(2026, 3, 2), monday/86400);
+
+  ADE7953TariffSwitch readme[] = {  //The README schedule
+    {ADE7953_TARIFF_WEEKDAYS, 0, 0},
+    {ADE7953_TARIFF_WEEKDAYS, 1, 7*60},
+    {ADE7953_TARIFF_WEEKDAYS, 2, 17*60},
+    {ADE7953_TARIFF_WEEKDAYS, 1, 21*60},
+    {ADE7953_TARIFF_WEEKEND | ADE7953_TARIFF_HOLIDAY, 0, 0},
+  };
+  {  //One interval split across a band boundary: 16:50 to 17:10, half shoulder and half peak
+    ADE7953Tariff tariff;
+    uint64_t expected[ADE7953_TARIFF_MAX_BANDS] = {0, 600000, 600000};
+    tariff.setSchedule(readme, 5);
+    feed(tariff, monday + 16*3600 + 50*60, monday + 17*3600 + 10*60, 1200000);
+    checkBands(tariff, "16:50-17:10", expected);
+    }
+  {  //06:00 to 22:00: 1 h off-peak, 10 h + 1 h shoulder, 4 h peak
+    ADE7953Tariff tariff;
+    uint64_t expected[ADE7953_TARIFF_MAX_BANDS] = {1000000, 11000000, 4000000};
+    tariff.setSchedule(readme, 5);
+    feed(tariff, monday + 6*3600, monday + 22*3600, 16000000);
+    checkBands(tariff, "06:00-22:00", expected);
+    }
+  {  //Friday 23:00 to Saturday 01:00 across the day type change at midnight: 1 h shoulder, 1 h off-peak
+    ADE7953Tariff tariff;
+    uint64_t expected[ADE7953_TARIFF_MAX_BANDS] = {1000000, 1000000, 0};
+    tariff.setSchedule(readme, 5);
+    feed(tariff, monday + 4*86400 + 23*3600, monday + 5*86400 + 3600, 2000000);
+    checkBands(tariff, "Fri 23:00-Sat 01:00", expected);
+    }
+
+  ADE7953TariffSwitch night[] = {  //No switch at minute 0: the 22:00 band runs through the night
+    {ADE7953_TARIFF_WEEKDAYS, 2, 7*60},
+    {ADE7953_TARIFF_WEEKDAYS, 1, 22*60},
+  };
+  {
+    ADE7953Tariff tariff;
+    tariff.setSchedule(night, 2);
+    check(tariff.getBand(monday + 8*86400 + 3*3600) == 1, "Tue 03:00 carries Mon 22:00", tariff.getBand(monday + 8*86400 + 3*3600), 1);
+    check(tariff.getBand(monday + 5*86400 + 12*3600) == 1, "Sat 12:00 carries Fri 22:00", tariff.getBand(monday + 5*86400 + 12*3600), 1);
+    check(tariff.getBand(monday + 7*86400 + 6*3600 + 59*60) == 1, "Mon 06:59 carries Fri 22:00", tariff.getBand(monday + 7*86400 + 6*3600 + 59*60), 1);
+    check(tariff.getBand(monday + 7*86400 + 7*3600) == 2, "Mon 07:00", tariff.getBand(monday + 7*86400 + 7*3600), 2);
+    }
+  {  //Monday 21:00 to Tuesday 01:00: 1 h in band 2, then 3 h in band 1 across midnight
+    ADE7953Tariff tariff;
+    uint64_t expected[ADE7953_TARIFF_MAX_BANDS] = {0, 3000000, 1000000};
+    tariff.setSchedule(night, 2);
+    feed(tariff, monday + 21*3600, monday + 86400 + 3600, 4000000);
+    checkBands(tariff, "night, Mon 21:00-Tue 01:00", expected);
+    }
+  {  //A holiday Wednesday with no holiday switches carries Tuesday's 22:00 band all day
+    ADE7953Tariff tariff;
+    uint64_t expected[ADE7953_TARIFF_MAX_BANDS] = {0, 2400000, 0};
+    tariff.setSchedule(night, 2);
+    tariff.addHoliday(monday/86400 + 2);
+    feed(tariff, monday + 2*86400, monday + 3*86400 - 3600, 2300000);
+    feed(tariff, monday + 3*86400 - 3600, monday + 3*86400, 100000);
+    checkBands(tariff, "night, holiday Wednesday", expected);
+    }
+
+  //Random schedules, holidays and update intervals over a month, every interval split by the reference minute by minute.
+  static uint8_t bands[REFERENCE_MINUTES];
+  unsigned long intervals = 0, splits = 0;
+  for (int n = 0; n < schedules; n++) {
+    ADE7953TariffSwitch switches[12];
+    uint16_t holidays[4];
+    int count = 1 + rand() % 12, holidayCount = rand() % 5;
+    ADE7953Tariff tariff;
+    double reference[ADE7953_TARIFF_MAX_BANDS] = {0};
+    unsigned long scheduleIntervals = 0;
+    ADE7953EnergyTotals totals;
+    for (int i = 0; i < count; i++) {  //Every switch on some weekday, a holiday-only schedule would be carried for weeks
+      switches[i].days = (uint8_t)((1 + rand() % 127) | ((rand() % 2) ? ADE7953_TARIFF_HOLIDAY : 0));
+      switches[i].band = rand() % ADE7953_TARIFF_MAX_BANDS;
+      switches[i].minute = (rand() % 4) ? (rand() % 96)*15 : rand() % 1440;
+      }
+    for (int i = 0; i < count; i++) {  //Sorted by minute, stable, like setSchedule(), so the reference breaks ties the same way
+      for (int j = i; j > 0 && switches[j - 1].minute > switches[j].minute; j--) {
+        ADE7953TariffSwitch swap = switches[j];
+        switches[j] = switches[j - 1];
+        switches[j - 1] = swap;
+        }
+      }
+    check(tariff.setSchedule(switches, count), "setSchedule", 0, 1);
+    for (int i = 0; i < holidayCount; i++) {
+      holidays[i] = monday/86400 + rand() % 30;
+      tariff.addHoliday(holidays[i]);
+      }
+    referenceBands(switches, count, holidays, holidayCount, monday, bands);
+    memset(&totals, 0, sizeof(totals));
+    uint32_t time = monday + rand() % 86400;
+    tariff.update(totals, time);
+    while (time < monday + 30*86400) {
+      uint32_t next = time + 1 + ((rand() % 8) ? rand() % 900 : rand() % 30000);
+      uint64_t energy = (uint64_t)(next - time)*(1 + rand() % 1000000);
+      uint8_t first = bands[(time - monday)/60 + REFERENCE_START];
+      bool split = false;
+      for (uint32_t t = time; t < next; ) {  //Constant power over the interval, a minute at a time
+        uint32_t end = t - t % 60 + 60;
+        if (end > next) {end = next;}
+        uint8_t band = bands[(t - monday)/60 + REFERENCE_START];
+        reference[band] += (double)energy*(end - t)/(next - time);
+        split = split || band != first;
+        t = end;
+        }
+      if (split) {splits++;}
+      totals.activeImport += energy;
+      tariff.update(totals, next);
+      time = next;
+      scheduleIntervals++;
+      }
+    for (uint8_t b = 0; b < ADE7953_TARIFF_MAX_BANDS; b++) {  //Each split rounds down by under 1 uWh
+      ADE7953TariffRegister reg;
+      tariff.getRegister(b, reg);
+      check(reg.activeImport + 2.0*scheduleIntervals + 1 >= reference[b] && reg.activeImport <= reference[b] + 2.0*scheduleIntervals + 1,
+        "random schedule band", reg.activeImport, reference[b]);
+      }
+    intervals += scheduleIntervals;
+    }
+
+  printf("fixed cases        split at a boundary, across several and across midnight; night band carried over midnight, weekends and a holiday\n");
+  printf("random schedules   %d schedules, %lu update intervals, %lu of them split across a band change\n", schedules, intervals, splits);
+  printf("%s (%lu failures)\n", failures ? "FAIL" : "PASS", failures);
+  return failures ? 1 : 0;
+  }
@@ -0,0 +1,307 @@
+/*
+ ade7953telemetry.cpp - Linux/host decoder and benchmark for the ADE7953Telemetry record format
+  Decodes a stream of records captured from a node, and measures encode time and bytes per record against a
+  synthetic load profile with a round-trip and fuzz check of the same encoder/decoder the ESP32 library runs.  The round
+  trip is checked at mV/mW resolution for the calibrated profile and at the default resolutions with full scale raw
+  register counts (the shipped gains of 1.0), and a receiver joining mid-stream must get exact energy totals.
+  University of California, Irvine - California Plug Load Research Center (CalPlug)
+  Released into the public domain.
+
+  Build (from this folder):  g++ -O2 -I../.. ade7953telemetry.cpp ../../ADE7953Telemetry.cpp ../../ADE7953Deadband.cpp -o ade7953telemetry
+
+  Usage:  ade7953telemetry decode [records.bin]   print every record of a concatenated record stream as CSV
+          ade7953telemetry bench [records]        encode a synthetic 1 Hz residential profile (default 86400 records),
+                                                  report bytes/record and encode time, then round-trip and fuzz check
+  decode reads standard input when no file is given.  bench exits with status 1 if any check fails.
+*/
+
+#include "ADE7953Telemetry.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+static const char *fieldName[ADE7953_FIELDS] = {"vrms", "irmsa", "irmsb", "activea", "activeb", "reactivea", "reactiveb",
+  "apparenta", "apparentb", "pfa", "pfb", "period", "frequency", "anglea", "angleb"};
+
+static void usage(){
+  fprintf(stderr, "usage: ade7953telemetry decode [records.bin] | bench [records]\n");
+  exit(2);
+  }
+
+static double nowSeconds(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+  }
+
+static int decodeStream(FILE *in){
+  static uint8_t data[1 << 20];
+  size_t length = 0, offset = 0, got;
+  ADE7953TelemetryDecoder decoder;
+  ADE7953TelemetryRecord record;
+  unsigned long records = 0, skipped = 0;
+
+  printf("timestamp,keyframe,fields");
+  for (int f = 0; f < ADE7953_FIELDS; f++) {printf(",%s", fieldName[f]);}
+  printf(",importA,exportA,importB,exportB\n");
+  while ((got = fread(data + length, 1, sizeof(data) - length, in)) > 0 || offset < length) {
+    length += got;
+    while (offset < length) {
+      int r = decoder.decode(data + offset, length - offset, record);
+      if (r == ADE7953_TELEMETRY_TRUNCATED && got > 0) {break;}  //Rest of the record is in the next read
+      if (r < 0) {
+        offset++;  //Corrupt or unsynchronized: step one byte and look for the next keyframe
+        skipped++;
+        continue;
+        }
+      offset += r;
+      records++;
+      printf("%lu,%d,0x%04lx", (unsigned long)record.timestamp, record.keyframe ? 1 : 0, (unsigned long)record.fieldMask);
+      for (int f = 0; f < ADE7953_FIELDS; f++) {printf(",%.4f", record.values[f]);}
+      printf(",%.6f,%.6f,%.6f,%.6f\n", record.energy[0].activeImport*1e-6, record.energy[0].activeExport*1e-6,
+        record.energy[1].activeImport*1e-6, record.energy[1].activeExport*1e-6);
+      }
+    memmove(data, data + offset, length - offset);
+    length -= offset;
+    offset = 0;
+    if (got == 0) {break;}
+    }
+  fprintf(stderr, "%lu records, %lu bytes skipped\n", records, skipped);
+  return 0;
+  }
+
+static double gaussian(){  //Box-Muller, rand() is good enough for a load profile
+  double u = (rand() + 1.0)/(RAND_MAX + 2.0), v = (rand() + 1.0)/(RAND_MAX + 2.0);
+  return sqrt(-2*log(u))*cos(2*M_PI*v);
+  }
+
+static void syntheticSnapshot(long t, float *values, ADE7953EnergyTotals *energy){  //Fridge cycling on channel A, kettle bursts and PV export on channel B
+  double v = 230 + 2*sin(t/3600.0) + 0.2*gaussian();
+  double pa = ((t % 2400) < 900 ? 120 : 3) + 1.5*gaussian() + (((t % 5400) < 180) ? 2200 : 0);
+  double pb = -((t % 86400) > 25000 && (t % 86400) < 65000 ? 1800*sin(M_PI*((t % 86400) - 25000)/40000.0) : 0) + 1.0*gaussian();
+  double qa = 0.3*pa + gaussian(), qb = 0.5*gaussian();
+  values[ADE7953_FIELD_VRMS] = v;
+  values[ADE7953_FIELD_IRMSA] = sqrt(pa*pa + qa*qa)/v;
+  values[ADE7953_FIELD_IRMSB] = fabs(pb)/v;
+  values[ADE7953_FIELD_ACTIVEA] = pa;
+  values[ADE7953_FIELD_ACTIVEB] = pb;
+  values[ADE7953_FIELD_REACTIVEA] = qa;
+  values[ADE7953_FIELD_REACTIVEB] = qb;
+  values[ADE7953_FIELD_APPARENTA] = sqrt(pa*pa + qa*qa);
+  values[ADE7953_FIELD_APPARENTB] = fabs(pb);
+  values[ADE7953_FIELD_PFA] = values[ADE7953_FIELD_APPARENTA] > 1 ? pa/values[ADE7953_FIELD_APPARENTA] : 1;
+  values[ADE7953_FIELD_PFB] = values[ADE7953_FIELD_APPARENTB] > 1 ? -1 : 1;
+  values[ADE7953_FIELD_FREQUENCY] = 50 + 0.02*sin(t/300.0) + 0.002*gaussian();
+  values[ADE7953_FIELD_PERIOD] = floor(223750/values[ADE7953_FIELD_FREQUENCY] - 1 + 0.5);
+  values[ADE7953_FIELD_ANGLEA] = atan2(qa, pa)*180/M_PI;
+  values[ADE7953_FIELD_ANGLEB] = 0.1*gaussian();
+  energy[0].activeImport += (uint64_t)(pa > 0 ? pa*1e6/3600 : 0);
+  energy[0].reactive[0] += (uint64_t)(qa > 0 ? qa*1e6/3600 : 0);
+  energy[0].apparent += (uint64_t)(values[ADE7953_FIELD_APPARENTA]*1e6/3600);
+  energy[1].activeExport += (uint64_t)(pb < 0 ? -pb*1e6/3600 : 0);
+  energy[1].apparent += (uint64_t)(values[ADE7953_FIELD_APPARENTB]*1e6/3600);
+  }
+
+static float calibratedScale(int f){  //The profile is in volts, amps and watts, as from a node with calibrated gains: mV, mA, mW
+  return (f <= ADE7953_FIELD_APPARENTB) ? 1000 : ADE7953TelemetryEncoder::defaultResolution(f);
+  }
+
+static bool sameValue(float sent, float decoded, float scale){  //Within half a count, or both clipped
+  if (!(sent == sent)) {return decoded == 0;}
+  if (fabs(sent*scale) >= 2147483647.0) {return fabs(decoded*scale) >= 2147483000.0;}
+  return fabs(sent - decoded) <= 0.5/scale + fabs(sent)*1e-6;
+  }
+
+static int bench(long count){
+  ADE7953TelemetryEncoder encoder;
+  ADE7953TelemetryDecoder decoder;
+  ADE7953TelemetryRecord record;
+  ADE7953Deadband deadband;
+  ADE7953EnergyTotals energy[2];
+  float values[ADE7953_FIELDS];
+  uint8_t buffer[ADE7953_TELEMETRY_MAX_RECORD];
+  char text[512];
+  unsigned long bytes = 0, fullBytes = 0, textBytes = 0, failures = 0;
+  double encodeTime = 0;
+
+  memset(energy, 0, sizeof(energy));
+  for (int f = 0; f < ADE7953_FIELDS; f++) {
+    encoder.setResolution(f, calibratedScale(f));
+    decoder.setResolution(f, calibratedScale(f));
+    }
+  deadband.setDeadband(ADE7953_FIELD_ACTIVEB, 5, 0.02);
+  deadband.setDeadband(ADE7953_FIELD_REACTIVEA, 5, 0.02);
+  deadband.setDeadband(ADE7953_FIELD_REACTIVEB, 5, 0.02);
+  deadband.setDeadband(ADE7953_FIELD_APPARENTB, 5, 0.02);
+  deadband.setDeadband(ADE7953_FIELD_IRMSB, 0.05, 0.02);
+  deadband.setDeadband(ADE7953_FIELD_PFA, 0.02, 0);
+  deadband.setDeadband(ADE7953_FIELD_PFB, 0.02, 0);
+  deadband.setDeadband(ADE7953_FIELD_FREQUENCY, 0.01, 0);
+  deadband.setDeadband(ADE7953_FIELD_PERIOD, 2, 0);
+  deadband.setDeadband(ADE7953_FIELD_ANGLEA, 1, 0);
+  deadband.setDeadband(ADE7953_FIELD_ANGLEB, 1, 0);
+  srand(1);
+  for (long t = 0; t < count; t++) {
+    syntheticSnapshot(t, values, energy);
+    uint32_t mask = deadband.update(values, t*1000UL);
+    int n = 0;
+    for (int f = 0; f < ADE7953_FIELDS; f++) {n += snprintf(text + n, sizeof(text) - n, "%.3f,", values[f]);}
+    textBytes += n;
+
+    double start = nowSeconds();
+    size_t length = encoder.encode(values, mask, t*1000UL, energy, (t % 60 == 0) ? 0x03 : 0, buffer, sizeof(buffer));
+    encodeTime += nowSeconds() - start;
+    bytes += length;
+    deadband.clearDirty(mask);
+    if (decoder.decode(buffer, length, record) != (int)length) {
+      failures++;
+      continue;
+      }
+    for (int f = 0; f < ADE7953_FIELDS; f++) {
+      if ((record.fieldMask & (1UL << f)) && !sameValue(values[f], record.values[f], calibratedScale(f))) {failures++;}
+      }
+    if ((t % 60 == 0) && memcmp(record.energy, energy, sizeof(energy)) != 0) {failures++;}
+    }
+  {
+    ADE7953TelemetryEncoder full;
+    full.setKeyframeInterval(1);
+    for (int f = 0; f < ADE7953_FIELDS; f++) {full.setResolution(f, calibratedScale(f));}
+    srand(1);
+    memset(energy, 0, sizeof(energy));
+    for (long t = 0; t < count; t++) {
+      syntheticSnapshot(t, values, energy);
+      fullBytes += full.encode(values, ADE7953_FIELDS_ALL, t*1000UL, energy, (t % 60 == 0) ? 0x03 : 0, buffer, sizeof(buffer));
+      }
+  }
+  printf("records            %ld\n", count);
+  printf("text CSV           %.1f bytes/record\n", (double)textBytes/count);
+  printf("binary, keyframes  %.1f bytes/record\n", (double)fullBytes/count);
+  printf("binary, deadband   %.1f bytes/record\n", (double)bytes/count);
+  printf("encode time        %.0f ns/record (host)\n", encodeTime*1e9/count);
+  printf("round trip         %s (%lu mismatches)\n", failures ? "FAIL" : "ok", failures);
+
+  //Default resolutions with the shipped gains of 1.0: snapshots in raw register counts must come back exact, not clipped
+  unsigned long rawFailures = 0;
+  ADE7953TelemetryEncoder rawEncoder;
+  ADE7953TelemetryDecoder rawDecoder;
+  for (long i = 0; i < 100000; i++) {
+    double load = (i % 100 == 0) ? 1.0 : (double)rand()/RAND_MAX;  //Every 100th record at full scale
+    double angle = 2*M_PI*rand()/RAND_MAX;
+    values[ADE7953_FIELD_VRMS] = floorf(9032007*((i % 100 == 0) ? 1.0 : 0.5 + 0.5*rand()/RAND_MAX));
+    values[ADE7953_FIELD_IRMSA] = floorf(9032007*load);
+    values[ADE7953_FIELD_IRMSB] = floorf(9032007*(1 - load));
+    values[ADE7953_FIELD_ACTIVEA] = floorf(4862401*load*cos(angle));
+    values[ADE7953_FIELD_ACTIVEB] = -floorf(4862401*(1 - load));
+    values[ADE7953_FIELD_REACTIVEA] = floorf(4862401*load*sin(angle));
+    values[ADE7953_FIELD_REACTIVEB] = 0;
+    values[ADE7953_FIELD_APPARENTA] = floorf(4862401*load);
+    values[ADE7953_FIELD_APPARENTB] = floorf(4862401*(1 - load));
+    values[ADE7953_FIELD_PFA] = floorf(32767*cos(angle))/32767;
+    values[ADE7953_FIELD_PFB] = -1;
+    values[ADE7953_FIELD_PERIOD] = 4474 + rand() % 3;
+    values[ADE7953_FIELD_FREQUENCY] = 223750.0f/(values[ADE7953_FIELD_PERIOD] + 1);
+    values[ADE7953_FIELD_ANGLEA] = (float)(angle*180/M_PI - 180);
+    values[ADE7953_FIELD_ANGLEB] = 0;
+    size_t length = rawEncoder.encode(values, ADE7953_FIELDS_ALL, i*1000UL, NULL, 0, buffer, sizeof(buffer));
+    if (length == 0 || rawDecoder.decode(buffer, length, record) != (int)length) {
+      rawFailures++;
+      continue;
+      }
+    for (int f = 0; f <= ADE7953_FIELD_APPARENTB; f++) {
+      if (record.values[f] != values[f]) {rawFailures++;}
+      }
+    for (int f = ADE7953_FIELD_APPARENTB + 1; f < ADE7953_FIELDS; f++) {
+      if (!sameValue(values[f], record.values[f], ADE7953TelemetryEncoder::defaultResolution(f))) {rawFailures++;}
+      }
+    }
+  printf("raw counts         %s (%lu mismatches, full scale VRMS/IRMS 9032007, powers 4862401)\n", rawFailures ? "FAIL" : "ok", rawFailures);
+
+  //A receiver joining mid-stream: energy deltas every 7 records, keyframes every 60; once it has a keyframe both channels
+  //must be valid and exact, and nothing may be reported valid before that
+  unsigned long joinFailures = 0;
+  {
+    ADE7953TelemetryEncoder joinEncoder;
+    ADE7953TelemetryDecoder late;
+    bool joined = false;
+    memset(energy, 0, sizeof(energy));
+    srand(2);
+    for (long t = 0; t < 5000; t++) {
+      syntheticSnapshot(t, values, energy);
+      size_t length = joinEncoder.encode(values, ADE7953_FIELDS_ALL, t*1000UL, energy, (t % 7 == 0) ? 0x01 : 0, buffer, sizeof(buffer));
+      if (t < 1234) {continue;}  //Not listening yet
+      int r = late.decode(buffer, length, record);
+      if (r == ADE7953_TELEMETRY_NO_KEYFRAME && !joined) {continue;}
+      if (r != (int)length) {
+        joinFailures++;
+        continue;
+        }
+      joined = true;
+      if (record.energyValid != 0x03) {joinFailures++;}
+      for (int ch = 0; ch < 2; ch++) {  //Totals are current in the records that carried them
+        if ((record.energyMask & (1 << ch)) && memcmp(&record.energy[ch], &energy[ch], sizeof(energy[ch])) != 0) {joinFailures++;}
+        }
+      if (record.keyframe && record.energyMask != 0x03) {joinFailures++;}
+      }
+    if (!joined) {joinFailures++;}
+  }
+  printf("late receiver      %s (%lu energy mismatches)\n", joinFailures ? "FAIL" : "ok", joinFailures);
+
+  //Fuzz: random values (NaN, extremes), masks and keyframes must survive the round trip; random bytes must never be over-read
+  unsigned long fuzzFailures = 0;
+  ADE7953TelemetryEncoder fuzzEncoder;
+  ADE7953TelemetryDecoder fuzzDecoder;
+  for (long i = 0; i < 200000; i++) {
+    for (int f = 0; f < ADE7953_FIELDS; f++) {
+      int kind = rand() % 8;
+      values[f] = kind == 0 ? NAN : kind == 1 ? 3e9f*((rand() & 1) ? 1 : -1) : (float)(gaussian()*pow(10.0, rand() % 6));
+      }
+    for (int ch = 0; ch < 2; ch++) {
+      energy[ch].activeImport += rand();
+      energy[ch].activeExport = ((uint64_t)rand() << 33) | rand();  //Not monotonic on purpose
+      }
+    if (rand() % 50 == 0) {fuzzEncoder.forceKeyframe();}
+    uint32_t mask = ((uint32_t)rand() << 8 ^ rand()) & ADE7953_FIELDS_ALL;
+    uint8_t energyMask = rand() & 0x03;
+    size_t length = fuzzEncoder.encode(values, mask, (uint32_t)rand(), energy, energyMask, buffer, sizeof(buffer));
+    if (length == 0 || fuzzDecoder.decode(buffer, length, record) != (int)length) {
+      fuzzFailures++;
+      continue;
+      }
+    for (int f = 0; f < ADE7953_FIELDS; f++) {
+      if ((record.fieldMask & (1UL << f)) && !sameValue(values[f], record.values[f], ADE7953TelemetryEncoder::defaultResolution(f))) {fuzzFailures++;}
+      }
+    for (int ch = 0; ch < 2; ch++) {
+      if ((record.energyMask & (1 << ch)) && memcmp(&record.energy[ch], &energy[ch], sizeof(energy[ch])) != 0) {fuzzFailures++;}
+      }
+    }
+  for (long i = 0; i < 200000; i++) {
+    uint8_t junk[48];
+    size_t length = rand() % sizeof(junk);
+    for (size_t b = 0; b < length; b++) {junk[b] = rand();}
+    if (rand() & 1) {junk[0] = ADE7953_TELEMETRY_VERSION | ADE7953_TELEMETRY_KEYFRAME | (rand() & ADE7953_TELEMETRY_ENERGY);}
+    ADE7953TelemetryDecoder junkDecoder;
+    int r = junkDecoder.decode(junk, length, record);
+    if (r > (int)length || r == 0) {fuzzFailures++;}
+    }
+  printf("fuzz               %s (%lu failures)\n", fuzzFailures ? "FAIL" : "ok", fuzzFailures);
+  return (failures || rawFailures || joinFailures || fuzzFailures) ? 1 : 0;
+  }
+
+int main(int argc, char **argv){
+  if (argc < 2) {usage();}
+  if (strcmp(argv[1], "decode") == 0) {
+    FILE *in = stdin;
+    if (argc > 2 && !(in = fopen(argv[2], "rb"))) {
+      perror(argv[2]);
+      return 1;
+      }
+    return decodeStream(in);
+    }
+  if (strcmp(argv[1], "bench") == 0) {
+    return bench(argc > 2 ? atol(argv[2]) : 86400);
+    }
+  usage();
+  return 2;
+  }